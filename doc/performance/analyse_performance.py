@@ -892,6 +892,7 @@ def plot_network(data: dict, output_path: Path = None) -> None:
         'sublistFetch': '#1565C0', 'networkLatency': '#0D47A1',
         'cacheLookup': '#00BCD4', 'cacheVerification': '#00ACC1',
         'cacheWrite': '#0097A7', 'cacheFlush': '#00838F',
+        'chunkStoreRead': '#006064',
     }
     
     # Top plot: Timeline of network operations
@@ -1526,6 +1527,7 @@ def create_network_figure(data: dict):
         'sublistFetch': '#1565C0', 'networkLatency': '#0D47A1',
         'cacheLookup': '#00BCD4', 'cacheVerification': '#00ACC1',
         'cacheWrite': '#0097A7', 'cacheFlush': '#00838F',
+        'chunkStoreRead': '#006064',
     }
     
     y_positions = {}
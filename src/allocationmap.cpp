@@ -0,0 +1,348 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "allocationmap.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <QDebug>
+
+namespace {
+
+inline uint16_t le16(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<uint16_t>(u[0] | (u[1] << 8));
+}
+
+inline uint32_t le32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8)
+         | (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+// Partition table and filesystem constants
+constexpr uint64_t SECTOR_SIZE = 512;
+constexpr uint8_t MBR_TYPE_GPT_PROTECTIVE = 0xEE;
+constexpr uint8_t MBR_TYPE_LINUX = 0x83;
+
+constexpr uint16_t EXT4_MAGIC = 0xEF53;
+constexpr uint32_t EXT4_INCOMPAT_META_BG = 0x10;
+constexpr uint32_t EXT4_INCOMPAT_64BIT = 0x80;
+constexpr uint16_t EXT4_BG_BLOCK_UNINIT = 0x2;
+
+bool isFatPartitionType(uint8_t type)
+{
+    return type == 0x04 || type == 0x06 || type == 0x0b || type == 0x0c || type == 0x0e;
+}
+
+} // namespace
+
+AllocationMap::AllocationMap()
+    : _unallocatedBytes(0), _streamPos(0),
+      _fatPartitions(0), _ext4Partitions(0), _groupsMapped(0), _groupsSkipped(0), _missedRequests(0)
+{
+    _request(0, SECTOR_SIZE, [this](const QByteArray &sector) { _parseMbr(sector); });
+}
+
+void AllocationMap::feed(uint64_t offset, const char *buf, size_t len)
+{
+    if (offset != _streamPos)
+    {
+        /* Out of order input: nothing pending can be trusted to complete */
+        qDebug() << "AllocationMap: non-sequential feed at" << offset << "expected" << _streamPos;
+        _missedRequests += static_cast<int>(_requests.size());
+        _requests.clear();
+    }
+
+    /* Handlers may queue requests that fall within this same chunk
+     * (e.g. the MBR pointing at a superblock a few MB further on) */
+    while (_serviceRequests(offset, buf, len))
+    {
+    }
+
+    _streamPos = offset + len;
+}
+
+bool AllocationMap::isUnallocated(uint64_t offset, uint64_t len) const
+{
+    auto it = _unallocated.upper_bound(offset);
+    if (it == _unallocated.begin())
+        return false;
+    --it;
+    return it->second >= offset + len;
+}
+
+QByteArray AllocationMap::summary() const
+{
+    return QByteArray("fat_partitions: ") + QByteArray::number(_fatPartitions)
+         + "; ext4_partitions: " + QByteArray::number(_ext4Partitions)
+         + "; groups_mapped: " + QByteArray::number(_groupsMapped)
+         + "; groups_uninit: " + QByteArray::number(_groupsSkipped)
+         + "; late_metadata: " + QByteArray::number(_missedRequests)
+         + "; unallocated_mb: " + QByteArray::number(_unallocatedBytes / (1024 * 1024));
+}
+
+void AllocationMap::_request(uint64_t offset, size_t len, std::function<void(const QByteArray &)> handler)
+{
+    if (!len)
+        return;
+
+    Request r;
+    r.offset = offset;
+    r.data.resize(static_cast<qsizetype>(len));
+    r.filled = 0;
+    r.handler = std::move(handler);
+    _requests.push_back(std::move(r));
+}
+
+bool AllocationMap::_serviceRequests(uint64_t offset, const char *buf, size_t len)
+{
+    std::vector<Request> completed;
+    const uint64_t chunkEnd = offset + len;
+
+    for (auto it = _requests.begin(); it != _requests.end(); )
+    {
+        const uint64_t need = it->offset + it->filled;
+        const uint64_t reqEnd = it->offset + static_cast<uint64_t>(it->data.size());
+
+        if (need < offset)
+        {
+            /* Part of this metadata already went past: whatever it would
+             * have described stays marked as allocated */
+            _missedRequests++;
+            it = _requests.erase(it);
+            continue;
+        }
+
+        if (need < chunkEnd)
+        {
+            const uint64_t copyEnd = std::min(reqEnd, chunkEnd);
+            std::memcpy(it->data.data() + it->filled, buf + (need - offset), static_cast<size_t>(copyEnd - need));
+            it->filled += static_cast<size_t>(copyEnd - need);
+
+            if (it->offset + it->filled == reqEnd)
+            {
+                completed.push_back(std::move(*it));
+                it = _requests.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    for (auto &r : completed)
+        r.handler(r.data);
+
+    return !completed.empty();
+}
+
+void AllocationMap::_markUnallocated(uint64_t start, uint64_t stop)
+{
+    if (start >= stop)
+        return;
+
+    auto it = _unallocated.upper_bound(start);
+    if (it != _unallocated.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->second >= start)
+        {
+            start = prev->first;
+            stop = std::max(stop, prev->second);
+            _unallocatedBytes -= prev->second - prev->first;
+            it = _unallocated.erase(prev);
+        }
+    }
+    while (it != _unallocated.end() && it->first <= stop)
+    {
+        stop = std::max(stop, it->second);
+        _unallocatedBytes -= it->second - it->first;
+        it = _unallocated.erase(it);
+    }
+
+    _unallocated[start] = stop;
+    _unallocatedBytes += stop - start;
+}
+
+void AllocationMap::_parseMbr(const QByteArray &sector)
+{
+    const char *s = sector.constData();
+    if (static_cast<unsigned char>(s[510]) != 0x55 || static_cast<unsigned char>(s[511]) != 0xAA)
+    {
+        qDebug() << "AllocationMap: no MBR signature, writing full image";
+        return;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        const char *entry = s + 446 + i * 16;
+        const uint8_t type = static_cast<uint8_t>(entry[4]);
+        const uint64_t start = static_cast<uint64_t>(le32(entry + 8)) * SECTOR_SIZE;
+        const uint64_t length = static_cast<uint64_t>(le32(entry + 12)) * SECTOR_SIZE;
+
+        if (type == MBR_TYPE_GPT_PROTECTIVE)
+        {
+            /* GPT images are not mapped yet; they are written in full */
+            qDebug() << "AllocationMap: GPT partition table, writing full image";
+            return;
+        }
+        if (!start || !length)
+            continue;
+
+        if (isFatPartitionType(type))
+            _probeFat(start, length);
+        else if (type == MBR_TYPE_LINUX)
+            _probeExt4(start, length);
+    }
+}
+
+void AllocationMap::_probeFat(uint64_t partStart, uint64_t partLen)
+{
+    _request(partStart, SECTOR_SIZE, [this, partStart, partLen](const QByteArray &bootSector) {
+        const char *b = bootSector.constData();
+        const uint32_t bytesPerSector = le16(b + 11);
+        const uint32_t sectorsPerCluster = static_cast<uint8_t>(b[13]);
+        const uint32_t reservedSectors = le16(b + 14);
+        const uint32_t numFats = static_cast<uint8_t>(b[16]);
+        const uint32_t rootEntries = le16(b + 17);
+        const uint32_t totalSectors = le16(b + 19) ? le16(b + 19) : le32(b + 32);
+        const uint32_t fatSectors = le16(b + 22) ? le16(b + 22) : le32(b + 36);
+
+        if (static_cast<unsigned char>(b[510]) != 0x55 || static_cast<unsigned char>(b[511]) != 0xAA
+            || (bytesPerSector != 512 && bytesPerSector != 1024 && bytesPerSector != 2048 && bytesPerSector != 4096)
+            || !sectorsPerCluster || (sectorsPerCluster & (sectorsPerCluster - 1))
+            || !reservedSectors || !numFats || !fatSectors
+            || static_cast<uint64_t>(totalSectors) * bytesPerSector > partLen)
+        {
+            return;
+        }
+
+        const uint32_t rootDirSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+        const uint64_t metaSectors = reservedSectors + static_cast<uint64_t>(numFats) * fatSectors + rootDirSectors;
+        if (metaSectors >= totalSectors)
+            return;
+
+        const uint32_t clusters = static_cast<uint32_t>((totalSectors - metaSectors) / sectorsPerCluster);
+        if (clusters < 4085)
+            return; // FAT12: tiny, not worth mapping
+
+        const bool fat32 = clusters >= 65525;
+        const uint64_t entryBytes = fat32 ? 4 : 2;
+        if ((static_cast<uint64_t>(clusters) + 2) * entryBytes > static_cast<uint64_t>(fatSectors) * bytesPerSector)
+            return;
+
+        const uint64_t clusterBytes = static_cast<uint64_t>(sectorsPerCluster) * bytesPerSector;
+        const uint64_t dataStart = partStart + metaSectors * bytesPerSector;
+        _fatPartitions++;
+
+        /* The FAT precedes the data region, so free clusters are known before they stream past */
+        _request(partStart + static_cast<uint64_t>(reservedSectors) * bytesPerSector,
+                 static_cast<size_t>((static_cast<uint64_t>(clusters) + 2) * entryBytes),
+                 [this, fat32, clusters, clusterBytes, dataStart](const QByteArray &fat) {
+            uint32_t runStart = 0, runLength = 0;
+            for (uint32_t c = 2; c < clusters + 2; c++)
+            {
+                const uint32_t entry = fat32 ? (le32(fat.constData() + c * 4) & 0x0FFFFFFF)
+                                             : le16(fat.constData() + c * 2);
+                if (!entry)
+                {
+                    if (!runLength)
+                        runStart = c;
+                    runLength++;
+                }
+                else if (runLength)
+                {
+                    _markUnallocated(dataStart + (runStart - 2) * clusterBytes, dataStart + (runStart - 2 + runLength) * clusterBytes);
+                    runLength = 0;
+                }
+            }
+            if (runLength)
+                _markUnallocated(dataStart + (runStart - 2) * clusterBytes, dataStart + (runStart - 2 + runLength) * clusterBytes);
+        });
+    });
+}
+
+void AllocationMap::_probeExt4(uint64_t partStart, uint64_t partLen)
+{
+    /* Primary superblock lives 1024 bytes into the partition */
+    _request(partStart + 1024, 1024, [this, partStart, partLen](const QByteArray &superblock) {
+        const char *sb = superblock.constData();
+        if (le16(sb + 0x38) != EXT4_MAGIC)
+            return;
+
+        const uint32_t logBlockSize = le32(sb + 0x18);
+        const uint32_t incompat = le32(sb + 0x60);
+        if (logBlockSize > 6 || (incompat & EXT4_INCOMPAT_META_BG))
+            return;
+
+        const bool is64bit = incompat & EXT4_INCOMPAT_64BIT;
+        const uint64_t blockSize = 1024ULL << logBlockSize;
+        const uint64_t blocksCount = le32(sb + 0x04) | (is64bit ? static_cast<uint64_t>(le32(sb + 0x150)) << 32 : 0);
+        const uint64_t firstDataBlock = le32(sb + 0x14);
+        const uint64_t blocksPerGroup = le32(sb + 0x20);
+        const uint64_t descSize = is64bit ? le16(sb + 0xFE) : 32;
+
+        if (!blocksPerGroup || blocksPerGroup > blockSize * 8 || blocksCount <= firstDataBlock
+            || blocksCount * blockSize > partLen
+            || descSize < 32 || (is64bit && descSize < 64))
+        {
+            return;
+        }
+
+        const uint64_t groups = (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+        _ext4Partitions++;
+
+        /* Group descriptor table starts in the block after the superblock */
+        _request(partStart + (firstDataBlock + 1) * blockSize, static_cast<size_t>(groups * descSize),
+                 [this, partStart, is64bit, blockSize, blocksCount, firstDataBlock, blocksPerGroup, descSize, groups](const QByteArray &gdt) {
+            for (uint64_t g = 0; g < groups; g++)
+            {
+                const char *desc = gdt.constData() + g * descSize;
+                const uint64_t bitmapBlock = le32(desc) | (is64bit ? static_cast<uint64_t>(le32(desc + 0x20)) << 32 : 0);
+                const uint16_t flags = le16(desc + 0x12);
+
+                if (flags & EXT4_BG_BLOCK_UNINIT)
+                {
+                    /* Bitmap is not stored on disk; the kernel derives it.
+                     * Leave the group fully allocated. */
+                    _groupsSkipped++;
+                    continue;
+                }
+                if (!bitmapBlock || bitmapBlock >= blocksCount)
+                    continue;
+
+                const uint64_t groupFirst = firstDataBlock + g * blocksPerGroup;
+                const uint64_t groupBlocks = std::min(blocksPerGroup, blocksCount - groupFirst);
+
+                _request(partStart + bitmapBlock * blockSize, static_cast<size_t>((groupBlocks + 7) / 8),
+                         [this, partStart, blockSize, groupFirst, groupBlocks](const QByteArray &bitmap) {
+                    const unsigned char *bits = reinterpret_cast<const unsigned char *>(bitmap.constData());
+                    uint64_t runStart = 0, runLength = 0;
+                    for (uint64_t i = 0; i < groupBlocks; i++)
+                    {
+                        if (!(bits[i / 8] & (1 << (i % 8))))
+                        {
+                            if (!runLength)
+                                runStart = i;
+                            runLength++;
+                        }
+                        else if (runLength)
+                        {
+                            _markUnallocated(partStart + (groupFirst + runStart) * blockSize,
+                                             partStart + (groupFirst + runStart + runLength) * blockSize);
+                            runLength = 0;
+                        }
+                    }
+                    if (runLength)
+                        _markUnallocated(partStart + (groupFirst + runStart) * blockSize,
+                                         partStart + (groupFirst + runStart + runLength) * blockSize);
+                    _groupsMapped++;
+                });
+            }
+        });
+    });
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef ALLOCATIONMAP_H
+#define ALLOCATIONMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include <QByteArray>
+
+/**
+ * @brief Allocation map derived from an image's own filesystem metadata while it streams past
+ *
+ * Images normally carry no .bmap, but the metadata needed to derive one (MBR,
+ * FAT boot sector and allocation table, ext4 superblock, group descriptors and
+ * block bitmaps) sits near the start of each partition and arrives long before
+ * most of the data it describes. feed() is called with every chunk of the
+ * decompressed image in stream order; the map captures the metadata ranges it
+ * asks for and records byte ranges that are known to be unallocated.
+ *
+ * Safety model: everything is treated as allocated unless explicitly proven
+ * free. Metadata that arrives after the data it describes (or that is never
+ * seen, or fails validation) simply leaves that data marked allocated, so the
+ * consumer falls back to a full write for those ranges. Callers must only act
+ * on isUnallocated() for ranges that have not been fed yet.
+ *
+ * Not thread-safe; feed it from the single writer thread.
+ */
+class AllocationMap
+{
+public:
+    AllocationMap();
+
+    /**
+     * @brief Consume the next chunk of the image
+     * @param offset Absolute image offset of buf (must follow the previous chunk)
+     */
+    void feed(uint64_t offset, const char *buf, size_t len);
+
+    /**
+     * @brief True if every byte of [offset, offset+len) is known to be unallocated
+     */
+    bool isUnallocated(uint64_t offset, uint64_t len) const;
+
+    /**
+     * @brief Total bytes currently known to be unallocated
+     */
+    uint64_t unallocatedBytes() const { return _unallocatedBytes; }
+
+    /**
+     * @brief Human readable summary of what was parsed, for logging and performance events
+     */
+    QByteArray summary() const;
+
+private:
+    /* A byte range of the image the parser wants to see, and what to do with it */
+    struct Request {
+        uint64_t offset;
+        QByteArray data;
+        size_t filled;
+        std::function<void(const QByteArray &)> handler;
+    };
+
+    void _request(uint64_t offset, size_t len, std::function<void(const QByteArray &)> handler);
+    bool _serviceRequests(uint64_t offset, const char *buf, size_t len);
+    void _markUnallocated(uint64_t start, uint64_t end);
+
+    void _parseMbr(const QByteArray &sector);
+    void _probeFat(uint64_t partStart, uint64_t partLen);
+    void _probeExt4(uint64_t partStart, uint64_t partLen);
+
+    std::vector<Request> _requests;
+    std::map<uint64_t, uint64_t> _unallocated;   // start -> end (exclusive), non-overlapping
+    uint64_t _unallocatedBytes;
+    uint64_t _streamPos;
+    int _fatPartitions, _ext4Partitions, _groupsMapped, _groupsSkipped, _missedRequests;
+};
+
+#endif // ALLOCATIONMAP_H
@@ -4,6 +4,7 @@
  */
 
 #include "asynccachewriter.h"
+#include "perfcounters.h"
 #include <QDebug>
 #include <QFileInfo>
 
@@ -222,6 +223,7 @@ void AsyncCacheWriter::cancel()
 
 void AsyncCacheWriter::run()
 {
+    PerfCounters::Scope scope(PerfCounters::Stage::CacheWriter);
     qDebug() << "AsyncCacheWriter: Thread started";
     
     while (!_shouldStop) {
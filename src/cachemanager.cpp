@@ -11,18 +11,108 @@
 #include <QDebug>
 #include <QCoreApplication>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <vector>
+#include <archive.h>
+#include <archive_entry.h>
+#include <zstd.h>
 #include "systemmemorymanager.h"
+#include "chunkstore.h"
+#include "hottierindex.h"
+#include "zstdseekable.h"
 #include "config.h"
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // Hash algorithm used for cache verification (use same as OS list verification)
 #define CACHE_HASH_ALGORITHM OSLIST_HASH_ALGORITHM
 
+namespace {
+
+/* Memory a hot tier file takes; holes of sparse files take none */
+qint64 allocatedBytes(const QString& fileName)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) == 0) {
+        return static_cast<qint64>(st.st_blocks) * 512;
+    }
+#endif
+    return QFileInfo(fileName).size();
+}
+
+/* Writers of one process (CLI --jobs) share the default cache file: the one
+   that owns it downloads into and transcodes it, the read-only others only
+   write from it */
+struct SharedCacheFile {
+    QMutex mutex;
+    int readers = 0;            // Read-only managers writing from the file
+    quint64 generation = 0;     // Changed whenever the owner starts replacing the file
+};
+
+SharedCacheFile& sharedCacheFile()
+{
+    static SharedCacheFile shared;
+    return shared;
+}
+
+quint64 sharedCacheGeneration()
+{
+    QMutexLocker locker(&sharedCacheFile().mutex);
+    return sharedCacheFile().generation;
+}
+
+/* For the owner, before it changes or removes the file; refused while it is read */
+bool beginReplacingCacheFile()
+{
+    SharedCacheFile& shared = sharedCacheFile();
+    QMutexLocker locker(&shared.mutex);
+    if (shared.readers > 0) {
+        return false;
+    }
+    shared.generation++;
+    return true;
+}
+
+} // namespace
+
 CacheManager::CacheManager(QObject *parent)
     : QObject(parent)
     , workerThread_(new QThread())  // Don't parent to avoid Qt's automatic deletion
     , worker_(new CacheVerificationWorker())
+    , transcodeThread_(new QThread())
+    , transcodeWorker_(new CacheTranscodeWorker())
     , cachingEnabled_(!::isEmbeddedMode())
+    , readOnly_(false)
+    , cacheGeneration_(0)
+    , readingCacheFile_(false)
+    , transcodeRunning_(false)
+    , transcodeGeneration_(0)
+    , transcodeJobGeneration_(0)
+    , hotTierThread_(new QThread())
+    , hotTierWorker_(new CacheHotTierWorker())
+    , hotTierBudget_(0)
+    , hotTierSparse_(false)
+    , promotionRunning_(false)
+    , ramHits_(0)
+    , ramMisses_(0)
+    , diskHits_(0)
+    , diskMisses_(0)
+    , importRunning_(false)
+    , chunkHits_(0)
+    , chunkMisses_(0)
 {
     // Move worker to background thread
     worker_->moveToThread(workerThread_);
@@ -37,9 +127,25 @@ CacheManager::CacheManager(QObject *parent)
     
     // Start worker thread
     workerThread_->start();
+
+    // Transcoding is purely opportunistic, so it only ever gets idle CPU time
+    transcodeWorker_->moveToThread(transcodeThread_);
+    connect(transcodeWorker_, &CacheTranscodeWorker::transcodeFinished,
+            this, &CacheManager::onTranscodeFinished);
+    connect(transcodeWorker_, &CacheTranscodeWorker::chunkImportFinished,
+            this, &CacheManager::onChunkImportFinished);
+    transcodeThread_->start(QThread::IdlePriority);
+
+    // Promotion mostly waits for I/O, but should not slow down a write running alongside it
+    hotTierWorker_->moveToThread(hotTierThread_);
+    connect(hotTierWorker_, &CacheHotTierWorker::promotionFinished,
+            this, &CacheManager::onPromotionFinished);
+    hotTierThread_->start(QThread::LowPriority);
     
     // Load cache settings
     loadCacheSettings();
+    loadHotTierSettings();
+    cacheGeneration_ = sharedCacheGeneration();
     
     qDebug() << "CacheManager initialized with background thread";
 }
@@ -50,6 +156,37 @@ CacheManager::~CacheManager()
     
     // Disconnect all signals to prevent any further communication
     disconnect(worker_, nullptr, this, nullptr);
+    disconnect(transcodeWorker_, nullptr, this, nullptr);
+    disconnect(hotTierWorker_, nullptr, this, nullptr);
+
+    releaseHotTierFile();
+    releaseCacheFile();
+
+    // A promotion in progress is abandoned, and retried on the entry's next use
+    hotTierWorker_->abort();
+    hotTierThread_->quit();
+    if (!hotTierThread_->wait(5000)) {
+        qDebug() << "CacheManager: Hot tier thread did not quit within 5 seconds, terminating";
+        hotTierThread_->terminate();
+        hotTierThread_->wait(2000);
+    }
+    delete hotTierWorker_;
+    hotTierWorker_ = nullptr;
+    delete hotTierThread_;
+    hotTierThread_ = nullptr;
+
+    // A transcode in progress stops at its next frame boundary and discards its output
+    transcodeWorker_->abort();
+    transcodeThread_->quit();
+    if (!transcodeThread_->wait(5000)) {
+        qDebug() << "CacheManager: Transcode thread did not quit within 5 seconds, terminating";
+        transcodeThread_->terminate();
+        transcodeThread_->wait(2000);
+    }
+    delete transcodeWorker_;
+    transcodeWorker_ = nullptr;
+    delete transcodeThread_;
+    transcodeThread_ = nullptr;
     
     if (workerThread_ && workerThread_->isRunning()) {
         // Request thread to quit gracefully
@@ -112,7 +249,8 @@ bool CacheManager::isCached(const QByteArray& expectedHash) const
                   !status_.cacheFileName.isEmpty() &&
                   QFile::exists(status_.cacheFileName) &&
                   status_.verificationComplete &&
-                  status_.isValid;
+                  status_.isValid &&
+                  (!readOnly_ || cacheGeneration_ == sharedCacheGeneration());
     
     // Debug output removed - cache system working correctly
     
@@ -147,9 +285,65 @@ void CacheManager::setCustomCacheFile(const QString& cacheFile, const QByteArray
     cachingEnabled_ = true;
 }
 
+void CacheManager::setReadOnly(bool readOnly)
+{
+    QMutexLocker locker(&mutex_);
+    readOnly_ = readOnly;
+}
+
+bool CacheManager::useCacheFile(const QByteArray& expectedHash)
+{
+    releaseCacheFile();
+    if (!isCached(expectedHash)) {
+        return false;
+    }
+
+    QMutexLocker locker(&mutex_);
+    if (!readOnly_) {
+        return true;
+    }
+    SharedCacheFile& shared = sharedCacheFile();
+    QMutexLocker sharedLocker(&shared.mutex);
+    if (shared.generation != cacheGeneration_) {
+        return false;
+    }
+    shared.readers++;
+    readingCacheFile_ = true;
+    return true;
+}
+
+void CacheManager::releaseCacheFile()
+{
+    if (!readingCacheFile_) {
+        return;
+    }
+    readingCacheFile_ = false;
+    QMutexLocker locker(&sharedCacheFile().mutex);
+    sharedCacheFile().readers--;
+}
+
 void CacheManager::invalidateCache()
 {
     qDebug() << "Invalidating cache";
+
+    bool readOnly;
+    {
+        QMutexLocker locker(&mutex_);
+        readOnly = readOnly_;
+    }
+
+    if (readOnly) {
+        // Stop using the file, it is up to its owner to replace it
+        updateCacheStatus([](CacheStatus& status) {
+            status.isValid = false;
+            status.verificationComplete = false;
+            status.cachedHash.clear();
+        });
+        emit cacheInvalidated();
+        return;
+    }
+
+    stopTranscode();
     
     QString cacheFileName;
     bool customCache = false;
@@ -163,6 +357,8 @@ void CacheManager::invalidateCache()
         status.verificationComplete = false;
         status.cachedHash.clear();
         status.cacheFileHash.clear();
+        status.originalFileHash.clear();
+        status.transcoded = false;
         if (!customCache) {
             status.cacheFileName.clear();
         }
@@ -174,12 +370,22 @@ void CacheManager::invalidateCache()
         settings_.remove("lastDownloadSHA256");
         settings_.remove("lastCacheFileHash");
         settings_.remove("lastFileName");
+        settings_.remove("lastCacheTranscoded");
+        settings_.remove("lastOriginalCacheFileHash");
+        settings_.remove("lastCacheUses");
         settings_.endGroup();
         settings_.sync();
     }
+
+    // Original kept around by the transcode policy goes with it
+    if (!cacheFileName.isEmpty()) {
+        QFile::remove(cacheFileName + ".orig");
+    }
     
-    // Try to remove the cache file
-    if (!cacheFileName.isEmpty() && QFile::exists(cacheFileName)) {
+    // Try to remove the cache file, unless another writer is still writing from it
+    if (!cacheFileName.isEmpty() && QFile::exists(cacheFileName) && !beginReplacingCacheFile()) {
+        qDebug() << "Cache file is in use by another writer, leaving it in place:" << cacheFileName;
+    } else if (!cacheFileName.isEmpty() && QFile::exists(cacheFileName)) {
         if (QFile::remove(cacheFileName)) {
             qDebug() << "Successfully removed corrupted cache file:" << cacheFileName;
         } else {
@@ -200,6 +406,8 @@ void CacheManager::updateCacheFile(const QByteArray& uncompressedHash, const QBy
         status.cacheFileHash = compressedHash;   // Store compressed hash for cache verification
         status.isValid = true;
         status.verificationComplete = true;
+        status.transcoded = false;               // Freshly downloaded, still in the publisher's format
+        status.originalFileHash.clear();
         customCache = status.customCacheFile;
         cacheFileName = status.cacheFileName;
     });
@@ -210,11 +418,17 @@ void CacheManager::updateCacheFile(const QByteArray& uncompressedHash, const QBy
         settings_.setValue("lastDownloadSHA256", uncompressedHash);   // Store uncompressed hash for UI matching
         settings_.setValue("lastCacheFileHash", compressedHash);      // Store compressed hash for verification
         settings_.setValue("lastFileName", cacheFileName);
+        settings_.remove("lastCacheTranscoded");
+        settings_.remove("lastOriginalCacheFileHash");
+        settings_.setValue("lastCacheUses", 1);                       // The write that downloaded it
         settings_.endGroup();
         settings_.sync();
     }
     
     emit cacheFileUpdated(uncompressedHash); // UI matches against uncompressed hash
+
+    maybeStartTranscode();
+    maybeStartChunkImport();
 }
 
 void CacheManager::startVerification(const QByteArray& expectedHash)
@@ -245,9 +459,21 @@ void CacheManager::startVerification(const QByteArray& expectedHash)
 
 bool CacheManager::setupCacheForDownload(const QByteArray& expectedHash, qint64 downloadSize, QString& cacheFilePath)
 {
+    // The download may overwrite the cache file, which must not be replaced under it
+    stopTranscode();
+    if (promotionRunning_) {
+        hotTierWorker_->abort();
+    }
+
     QMutexLocker locker(&mutex_);
     
-    if (!cachingEnabled_) {
+    if (!cachingEnabled_ || readOnly_) {
+        return false;
+    }
+
+    // The download overwrites the file, so it is not cached while another writer reads it
+    if (!beginReplacingCacheFile()) {
+        qDebug() << "Cache file is in use by another writer, not caching this download";
         return false;
     }
     
@@ -303,6 +529,11 @@ void CacheManager::onVerificationComplete(bool isValid, const QString& fileName,
     if (getCacheStatus().diskSpaceCheckComplete) {
         emit cacheOperationsReady();
     }
+
+    if (isValid) {
+        maybeStartTranscode();
+        maybeStartChunkImport();
+    }
 }
 
 void CacheManager::onDiskSpaceCheckComplete(qint64 availableBytes, const QString& directory)
@@ -322,6 +553,333 @@ void CacheManager::onDiskSpaceCheckComplete(qint64 availableBytes, const QString
     }
 }
 
+void CacheManager::onTranscodeFinished(bool transcoded, const QString& fileName, const QByteArray& newFileHash, const QByteArray& originalFileHash)
+{
+    transcodeRunning_ = false;
+
+    // An empty original hash means the job was aborted or failed; it may be retried later.
+    // A job stopped after it replaced the file reports success, but the file is about to go
+    if (originalFileHash.isEmpty() || transcodeJobGeneration_ != transcodeGeneration_) {
+        emit cacheTranscodeFinished(false);
+        return;
+    }
+
+    bool customCache = false;
+    bool current = false;
+    updateCacheStatus([&](CacheStatus& status) {
+        current = status.cacheFileName == fileName;
+        if (current) {
+            status.cacheFileHash = newFileHash;          // Verification now runs against the transcoded file
+            status.originalFileHash = originalFileHash;
+            status.transcoded = true;                    // Also set when there was nothing to transcode
+            customCache = status.customCacheFile;
+        }
+    });
+
+    if (current && !customCache) {
+        settings_.beginGroup("caching");
+        settings_.setValue("lastCacheFileHash", newFileHash);
+        settings_.setValue("lastOriginalCacheFileHash", originalFileHash);
+        settings_.setValue("lastCacheTranscoded", true);
+        settings_.endGroup();
+        settings_.sync();
+    }
+
+    qDebug() << "Cache transcode finished:" << (transcoded ? "transcoded to seekable zstd" : "left as is") << fileName;
+    emit cacheTranscodeFinished(transcoded);
+}
+
+void CacheManager::maybeStartTranscode()
+{
+    QString fileName;
+    QByteArray fileHash;
+    {
+        QMutexLocker locker(&mutex_);
+        if (transcodeRunning_ || !cachingEnabled_ || readOnly_ || status_.customCacheFile || status_.transcoded
+            || !status_.verificationComplete || !status_.isValid
+            || status_.cacheFileName.isEmpty() || status_.cacheFileHash.isEmpty()) {
+            return;
+        }
+
+        // The transcoded copy is built next to the original, which may be kept too
+        qint64 fileSize = QFileInfo(status_.cacheFileName).size();
+        if (!status_.diskSpaceCheckComplete || status_.availableBytes - 2 * fileSize < IMAGEWRITER_MINIMAL_SPACE_FOR_CACHING) {
+            return;
+        }
+
+        fileName = status_.cacheFileName;
+        fileHash = status_.cacheFileHash;
+    }
+
+    if (QThread::idealThreadCount() < IMAGEWRITER_CACHE_TRANSCODE_MIN_CORES) {
+        return;
+    }
+
+    settings_.beginGroup("caching");
+    bool enabled = settings_.value("transcode", true).toBool();
+    bool keepOriginal = settings_.value("transcodeKeepOriginal", false).toBool();
+    settings_.endGroup();
+
+    // Replaced in place, so not while another writer reads it; tried again on the next verification
+    if (!enabled || !beginReplacingCacheFile()) {
+        return;
+    }
+
+    qDebug() << "Starting background transcode of cache file:" << fileName;
+    transcodeRunning_ = true;
+    transcodeJobGeneration_ = transcodeGeneration_;
+    transcodeWorker_->clearAbort();
+    QMetaObject::invokeMethod(transcodeWorker_, "transcodeCacheFile", Qt::QueuedConnection,
+                              Q_ARG(QString, fileName), Q_ARG(QByteArray, fileHash), Q_ARG(bool, keepOriginal));
+}
+
+void CacheManager::stopTranscode()
+{
+    if (transcodeRunning_ || importRunning_) {
+        qDebug() << "Aborting background cache transcode";
+        transcodeGeneration_++;
+        transcodeWorker_->abort();
+    }
+}
+
+QString CacheManager::hotTierFile(const QByteArray& expectedHash)
+{
+    releaseHotTierFile();
+    if (!hotTierBudget_ || expectedHash.isEmpty()) {
+        return QString();
+    }
+
+    // Pinned while the index is locked, so no other process evicts it before it is opened
+    HotTierIndex index(hotTierDirectory_);
+    pinnedHotTierFile_ = index.pin(expectedHash);
+    return pinnedHotTierFile_;
+}
+
+void CacheManager::releaseHotTierFile()
+{
+    HotTierIndex::releasePin(pinnedHotTierFile_);
+    pinnedHotTierFile_.clear();
+}
+
+void CacheManager::recordLookup(const QByteArray& expectedHash, CacheTier tier)
+{
+    const bool hotTier = hotTierBudget_ > 0;
+
+    const bool chunkStore = !chunkStoreDirectory_.isEmpty();
+
+    switch (tier) {
+    case CacheTier::Ram:
+        ramHits_++;
+        break;
+    case CacheTier::Disk:
+        ramMisses_ += hotTier ? 1 : 0;
+        diskHits_++;
+        maybeStartPromotion(expectedHash);
+        break;
+    case CacheTier::ChunkStore:
+        ramMisses_ += hotTier ? 1 : 0;
+        diskMisses_++;
+        chunkHits_++;
+        break;
+    case CacheTier::None:
+        ramMisses_ += hotTier ? 1 : 0;
+        diskMisses_++;
+        chunkMisses_ += chunkStore ? 1 : 0;
+        break;
+    }
+}
+
+QString CacheManager::tierStatistics() const
+{
+    QStringList tiers;
+    if (hotTierBudget_) {
+        tiers << QString("ram: %1 hits, %2 misses").arg(ramHits_).arg(ramMisses_);
+    }
+    tiers << QString("disk: %1 hits, %2 misses").arg(diskHits_).arg(diskMisses_);
+    if (!chunkStoreDirectory_.isEmpty()) {
+        tiers << QString("chunks: %1 hits, %2 misses").arg(chunkHits_).arg(chunkMisses_);
+    }
+    return tiers.join("; ");
+}
+
+QString CacheManager::chunkStoreRecipe(const QByteArray& expectedHash) const
+{
+    if (chunkStoreDirectory_.isEmpty() || expectedHash.isEmpty()) {
+        return QString();
+    }
+    const ChunkStore store(chunkStoreDirectory_);
+    return store.contains(expectedHash) ? store.recipePath(expectedHash) : QString();
+}
+
+void CacheManager::maybeStartChunkImport()
+{
+    QString fileName;
+    QByteArray uncompressedHash;
+    {
+        QMutexLocker locker(&mutex_);
+        if (chunkStoreDirectory_.isEmpty() || importRunning_ || readOnly_ || status_.customCacheFile
+            || !status_.verificationComplete || !status_.isValid
+            || status_.cacheFileName.isEmpty() || status_.cachedHash.isEmpty()) {
+            return;
+        }
+
+        // New chunks take at most about as much as the compressed cache file
+        if (!status_.diskSpaceCheckComplete
+            || status_.availableBytes - QFileInfo(status_.cacheFileName).size() < IMAGEWRITER_MINIMAL_SPACE_FOR_CACHING) {
+            return;
+        }
+
+        fileName = status_.cacheFileName;
+        uncompressedHash = status_.cachedHash;
+    }
+
+    if (ChunkStore(chunkStoreDirectory_).contains(uncompressedHash)) {
+        return;
+    }
+
+    qDebug() << "Queueing import of cache file into the chunk store:" << fileName;
+    importRunning_ = true;
+    transcodeWorker_->clearAbort();
+    QMetaObject::invokeMethod(transcodeWorker_, "importIntoChunkStore", Qt::QueuedConnection,
+                              Q_ARG(QString, fileName), Q_ARG(QString, chunkStoreDirectory_), Q_ARG(QByteArray, uncompressedHash));
+}
+
+void CacheManager::onChunkImportFinished(bool imported, const QByteArray& uncompressedHash)
+{
+    importRunning_ = false;
+    qDebug() << "Chunk store import:" << (imported ? "done" : "not done") << uncompressedHash;
+    emit chunkImportFinished(imported);
+}
+
+void CacheManager::maybeStartPromotion(const QByteArray& expectedHash)
+{
+    QString fileName;
+    QByteArray fileHash;
+    {
+        QMutexLocker locker(&mutex_);
+        if (!hotTierBudget_ || promotionRunning_ || status_.customCacheFile
+            || status_.cachedHash != expectedHash || !status_.verificationComplete || !status_.isValid
+            || status_.cacheFileName.isEmpty() || status_.cacheFileHash.isEmpty()) {
+            return;
+        }
+        fileName = status_.cacheFileName;
+        fileHash = status_.cacheFileHash;
+    }
+
+    settings_.beginGroup("caching");
+    const int uses = settings_.value("lastCacheUses", 0).toInt() + 1;
+    settings_.setValue("lastCacheUses", uses);
+    settings_.endGroup();
+    settings_.sync();
+
+    if (uses < IMAGEWRITER_CACHE_HOT_TIER_PROMOTE_USES) {
+        return;
+    }
+
+    // The compressed file is the least the entry takes, decompressed it may need more
+    const qint64 fileSize = QFileInfo(fileName).size();
+    if (fileSize > hotTierBudget_) {
+        qDebug() << "Cache file is larger than the hot tier budget, not promoting:" << fileName;
+        return;
+    }
+    qint64 limit = 0;
+    {
+        HotTierIndex index(hotTierDirectory_);
+        if (!index.isLocked()) {
+            return;
+        }
+        index.evict(hotTierBudget_, fileSize);
+        index.save();
+        limit = std::min(hotTierBudget_ - index.usedBytes(), QStorageInfo(hotTierDirectory_).bytesAvailable());
+    }
+    if (limit < fileSize) {
+        qDebug() << "Not enough free space in the hot tier for:" << fileName;
+        return;
+    }
+
+    const QString target = QDir(hotTierDirectory_).filePath(QString::fromLatin1(expectedHash)
+                                                            + (hotTierSparse_ ? ".img" : ".cache"));
+    qDebug() << "Promoting cache file to the hot tier:" << fileName << "->" << target;
+    promotionRunning_ = true;
+    hotTierWorker_->clearAbort();
+    QMetaObject::invokeMethod(hotTierWorker_, "promote", Qt::QueuedConnection,
+                              Q_ARG(QString, fileName), Q_ARG(QString, target), Q_ARG(bool, hotTierSparse_),
+                              Q_ARG(QByteArray, fileHash), Q_ARG(QByteArray, expectedHash), Q_ARG(qint64, limit));
+}
+
+void CacheManager::onPromotionFinished(bool promoted, const QByteArray& uncompressedHash, const QString& fileName, qint64 bytes)
+{
+    promotionRunning_ = false;
+
+    if (promoted) {
+        HotTierIndex index(hotTierDirectory_);
+        if (index.isLocked()) {
+            // Another process may have promoted the same image meanwhile
+            for (auto it = index.entries.begin(); it != index.entries.end();) {
+                if (it->hash == uncompressedHash) {
+                    if (it->fileName != fileName) {
+                        QFile::remove(it->fileName);
+                    }
+                    it = index.entries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            promoted = index.evict(hotTierBudget_, bytes);
+            if (promoted) {
+                HotTierEntry entry;
+                entry.hash = uncompressedHash;
+                entry.fileName = fileName;
+                entry.bytes = bytes;
+                entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+                index.entries.push_back(entry);
+            }
+            promoted = index.save() && promoted;
+        } else {
+            promoted = false;
+        }
+
+        if (!promoted) {
+            QFile::remove(fileName);
+        }
+    }
+
+    qDebug() << "Cache hot tier promotion:" << (promoted ? "done" : "not done") << fileName << bytes / (1024 * 1024) << "MB";
+    emit cachePromotionFinished(promoted);
+}
+
+void CacheManager::loadHotTierSettings()
+{
+    settings_.beginGroup("caching");
+    const qint64 budgetMB = settings_.value("hotTierBudgetMB", 0).toLongLong();
+    QString directory = settings_.value("hotTierDirectory").toString();
+    hotTierSparse_ = settings_.value("hotTierSparse", false).toBool();
+    settings_.endGroup();
+
+    if (budgetMB <= 0 || !cachingEnabled_) {
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    if (directory.isEmpty()) {
+        // Per user, as the tmpfs is shared
+        directory = QString("%1/rpi-imager-cache-%2").arg(IMAGEWRITER_CACHE_HOT_TIER_ROOT).arg(::getuid());
+    }
+#endif
+    if (!HotTierIndex::secureDirectory(directory)) {
+        qDebug() << "Cache hot tier disabled, cannot create directory:" << directory;
+        return;
+    }
+
+    hotTierDirectory_ = directory;
+    hotTierBudget_ = budgetMB * 1024 * 1024;
+    HotTierIndex::removeStaleFiles(directory);
+
+    qDebug() << "Cache hot tier:" << directory << budgetMB << "MB,"
+             << (hotTierSparse_ ? "decompressed sparse images" : "compressed images");
+}
+
 void CacheManager::updateCacheStatus(const std::function<void(CacheStatus&)>& updater)
 {
     QMutexLocker locker(&mutex_);
@@ -341,6 +899,14 @@ void CacheManager::loadCacheSettings()
     QString lastFileName = settings_.value("lastFileName").toString();
     QByteArray lastHash = settings_.value("lastDownloadSHA256").toByteArray();
     QByteArray cacheFileHash = settings_.value("lastCacheFileHash").toByteArray();
+    bool transcoded = settings_.value("lastCacheTranscoded", false).toBool();
+    QByteArray originalFileHash = settings_.value("lastOriginalCacheFileHash").toByteArray();
+
+    if (cachingEnabled_ && settings_.value("chunkStore", false).toBool()) {
+        chunkStoreDirectory_ = settings_.value("chunkStoreDirectory",
+            QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QDir::separator() + "chunks").toString();
+        qDebug() << "Chunk store:" << chunkStoreDirectory_;
+    }
     
     settings_.endGroup();
     
@@ -357,6 +923,8 @@ void CacheManager::loadCacheSettings()
                     status.cacheFileName = lastFileName;
                     status.cachedHash = lastHash;        // Uncompressed hash for UI queries
                     status.cacheFileHash = cacheFileHash; // Compressed hash for cache verification
+                    status.transcoded = transcoded;
+                    status.originalFileHash = originalFileHash;
                     status.customCacheFile = false;
                     status.verificationComplete = false;
                 });
@@ -384,6 +952,8 @@ void CacheManager::saveCacheSettings()
     settings_.setValue("lastFileName", status_.cacheFileName);
     settings_.setValue("lastDownloadSHA256", status_.cachedHash);
     settings_.setValue("lastCacheFileHash", status_.cacheFileHash);
+    settings_.setValue("lastCacheTranscoded", status_.transcoded);
+    settings_.setValue("lastOriginalCacheFileHash", status_.originalFileHash);
     settings_.endGroup();
     settings_.sync();
 }
@@ -512,4 +1082,414 @@ bool CacheVerificationWorker::ensureCacheDirectoryExists()
 QString CacheVerificationWorker::getCacheDirectory() const
 {
     return QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
-}
\ No newline at end of file
+}
+namespace {
+
+/* libarchive input that hashes the compressed bytes as they are consumed */
+struct TranscodeInput {
+    QFile file;
+    QCryptographicHash hash{CACHE_HASH_ALGORITHM};
+    QByteArray buffer;
+};
+
+la_ssize_t transcodeRead(struct archive *, void *clientData, const void **buff)
+{
+    auto *in = static_cast<TranscodeInput *>(clientData);
+    qint64 len = in->file.read(in->buffer.data(), in->buffer.size());
+    if (len > 0) {
+        in->hash.addData(QByteArrayView(in->buffer.constData(), len));
+    }
+    *buff = in->buffer.constData();
+    return static_cast<la_ssize_t>(len);
+}
+
+} // namespace
+
+CacheTranscodeWorker::CacheTranscodeWorker(QObject *parent)
+    : QObject(parent)
+    , abort_(false)
+{
+}
+
+void CacheTranscodeWorker::transcodeCacheFile(const QString& fileName, const QByteArray& expectedFileHash, bool keepOriginal)
+{
+    auto fail = [&](const char *reason) {
+        qDebug() << "Background: Cache transcode not completed:" << reason;
+        emit transcodeFinished(false, fileName, QByteArray(), QByteArray());
+    };
+    auto leaveAsIs = [&](const char *reason) {
+        qDebug() << "Background: Cache file not transcoded:" << reason;
+        emit transcodeFinished(false, fileName, expectedFileHash, expectedFileHash);
+    };
+
+    if (ZstdSeekable::isSeekable(fileName)) {
+        leaveAsIs("already seekable zstd");
+        return;
+    }
+
+    QFileInfo before(fileName);
+    const qint64 sizeBefore = before.size();
+    const QDateTime mtimeBefore = before.lastModified();
+
+    TranscodeInput in;
+    in.file.setFileName(fileName);
+    if (!in.file.open(QIODevice::ReadOnly)) {
+        fail("cannot open cache file");
+        return;
+    }
+    in.buffer.resize(1024 * 1024);
+
+    struct archive *a = archive_read_new();
+    struct archive_entry *entry;
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+
+    if (archive_read_open(a, &in, nullptr, &transcodeRead, nullptr) != ARCHIVE_OK
+        || archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        archive_read_free(a);
+        leaveAsIs("not a compressed image");
+        return;
+    }
+    if (archive_filter_count(a) <= 1) {
+        // No compression filter: uncompressed or a container (e.g. zip) we must not touch
+        archive_read_free(a);
+        leaveAsIs("not a single compressed stream");
+        return;
+    }
+    qDebug() << "Background: Transcoding cache file from" << archive_filter_name(a, 0) << "to seekable zstd";
+
+    QSaveFile out(fileName);
+    out.setDirectWriteFallback(false);
+    if (!out.open(QIODevice::WriteOnly)) {
+        archive_read_free(a);
+        fail("cannot create output file");
+        return;
+    }
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, IMAGEWRITER_CACHE_TRANSCODE_LEVEL);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+    const size_t frameSize = IMAGEWRITER_CACHE_TRANSCODE_FRAME_SIZE;
+    std::unique_ptr<char[]> frame = std::make_unique<char[]>(frameSize);
+    const size_t dstCapacity = ZSTD_compressBound(frameSize);
+    std::unique_ptr<char[]> dst = std::make_unique<char[]>(dstCapacity);
+    ZstdSeekable::SeekTable seekTable;
+    QCryptographicHash outHash(CACHE_HASH_ALGORITHM);
+    quint64 totalIn = 0, totalOut = 0;
+    const char *error = nullptr;
+    bool eof = false;
+
+    while (!eof && !error) {
+        if (abort_ || QThread::currentThread()->isInterruptionRequested()) {
+            error = "aborted";
+            break;
+        }
+
+        // Fill a whole frame so every frame but the last has the same uncompressed size
+        size_t filled = 0;
+        while (filled < frameSize) {
+            la_ssize_t n = archive_read_data(a, frame.get() + filled, frameSize - filled);
+            if (n < 0) {
+                error = "decompression error";
+                break;
+            }
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            filled += static_cast<size_t>(n);
+        }
+        if (error || !filled) {
+            break;
+        }
+
+        size_t compressed = ZSTD_compress2(cctx, dst.get(), dstCapacity, frame.get(), filled);
+        if (ZSTD_isError(compressed)) {
+            error = "zstd compression error";
+            break;
+        }
+        if (out.write(dst.get(), static_cast<qint64>(compressed)) != static_cast<qint64>(compressed)) {
+            error = "write error";
+            break;
+        }
+        outHash.addData(QByteArrayView(dst.get(), static_cast<qsizetype>(compressed)));
+        seekTable.emplace_back(static_cast<quint32>(compressed), static_cast<quint32>(filled));
+        totalIn += filled;
+        totalOut += compressed;
+    }
+
+    ZSTD_freeCCtx(cctx);
+    archive_read_free(a);
+
+    // Hash whatever libarchive did not need to read, so the original hash covers the whole file
+    while (!error && !in.file.atEnd()) {
+        qint64 len = in.file.read(in.buffer.data(), in.buffer.size());
+        if (len <= 0) {
+            break;
+        }
+        in.hash.addData(QByteArrayView(in.buffer.constData(), len));
+    }
+    in.file.close();
+
+    if (!error) {
+        const QByteArray table = ZstdSeekable::seekTableFrame(seekTable);
+
+        if (out.write(table) != table.size()) {
+            error = "write error";
+        } else {
+            outHash.addData(table);
+        }
+    }
+
+    const QByteArray originalHash = in.hash.result().toHex();
+    QFileInfo after(fileName);
+    if (!error && originalHash != expectedFileHash) {
+        error = "original file does not match its cached hash";
+    } else if (!error && (after.size() != sizeBefore || after.lastModified() != mtimeBefore)) {
+        error = "cache file changed while transcoding";
+    }
+
+    // abort() waits for the file to be replaced, so once it returns, a download can take its place
+    QMutexLocker commitLocker(&commitMutex_);
+    if (!error && abort_) {
+        error = "aborted";
+    }
+
+    if (error) {
+        out.cancelWriting();
+        fail(error);
+        return;
+    }
+
+    const QString originalName = fileName + ".orig";
+    if (keepOriginal) {
+        QFile::remove(originalName);
+        if (!QFile::rename(fileName, originalName)) {
+            out.cancelWriting();
+            fail("cannot keep original file");
+            return;
+        }
+    }
+
+    if (!out.commit()) {
+        if (keepOriginal) {
+            QFile::rename(originalName, fileName);
+        }
+        fail("cannot replace cache file");
+        return;
+    }
+
+    qDebug() << "Background: Cache transcoded:" << seekTable.size() << "frames,"
+             << totalIn / (1024 * 1024) << "MB image," << sizeBefore / (1024 * 1024) << "MB ->"
+             << (totalOut + seekTable.size() * 8 + 17) / (1024 * 1024) << "MB"
+             << (keepOriginal ? "(original kept)" : "(original dropped)");
+
+    emit transcodeFinished(true, fileName, outHash.result().toHex(), originalHash);
+}
+
+namespace {
+
+bool isZero(const char *data, size_t len)
+{
+    return len == 0 || (data[0] == 0 && std::memcmp(data, data + 1, len - 1) == 0);
+}
+
+} // namespace
+
+CacheHotTierWorker::CacheHotTierWorker(QObject *parent)
+    : QObject(parent)
+    , abort_(false)
+{
+}
+
+void CacheHotTierWorker::promote(const QString& sourceFile, const QString& targetFile, bool sparse,
+                                 const QByteArray& expectedHash, const QByteArray& uncompressedHash, qint64 limit)
+{
+    const QString partName = targetFile + ".part";
+    QFile out(partName);
+    bool created = false;
+    auto fail = [&](const char *reason) {
+        qDebug() << "Background: Cache file not promoted to the hot tier:" << reason;
+        out.close();
+        if (created) {
+            QFile::remove(partName);
+        }
+        emit promotionFinished(false, uncompressedHash, targetFile, 0);
+    };
+
+#ifdef Q_OS_UNIX
+    // Never through a link, nor into a copy another process is still making
+    const int fd = ::open(QFile::encodeName(partName).constData(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    created = fd >= 0;
+    if (!created || !out.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        if (created) {
+            ::close(fd);
+        }
+        fail("cannot create hot tier file");
+        return;
+    }
+#else
+    created = out.open(QIODevice::NewOnly | QIODevice::WriteOnly);
+    if (!created) {
+        fail("cannot create hot tier file");
+        return;
+    }
+#endif
+
+    const qint64 bufferSize = IMAGEWRITER_BLOCKSIZE;
+    std::unique_ptr<char[]> buffer = std::make_unique<char[]>(bufferSize);
+    QCryptographicHash hash(CACHE_HASH_ALGORITHM);
+    const char *error = nullptr;
+
+    if (!sparse) {
+        // Copy of the compressed cache file, checked against its own hash
+        QFile in(sourceFile);
+        if (!in.open(QIODevice::ReadOnly)) {
+            fail("cannot open cache file");
+            return;
+        }
+        if (in.size() > limit) {
+            fail("larger than the hot tier budget");
+            return;
+        }
+        while (!error && !in.atEnd()) {
+            qint64 len = in.read(buffer.get(), bufferSize);
+            if (len < 0) {
+                error = "read error";
+            } else if (out.write(buffer.get(), len) != len) {
+                error = "write error";
+            } else if (abort_ || QThread::currentThread()->isInterruptionRequested()) {
+                error = "aborted";
+            } else {
+                hash.addData(QByteArrayView(buffer.get(), len));
+            }
+        }
+    } else {
+        // Decompressed image, checked against the image hash. Zero blocks become holes
+        struct archive *a = archive_read_new();
+        struct archive_entry *entry;
+        archive_read_support_filter_all(a);
+        archive_read_support_format_raw(a);
+
+        if (archive_read_open_filename(a, QFile::encodeName(sourceFile).constData(), bufferSize) != ARCHIVE_OK
+            || archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+            archive_read_free(a);
+            fail("cannot decompress cache file");
+            return;
+        }
+
+        const qint64 holeGranularity = 64 * 1024;
+        qint64 pos = 0, stored = 0;
+        while (!error) {
+            la_ssize_t n = archive_read_data(a, buffer.get(), bufferSize);
+            if (n < 0) {
+                error = "decompression error";
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            hash.addData(QByteArrayView(buffer.get(), n));
+
+            for (qint64 offset = 0; offset < n && !error; offset += holeGranularity) {
+                const qint64 len = std::min<qint64>(holeGranularity, n - offset);
+                if (isZero(buffer.get() + offset, static_cast<size_t>(len))) {
+                    continue;
+                }
+                if (!out.seek(pos + offset) || out.write(buffer.get() + offset, len) != len) {
+                    error = "write error";
+                }
+                stored += len;
+            }
+            pos += n;
+
+            if (!error && stored > limit) {
+                error = "larger than the hot tier budget";
+            } else if (!error && (abort_ || QThread::currentThread()->isInterruptionRequested())) {
+                error = "aborted";
+            }
+        }
+        archive_read_free(a);
+
+        if (!error && !out.resize(pos)) {
+            error = "write error";
+        }
+    }
+
+    out.close();
+    if (!error && hash.result().toHex() != (sparse ? uncompressedHash : expectedHash)) {
+        error = "cache file does not match its hash";
+    }
+    if (!error) {
+        QFile::remove(targetFile);
+        if (!QFile::rename(partName, targetFile)) {
+            error = "cannot rename hot tier file";
+        }
+    }
+    if (error) {
+        fail(error);
+        return;
+    }
+
+    emit promotionFinished(true, uncompressedHash, targetFile, allocatedBytes(targetFile));
+}
+
+void CacheTranscodeWorker::importIntoChunkStore(const QString& fileName, const QString& storeDirectory, const QByteArray& uncompressedHash)
+{
+    auto fail = [&](const QString& reason) {
+        qDebug() << "Background: Cache file not imported into the chunk store:" << reason;
+        emit chunkImportFinished(false, uncompressedHash);
+    };
+
+    struct archive *a = archive_read_new();
+    struct archive_entry *entry;
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+
+    if (archive_read_open_filename(a, QFile::encodeName(fileName).constData(), IMAGEWRITER_BLOCKSIZE) != ARCHIVE_OK
+        || archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        archive_read_free(a);
+        fail("cannot open cache file");
+        return;
+    }
+
+    ChunkStore store(storeDirectory);
+    ChunkStore::Importer importer(store);
+    const size_t bufferSize = IMAGEWRITER_BLOCKSIZE;
+    std::unique_ptr<char[]> buffer = std::make_unique<char[]>(bufferSize);
+    QString error;
+
+    while (error.isEmpty()) {
+        if (abort_ || QThread::currentThread()->isInterruptionRequested()) {
+            error = "aborted";
+            break;
+        }
+        la_ssize_t n = archive_read_data(a, buffer.get(), bufferSize);
+        if (n < 0) {
+            error = "decompression error";
+        } else if (n == 0) {
+            break;
+        } else if (!importer.write(buffer.get(), static_cast<size_t>(n))) {
+            error = importer.errorString();
+        }
+    }
+    archive_read_free(a);
+
+    // A cache file replaced meanwhile no longer matches the image hash, and is not recorded
+    if (error.isEmpty() && !importer.finish(uncompressedHash)) {
+        error = importer.errorString();
+    }
+    if (!error.isEmpty()) {
+        fail(error);
+        return;
+    }
+
+    // Walking the store takes a while, so it is done here and not by writes from it
+    const ChunkStore::Statistics stats = store.statistics();
+    store.saveStatistics(stats);
+    qDebug() << "Background: Chunk store holds" << stats.images << "images," << stats.logicalBytes / (1024 * 1024) << "MB in"
+             << stats.storedBytes / (1024 * 1024) << "MB, dedup ratio" << stats.dedupRatio()
+             << "(" << importer.newChunkBytes() / (1024 * 1024) << "MB new)";
+    emit chunkImportFinished(true, uncompressedHash);
+}
@@ -14,8 +14,11 @@
 #include <QStorageInfo>
 #include <QMutex>
 #include <QMutexLocker>
+#include <atomic>
 
 class CacheVerificationWorker;
+class CacheTranscodeWorker;
+class CacheHotTierWorker;
 
 /**
  * @brief Manages all cache operations in the background to avoid blocking the UI
@@ -28,6 +31,9 @@ class CacheVerificationWorker;
  * - Disk space monitoring
  * - Cache directory setup
  * - Custom cache file support
+ * - Idle-priority transcoding of the cache into seekable zstd
+ * - An optional RAM (tmpfs) hot tier in front of the disk cache
+ * - An optional deduplicating chunk store behind it, holding many images
  * 
  * Operations are performed on background threads and results are cached
  * to avoid blocking the main UI thread during write operations.
@@ -48,6 +54,15 @@ public:
         bool verificationComplete = false;
         bool diskSpaceCheckComplete = false;
         bool customCacheFile = false;
+        bool transcoded = false;            // Cache file has been converted to seekable zstd
+        QByteArray originalFileHash;        // Compressed hash of the file as originally downloaded
+    };
+
+    enum class CacheTier {
+        None,
+        Ram,
+        Disk,
+        ChunkStore
     };
 
     explicit CacheManager(QObject *parent = nullptr);
@@ -70,6 +85,16 @@ public:
     void setCustomCacheFile(const QString& cacheFile, const QByteArray& sha256);
     void invalidateCache();
     void updateCacheFile(const QByteArray& uncompressedHash, const QByteArray& compressedHash);
+
+    // Use a valid cache file, but never download into, transcode or remove it.
+    // For additional writers in one process, so only one of them owns the cache
+    void setReadOnly(bool readOnly);
+
+    // isCached(), and for a read-only manager also hold the file until it is
+    // released, the next lookup or destruction, so its owner leaves it alone.
+    // Once the owner has replaced the file, read-only managers no longer use it
+    bool useCacheFile(const QByteArray& expectedHash);
+    void releaseCacheFile();
     
     // Cache verification
     void startVerification(const QByteArray& expectedHash);
@@ -77,6 +102,22 @@ public:
     // Cache file setup for downloads
     bool setupCacheForDownload(const QByteArray& expectedHash, qint64 downloadSize, QString& cacheFilePath);
 
+    // RAM hot tier: the file holding the image in RAM, or an empty string.
+    // Marks the entry as recently used, and pins the file until it is
+    // released, the next lookup or destruction, so eviction does not remove it
+    QString hotTierFile(const QByteArray& expectedHash);
+    void releaseHotTierFile();
+
+    // Chunk store: the recipe of the image, or an empty string
+    QString chunkStoreRecipe(const QByteArray& expectedHash) const;
+
+    // Count a write's cache lookup against the tier it was served from, and
+    // promote disk entries to the hot tier once they are used often enough
+    void recordLookup(const QByteArray& expectedHash, CacheTier tier);
+
+    // Hits and misses per tier since startup, for performance stats
+    QString tierStatistics() const;
+
 signals:
     void cacheVerificationComplete(bool isValid);
     void diskSpaceCheckComplete(qint64 availableBytes);
@@ -84,24 +125,62 @@ signals:
     void cacheVerificationProgress(qint64 bytesProcessed, qint64 totalBytes);
     void cacheInvalidated();
     void cacheFileUpdated(const QByteArray& uncompressedHash);
+    void cacheTranscodeFinished(bool transcoded);
+    void cachePromotionFinished(bool promoted);
+    void chunkImportFinished(bool imported);
 
 private slots:
     void onVerificationComplete(bool isValid, const QString& fileName, const QByteArray& hash);
     void onDiskSpaceCheckComplete(qint64 availableBytes, const QString& directory);
+    void onTranscodeFinished(bool transcoded, const QString& fileName, const QByteArray& newFileHash, const QByteArray& originalFileHash);
+    void onPromotionFinished(bool promoted, const QByteArray& uncompressedHash, const QString& fileName, qint64 bytes);
+    void onChunkImportFinished(bool imported, const QByteArray& uncompressedHash);
 
 private:
     mutable QMutex mutex_;
     CacheStatus status_;
     QThread* workerThread_;
     CacheVerificationWorker* worker_;
+    QThread* transcodeThread_;
+    CacheTranscodeWorker* transcodeWorker_;
     QSettings settings_;
     bool cachingEnabled_;
+    bool readOnly_;
+    quint64 cacheGeneration_;   // Of the shared cache file, when its status was loaded
+    bool readingCacheFile_;
+    bool transcodeRunning_;
+    quint64 transcodeGeneration_;       // Changed by stopTranscode(), so a stopped job's result is ignored
+    quint64 transcodeJobGeneration_;
+
+    // Hot tier; disabled while hotTierBudget_ is 0
+    QThread* hotTierThread_;
+    CacheHotTierWorker* hotTierWorker_;
+    QString hotTierDirectory_;
+    qint64 hotTierBudget_;
+    bool hotTierSparse_;
+    QString pinnedHotTierFile_;
+    bool promotionRunning_;
+    quint64 ramHits_;
+    quint64 ramMisses_;
+    quint64 diskHits_;
+    quint64 diskMisses_;
+
+    // Chunk store, imported into on the transcode thread; disabled while the directory is empty
+    QString chunkStoreDirectory_;
+    bool importRunning_;
+    quint64 chunkHits_;
+    quint64 chunkMisses_;
 
     void updateCacheStatus(const std::function<void(CacheStatus&)>& updater);
     void loadCacheSettings();
     void saveCacheSettings();
     QString getDefaultCacheFilePath() const;
     bool isCachingEnabled() const;
+    void maybeStartTranscode();
+    void stopTranscode();
+    void loadHotTierSettings();
+    void maybeStartPromotion(const QByteArray& expectedHash);
+    void maybeStartChunkImport();
 };
 
 /**
@@ -128,4 +207,82 @@ private:
     QString getCacheDirectory() const;
 };
 
+/**
+ * @brief Worker that rewrites a verified cache file as seekable zstd
+ *
+ * Publishers often ship single-block .xz images, which can only be decoded on
+ * one core. The transcoded file is a sequence of independent zstd frames of
+ * IMAGEWRITER_CACHE_TRANSCODE_FRAME_SIZE uncompressed bytes each, followed by
+ * a seek table in the zstd seekable format (a skippable frame, so ordinary
+ * zstd decoders including libarchive read the file unchanged). Frames can be
+ * decoded in parallel and from arbitrary offsets.
+ *
+ * Runs on an idle-priority thread and can be aborted at any frame boundary;
+ * the cache file is only replaced, atomically, once the new file is complete
+ * and the original compressed data has re-hashed to the expected value.
+ *
+ * The same thread imports verified cache files into the chunk store, after
+ * any transcode of the file.
+ */
+class CacheTranscodeWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CacheTranscodeWorker(QObject *parent = nullptr);
+
+    // Thread safe: stop the running job at its next frame boundary, and a job
+    // already queued when it starts. Once this returns, the job no longer
+    // replaces the cache file. Queueing a job clears the flag again
+    void abort() { QMutexLocker locker(&commitMutex_); abort_ = true; }
+    void clearAbort() { abort_ = false; }
+
+public slots:
+    void transcodeCacheFile(const QString& fileName, const QByteArray& expectedFileHash, bool keepOriginal);
+    void importIntoChunkStore(const QString& fileName, const QString& storeDirectory, const QByteArray& uncompressedHash);
+
+signals:
+    void transcodeFinished(bool transcoded, const QString& fileName, const QByteArray& newFileHash, const QByteArray& originalFileHash);
+    void chunkImportFinished(bool imported, const QByteArray& uncompressedHash);
+
+private:
+    std::atomic<bool> abort_;
+    QMutex commitMutex_;    // Held from the last abort check until the cache file is replaced
+};
+
+/**
+ * @brief Worker that copies a verified cache file into the RAM hot tier
+ *
+ * The hot tier is a directory on tmpfs holding the most frequently written
+ * images, so repeated writes do not read from a disk shared with other work.
+ * Entries are stored either as a copy of the compressed cache file, or
+ * decompressed as a sparse raw image, trading RAM for decompression time on
+ * every write. Blocks of zeroes are left as holes and take no memory.
+ *
+ * The copy is made under a temporary name, checked against the expected hash
+ * (of the cache file, or of the image when decompressed), and only then
+ * renamed into place. It is abandoned if it grows beyond the given limit.
+ */
+class CacheHotTierWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CacheHotTierWorker(QObject *parent = nullptr);
+
+    // Thread safe: stop the current promotion
+    void abort() { abort_ = true; }
+    void clearAbort() { abort_ = false; }
+
+public slots:
+    void promote(const QString& sourceFile, const QString& targetFile, bool sparse,
+                 const QByteArray& expectedHash, const QByteArray& uncompressedHash, qint64 limit);
+
+signals:
+    void promotionFinished(bool promoted, const QByteArray& uncompressedHash, const QString& fileName, qint64 bytes);
+
+private:
+    std::atomic<bool> abort_;
+};
+
 #endif // CACHEMANAGER_H 
\ No newline at end of file
@@ -0,0 +1,327 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "chunkstore.h"
+#include "config.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <algorithm>
+#include <array>
+#include <memory>
+
+namespace {
+
+/* Random values per byte for the gear hash. Fixed (splitmix64 from a constant
+ * seed), as changing them would change every chunk boundary of the store */
+constexpr std::array<uint64_t, 256> makeGearTable()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x5EED0F1A6E5C0DEDull;
+    for (auto &value : table) {
+        state += 0x9E3779B97F4A7C15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> Gear = makeGearTable();
+
+/* The top bits of the gear hash depend on the last 64 bytes. Below the
+ * average size a cut needs more of them to be zero, above it fewer, which
+ * narrows the spread of chunk sizes (FastCDC's normalised chunking) */
+constexpr uint64_t MaskSmall = ~0ull << (64 - 20);
+constexpr uint64_t MaskLarge = ~0ull << (64 - 16);
+
+bool writeFileAtomically(const QString &fileName, const char *data, qint64 len)
+{
+    // Not QSaveFile: it syncs every file, and a store holds tens of thousands of chunks
+    const QString partName = fileName + QString(".part%1").arg(QCoreApplication::applicationPid());
+    QFile f(partName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || f.write(data, len) != len) {
+        f.remove();
+        return false;
+    }
+    f.close();
+    QFile::remove(fileName);
+    if (!QFile::rename(partName, fileName)) {
+        QFile::remove(partName);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+ChunkStore::ChunkStore(const QString &directory)
+    : directory_(directory)
+{
+}
+
+size_t ChunkStore::cutPoint(const uint8_t *data, size_t len)
+{
+    if (len <= MinChunkSize) {
+        return len;
+    }
+
+    const size_t end = std::min(len, MaxChunkSize);
+    const size_t normal = std::min(end, AvgChunkSize);
+    uint64_t hash = 0;
+    size_t i = MinChunkSize;
+
+    for (; i < normal; i++) {
+        hash = (hash << 1) + Gear[data[i]];
+        if (!(hash & MaskSmall)) {
+            return i + 1;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + Gear[data[i]];
+        if (!(hash & MaskLarge)) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+QString ChunkStore::chunkPath(const QByteArray &hash) const
+{
+    return QString("%1/chunks/%2/%3").arg(directory_, QString::fromLatin1(hash.left(2)), QString::fromLatin1(hash));
+}
+
+QString ChunkStore::recipePath(const QByteArray &imageHash) const
+{
+    return QString("%1/recipes/%2.json").arg(directory_, QString::fromLatin1(imageHash));
+}
+
+bool ChunkStore::contains(const QByteArray &imageHash) const
+{
+    return !imageHash.isEmpty() && QFile::exists(recipePath(imageHash));
+}
+
+bool ChunkStore::readRecipe(const QString &recipePath, Recipe &recipe)
+{
+    QFile f(recipePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QJsonObject obj = QJsonDocument::fromJson(f.readAll()).object();
+    const QJsonArray chunks = obj["chunks"].toArray();
+
+    recipe.imageHash = obj["sha256"].toString().toLatin1();
+    recipe.size = obj["size"].toInteger();
+    recipe.chunks.clear();
+    recipe.chunks.reserve(chunks.size());
+
+    qint64 total = 0;
+    for (const QJsonValue &value : chunks) {
+        const QJsonArray pair = value.toArray();
+        Chunk chunk;
+        chunk.hash = pair.at(0).toString().toLatin1();
+        chunk.length = static_cast<quint32>(pair.at(1).toInteger());
+        if (chunk.hash.size() != 64 || !chunk.length || chunk.length > MaxChunkSize) {
+            return false;
+        }
+        total += chunk.length;
+        recipe.chunks.push_back(chunk);
+    }
+    return !recipe.imageHash.isEmpty() && total == recipe.size;
+}
+
+bool ChunkStore::readChunk(const Chunk &chunk, char *out) const
+{
+    QFile f(chunkPath(chunk.hash));
+    if (!f.open(QIODevice::ReadOnly)) {
+        qDebug() << "Chunk store: missing chunk" << chunk.hash;
+        return false;
+    }
+    const QByteArray compressed = f.readAll();
+
+    // The frame's content checksum catches corruption of the chunk file
+    if (ZSTD_getFrameContentSize(compressed.constData(), compressed.size()) != chunk.length) {
+        qDebug() << "Chunk store: chunk has unexpected size" << chunk.hash;
+        return false;
+    }
+    size_t len = ZSTD_decompress(out, chunk.length, compressed.constData(), compressed.size());
+    if (ZSTD_isError(len) || len != chunk.length) {
+        qDebug() << "Chunk store: cannot decompress chunk" << chunk.hash;
+        return false;
+    }
+    return true;
+}
+
+ChunkStore::Statistics ChunkStore::statistics() const
+{
+    Statistics stats;
+    QSet<QByteArray> seen;
+
+    QDirIterator recipes(directory_ + "/recipes", {"*.json"}, QDir::Files);
+    while (recipes.hasNext()) {
+        Recipe recipe;
+        if (!readRecipe(recipes.next(), recipe)) {
+            continue;
+        }
+        stats.images++;
+        stats.logicalBytes += recipe.size;
+        for (const Chunk &chunk : recipe.chunks) {
+            if (!seen.contains(chunk.hash)) {
+                seen.insert(chunk.hash);
+                stats.uniqueBytes += chunk.length;
+            }
+        }
+    }
+
+    QDirIterator chunks(directory_ + "/chunks", QDir::Files, QDirIterator::Subdirectories);
+    while (chunks.hasNext()) {
+        chunks.next();
+        stats.storedBytes += chunks.fileInfo().size();
+    }
+    return stats;
+}
+
+bool ChunkStore::saveStatistics(const Statistics &stats) const
+{
+    QJsonObject obj;
+    obj["images"] = stats.images;
+    obj["logical_bytes"] = stats.logicalBytes;
+    obj["unique_bytes"] = stats.uniqueBytes;
+    obj["stored_bytes"] = stats.storedBytes;
+
+    QSaveFile f(directory_ + "/statistics.json");
+    return f.open(QIODevice::WriteOnly) && f.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) >= 0 && f.commit();
+}
+
+ChunkStore::Statistics ChunkStore::savedStatistics() const
+{
+    Statistics stats;
+    QFile f(directory_ + "/statistics.json");
+    if (!f.open(QIODevice::ReadOnly)) {
+        return stats;
+    }
+    const QJsonObject obj = QJsonDocument::fromJson(f.readAll()).object();
+    stats.images = obj["images"].toInt();
+    stats.logicalBytes = obj["logical_bytes"].toInteger();
+    stats.uniqueBytes = obj["unique_bytes"].toInteger();
+    stats.storedBytes = obj["stored_bytes"].toInteger();
+    return stats;
+}
+
+ChunkStore::Importer::Importer(ChunkStore &store)
+    : store_(store)
+    , cctx_(ZSTD_createCCtx())
+    , imageHash_(OSLIST_HASH_ALGORITHM)
+    , newChunkBytes_(0)
+{
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, IMAGEWRITER_CHUNK_STORE_ZSTD_LEVEL);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_checksumFlag, 1);
+    pending_.reserve(2 * MaxChunkSize);
+}
+
+ChunkStore::Importer::~Importer()
+{
+    ZSTD_freeCCtx(cctx_);
+}
+
+bool ChunkStore::Importer::write(const char *data, size_t len)
+{
+    imageHash_.addData(QByteArrayView(data, static_cast<qsizetype>(len)));
+    pending_.append(data, static_cast<qsizetype>(len));
+    recipe_.size += static_cast<qint64>(len);
+
+    // Boundaries are only looked for once a whole chunk's worth of data is
+    // available, so they do not depend on how the image is fed in
+    return pending_.size() < static_cast<qsizetype>(MaxChunkSize) || storeChunks(false);
+}
+
+bool ChunkStore::Importer::storeChunks(bool final)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(pending_.constData());
+    const size_t size = static_cast<size_t>(pending_.size());
+    size_t pos = 0;
+    std::unique_ptr<char[]> compressed;
+    size_t compressedCapacity = 0;
+
+    while (pos < size && (final || size - pos >= MaxChunkSize)) {
+        const size_t len = cutPoint(data + pos, size - pos);
+        const QByteArrayView chunkData(pending_.constData() + pos, static_cast<qsizetype>(len));
+
+        Chunk chunk;
+        chunk.hash = QCryptographicHash::hash(chunkData, OSLIST_HASH_ALGORITHM).toHex();
+        chunk.length = static_cast<quint32>(len);
+
+        const QString path = store_.chunkPath(chunk.hash);
+        if (!QFile::exists(path)) {
+            if (!compressed) {
+                compressedCapacity = ZSTD_compressBound(MaxChunkSize);
+                compressed = std::make_unique<char[]>(compressedCapacity);
+            }
+            size_t clen = ZSTD_compress2(cctx_, compressed.get(), compressedCapacity, chunkData.data(), len);
+            if (ZSTD_isError(clen)) {
+                error_ = QString("Cannot compress chunk: %1").arg(ZSTD_getErrorName(clen));
+                return false;
+            }
+            QDir().mkpath(QFileInfo(path).path());
+            if (!writeFileAtomically(path, compressed.get(), static_cast<qint64>(clen))) {
+                error_ = QString("Cannot write chunk %1").arg(path);
+                return false;
+            }
+            newChunkBytes_ += static_cast<qint64>(len);
+        }
+
+        recipe_.chunks.push_back(chunk);
+        pos += len;
+    }
+
+    pending_.remove(0, static_cast<qsizetype>(pos));
+    return true;
+}
+
+bool ChunkStore::Importer::finish(const QByteArray &imageHash)
+{
+    if (!storeChunks(true)) {
+        return false;
+    }
+
+    recipe_.imageHash = imageHash_.result().toHex();
+    if (recipe_.imageHash != imageHash) {
+        error_ = QString("Image does not match its hash (%1, expected %2)")
+                     .arg(QString::fromLatin1(recipe_.imageHash), QString::fromLatin1(imageHash));
+        return false;
+    }
+
+    QJsonArray chunks;
+    for (const Chunk &chunk : recipe_.chunks) {
+        chunks.append(QJsonArray{QString::fromLatin1(chunk.hash), static_cast<qint64>(chunk.length)});
+    }
+    QJsonObject obj;
+    obj["sha256"] = QString::fromLatin1(recipe_.imageHash);
+    obj["size"] = recipe_.size;
+    obj["chunks"] = chunks;
+
+    // Written last: the recipe is what makes the image available
+    const QString path = store_.recipePath(recipe_.imageHash);
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) < 0 || !f.commit()) {
+        error_ = QString("Cannot write recipe %1").arg(path);
+        return false;
+    }
+
+    qDebug() << "Chunk store: imported" << recipe_.imageHash << recipe_.chunks.size() << "chunks,"
+             << recipe_.size / (1024 * 1024) << "MB image," << newChunkBytes_ / (1024 * 1024) << "MB new";
+    return true;
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <zstd.h>
+
+/**
+ * @brief Deduplicating store of decompressed images, split into content-defined chunks
+ *
+ * Image variants (lite/desktop/full, arm64/armhf, monthly releases) share most
+ * of their content, but rarely at the same offsets. Chunk boundaries are
+ * therefore chosen by a gear rolling hash over the data itself (normalised
+ * chunking as in FastCDC), so content inserted or removed in one variant only
+ * changes the chunks around it.
+ *
+ * Layout of the store directory:
+ * - chunks/ab/abcdef...: one chunk, named by the SHA256 of its data and
+ *   stored as a single zstd frame with a content checksum
+ * - recipes/<image sha256>.json: the image as a list of chunks
+ *
+ * Chunks are only ever added, and recipes are written last, so a store
+ * interrupted while importing never references missing chunks. Chunks of an
+ * image that was not finished are left behind and reused by the next import.
+ */
+class ChunkStore
+{
+public:
+    struct Chunk {
+        QByteArray hash;            // Hex SHA256 of the uncompressed chunk
+        quint32 length = 0;
+    };
+
+    struct Recipe {
+        QByteArray imageHash;       // Hex SHA256 of the whole image (extract_sha256)
+        qint64 size = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    struct Statistics {
+        int images = 0;
+        qint64 logicalBytes = 0;    // Sum of the image sizes
+        qint64 uniqueBytes = 0;     // Sum of the distinct chunks, uncompressed
+        qint64 storedBytes = 0;     // Size of the chunk files on disk
+
+        // How many times more image data the store serves than it holds
+        double dedupRatio() const { return storedBytes ? double(logicalBytes) / storedBytes : 0.0; }
+    };
+
+    /**
+     * @brief Splits an image into chunks as it streams past, and adds it to the store
+     *
+     * Not thread-safe; feed it from one thread. Importing the same image, or
+     * importing from several processes at once, is safe: chunk files and the
+     * recipe are written under temporary names and renamed into place.
+     */
+    class Importer
+    {
+    public:
+        explicit Importer(ChunkStore &store);
+        ~Importer();
+        Importer(const Importer &) = delete;
+        Importer &operator=(const Importer &) = delete;
+
+        // Next part of the decompressed image. False on error
+        bool write(const char *data, size_t len);
+
+        // Store the last chunk and the recipe, if the image matches imageHash
+        bool finish(const QByteArray &imageHash);
+
+        const QString &errorString() const { return error_; }
+        qint64 newChunkBytes() const { return newChunkBytes_; }    // Uncompressed data not already in the store
+
+    private:
+        bool storeChunks(bool final);
+
+        ChunkStore &store_;
+        ZSTD_CCtx *cctx_;
+        QByteArray pending_;
+        QCryptographicHash imageHash_;
+        Recipe recipe_;
+        qint64 newChunkBytes_;
+        QString error_;
+    };
+
+    explicit ChunkStore(const QString &directory);
+
+    const QString &directory() const { return directory_; }
+
+    bool contains(const QByteArray &imageHash) const;
+    QString recipePath(const QByteArray &imageHash) const;
+
+    // Reads the recipe of an image. False if there is none, or it cannot be parsed
+    static bool readRecipe(const QString &recipePath, Recipe &recipe);
+
+    // Decompresses a chunk into out, which must hold chunk.length bytes
+    bool readChunk(const Chunk &chunk, char *out) const;
+
+    // Walks all recipes and chunk files; takes a while on large stores
+    Statistics statistics() const;
+
+    // Figures saved by the last import, for readers that cannot afford statistics().
+    // All zero if there are none
+    bool saveStatistics(const Statistics &stats) const;
+    Statistics savedStatistics() const;
+
+    // Length of the first chunk of data. Only final if len is at least
+    // MaxChunkSize, or data is the rest of the image
+    static size_t cutPoint(const uint8_t *data, size_t len);
+
+    static constexpr size_t MinChunkSize = 64 * 1024;
+    static constexpr size_t AvgChunkSize = 256 * 1024;
+    static constexpr size_t MaxChunkSize = 1024 * 1024;
+
+private:
+    QString chunkPath(const QByteArray &hash) const;
+
+    QString directory_;
+};
+
+#endif // CHUNKSTORE_H
@@ -0,0 +1,162 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "chunkstoreextractthread.h"
+#include "config.h"
+#include "perfcounters.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QFuture>
+#include <QThreadPool>
+#include <QUrl>
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <cstring>
+#include <deque>
+
+ChunkStoreExtractThread::ChunkStoreExtractThread(const QByteArray &url, const QByteArray &dst, const QByteArray &expectedHash, QObject *parent)
+    : LocalFileExtractThread(url, dst, expectedHash, parent)
+{
+}
+
+void ChunkStoreExtractThread::run()
+{
+    if (!_startDevicePreparation())
+        return;
+
+    emit preparationStatusUpdate(tr("Opening image file..."));
+    _timer.start();
+
+    // The recipe lives in <store>/recipes
+    const QString recipePath = QUrl(_url).toLocalFile();
+    ChunkStore::Recipe recipe;
+    if (!ChunkStore::readRecipe(recipePath, recipe))
+    {
+        _onDownloadError(tr("Error opening image file"));
+        _closeFiles();
+        return;
+    }
+    const ChunkStore store(QDir::cleanPath(QFileInfo(recipePath).absolutePath() + "/.."));
+    _lastDlTotal = recipe.size;
+    _startWatchdog();
+
+    emit preparationStatusUpdate(tr("Starting extraction..."));
+    extractChunksRun(store, recipe);
+
+    if (_cancelled)
+        _closeFiles();
+
+    _waitForDevice();
+    _stopWatchdog();
+}
+
+void ChunkStoreExtractThread::extractChunksRun(const ChunkStore &store, const ChunkStore::Recipe &recipe)
+{
+    /* Nothing to download; reading the store is this path's download stage */
+    PerfCounters::Scope scope(PerfCounters::Stage::Download);
+    qDebug() << "Writing image from the chunk store:" << recipe.chunks.size() << "chunks";
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+    std::deque<QFuture<QByteArray>> readahead;
+    size_t next = 0;
+
+    // An empty result is a chunk that could not be read
+    auto fillReadahead = [&]() {
+        while (next < recipe.chunks.size() && readahead.size() < IMAGEWRITER_CHUNK_STORE_READAHEAD)
+        {
+            const ChunkStore::Chunk chunk = recipe.chunks[next++];
+            readahead.push_back(QtConcurrent::run(&pool, [&store, chunk]() {
+                QByteArray data(chunk.length, Qt::Uninitialized);
+                if (!store.readChunk(chunk, data.data()))
+                    data.clear();
+                return data;
+            }));
+        }
+    };
+
+    QElapsedTimer elapsed, waitTimer;
+    elapsed.start();
+    qint64 waitedMs = 0;
+    qint64 bytesRead = 0;
+    size_t filled = 0;
+    bool failed = false;
+
+    fillReadahead();
+    while (!readahead.empty() && !_cancelled && !failed)
+    {
+        waitTimer.start();
+        const QByteArray data = readahead.front().result();
+        waitedMs += waitTimer.elapsed();
+        readahead.pop_front();
+        fillReadahead();
+
+        if (data.isEmpty())
+        {
+            _onDownloadError(tr("Error reading from image file"));
+            failed = true;
+            break;
+        }
+
+        // Chunks have arbitrary lengths; the writer gets whole aligned buffers
+        qsizetype offset = 0;
+        while (offset < data.size())
+        {
+            size_t len = qMin(_inputBufSize - filled, static_cast<size_t>(data.size() - offset));
+            memcpy(_inputBuf + filled, data.constData() + offset, len);
+            filled += len;
+            offset += len;
+
+            if (filled == _inputBufSize)
+            {
+                if (_writeFile(_inputBuf, filled) != filled)
+                {
+                    _onDownloadError(tr("Error writing to device"));
+                    failed = true;
+                    break;
+                }
+                filled = 0;
+            }
+        }
+
+        bytesRead += data.size();
+        _lastDlNow = bytesRead;
+        _emitProgressUpdate();
+    }
+
+    if (!failed && !_cancelled && filled && _writeFile(_inputBuf, filled) != filled)
+    {
+        _onDownloadError(tr("Error writing to device"));
+        failed = true;
+    }
+
+    // Reads still in flight use the store and recipe
+    for (auto &future : readahead)
+        future.waitForFinished();
+
+    if (failed || _cancelled)
+        return;
+
+    if (bytesRead != recipe.size)
+    {
+        _onDownloadError(tr("Failed to read complete image file"));
+        return;
+    }
+
+    // As of the last import; walking the store here would hold up the end of the write
+    const ChunkStore::Statistics stats = store.savedStatistics();
+    const quint32 durationMs = static_cast<quint32>(elapsed.elapsed());
+    qDebug() << "Chunk store image written:" << bytesRead / (1024 * 1024) << "MB in" << durationMs << "ms,"
+             << "waited" << waitedMs << "ms for chunks, dedup ratio" << stats.dedupRatio();
+    emit eventChunkStoreRead(durationMs, static_cast<quint64>(bytesRead),
+        QString("chunks: %1; readahead: %2; waited: %3 ms; store: %4 images, %5 MB in %6 MB; dedup_ratio: %7")
+            .arg(recipe.chunks.size()).arg(IMAGEWRITER_CHUNK_STORE_READAHEAD).arg(waitedMs)
+            .arg(stats.images).arg(stats.logicalBytes / (1024 * 1024)).arg(stats.storedBytes / (1024 * 1024))
+            .arg(stats.dedupRatio(), 0, 'f', 2));
+
+    _writeComplete();
+}
@@ -0,0 +1,35 @@
+#ifndef CHUNKSTOREEXTRACTTHREAD_H
+#define CHUNKSTOREEXTRACTTHREAD_H
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "localfileextractthread.h"
+#include "chunkstore.h"
+
+/**
+ * @brief Writes an image from the chunk store
+ *
+ * The url is the image's recipe in the store. Chunks are read and
+ * decompressed IMAGEWRITER_CHUNK_STORE_READAHEAD ahead of the device on a
+ * thread pool, and handed to the raw write path in order, so the device is
+ * the only thing the write waits for as long as the store keeps up.
+ */
+class ChunkStoreExtractThread : public LocalFileExtractThread
+{
+    Q_OBJECT
+public:
+    explicit ChunkStoreExtractThread(const QByteArray &url, const QByteArray &dst = "", const QByteArray &expectedHash = "", QObject *parent = nullptr);
+
+signals:
+    // Whole image read from the store: time, bytes, readahead stalls and dedup ratio
+    void eventChunkStoreRead(quint32 durationMs, quint64 bytes, QString metadata);
+
+protected:
+    virtual void run();
+    void extractChunksRun(const ChunkStore &store, const ChunkStore::Recipe &recipe);
+};
+
+#endif // CHUNKSTOREEXTRACTTHREAD_H
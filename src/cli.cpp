@@ -5,21 +5,36 @@
 
 #include "cli.h"
 #include "imagewriter.h"
+#include "customization_template.h"
 #include <iostream>
 #include <QCoreApplication>
 #include <QCommandLineParser>
+#include <QDir>
 #include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
 #include "drivelistmodel.h"
 #include "dependencies/drivelist/src/drivelist.hpp"
 #include "imageadvancedoptions.h"
+#include "io_latency.h"
+#include "perfcompare.h"
+#include "imagepublisher.h"
+#include "performancestats.h"
 #include "platformquirks.h"
+#include "simulated_file_operations.h"
 
 /* Message handler to discard qDebug() output if using cli (unless --debug is set) */
 static void devnullMsgHandler(QtMsgType, const QMessageLogContext &, const QString &)
 {
 }
 
-Cli::Cli(int &argc, char *argv[]) : QObject(nullptr), _imageWriter(nullptr)
+Cli::Cli(int &argc, char *argv[]) : QObject(nullptr), _imageWriter(nullptr),
+    _batchNext(0), _batchAllowSystemDrives(false), _batchFinished(false), _advancedOptions(ImageOptions::NoAdvancedOptions)
 {
     /* Attach to console for output (Windows-specific, no-op on other platforms) */
     PlatformQuirks::attachConsole();
@@ -33,6 +48,12 @@ Cli::Cli(int &argc, char *argv[]) : QObject(nullptr), _imageWriter(nullptr)
 
 Cli::~Cli()
 {
+    _batchPregenerator.reset();
+    /* Additional --jobs workers, the first one is _imageWriter */
+    for (size_t i = 1; i < _batchWorkers.size(); i++)
+    {
+        delete _batchWorkers[i];
+    }
     delete _imageWriter;
     delete _app;
 }
@@ -54,18 +75,78 @@ int Cli::run()
         {"cloudinit-userdata", "Add cloud-init user-data file to image", "cloudinit-userdata", ""},
         {"cloudinit-networkconfig", "Add cloud-init network-config file to image", "cloudinit-networkconfig", ""},
         {"disable-eject", "Disable automatic ejection of storage media after verification"},
+        {"skip-if-identical", "Skip writing if the storage media already holds this image and customisation (needs an expected hash). Also stamps the media for next time"},
         {"debug", "Output debug messages to console"},
         {"quiet", "Only write to console on error"},
         {"log-file", "Log output to file (for debugging)", "path", ""},
         {"secure-boot-key", "Path to RSA private key (PEM format) for secure boot signing", "key-file", ""},
+        {"simulate-device", "Write to a simulated SD card described by a JSON profile instead of real storage. dst is then its backing file (or :memory:)", "profile.json", ""},
+        {"perf-export", "Write performance data to a JSON file when done", "path", ""},
+        {"perf-compare", "Compare performance data instead of writing: src is the base and dst the candidate export (or directories of exports). Exits with 2 on a regression"},
+        {"perf-threshold", "Regression threshold for --perf-compare in percent (default 5)", "percent", "5"},
+        {"publish", "Package src, a raw image, for publishing instead of writing: dst is the output directory. Writes seekable zstd (or multi-block xz), a bmap, a chunk hash manifest and the OS list entry"},
+        {"publish-compression", "Compression for --publish: zstd (default) or xz", "format", "zstd"},
+        {"publish-level", "Compression level for --publish (default 19 for zstd, preset 6 for xz)", "level", ""},
+        {"publish-url", "URL the --publish output directory will be served from, for the OS list entry", "url", ""},
+        {"jobs", "Write the jobs listed in a JSON manifest instead of src to dst. With --perf-export, path is a directory receiving one export per write", "manifest.json", ""},
+        {"jobs-report", "Write the JSON report of --jobs to a file instead of stdout", "path", ""},
     });
 
     parser.addPositionalArgument("src", "Image file/URL");
     parser.addPositionalArgument("dst", "Destination device");
     parser.process(*_app);
 
+    if (parser.isSet("perf-compare"))
+    {
+        const QStringList args = parser.positionalArguments();
+        bool ok;
+        double threshold = parser.value("perf-threshold").toDouble(&ok);
+        if (args.count() != 2 || !ok || threshold < 0)
+        {
+            std::cerr << parser.helpText().toStdString() << std::endl;
+            return 1;
+        }
+        if (!parser.isSet("debug"))
+        {
+            qInstallMessageHandler(devnullMsgHandler);
+        }
+
+        QTextStream out(stdout), err(stderr);
+        return PerfCompare::compare(args[0], args[1], threshold, out, err);
+    }
+
+    if (parser.isSet("publish"))
+    {
+        const QStringList args = parser.positionalArguments();
+        const QString compression = parser.value("publish-compression");
+        ImagePublisher::Options options;
+        options.compression = compression == "xz" ? ImagePublisher::Compression::Xz : ImagePublisher::Compression::Zstd;
+        options.baseUrl = parser.value("publish-url");
+        bool ok = true;
+        if (!parser.value("publish-level").isEmpty())
+            options.level = parser.value("publish-level").toInt(&ok);
+        if (args.count() != 2 || !ok || options.level < 0 || (compression != "zstd" && compression != "xz"))
+        {
+            std::cerr << parser.helpText().toStdString() << std::endl;
+            return 1;
+        }
+        if (!parser.isSet("debug"))
+        {
+            qInstallMessageHandler(devnullMsgHandler);
+        }
+
+        QTextStream out(stdout), err(stderr);
+        return ImagePublisher::publish(args[0], args[1], options, out, err);
+    }
+
+    const bool simulated = !parser.value("simulate-device").isEmpty();
+    if (simulated && !_setupSimulatedDevice(parser.value("simulate-device")))
+    {
+        return 1;
+    }
+
     // Check for elevated privileges on platforms that require them (Linux/Windows)
-    if (!PlatformQuirks::hasElevatedPrivileges())
+    if (!simulated && !PlatformQuirks::hasElevatedPrivileges())
     {
         // Common error message
         const char* commonMsg = "Writing to storage devices requires elevated privileges.";
@@ -92,6 +173,10 @@ int Cli::run()
         return 1;
     }
 
+    if (parser.isSet("jobs"))
+    {
+        return _runJobs(parser);
+    }
 
     const QStringList args = parser.positionalArguments();
     if (args.count() != 2)
@@ -113,34 +198,14 @@ int Cli::run()
         qInstallMessageHandler(devnullMsgHandler);
     }
     _quiet = parser.isSet("quiet");
+    _perfExportPath = parser.value("perf-export");
     QByteArray initFormat = (parser.value("cloudinit-userdata").isEmpty()
                              && parser.value("cloudinit-networkconfig").isEmpty() ) ? "systemd" : "cloudinit";
     
     // Handle secure boot key if provided
-    ImageOptions::AdvancedOptions advancedOptions = ImageOptions::NoAdvancedOptions;
-    if (!parser.value("secure-boot-key").isEmpty())
+    if (!parser.value("secure-boot-key").isEmpty() && !_setupSecureBootKey(parser.value("secure-boot-key")))
     {
-        QString keyPath = parser.value("secure-boot-key");
-        QFileInfo keyFile(keyPath);
-        if (!keyFile.exists())
-        {
-            std::cerr << "Error: secure boot key file does not exist: " << keyPath.toStdString() << std::endl;
-            return 1;
-        }
-        if (!keyFile.isFile())
-        {
-            std::cerr << "Error: secure boot key path is not a regular file: " << keyPath.toStdString() << std::endl;
-            return 1;
-        }
-        
-        // Store key path in settings for ImageWriter to access
-        _imageWriter->setSetting("secureboot_rsa_key", keyPath);
-        advancedOptions = ImageOptions::EnableSecureBoot;
-        
-        if (!_quiet)
-        {
-            std::cerr << "Secure boot signing enabled with key: " << keyPath.toStdString() << std::endl;
-        }
+        return 1;
     }
 
     if (args[0].startsWith("http:", Qt::CaseInsensitive) || args[0].startsWith("https:", Qt::CaseInsensitive))
@@ -172,7 +237,11 @@ int Cli::run()
         }
     }
 
-    if (parser.isSet("enable-writing-system-drives"))
+    if (simulated)
+    {
+        // Nothing real is written to
+    }
+    else if (parser.isSet("enable-writing-system-drives"))
     {
         std::cerr << "WARNING: writing to system drives is enabled." << std::endl;
     }
@@ -254,7 +323,7 @@ int Cli::run()
             }
         }
 
-        _imageWriter->setImageCustomisation("", "", "", userData, networkConfig, advancedOptions);
+        _imageWriter->setImageCustomisation("", "", "", userData, networkConfig, _advancedOptions);
     }
     else if (!parser.value("first-run-script").isEmpty())
     {
@@ -276,43 +345,741 @@ int Cli::run()
             return 1;
         }
 
-        _imageWriter->setImageCustomisation("", "", firstRunScript, "", "", ImageOptions::UserDefinedFirstRun | advancedOptions);
+        _imageWriter->setImageCustomisation("", "", firstRunScript, "", "", ImageOptions::UserDefinedFirstRun | _advancedOptions);
     }
-    else if (advancedOptions != ImageOptions::NoAdvancedOptions)
+    else if (_advancedOptions != ImageOptions::NoAdvancedOptions)
     {
         // Secure boot key provided without customization scripts
-        _imageWriter->setImageCustomisation("", "", "", "", "", advancedOptions);
+        _imageWriter->setImageCustomisation("", "", "", "", "", _advancedOptions);
     }
 
-    _imageWriter->setDst(args[1]);
+    _imageWriter->setDst(args[1], simulated ? _simulatedCard->Profile().capacity : 0);
     _imageWriter->setVerifyEnabled(!parser.isSet("disable-verify"));
-    _imageWriter->setSetting("eject", !parser.isSet("disable-eject"));
+    _imageWriter->setSetting("eject", !simulated && !parser.isSet("disable-eject"));
+    _imageWriter->setSetting("skipIfIdentical", parser.isSet("skip-if-identical"));
 
     /* Run startWrite() in event loop (otherwise calling _app->exit() on error does not work) */
     QTimer::singleShot(1, _imageWriter, &ImageWriter::startWrite);
     return _app->exec();
 }
 
+bool Cli::_setupSecureBootKey(const QString &keyPath)
+{
+    QFileInfo keyFile(keyPath);
+    if (!keyFile.exists())
+    {
+        std::cerr << "Error: secure boot key file does not exist: " << keyPath.toStdString() << std::endl;
+        return false;
+    }
+    if (!keyFile.isFile())
+    {
+        std::cerr << "Error: secure boot key path is not a regular file: " << keyPath.toStdString() << std::endl;
+        return false;
+    }
+
+    // Store key path in settings for ImageWriter to access
+    _imageWriter->setSetting("secureboot_rsa_key", keyPath);
+    _advancedOptions = ImageOptions::EnableSecureBoot;
+
+    if (!_quiet)
+    {
+        std::cerr << "Secure boot signing enabled with key: " << keyPath.toStdString() << std::endl;
+    }
+    return true;
+}
+
+void Cli::_exportPerformanceData()
+{
+    if (!_perfExportPath.isEmpty() && !_imageWriter->performanceStats()->exportToFile(_perfExportPath))
+    {
+        std::cerr << "Error: writing performance data to " << _perfExportPath.toStdString() << std::endl;
+    }
+}
+
 void Cli::onSuccess()
 {
+    _exportPerformanceData();
     if (!_quiet)
     {
         _clearLine();
         std::cerr << "Write successful." << std::endl;
+
+        if (_simulatedCard)
+        {
+            rpi_imager::SimulatedDeviceStats stats = _simulatedCard->Stats();
+            std::cerr << "Simulated device time: " << stats.simulated_ns / 1000000 << " ms ("
+                      << stats.bytes_written << " bytes in " << stats.writes << " writes, "
+                      << stats.bytes_read << " bytes in " << stats.reads << " reads, "
+                      << stats.syncs << " syncs, " << stats.misaligned_writes << " misaligned writes, "
+                      << stats.au_switches << " allocation unit switches, "
+                      << stats.post_slc_bytes << " bytes after SLC cache exhaustion)" << std::endl;
+        }
     }
     _app->exit(0);
 }
 
+bool Cli::_setupSimulatedDevice(const QString &profileFile)
+{
+    QFile f(profileFile);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        std::cerr << "Error: opening simulated device profile " << profileFile.toStdString() << std::endl;
+        return false;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &parseError);
+    if (!doc.isObject())
+    {
+        std::cerr << "Error: simulated device profile is not a JSON object: " << parseError.errorString().toStdString() << std::endl;
+        return false;
+    }
+
+    /* Keys missing from the profile keep their defaults */
+    const QJsonObject o = doc.object();
+    rpi_imager::SimulatedDeviceProfile p;
+    auto readDouble = [&o](const char *key, double &value) {
+        if (o.contains(key))
+            value = o.value(key).toDouble(value);
+    };
+    auto readSize = [&o](const char *key, std::uint64_t &value) {
+        if (o.contains(key))
+            value = static_cast<std::uint64_t>(o.value(key).toDouble(static_cast<double>(value)));
+    };
+
+    p.name = o.value("name").toString(QString::fromStdString(p.name)).toStdString();
+    readSize("capacity", p.capacity);
+    readDouble("sequential_write_mbps", p.sequential_write_mbps);
+    readDouble("random_write_mbps", p.random_write_mbps);
+    readDouble("read_mbps", p.read_mbps);
+    readDouble("read_after_write_mbps", p.read_after_write_mbps);
+    readDouble("read_after_write_window_ms", p.read_after_write_window_ms);
+    readDouble("latency_median_us", p.latency_median_us);
+    readDouble("latency_p99_us", p.latency_p99_us);
+    readDouble("sync_latency_us", p.sync_latency_us);
+    readSize("page_size", p.page_size);
+    readDouble("misaligned_penalty_us", p.misaligned_penalty_us);
+    readSize("allocation_unit", p.allocation_unit);
+    readDouble("au_switch_penalty_us", p.au_switch_penalty_us);
+    readSize("slc_cache_bytes", p.slc_cache_bytes);
+    readDouble("post_slc_write_mbps", p.post_slc_write_mbps);
+    readSize("fail_write_offset", p.fail_write_offset);
+    readSize("fail_read_offset", p.fail_read_offset);
+    readDouble("write_error_rate", p.write_error_rate);
+    readDouble("read_error_rate", p.read_error_rate);
+    p.fail_sync = o.value("fail_sync").toBool(p.fail_sync);
+    readSize("seed", p.seed);
+    readDouble("time_scale", p.time_scale);
+
+    if (!p.capacity || p.capacity % 512)
+    {
+        std::cerr << "Error: simulated device capacity must be a non-zero multiple of 512 bytes" << std::endl;
+        return false;
+    }
+
+    _simulatedCard = std::make_shared<rpi_imager::SimulatedCard>(p);
+    std::shared_ptr<rpi_imager::SimulatedCard> card = _simulatedCard;
+    rpi_imager::SetFileOperationsFactory([card]() -> std::unique_ptr<rpi_imager::FileOperations> {
+        return std::make_unique<rpi_imager::SimulatedFileOperations>(card);
+    });
+    return true;
+}
+
+int Cli::_runJobs(const QCommandLineParser &parser)
+{
+    if (!parser.positionalArguments().isEmpty())
+    {
+        std::cerr << "Error: --jobs takes its sources and destinations from the manifest, not the command line" << std::endl;
+        return 1;
+    }
+
+    if (!parser.isSet("debug"))
+    {
+        qInstallMessageHandler(devnullMsgHandler);
+    }
+    _quiet = parser.isSet("quiet");
+    _perfExportPath = parser.value("perf-export");
+    _batchReportPath = parser.value("jobs-report");
+    _batchAllowSystemDrives = _simulatedCard || parser.isSet("enable-writing-system-drives");
+
+    int concurrency = 1;
+    if (!_loadJobs(parser.value("jobs"), parser, concurrency))
+    {
+        return 1;
+    }
+    if (_simulatedCard && concurrency > 1)
+    {
+        std::cerr << "Error: a simulated device can only be written by one job at a time (concurrency 1)" << std::endl;
+        return 1;
+    }
+    if (!_perfExportPath.isEmpty() && !QDir().mkpath(_perfExportPath))
+    {
+        std::cerr << "Error: creating performance data directory " << _perfExportPath.toStdString() << std::endl;
+        return 1;
+    }
+
+    _imageWriter = new ImageWriter;
+    if (!parser.value("secure-boot-key").isEmpty() && !_setupSecureBootKey(parser.value("secure-boot-key")))
+    {
+        return 1;
+    }
+
+    if (_simulatedCard)
+    {
+        // Nothing real is written to
+    }
+    else if (_batchAllowSystemDrives)
+    {
+        std::cerr << "WARNING: writing to system drives is enabled." << std::endl;
+    }
+    else
+    {
+        /* Listed once, destinations that are not removable fail on their own */
+        DriveListModel dlm;
+        dlm.processDriveList(Drivelist::ListStorageDevices() );
+        int numDrives = dlm.rowCount( QModelIndex() );
+
+        for (int i = 0; i < numDrives; i++)
+        {
+            _batchRemovableDrives.insert(dlm.index(i, 0).data(dlm.deviceRole).toString());
+        }
+    }
+
+    concurrency = qMin(concurrency, static_cast<int>(_batchWrites.size()));
+    for (int i = 0; i < concurrency; i++)
+    {
+        ImageWriter *writer = _imageWriter;
+        if (i)
+        {
+            writer = new ImageWriter;
+            /* Writes from the cache while the first writer leaves it alone, downloads otherwise */
+            writer->setCacheReadOnly(true);
+        }
+        connect(writer, &ImageWriter::success, this, [this, i]() {
+            _finishBatchWrite(i, true, QString());
+        });
+        connect(writer, &ImageWriter::error, this, [this, i](QVariant msg) {
+            _finishBatchWrite(i, false, msg.toString());
+        });
+        connect(writer, &ImageWriter::cancelled, this, [this, i]() {
+            _finishBatchWrite(i, false, "Write cancelled");
+        });
+        connect(writer, &ImageWriter::writeCancelledDueToDeviceRemoval, this, [this, i]() {
+            _finishBatchWrite(i, false, "Storage device removed");
+        });
+
+        /* Progress bars only make sense for one write at a time */
+        if (concurrency == 1)
+        {
+            connect(writer, &ImageWriter::preparationStatusUpdate, this, &Cli::onPreparationStatusUpdate);
+            connect(writer, &ImageWriter::downloadProgress, this, &Cli::onDownloadProgress);
+            connect(writer, &ImageWriter::verifyProgress, this, &Cli::onVerifyProgress);
+        }
+
+        _batchWorkers.push_back(writer);
+        _batchWorkerWrite.push_back(-1);
+    }
+
+    _batchPregenerator->start();
+    _batchTimer.start();
+    for (int i = 0; i < concurrency; i++)
+    {
+        /* Run in event loop, like startWrite() for a single image */
+        QTimer::singleShot(1, this, [this, i]() { _startNextBatchWrite(i); });
+    }
+    return _app->exec();
+}
+
+bool Cli::_loadJobs(const QString &manifestFile, const QCommandLineParser &parser, int &concurrency)
+{
+    QFile f(manifestFile);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        std::cerr << "Error: opening job manifest " << manifestFile.toStdString() << std::endl;
+        return false;
+    }
+
+    /* Either an array of jobs, or an object with the jobs and options for the whole batch */
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &parseError);
+    QJsonArray jobs;
+    int pregenerate = QThread::idealThreadCount();
+    if (doc.isArray())
+    {
+        jobs = doc.array();
+    }
+    else if (doc.isObject())
+    {
+        jobs = doc.object().value("jobs").toArray();
+        concurrency = doc.object().value("concurrency").toInt(1);
+        pregenerate = doc.object().value("pregenerate").toInt(pregenerate);
+    }
+    else
+    {
+        std::cerr << "Error: job manifest is not valid JSON: " << parseError.errorString().toStdString() << std::endl;
+        return false;
+    }
+
+    if (jobs.isEmpty())
+    {
+        std::cerr << "Error: job manifest does not list any jobs" << std::endl;
+        return false;
+    }
+    if (concurrency < 1)
+    {
+        std::cerr << "Error: job manifest concurrency must be at least 1" << std::endl;
+        return false;
+    }
+    if (pregenerate < 1)
+    {
+        std::cerr << "Error: job manifest pregenerate must be at least 1" << std::endl;
+        return false;
+    }
+    _batchPregenerator = std::make_unique<rpi_imager::CustomisationPregenerator>(pregenerate);
+
+    /* Relative paths in the manifest are relative to the manifest itself */
+    const QDir manifestDir = QFileInfo(manifestFile).absoluteDir();
+
+    for (qsizetype i = 0; i < jobs.count(); i++)
+    {
+        const QJsonObject o = jobs.at(i).toObject();
+        BatchJob job;
+        job.name = o.value("name").toString(QString("job %1").arg(i + 1));
+        job.source = o.value("source").toString();
+        job.sha256 = o.value("sha256").toString().toLatin1();
+        job.verify = o.value("verify").toBool(!parser.isSet("disable-verify"));
+        job.eject = o.value("eject").toBool(!_simulatedCard && !parser.isSet("disable-eject"));
+        job.skipIfIdentical = o.value("skip_if_identical").toBool(parser.isSet("skip-if-identical"));
+
+        if (o.value("destination").isString())
+        {
+            job.destinations.append(o.value("destination").toString());
+        }
+        for (const QJsonValue &v : o.value("destinations").toArray())
+        {
+            job.destinations.append(v.toString());
+        }
+
+        /* A templated job is written once per row of its variables, which may name the destinations */
+        QList<QVariantMap> rows;
+        if (o.contains("template"))
+        {
+            if (!_loadTemplateJob(o.value("template").toObject(), manifestDir, job, rows))
+            {
+                return false;
+            }
+            if (job.destinations.isEmpty())
+            {
+                for (const QVariantMap &row : rows)
+                    job.destinations.append(row.value("destination").toString());
+            }
+            else if (job.destinations.size() != rows.size())
+            {
+                std::cerr << "Error: " << job.name.toStdString() << " in job manifest lists " << job.destinations.size()
+                          << " destinations for " << rows.size() << " sets of template variables" << std::endl;
+                return false;
+            }
+        }
+
+        if (job.source.isEmpty() || job.destinations.isEmpty() || job.destinations.contains(QString()))
+        {
+            std::cerr << "Error: " << job.name.toStdString() << " in job manifest needs a source and at least one destination" << std::endl;
+            return false;
+        }
+
+        if (!job.source.startsWith("http:", Qt::CaseInsensitive) && !job.source.startsWith("https:", Qt::CaseInsensitive))
+        {
+            job.source = manifestDir.absoluteFilePath(job.source);
+        }
+
+        /* A customisation file that cannot be read only fails its own job */
+        auto readFile = [&](const char *key, const char *description, QByteArray &data) {
+            const QString fileName = o.value(key).toString();
+            if (fileName.isEmpty() || !job.error.isEmpty())
+                return;
+
+            QFile cf(manifestDir.absoluteFilePath(fileName));
+            if (cf.open(QIODevice::ReadOnly))
+                data = cf.readAll();
+            else
+                job.error = QString("Cannot read %1 file %2").arg(description, cf.fileName());
+        };
+        readFile("first_run_script", "firstrun script", job.firstRunScript);
+        readFile("cloudinit_userdata", "user-data", job.cloudinitUserdata);
+        readFile("cloudinit_networkconfig", "network-config", job.cloudinitNetworkConfig);
+        if (job.customisationTemplate)
+            job.initFormat = job.customisationTemplate->isCloudInit() ? "cloudinit" : "systemd";
+        else
+            job.initFormat = (o.value("cloudinit_userdata").toString().isEmpty()
+                              && o.value("cloudinit_networkconfig").toString().isEmpty()) ? "systemd" : "cloudinit";
+
+        for (qsizetype d = 0; d < job.destinations.size(); d++)
+        {
+            BatchWrite w;
+            w.job = static_cast<int>(_batchJobs.size());
+            w.device = job.destinations.at(d);
+            w.ticket = job.customisationTemplate ? _batchPregenerator->enqueue(job.customisationTemplate, rows.at(d)) : -1;
+            w.state = BatchWrite::Pending;
+            w.durationMs = 0;
+            _batchWrites.push_back(w);
+        }
+        _batchJobs.push_back(job);
+    }
+
+    /* Writes running in parallel must not share a device */
+    if (concurrency > 1)
+    {
+        QSet<QString> devices;
+        for (const BatchWrite &w : _batchWrites)
+        {
+            if (devices.contains(w.device))
+            {
+                std::cerr << "Error: " << w.device.toStdString() << " is listed more than once, which needs concurrency 1" << std::endl;
+                return false;
+            }
+            devices.insert(w.device);
+        }
+    }
+
+    return true;
+}
+
+bool Cli::_loadTemplateJob(const QJsonObject &o, const QDir &manifestDir, BatchJob &job, QList<QVariantMap> &rows)
+{
+    const QString variablesFile = o.value("variables").toString();
+    if (variablesFile.isEmpty())
+    {
+        std::cerr << "Error: template of " << job.name.toStdString() << " in job manifest needs a variables file" << std::endl;
+        return false;
+    }
+
+    QString error;
+    if (!rpi_imager::CustomisationTemplate::loadVariables(manifestDir.absoluteFilePath(variablesFile), rows, error))
+    {
+        std::cerr << "Error: " << error.toStdString() << std::endl;
+        return false;
+    }
+    if (rows.isEmpty())
+    {
+        std::cerr << "Error: variables file of " << job.name.toStdString() << " does not list any devices" << std::endl;
+        return false;
+    }
+
+    QByteArray files[3];
+    const char *keys[3] = {"first_run_script", "cloudinit_userdata", "cloudinit_networkconfig"};
+    for (int i = 0; i < 3; i++)
+    {
+        const QString fileName = o.value(keys[i]).toString();
+        if (fileName.isEmpty())
+            continue;
+
+        QFile f(manifestDir.absoluteFilePath(fileName));
+        if (!f.open(QIODevice::ReadOnly))
+        {
+            std::cerr << "Error: cannot read template file " << f.fileName().toStdString() << std::endl;
+            return false;
+        }
+        files[i] = f.readAll();
+    }
+
+    const bool cloudInit = o.value("cloudinit").toBool(!files[1].isEmpty() || !files[2].isEmpty());
+    auto t = std::make_shared<rpi_imager::CustomisationTemplate>(o.value("settings").toObject().toVariantMap(), cloudInit);
+    t->setFirstRunTemplate(files[0]);
+    t->setCloudInitTemplates(files[1], files[2]);
+    t->setCloudInitRpi(o.value("cloudinit_rpi").toBool());
+    t->setYescrypt(o.value("yescrypt").toBool());
+    job.customisationTemplate = t;
+
+    return true;
+}
+
+void Cli::_startNextBatchWrite(int worker)
+{
+    while (_batchNext < _batchWrites.size())
+    {
+        BatchWrite &w = _batchWrites[_batchNext];
+        _batchWorkerWrite[worker] = static_cast<int>(_batchNext++);
+        w.state = BatchWrite::Running;
+        w.timer.start();
+
+        if (_startBatchWrite(worker, w))
+        {
+            return;
+        }
+
+        /* Failed before it got to the ImageWriter, on to the next one */
+        _batchWorkerWrite[worker] = -1;
+        w.state = BatchWrite::Failed;
+        _printBatchResult(w);
+    }
+
+    for (int busy : _batchWorkerWrite)
+    {
+        if (busy != -1)
+            return;
+    }
+    _finishBatch();
+}
+
+bool Cli::_startBatchWrite(int worker, BatchWrite &w)
+{
+    const BatchJob &job = _batchJobs[w.job];
+
+    if (!job.error.isEmpty())
+    {
+        w.error = job.error;
+        return false;
+    }
+
+    if (w.ticket == -1)
+    {
+        return _writeBatchWrite(worker, w, rpi_imager::CustomisationTemplate::Artifacts());
+    }
+
+    /* Normally generated by the time the write gets here. Taken first, so that the pre-generation
+       keeps ahead of the writes even if this one fails */
+    QFuture<rpi_imager::CustomisationTemplate::Artifacts> customisation = _batchPregenerator->take(w.ticket);
+    if (customisation.isFinished())
+    {
+        return _writeBatchWrite(worker, w, customisation.result());
+    }
+
+    /* Still being generated: carry on once it is, while other workers keep reporting progress */
+    const int index = _batchWorkerWrite[worker];
+    auto *watcher = new QFutureWatcher<rpi_imager::CustomisationTemplate::Artifacts>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, worker, index, watcher]() {
+        watcher->deleteLater();
+        BatchWrite &w = _batchWrites[index];
+        if (!_writeBatchWrite(worker, w, watcher->result()))
+        {
+            _batchWorkerWrite[worker] = -1;
+            w.state = BatchWrite::Failed;
+            _printBatchResult(w);
+            _startNextBatchWrite(worker);
+        }
+    });
+    watcher->setFuture(customisation);
+    return true;
+}
+
+bool Cli::_writeBatchWrite(int worker, BatchWrite &w, const rpi_imager::CustomisationTemplate::Artifacts &customisation)
+{
+    const BatchJob &job = _batchJobs[w.job];
+    ImageWriter *writer = _batchWorkers[worker];
+
+    if (!customisation.error.isEmpty())
+    {
+        w.error = customisation.error;
+        return false;
+    }
+    w.sshHostKeyPub = customisation.sshHostKeyPub;
+
+    if (!_batchAllowSystemDrives && !_batchRemovableDrives.contains(w.device))
+    {
+        w.error = "Destination drive is not in list of removable volumes";
+        return false;
+    }
+
+    if (job.source.startsWith("http:", Qt::CaseInsensitive) || job.source.startsWith("https:", Qt::CaseInsensitive))
+    {
+        writer->setSrc(job.source, 0, 0, job.sha256, false, "", "", job.initFormat);
+    }
+    else
+    {
+        QFileInfo fi(job.source);
+
+        if (!fi.isFile())
+        {
+            w.error = fi.exists() ? "Source is not a regular file" : "Source file does not exist";
+            return false;
+        }
+        writer->setSrc(QUrl::fromLocalFile(job.source), fi.size(), 0, job.sha256, false, "", "", job.initFormat);
+    }
+
+    /* The writer is reused, so always replace what the previous job customised */
+    if (job.customisationTemplate)
+    {
+        ImageOptions::AdvancedOptions opts = _advancedOptions;
+        if (job.customisationTemplate->hasLiteralFirstRun())
+            opts |= ImageOptions::UserDefinedFirstRun;
+        writer->setImageCustomisation("", customisation.cmdline, customisation.firstRun,
+                                      customisation.cloudInit, customisation.cloudInitNetwork, opts);
+    }
+    else if (!job.cloudinitUserdata.isEmpty() || !job.cloudinitNetworkConfig.isEmpty())
+    {
+        writer->setImageCustomisation("", "", "", job.cloudinitUserdata, job.cloudinitNetworkConfig, _advancedOptions);
+    }
+    else if (!job.firstRunScript.isEmpty())
+    {
+        writer->setImageCustomisation("", "", job.firstRunScript, "", "", ImageOptions::UserDefinedFirstRun | _advancedOptions);
+    }
+    else
+    {
+        writer->setImageCustomisation("", "", "", "", "", _advancedOptions);
+    }
+
+    writer->setDst(w.device, _simulatedCard ? _simulatedCard->Profile().capacity : 0);
+    writer->setVerifyEnabled(job.verify);
+    /* Only for this writer, as other jobs may be writing in parallel */
+    writer->setWriteOverride("eject", job.eject);
+    writer->setWriteOverride("skipIfIdentical", job.skipIfIdentical);
+
+    if (!_quiet)
+    {
+        _clearLine();
+        std::cerr << job.name.toStdString() << ": writing " << job.source.toStdString()
+                  << " to " << w.device.toStdString() << std::endl;
+    }
+
+    QTimer::singleShot(1, writer, &ImageWriter::startWrite);
+    return true;
+}
+
+void Cli::_finishBatchWrite(int worker, bool success, const QString &error)
+{
+    const int index = _batchWorkerWrite[worker];
+    if (index == -1)
+    {
+        return;  // Late signal of a write already accounted for
+    }
+    _batchWorkerWrite[worker] = -1;
+
+    BatchWrite &w = _batchWrites[index];
+    w.state = success ? BatchWrite::Succeeded : BatchWrite::Failed;
+    w.error = error;
+    w.durationMs = w.timer.elapsed();
+
+    if (!_perfExportPath.isEmpty())
+    {
+        const QString exportFile = QDir(_perfExportPath).filePath(QString("write-%1.json").arg(index + 1, 3, 10, QChar('0')));
+        if (!_batchWorkers[worker]->performanceStats()->exportToFile(exportFile))
+        {
+            std::cerr << "Error: writing performance data to " << exportFile.toStdString() << std::endl;
+        }
+    }
+    _printBatchResult(w);
+
+    /* Let the ImageWriter finish handling this write before it starts on the next */
+    QTimer::singleShot(0, this, [this, worker]() { _startNextBatchWrite(worker); });
+}
+
+void Cli::_printBatchResult(const BatchWrite &w)
+{
+    const BatchJob &job = _batchJobs[w.job];
+
+    if (w.state == BatchWrite::Succeeded)
+    {
+        if (!_quiet)
+        {
+            _clearLine();
+            std::cerr << job.name.toStdString() << ": " << w.device.toStdString() << ": write successful." << std::endl;
+        }
+    }
+    else
+    {
+        if (!_quiet)
+        {
+            _clearLine();
+        }
+        std::cerr << "Error: " << job.name.toStdString() << ": " << w.device.toStdString() << ": " << w.error.toStdString() << std::endl;
+    }
+}
+
+void Cli::_finishBatch()
+{
+    /* Workers that go idle together each get here */
+    if (_batchFinished)
+    {
+        return;
+    }
+    _batchFinished = true;
+
+    int succeeded = 0, failed = 0;
+    QJsonArray jobs;
+
+    for (size_t i = 0; i < _batchJobs.size(); i++)
+    {
+        const BatchJob &job = _batchJobs[i];
+        QJsonArray writes;
+        bool jobSucceeded = true;
+
+        for (const BatchWrite &w : _batchWrites)
+        {
+            if (w.job != static_cast<int>(i))
+                continue;
+
+            QJsonObject write;
+            write["device"] = w.device;
+            write["status"] = w.state == BatchWrite::Succeeded ? "succeeded" : "failed";
+            if (w.state != BatchWrite::Succeeded)
+                write["error"] = w.error;
+            write["duration_ms"] = w.durationMs;
+            if (!w.sshHostKeyPub.isEmpty())
+                write["ssh_host_ed25519_key_pub"] = w.sshHostKeyPub;
+            writes.append(write);
+
+            if (w.state == BatchWrite::Succeeded)
+                succeeded++;
+            else
+            {
+                failed++;
+                jobSucceeded = false;
+            }
+        }
+
+        QJsonObject o;
+        o["name"] = job.name;
+        o["source"] = job.source;
+        if (!job.sha256.isEmpty())
+            o["sha256"] = QString::fromLatin1(job.sha256);
+        o["verify"] = job.verify;
+        o["status"] = jobSucceeded ? "succeeded" : "failed";
+        o["writes"] = writes;
+        jobs.append(o);
+    }
+
+    QJsonObject report;
+    report["version"] = ImageWriter::staticVersion();
+    report["concurrency"] = static_cast<int>(_batchWorkers.size());
+    report["duration_ms"] = _batchTimer.elapsed();
+    report["succeeded"] = succeeded;
+    report["failed"] = failed;
+    report["jobs"] = jobs;
+    const QByteArray json = QJsonDocument(report).toJson();
+    bool reportFailed = false;
+
+    if (_batchReportPath.isEmpty())
+    {
+        std::cout << json.constData() << std::flush;
+    }
+    else
+    {
+        QFile f(_batchReportPath);
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size())
+        {
+            std::cerr << "Error: writing job report to " << _batchReportPath.toStdString() << std::endl;
+            reportFailed = true;
+        }
+    }
+
+    if (!_quiet)
+    {
+        std::cerr << succeeded << " of " << succeeded + failed << " writes successful." << std::endl;
+    }
+    _app->exit(failed || reportFailed ? 1 : 0);
+}
+
 void Cli::_clearLine()
 {
     /* Properly clearing line requires platform specific code.
        Just write some spaces for now, and return to beginning of line. */
-    std::cerr << "                                          \r";
+    std::cerr << "                                                              \r";
 }
 
 void Cli::onError(QVariant msg)
 {
     QByteArray m = msg.toByteArray();
+    _exportPerformanceData();
 
     if (!_quiet)
     {
@@ -355,7 +1122,20 @@ void Cli::_printProgress(const QByteArray &msg, QVariant now, QVariant total)
         int percent = n/t*100;
         if (percent != _lastPercent || msg != _lastMsg)
         {
-            QByteArray txt = QByteArray("  ")+msg+": ["+QByteArray(percent/5, '-')+'>'+QByteArray(20-percent/5, ' ')+"] "+QByteArray::number(percent)+" %\r";
+            QByteArray txt = QByteArray("  ")+msg+": ["+QByteArray(percent/5, '-')+'>'+QByteArray(20-percent/5, ' ')+"] "+QByteArray::number(percent)+" %";
+
+            /* Live tail latency of the device calls behind this progress */
+            auto &latency = rpi_imager::IoLatencyStats::Instance();
+            bool verifying = latency.Phase() == rpi_imager::IoPhase::kVerifying;
+            const rpi_imager::LatencyHistogram &h = verifying
+                ? latency.Histogram(rpi_imager::IoOperation::kRead, rpi_imager::IoPhase::kVerifying)
+                : latency.Histogram(rpi_imager::IoOperation::kWrite, rpi_imager::IoPhase::kWriting);
+            if (h.Count())
+            {
+                double p99Ms = h.Snap().ValueAtPercentile(99.0) / 1000.0;
+                txt += QByteArray("  p99 ")+(verifying ? "read " : "write ")+QByteArray::number(p99Ms, 'f', 1)+" ms";
+            }
+            txt += "   \r";
             std::cerr << txt.constData();
             _lastPercent = percent;
             _lastMsg = msg;
@@ -1,11 +1,22 @@
 #ifndef CLI_H
 #define CLI_H
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <QSet>
+#include <QStringList>
 #include <QVariant>
+#include <memory>
+#include <vector>
+#include "imageadvancedoptions.h"
+#include "customization_template.h"
 
 class ImageWriter;
 class QCoreApplication;
+class QCommandLineParser;
+class QDir;
+class QJsonObject;
+namespace rpi_imager { class SimulatedCard; }
 
 class Cli : public QObject
 {
@@ -21,9 +32,56 @@ protected:
     int _lastPercent;
     QByteArray _lastMsg;
     bool _quiet;
+    std::shared_ptr<rpi_imager::SimulatedCard> _simulatedCard;  // Set with --simulate-device
+    QString _perfExportPath;
+
+    /* Batch mode (--jobs): every job is written to each of its destinations */
+    struct BatchJob {
+        QString name, source;
+        QByteArray sha256, initFormat;
+        QStringList destinations;
+        QByteArray firstRunScript, cloudinitUserdata, cloudinitNetworkConfig;
+        bool verify, eject, skipIfIdentical;
+        std::shared_ptr<const rpi_imager::CustomisationTemplate> customisationTemplate;  // Per-device customisation
+        QString error;                    // Set if the job cannot be started; all its writes fail with it
+    };
+    struct BatchWrite {
+        int job;
+        QString device;
+        int ticket;                       // Pre-generated customisation, -1 if the job has no template
+        QString sshHostKeyPub;
+        enum { Pending, Running, Succeeded, Failed } state;
+        QString error;
+        QElapsedTimer timer;
+        qint64 durationMs;
+    };
+    std::vector<BatchJob> _batchJobs;
+    std::vector<BatchWrite> _batchWrites;
+    std::vector<ImageWriter *> _batchWorkers;    // First one is _imageWriter, which owns the download cache
+    std::vector<int> _batchWorkerWrite;         // Write each worker is busy with, -1 if idle
+    size_t _batchNext;
+    QSet<QString> _batchRemovableDrives;
+    bool _batchAllowSystemDrives, _batchFinished;
+    QString _batchReportPath;
+    QElapsedTimer _batchTimer;
+    std::unique_ptr<rpi_imager::CustomisationPregenerator> _batchPregenerator;
+    ImageOptions::AdvancedOptions _advancedOptions;
 
     void _printProgress(const QByteArray &msg, QVariant now, QVariant total);
     void _clearLine();
+    bool _setupSimulatedDevice(const QString &profileFile);
+    bool _setupSecureBootKey(const QString &keyPath);
+    void _exportPerformanceData();
+
+    int _runJobs(const QCommandLineParser &parser);
+    bool _loadJobs(const QString &manifestFile, const QCommandLineParser &parser, int &concurrency);
+    bool _loadTemplateJob(const QJsonObject &o, const QDir &manifestDir, BatchJob &job, QList<QVariantMap> &rows);
+    void _startNextBatchWrite(int worker);
+    bool _startBatchWrite(int worker, BatchWrite &w);
+    bool _writeBatchWrite(int worker, BatchWrite &w, const rpi_imager::CustomisationTemplate::Artifacts &customisation);
+    void _finishBatchWrite(int worker, bool success, const QString &error);
+    void _printBatchResult(const BatchWrite &w);
+    void _finishBatch();
 
 protected slots:
     void onSuccess();
@@ -31,4 +31,35 @@
 /* Do not cache if it would bring free disk space under 5 GB */
 #define IMAGEWRITER_MINIMAL_SPACE_FOR_CACHING   5*1024*1024*1024ll
 
+/* Transcode cached images into seekable zstd in the background, on hosts with at least this many cores */
+#define IMAGEWRITER_CACHE_TRANSCODE_MIN_CORES   4
+
+/* Uncompressed size of each independently decodable zstd frame in a transcoded cache file */
+#define IMAGEWRITER_CACHE_TRANSCODE_FRAME_SIZE  8*1024*1024
+
+/* zstd level used for transcoding (runs at idle priority, so favour ratio over speed) */
+#define IMAGEWRITER_CACHE_TRANSCODE_LEVEL       9
+
+/* Copy a cached image into the RAM hot tier (if it has a budget) once it has been written this often */
+#define IMAGEWRITER_CACHE_HOT_TIER_PROMOTE_USES 2
+
+/* tmpfs directory under which the hot tier is kept, unless configured otherwise */
+#define IMAGEWRITER_CACHE_HOT_TIER_ROOT         "/dev/shm"
+
+/* zstd level of the chunk store's chunks (compressed once per new chunk, decompressed on every write) */
+#define IMAGEWRITER_CHUNK_STORE_ZSTD_LEVEL      3
+
+/* Chunks read and decompressed ahead of the device when writing from the chunk store */
+#define IMAGEWRITER_CHUNK_STORE_READAHEAD       16
+
+/* Uncompressed size of each zstd frame or xz block of images packaged with --publish */
+#define IMAGEWRITER_PUBLISH_BLOCK_SIZE          16*1024*1024
+
+/* Size of the download chunks hashed in the integrity manifest written by --publish */
+#define IMAGEWRITER_PUBLISH_CHUNK_SIZE          4*1024*1024
+
+/* Default compression of --publish (done once per release, so favour ratio over speed) */
+#define IMAGEWRITER_PUBLISH_ZSTD_LEVEL          19
+#define IMAGEWRITER_PUBLISH_XZ_PRESET           6
+
 #endif // CONFIG_H
@@ -148,6 +148,23 @@ QByteArray CustomisationGenerator::generateSystemdScript(const QVariantMap& s, c
         line(QStringLiteral("fi"), script);
     }
 
+    // Host key generated ahead of time (fleet provisioning), so the device's identity is known
+    // before it first boots. Other key types are still generated on the device
+    const QString hostKey = s.value("sshHostKeyEd25519").toString().trimmed();
+    const QString hostKeyPub = s.value("sshHostKeyEd25519Pub").toString().trimmed();
+    if (!hostKey.isEmpty() && !hostKeyPub.isEmpty()) {
+        line(QStringLiteral("cat >/etc/ssh/ssh_host_ed25519_key <<'EOF'"), script);
+        line(hostKey, script);
+        line(QStringLiteral("EOF"), script);
+        line(QStringLiteral("cat >/etc/ssh/ssh_host_ed25519_key.pub <<'EOF'"), script);
+        line(hostKeyPub, script);
+        line(QStringLiteral("EOF"), script);
+        line(QStringLiteral("chmod 600 /etc/ssh/ssh_host_ed25519_key"), script);
+        line(QStringLiteral("chmod 644 /etc/ssh/ssh_host_ed25519_key.pub"), script);
+        line(QStringLiteral("ssh-keygen -A"), script);
+        line(QStringLiteral("systemctl disable regenerate_ssh_host_keys 2>/dev/null || true"), script);
+    }
+
     // User and password setup with userconf integration
     // Also run when SSH public keys are configured (even without password) to ensure
     // the system is marked as configured and the initial setup wizard is skipped
@@ -396,6 +413,20 @@ QByteArray CustomisationGenerator::generateCloudInitUserData(const QVariantMap&
             push(QStringLiteral("ssh_pwauth: true"), cloud);
         }
     }
+
+    // Host key generated ahead of time (fleet provisioning)
+    const QString hostKey = settings.value("sshHostKeyEd25519").toString().trimmed();
+    const QString hostKeyPub = settings.value("sshHostKeyEd25519Pub").toString().trimmed();
+    if (!hostKey.isEmpty() && !hostKeyPub.isEmpty()) {
+        push(QStringLiteral("ssh_keys:"), cloud);
+        push(QStringLiteral("  ed25519_private: |"), cloud);
+        const QStringList keyLines = hostKey.split(QRegularExpression("\r?\n"), Qt::SkipEmptyParts);
+        for (const QString& k : keyLines) {
+            push(QStringLiteral("    ") + k, cloud);
+        }
+        push(QStringLiteral("  ed25519_public: ") + hostKeyPub, cloud);
+        push(QString(), cloud);
+    }
     
     const bool enableI2C = settings.value("enableI2C").toBool();
     const bool enableSPI = settings.value("enableSPI").toBool();
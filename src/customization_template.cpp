@@ -0,0 +1,386 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "customization_template.h"
+#include "customization_generator.h"
+#include "dependencies/sha256crypt/sha256crypt.h"
+#include "dependencies/yescrypt/yescrypt_wrapper.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QtConcurrent/qtconcurrentrun.h>
+
+namespace rpi_imager {
+
+namespace {
+
+// Fields of one CSV record. Quoted fields may contain commas, quotes ("") and line breaks
+QStringList parseCsvRecord(const QString &text, qsizetype &pos)
+{
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+
+    while (pos < text.size())
+    {
+        const QChar c = text.at(pos++);
+        if (quoted)
+        {
+            if (c == '"' && pos < text.size() && text.at(pos) == '"')
+            {
+                field += '"';
+                pos++;
+            }
+            else if (c == '"')
+                quoted = false;
+            else
+                field += c;
+        }
+        else if (c == '"')
+            quoted = true;
+        else if (c == ',')
+        {
+            fields.append(field);
+            field.clear();
+        }
+        else if (c == '\n')
+            break;
+        else if (c != '\r')
+            field += c;
+    }
+
+    fields.append(field);
+    return fields;
+}
+
+} // namespace
+
+CustomisationTemplate::CustomisationTemplate(const QVariantMap &settings, bool cloudInit)
+    : _settings(settings), _cloudInit(cloudInit), _hasCcRpi(false), _yescrypt(false)
+{
+}
+
+void CustomisationTemplate::setCloudInitTemplates(const QByteArray &userData, const QByteArray &networkConfig)
+{
+    _userDataTemplate = userData;
+    _networkConfigTemplate = networkConfig;
+}
+
+CustomisationTemplate::Artifacts CustomisationTemplate::generate(const QVariantMap &variables) const
+{
+    Artifacts a;
+    QVariantMap vars = variables;
+    QStringList missing;
+
+    QVariantMap s;
+    for (auto it = _settings.cbegin(); it != _settings.cend(); ++it)
+    {
+        if (it.value().typeId() == QMetaType::QString)
+            s.insert(it.key(), expand(it.value().toString(), vars, &missing));
+        else
+            s.insert(it.key(), it.value());
+    }
+
+    if (s.value("sshHostKeys").toBool())
+    {
+        const QString hostname = s.value("hostname").toString().trimmed();
+        QString privateKey, publicKey;
+        if (!_generateHostKey("root@" + (hostname.isEmpty() ? QStringLiteral("raspberrypi") : hostname), privateKey, publicKey, a.error))
+            return a;
+
+        s.insert("sshHostKeyEd25519", privateKey);
+        s.insert("sshHostKeyEd25519Pub", publicKey);
+        vars.insert("ssh_host_ed25519_key", privateKey);
+        vars.insert("ssh_host_ed25519_key_pub", publicKey);
+        a.sshHostKeyPub = publicKey;
+    }
+
+    // Plain text in the template or variables; values starting with $ are already hashed
+    const QString password = s.value("sshUserPassword").toString();
+    if (!password.isEmpty() && !password.startsWith('$'))
+    {
+        const QString hash = cryptPassword(password.toUtf8(), _yescrypt);
+        if (hash.isEmpty())
+        {
+            a.error = QStringLiteral("Hashing the user password failed");
+            return a;
+        }
+        s.insert("sshUserPassword", hash);
+    }
+
+    if (_cloudInit)
+    {
+        if (!_userDataTemplate.isEmpty())
+            a.cloudInit = expand(QString::fromUtf8(_userDataTemplate), vars, &missing, Quoting::Yaml).toUtf8();
+        else if (!_settings.isEmpty())
+            a.cloudInit = CustomisationGenerator::generateCloudInitUserData(s, QString(), _hasCcRpi,
+                                                                           s.value("sshEnabled").toBool(),
+                                                                           s.value("sshUserName").toString());
+
+        if (!_networkConfigTemplate.isEmpty())
+            a.cloudInitNetwork = expand(QString::fromUtf8(_networkConfigTemplate), vars, &missing, Quoting::Yaml).toUtf8();
+        else if (!_settings.isEmpty())
+            a.cloudInitNetwork = CustomisationGenerator::generateCloudInitNetworkConfig(s, _hasCcRpi);
+    }
+    else
+    {
+        if (!_firstRunTemplate.isEmpty())
+            a.firstRun = expand(QString::fromUtf8(_firstRunTemplate), vars, &missing, Quoting::Shell).toUtf8();
+        else if (!_settings.isEmpty())
+            a.firstRun = CustomisationGenerator::generateSystemdScript(s);
+    }
+
+    // Same as ImageWriter applies for the wizard's settings
+    const QString wifiCountry = s.value("recommendedWifiCountry").toString().trimmed();
+    if (!wifiCountry.isEmpty())
+        a.cmdline = QByteArray(" cfg80211.ieee80211_regdom=") + wifiCountry.toUtf8();
+
+    if (!missing.isEmpty())
+    {
+        missing.removeDuplicates();
+        a = Artifacts();
+        a.error = QStringLiteral("No value for template variable %1").arg(missing.join(", "));
+    }
+
+    return a;
+}
+
+bool CustomisationTemplate::loadVariables(const QString &fileName, QList<QVariantMap> &rows, QString &error)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        error = QStringLiteral("Cannot read variables file %1").arg(fileName);
+        return false;
+    }
+    const QByteArray data = f.readAll();
+
+    if (QFileInfo(fileName).suffix().compare("json", Qt::CaseInsensitive) == 0)
+    {
+        QJsonParseError parseError;
+        const QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
+        if (!doc.isArray())
+        {
+            error = QStringLiteral("Variables file %1 is not a JSON array: %2").arg(fileName, parseError.errorString());
+            return false;
+        }
+
+        for (const QJsonValue &v : doc.array())
+        {
+            if (!v.isObject())
+            {
+                error = QStringLiteral("Variables file %1 has an entry that is not an object").arg(fileName);
+                return false;
+            }
+            rows.append(v.toObject().toVariantMap());
+        }
+        return true;
+    }
+
+    const QString text = QString::fromUtf8(data);
+    qsizetype pos = 0;
+    QStringList header = parseCsvRecord(text, pos);
+    for (QString &name : header)
+        name = name.trimmed();
+    if (header.isEmpty() || header.contains(QString()))
+    {
+        error = QStringLiteral("Variables file %1 needs a header row naming every column").arg(fileName);
+        return false;
+    }
+
+    int line = 1;
+    while (pos < text.size())
+    {
+        const QStringList fields = parseCsvRecord(text, pos);
+        line++;
+        if (fields.size() == 1 && fields.first().trimmed().isEmpty())
+            continue;
+        if (fields.size() != header.size())
+        {
+            error = QStringLiteral("Variables file %1, record %2: expected %3 fields, got %4")
+                        .arg(fileName).arg(line).arg(header.size()).arg(fields.size());
+            return false;
+        }
+
+        QVariantMap row;
+        for (qsizetype i = 0; i < header.size(); i++)
+            row.insert(header.at(i), fields.at(i));
+        rows.append(row);
+    }
+
+    return true;
+}
+
+QString CustomisationTemplate::expand(const QString &text, const QVariantMap &variables, QStringList *missing,
+                                      Quoting quoting)
+{
+    static const QRegularExpression placeholder(QStringLiteral("\\{\\{\\s*([A-Za-z0-9_.-]+)\\s*\\}\\}"));
+
+    QString result;
+    qsizetype last = 0;
+    QRegularExpressionMatchIterator it = placeholder.globalMatch(text);
+    while (it.hasNext())
+    {
+        const QRegularExpressionMatch m = it.next();
+        const QString name = m.captured(1);
+        result += QStringView(text).mid(last, m.capturedStart() - last);
+
+        if (variables.contains(name))
+        {
+            /* Values come from a spreadsheet, not from the template's author: never let them
+               end a string or start a command */
+            const QString value = variables.value(name).toString();
+            if (quoting == Quoting::Shell)
+                result += CustomisationGenerator::shellQuote(value);
+            else if (quoting == Quoting::Yaml)
+                result += '"' + CustomisationGenerator::yamlEscapeString(value) + '"';
+            else
+                result += value;
+        }
+        else
+        {
+            if (missing)
+                missing->append(name);
+            result += m.captured(0);
+        }
+        last = m.capturedEnd();
+    }
+    result += QStringView(text).mid(last);
+
+    return result;
+}
+
+QString CustomisationTemplate::cryptPassword(const QByteArray &password, bool yescrypt)
+{
+    static const QByteArray saltchars =
+      "./0123456789ABCDEFGHIJKLMNOPQRST"
+      "UVWXYZabcdefghijklmnopqrstuvwxyz";
+
+    // Salts must differ between devices, even if hashed in the same millisecond
+    QRandomGenerator *gen = QRandomGenerator::system();
+
+    if (yescrypt)
+    {
+        QByteArray salt;
+        for (int i=0; i<16; i++)  // yescrypt uses longer salts
+            salt += saltchars[gen->bounded(saltchars.length())];
+
+        char result[512];
+        return yescrypt_crypt_r(password.constData(), salt.constData(), result, sizeof(result)) ? QString(result) : QString();
+    }
+
+    QByteArray salt = "$5$";
+    for (int i=0; i<10; i++)
+        salt += saltchars[gen->bounded(saltchars.length())];
+
+    // sha256_crypt() returns a static buffer
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    const char *result = sha256_crypt(password.constData(), salt.constData());
+    return result ? QString(result) : QString();
+}
+
+QString CustomisationTemplate::sshKeygenProgram()
+{
+#ifdef Q_OS_WIN
+    QString windir = QProcessEnvironment::systemEnvironment().value("windir");
+    return QDir::fromNativeSeparators(windir+"\\SysNative\\OpenSSH\\ssh-keygen.exe");
+#else
+    return "ssh-keygen";
+#endif
+}
+
+bool CustomisationTemplate::_generateHostKey(const QString &comment, QString &privateKey, QString &publicKey, QString &error)
+{
+    QTemporaryDir dir;
+    if (!dir.isValid())
+    {
+        error = QStringLiteral("Cannot create a temporary directory for the SSH host key");
+        return false;
+    }
+
+    const QString keyFile = dir.filePath("ssh_host_ed25519_key");
+    QProcess proc;
+    proc.start(sshKeygenProgram(), {"-q", "-t", "ed25519", "-N", "", "-C", comment, "-f", keyFile});
+    if (!proc.waitForFinished(30000) || proc.exitStatus() != QProcess::NormalExit || proc.exitCode() != 0)
+    {
+        error = QStringLiteral("Generating an SSH host key failed: %1")
+                    .arg(proc.error() == QProcess::FailedToStart ? proc.errorString() : QString::fromLocal8Bit(proc.readAllStandardError()).trimmed());
+        return false;
+    }
+
+    QFile priv(keyFile), pub(keyFile + ".pub");
+    if (!priv.open(QIODevice::ReadOnly) || !pub.open(QIODevice::ReadOnly))
+    {
+        error = QStringLiteral("Reading the generated SSH host key failed");
+        return false;
+    }
+    privateKey = QString::fromLatin1(priv.readAll()).trimmed();
+    publicKey = QString::fromLatin1(pub.readAll()).trimmed();
+    return true;
+}
+
+CustomisationPregenerator::CustomisationPregenerator(int lookahead)
+    : _lookahead(qMax(lookahead, 1))
+{
+    _pool.setMaxThreadCount(_lookahead);
+}
+
+CustomisationPregenerator::~CustomisationPregenerator()
+{
+    _pool.waitForDone();
+}
+
+int CustomisationPregenerator::enqueue(std::shared_ptr<const CustomisationTemplate> customisationTemplate, const QVariantMap &variables)
+{
+    _entries.push_back({std::move(customisationTemplate), variables, {}, false});
+    return static_cast<int>(_entries.size()) - 1;
+}
+
+void CustomisationPregenerator::start()
+{
+    _startUpTo(_lookahead - 1);
+}
+
+QFuture<CustomisationTemplate::Artifacts> CustomisationPregenerator::take(int ticket)
+{
+    // Keep the pool lookahead devices ahead of the writes
+    _startUpTo(ticket + _lookahead);
+
+    Entry &e = _entries.at(ticket);
+    QFuture<CustomisationTemplate::Artifacts> future = e.future;
+    e.future = {};
+    e.variables.clear();
+    return future;
+}
+
+void CustomisationPregenerator::_startUpTo(int last)
+{
+    last = qMin(last, static_cast<int>(_entries.size()) - 1);
+    for (int i = 0; i <= last; i++)
+    {
+        Entry &e = _entries[i];
+        if (e.started)
+            continue;
+
+        e.started = true;
+        e.future = QtConcurrent::run(&_pool, [t = e.customisationTemplate, vars = e.variables]() {
+            return t->generate(vars);
+        });
+    }
+}
+
+} // namespace rpi_imager
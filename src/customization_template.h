@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef CUSTOMIZATION_TEMPLATE_H
+#define CUSTOMIZATION_TEMPLATE_H
+
+#include <QByteArray>
+#include <QFuture>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVariantMap>
+#include <memory>
+#include <vector>
+
+namespace rpi_imager {
+
+/**
+ * @brief Per-device customisation from a template, for provisioning fleets
+ *
+ * A template is a set of CustomisationGenerator settings, and/or literal
+ * firstrun.sh or cloud-init files. String values in either may contain
+ * {{name}} placeholders, which are filled in from one row of per-device
+ * variables (a CSV file with a header row, or a JSON array of objects).
+ *
+ * In literal files a placeholder stands for one whole value, and is
+ * quoted for the file it is in: a single-quoted shell word in firstrun.sh,
+ * a double-quoted scalar in cloud-init YAML. Write `hostname={{hostname}}`
+ * or `hostname: {{hostname}}`, without quotes of your own.
+ *
+ * generate() does the expensive work for one device: the user password is
+ * hashed, the Wi-Fi PSK derived and, if the "sshHostKeys" setting is true,
+ * an ed25519 SSH host key pair created with ssh-keygen. Literal templates can
+ * refer to the key pair as {{ssh_host_ed25519_key}} and
+ * {{ssh_host_ed25519_key_pub}}.
+ */
+class CustomisationTemplate {
+public:
+    struct Artifacts {
+        QByteArray firstRun;            // systemd templates
+        QByteArray cloudInit;           // cloud-init templates
+        QByteArray cloudInitNetwork;
+        QByteArray cmdline;             // Appended to cmdline.txt
+        QString sshHostKeyPub;          // Generated host key, for the fleet's known_hosts
+        QString error;                  // Set if the device's customisation could not be generated
+    };
+
+    CustomisationTemplate(const QVariantMap &settings, bool cloudInit);
+
+    void setFirstRunTemplate(const QByteArray &script) { _firstRunTemplate = script; }
+    void setCloudInitTemplates(const QByteArray &userData, const QByteArray &networkConfig);
+    void setCloudInitRpi(bool hasCcRpi) { _hasCcRpi = hasCcRpi; }   // OS has the cc_raspberry_pi module
+    void setYescrypt(bool yescrypt) { _yescrypt = yescrypt; }       // Else sha256crypt password hashes
+
+    bool isCloudInit() const { return _cloudInit; }
+    bool hasLiteralFirstRun() const { return !_firstRunTemplate.isEmpty(); }
+
+    /* Everything one device needs. Thread safe, run it on a worker thread */
+    Artifacts generate(const QVariantMap &variables) const;
+
+    /* CSV (header row naming the variables) or JSON array of objects, by file extension */
+    static bool loadVariables(const QString &fileName, QList<QVariantMap> &rows, QString &error);
+
+    /* How expand() inserts values */
+    enum class Quoting {
+        None,
+        Shell,      // Single-quoted shell word
+        Yaml        // Double-quoted YAML scalar
+    };
+
+    /* Replace {{name}} placeholders. Names without a value are added to missing and left as is */
+    static QString expand(const QString &text, const QVariantMap &variables, QStringList *missing = nullptr,
+                          Quoting quoting = Quoting::None);
+
+    /* sha256crypt or yescrypt hash with a random salt, empty on failure. Thread safe */
+    static QString cryptPassword(const QByteArray &password, bool yescrypt);
+
+    static QString sshKeygenProgram();
+
+private:
+    QVariantMap _settings;
+    QByteArray _firstRunTemplate, _userDataTemplate, _networkConfigTemplate;
+    bool _cloudInit, _hasCcRpi, _yescrypt;
+
+    static bool _generateHostKey(const QString &comment, QString &privateKey, QString &publicKey, QString &error);
+};
+
+/**
+ * @brief Generates the customisation of upcoming devices on a thread pool
+ *
+ * Devices are queued in the order they will be written. Up to lookahead
+ * devices past the last one taken are generated in the background, so by
+ * the time a write starts its customisation is normally ready; if not, the
+ * caller waits on the returned future without blocking its event loop.
+ */
+class CustomisationPregenerator {
+public:
+    explicit CustomisationPregenerator(int lookahead);
+    ~CustomisationPregenerator();
+
+    /* Returns the device's ticket for take() */
+    int enqueue(std::shared_ptr<const CustomisationTemplate> customisationTemplate, const QVariantMap &variables);
+
+    /* Start generating the first devices */
+    void start();
+
+    /* The device's customisation, finished or still being generated. Each ticket can be taken once */
+    QFuture<CustomisationTemplate::Artifacts> take(int ticket);
+
+private:
+    struct Entry {
+        std::shared_ptr<const CustomisationTemplate> customisationTemplate;
+        QVariantMap variables;
+        QFuture<CustomisationTemplate::Artifacts> future;
+        bool started;
+    };
+
+    QThreadPool _pool;
+    std::vector<Entry> _entries;
+    int _lookahead;
+
+    void _startUpTo(int last);
+};
+
+} // namespace rpi_imager
+
+#endif // CUSTOMIZATION_TEMPLATE_H
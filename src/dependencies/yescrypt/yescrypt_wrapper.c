@@ -12,6 +12,11 @@
 static char result_buffer[512];
 
 char *yescrypt_crypt(const char *key, const char *salt)
+{
+    return yescrypt_crypt_r(key, salt, result_buffer, sizeof(result_buffer));
+}
+
+char *yescrypt_crypt_r(const char *key, const char *salt, char *buffer, size_t buflen)
 {
     yescrypt_local_t local;
     uint8_t hash[256];
@@ -66,8 +71,8 @@ char *yescrypt_crypt(const char *key, const char *salt)
         return NULL;
     }
     
-    /* Copy result to static buffer */
-    snprintf(result_buffer, sizeof(result_buffer), "%s", (char *)hash);
+    /* Copy result to the caller's buffer */
+    snprintf(buffer, buflen, "%s", (char *)hash);
     
     /* Clean up */
     yescrypt_free_local(&local);
@@ -75,6 +80,6 @@ char *yescrypt_crypt(const char *key, const char *salt)
     /* Clear sensitive data */
     memset(hash, 0, sizeof(hash));
     
-    return result_buffer;
+    return buffer;
 }
 
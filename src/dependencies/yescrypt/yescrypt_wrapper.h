@@ -27,6 +27,11 @@ extern "C" {
  */
 char *yescrypt_crypt(const char *key, const char *salt);
 
+/* Reentrant variant: the hash is written to buffer (of buflen bytes).
+ * Returns buffer, or NULL on error
+ */
+char *yescrypt_crypt_r(const char *key, const char *salt, char *buffer, size_t buflen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -61,6 +61,13 @@ class Result<void> {
   std::optional<FormatError> error_;
 };
 
+// Filesystem to create
+enum class Filesystem {
+  kAuto,   // exFAT on SDXC capacities (over 32 GB), FAT32 below
+  kFat32,
+  kExfat
+};
+
 // Configuration for FAT32 formatting
 struct Fat32Config {
   std::uint32_t total_sectors;
@@ -71,6 +78,21 @@ struct Fat32Config {
   std::uint32_t volume_id = 0x12345678;
 };
 
+// Configuration for exFAT formatting. Offsets and lengths are in sectors,
+// relative to the start of the partition except for partition_offset
+struct ExfatConfig {
+  std::uint64_t partition_offset;
+  std::uint64_t volume_length;
+  std::uint32_t sectors_per_cluster = 256;  // 128KB clusters
+  std::uint32_t boundary_unit = 65536;      // 32MB, the FAT and cluster heap start on a multiple
+  std::uint32_t fat_offset;
+  std::uint32_t fat_length;
+  std::uint32_t cluster_heap_offset;
+  std::uint32_t cluster_count;
+  std::string volume_label = "BOOT";
+  std::uint32_t volume_serial = 0x12345678;
+};
+
 // MBR partition entry
 struct __attribute__((packed)) MbrPartitionEntry {
   std::uint8_t status;
@@ -129,6 +151,56 @@ struct __attribute__((packed)) Fat32FsInfo {
   std::uint32_t trail_signature;
 };
 
+// exFAT boot sector structure (sector 0 of the main and backup boot regions)
+struct __attribute__((packed)) ExfatBootSector {
+  std::array<std::uint8_t, 3> jump_instruction;
+  std::array<char, 8> fs_name;                // "EXFAT   "
+  std::array<std::uint8_t, 53> must_be_zero;
+  std::uint64_t partition_offset;
+  std::uint64_t volume_length;
+  std::uint32_t fat_offset;
+  std::uint32_t fat_length;
+  std::uint32_t cluster_heap_offset;
+  std::uint32_t cluster_count;
+  std::uint32_t root_cluster;
+  std::uint32_t volume_serial;
+  std::uint16_t fs_revision;
+  std::uint16_t volume_flags;                 // Excluded from the boot checksum
+  std::uint8_t bytes_per_sector_shift;
+  std::uint8_t sectors_per_cluster_shift;
+  std::uint8_t num_fats;
+  std::uint8_t drive_select;
+  std::uint8_t percent_in_use;                // Excluded from the boot checksum
+  std::array<std::uint8_t, 7> reserved;
+  std::array<std::uint8_t, 390> boot_code;
+  std::uint16_t signature;
+};
+
+// exFAT root directory entries
+struct __attribute__((packed)) ExfatVolumeLabelEntry {
+  std::uint8_t entry_type;                    // 0x83
+  std::uint8_t character_count;
+  std::array<std::uint16_t, 11> volume_label; // UTF-16
+  std::array<std::uint8_t, 8> reserved;
+};
+
+struct __attribute__((packed)) ExfatBitmapEntry {
+  std::uint8_t entry_type;                    // 0x81
+  std::uint8_t bitmap_flags;
+  std::array<std::uint8_t, 18> reserved;
+  std::uint32_t first_cluster;
+  std::uint64_t data_length;
+};
+
+struct __attribute__((packed)) ExfatUpcaseEntry {
+  std::uint8_t entry_type;                    // 0x82
+  std::array<std::uint8_t, 3> reserved1;
+  std::uint32_t table_checksum;
+  std::array<std::uint8_t, 12> reserved2;
+  std::uint32_t first_cluster;
+  std::uint64_t data_length;
+};
+
 class DiskFormatter {
  public:
   // Constructor that accepts a FileOperations implementation
@@ -141,32 +213,55 @@ class DiskFormatter {
   DiskFormatter(DiskFormatter&&) = default;
   DiskFormatter& operator=(DiskFormatter&&) = default;
 
-  // Format a device with MBR partition table and FAT32 filesystem
-  Result<void> FormatDrive(const std::string& device_path);
+  // Format a device with MBR partition table and FAT32 or exFAT filesystem
+  Result<void> FormatDrive(
+      const std::string& device_path,
+      Filesystem filesystem = Filesystem::kAuto);
 
   // Format to a file for testing
   Result<void> FormatFile(
       const std::string& file_path,
-      std::uint64_t file_size_bytes);
+      std::uint64_t file_size_bytes,
+      Filesystem filesystem = Filesystem::kAuto);
 
  private:
   static constexpr std::uint32_t kSectorSize = 512;
   static constexpr std::uint32_t kPartitionStartSector = 8192;  // 4MB offset
   static constexpr std::uint8_t kFat32PartitionType = 0x0C;    // FAT32 LBA
+  static constexpr std::uint8_t kExfatPartitionType = 0x07;    // exFAT/NTFS
+  static constexpr std::uint64_t kSdxcMinBytes = 32ULL << 30;  // SDHC cards go up to 32GB
 
   std::unique_ptr<FileOperations> file_ops_;
 
   // Convert FileError to FormatError
   FormatError ConvertError(FileError error) const;
 
+  // Partition the opened device and create the filesystem on it
+  Result<void> WritePartitionAndFilesystem(
+      std::uint64_t device_size_bytes,
+      Filesystem filesystem,
+      std::uint32_t allocation_unit_bytes);
+
   // Write MBR with single partition
-  Result<void> WriteMbr(std::uint64_t device_size_bytes) const;
+  Result<void> WriteMbr(
+      std::uint32_t partition_start_sector,
+      std::uint32_t partition_size_sectors,
+      std::uint8_t partition_type) const;
 
   // Write FAT32 filesystem
   Result<void> WriteFat32(
       std::uint32_t partition_start_sector,
       std::uint32_t partition_size_sectors) const;
 
+  // Write exFAT filesystem: discards the partition, then writes only the
+  // boot regions, the start of the FAT, the allocation bitmap, the up-case
+  // table and the root directory
+  Result<void> WriteExfat(const ExfatConfig& config) const;
+
+  Result<void> WriteExfatBootRegions(
+      const ExfatConfig& config,
+      std::uint32_t root_cluster) const;
+
   // Helper functions
   Result<void> WriteBootSector(
       std::uint32_t offset_sectors,
@@ -185,6 +280,16 @@ class DiskFormatter {
 
   // Utility functions
   Fat32Config CalculateFat32Config(std::uint32_t partition_size_sectors) const;
+
+  // Cluster size and boundary unit after the SD card file system
+  // specification's SDXC parameters. A larger allocation unit reported by
+  // the card raises the boundary unit to match
+  static ExfatConfig CalculateExfatConfig(
+      std::uint64_t device_size_bytes,
+      std::uint32_t allocation_unit_bytes);
+
+  // Lay out the FAT and cluster heap of a partition of partition_size_sectors
+  static bool LayoutExfat(ExfatConfig& config, std::uint64_t partition_size_sectors);
   std::uint32_t CalculateSectorsPerFat(const Fat32Config& config) const;
   
   Result<void> WriteAtOffset(
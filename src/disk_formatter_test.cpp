@@ -12,6 +12,10 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
 
 namespace fs = std::filesystem;
 using namespace rpi_imager;
@@ -26,6 +30,8 @@ class DiskFormatterTest {
     all_passed &= TestMbrStructure();
     all_passed &= TestFat32Structure();
     all_passed &= TestSystemToolValidation();
+    all_passed &= TestExfatStructure();
+    all_passed &= TestExfatSystemToolValidation();
     
     if (all_passed) {
       std::cout << "All tests passed!\n";
@@ -37,14 +43,21 @@ class DiskFormatterTest {
   }
 
  private:
+  // Removes a test image before the test and on every way out of it
+  struct RemoveOnExit {
+    explicit RemoveOnExit(const std::string& path) : path(path) { fs::remove(path); }
+    ~RemoveOnExit() { fs::remove(path); }
+    std::string path;
+  };
+
   static bool TestBasicFormatting() {
     std::cout << "Testing basic formatting...\n";
     
     const std::string test_file = "/tmp/test_disk.img";
     const std::uint64_t disk_size = 64 * 1024 * 1024;  // 64MB
     
-    // Clean up any existing test file
-    fs::remove(test_file);
+    // Clean up any existing test file, and the image once done
+    RemoveOnExit cleanup(test_file);
     
     DiskFormatter formatter;
     auto result = formatter.FormatFile(test_file, disk_size);
@@ -75,7 +88,7 @@ class DiskFormatterTest {
     const std::string test_file = "/tmp/test_mbr.img";
     const std::uint64_t disk_size = 64 * 1024 * 1024;  // 64MB
     
-    fs::remove(test_file);
+    RemoveOnExit cleanup(test_file);
     
     DiskFormatter formatter;
     auto result = formatter.FormatFile(test_file, disk_size);
@@ -130,7 +143,7 @@ class DiskFormatterTest {
     const std::string test_file = "/tmp/test_fat32.img";
     const std::uint64_t disk_size = 64 * 1024 * 1024;  // 64MB
     
-    fs::remove(test_file);
+    RemoveOnExit cleanup(test_file);
     
     DiskFormatter formatter;
     auto result = formatter.FormatFile(test_file, disk_size);
@@ -190,7 +203,7 @@ class DiskFormatterTest {
     const std::string test_file = "/tmp/test_system.img";
     const std::uint64_t disk_size = 64 * 1024 * 1024;  // 64MB
     
-    fs::remove(test_file);
+    RemoveOnExit cleanup(test_file);
     
     DiskFormatter formatter;
     auto result = formatter.FormatFile(test_file, disk_size);
@@ -274,6 +287,215 @@ class DiskFormatterTest {
     std::cout << "✅ System tool validation completed\n";
     return all_passed;
   }
+
+  static std::uint32_t ExfatChecksum(const std::vector<std::uint8_t>& data, bool boot_region) {
+    std::uint32_t checksum = 0;
+    for (std::size_t i = 0; i < data.size(); ++i) {
+      if (boot_region && (i == 106 || i == 107 || i == 112)) {
+        continue;
+      }
+      checksum = ((checksum & 1) ? 0x80000000U : 0) + (checksum >> 1) + data[i];
+    }
+    return checksum;
+  }
+
+  static std::vector<std::uint8_t> ReadAt(std::ifstream& file, std::uint64_t offset, std::size_t size) {
+    std::vector<std::uint8_t> data(size);
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(size));
+    return data;
+  }
+
+  static bool TestExfatStructure() {
+    std::cout << "Testing exFAT structure...\n";
+
+    // A 256GB SDXC card; the image stays sparse apart from the metadata
+    const std::string test_file = "/tmp/test_exfat.img";
+    const std::uint64_t disk_size = 256ULL * 1024 * 1024 * 1024;
+
+    RemoveOnExit cleanup(test_file);
+
+    DiskFormatter formatter;
+    auto start = std::chrono::steady_clock::now();
+    auto result = formatter.FormatFile(test_file, disk_size);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    if (!result) {
+      std::cout << "❌ Failed to format file\n";
+      return false;
+    }
+    std::cout << "Formatted 256GB in " << elapsed.count() << " ms\n";
+
+    std::ifstream file(test_file, std::ios::binary);
+    if (!file) {
+      std::cout << "❌ Cannot open test file for reading\n";
+      return false;
+    }
+
+    auto mbr = ReadAt(file, 0, 512);
+    const auto* partition = reinterpret_cast<const MbrPartitionEntry*>(mbr.data() + 446);
+    if (partition->partition_type != 0x07) {
+      std::cout << "❌ Wrong partition type: " << static_cast<int>(partition->partition_type) << "\n";
+      return false;
+    }
+
+    // 32MB boundary unit for a 256GB card
+    const std::uint32_t boundary_unit = 65536;
+    std::uint32_t first_lba = partition->first_lba;
+    if (first_lba % boundary_unit != 0) {
+      std::cout << "❌ Partition not aligned to the boundary unit: " << first_lba << "\n";
+      return false;
+    }
+
+    const std::uint64_t partition_offset = static_cast<std::uint64_t>(first_lba) * 512;
+    auto boot_region = ReadAt(file, partition_offset, 12 * 512);
+    auto backup_region = ReadAt(file, partition_offset + 12 * 512, 12 * 512);
+    const auto* boot = reinterpret_cast<const ExfatBootSector*>(boot_region.data());
+
+    if (std::string(boot->fs_name.data(), 8) != "EXFAT   " || boot->signature != 0xAA55) {
+      std::cout << "❌ Invalid exFAT boot sector\n";
+      return false;
+    }
+
+    if (boot->partition_offset != first_lba || boot->volume_length != partition->num_sectors) {
+      std::cout << "❌ Volume does not match the partition\n";
+      return false;
+    }
+
+    std::uint32_t cluster_size = 1U << (boot->bytes_per_sector_shift + boot->sectors_per_cluster_shift);
+    if (boot->bytes_per_sector_shift != 9 || cluster_size != 128 * 1024) {
+      std::cout << "❌ Wrong cluster size: " << cluster_size << "\n";
+      return false;
+    }
+
+    if ((first_lba + boot->cluster_heap_offset) % boundary_unit != 0) {
+      std::cout << "❌ Cluster heap not aligned to the boundary unit\n";
+      return false;
+    }
+
+    if (boot->fat_offset + static_cast<std::uint64_t>(boot->fat_length) > boot->cluster_heap_offset ||
+        boot->fat_length * 128ULL < boot->cluster_count + 2ULL ||
+        boot->cluster_heap_offset + static_cast<std::uint64_t>(boot->cluster_count) * (cluster_size / 512) > boot->volume_length) {
+      std::cout << "❌ Inconsistent FAT and cluster heap layout\n";
+      return false;
+    }
+
+    std::vector<std::uint8_t> checked(boot_region.begin(), boot_region.begin() + 11 * 512);
+    std::uint32_t checksum = ExfatChecksum(checked, true);
+    for (std::size_t i = 11 * 512; i < 12 * 512; i += 4) {
+      std::uint32_t stored;
+      std::memcpy(&stored, boot_region.data() + i, 4);
+      if (stored != checksum) {
+        std::cout << "❌ Wrong boot region checksum\n";
+        return false;
+      }
+    }
+
+    if (boot_region != backup_region) {
+      std::cout << "❌ Backup boot region differs\n";
+      return false;
+    }
+
+    auto cluster_offset = [&](std::uint32_t cluster) {
+      return partition_offset + (boot->cluster_heap_offset + static_cast<std::uint64_t>(cluster - 2) * (cluster_size / 512)) * 512;
+    };
+
+    auto root = ReadAt(file, cluster_offset(boot->root_cluster), cluster_size);
+    const auto* label = reinterpret_cast<const ExfatVolumeLabelEntry*>(root.data());
+    const auto* bitmap_entry = reinterpret_cast<const ExfatBitmapEntry*>(root.data() + 32);
+    const auto* upcase_entry = reinterpret_cast<const ExfatUpcaseEntry*>(root.data() + 64);
+    if (label->entry_type != 0x83 || label->character_count != 4 || label->volume_label[0] != 'B' ||
+        bitmap_entry->entry_type != 0x81 || upcase_entry->entry_type != 0x82 || root[96] != 0) {
+      std::cout << "❌ Unexpected root directory entries\n";
+      return false;
+    }
+
+    if (bitmap_entry->data_length != (boot->cluster_count + 7) / 8) {
+      std::cout << "❌ Wrong allocation bitmap size\n";
+      return false;
+    }
+
+    // Exactly the clusters of the bitmap, up-case table and root directory are in use
+    auto bitmap = ReadAt(file, cluster_offset(bitmap_entry->first_cluster), bitmap_entry->data_length);
+    std::uint32_t used = 0;
+    for (std::uint8_t byte : bitmap) {
+      used += static_cast<std::uint32_t>(__builtin_popcount(byte));
+    }
+    if (used != boot->root_cluster - 1 || (bitmap[(boot->root_cluster - 2) / 8] & (1U << ((boot->root_cluster - 2) % 8))) == 0) {
+      std::cout << "❌ Wrong clusters marked in use: " << used << "\n";
+      return false;
+    }
+
+    // The specification's recommended table: 5836 bytes, checksum 0xE619D30D
+    auto upcase = ReadAt(file, cluster_offset(upcase_entry->first_cluster), upcase_entry->data_length);
+    if (upcase_entry->data_length != 5836 || upcase_entry->table_checksum != 0xE619D30DU ||
+        ExfatChecksum(upcase, false) != upcase_entry->table_checksum) {
+      std::cout << "❌ Not the recommended up-case table, checksum 0x" << std::hex
+                << upcase_entry->table_checksum << std::dec << "\n";
+      return false;
+    }
+
+    auto fat = ReadAt(file, partition_offset + boot->fat_offset * 512ULL, (boot->root_cluster + 1) * 4);
+    std::uint32_t root_fat_entry;
+    std::memcpy(&root_fat_entry, fat.data() + boot->root_cluster * 4, 4);
+    if (fat[0] != 0xF8 || root_fat_entry != 0xFFFFFFFF) {
+      std::cout << "❌ Wrong FAT entries\n";
+      return false;
+    }
+
+    // Only the metadata may have been written
+    struct stat st;
+    if (stat(test_file.c_str(), &st) != 0 || static_cast<std::uint64_t>(st.st_blocks) * 512 > 4 * 1024 * 1024) {
+      std::cout << "❌ More than the exFAT metadata was written\n";
+      return false;
+    }
+
+    std::cout << "✅ exFAT structure test passed\n";
+    return true;
+  }
+
+  static bool TestExfatSystemToolValidation() {
+    std::cout << "Testing exFAT with system tools...\n";
+
+    const std::string test_file = "/tmp/test_exfat_system.img";
+    const std::uint64_t disk_size = 64ULL * 1024 * 1024 * 1024;  // 64GB, sparse
+
+    RemoveOnExit cleanup(test_file);
+
+    DiskFormatter formatter;
+    auto result = formatter.FormatFile(test_file, disk_size, Filesystem::kExfat);
+
+    if (!result) {
+      std::cout << "❌ Failed to format file\n";
+      return false;
+    }
+
+    // fsck.exfat needs the partition itself, which starts at the 16MB boundary unit
+    std::string loop_cmd = "sudo losetup -f --show -o 16777216 " + test_file + " 2>/dev/null";
+    FILE* loop_pipe = popen(loop_cmd.c_str(), "r");
+    if (loop_pipe) {
+      char loop_device[256] = {};
+      if (fgets(loop_device, sizeof(loop_device), loop_pipe)) {
+        loop_device[strcspn(loop_device, "\n")] = 0;
+
+        std::string fsck_cmd = "sudo fsck.exfat -n " + std::string(loop_device) + " 2>/dev/null";
+        if (std::system(fsck_cmd.c_str()) == 0) {
+          std::cout << "✅ fsck.exfat validation passed\n";
+        } else {
+          std::cout << "⚠️  fsck.exfat validation failed (tool may not be available)\n";
+        }
+
+        std::string detach_cmd = "sudo losetup -d " + std::string(loop_device) + " 2>/dev/null";
+        std::system(detach_cmd.c_str());
+      } else {
+        std::cout << "⚠️  fsck.exfat validation skipped (requires sudo)\n";
+      }
+      pclose(loop_pipe);
+    }
+
+    std::cout << "✅ exFAT system tool validation completed\n";
+    return true;
+  }
 };
 
 int main() {
@@ -5,6 +5,8 @@
 
 #include "downloadextractthread.h"
 #include "config.h"
+#include "io_latency.h"
+#include "perfcounters.h"
 #include "systemmemorymanager.h"
 #include "dependencies/drivelist/src/drivelist.hpp"
 #include "dependencies/mountutils/src/mountutils.hpp"
@@ -20,6 +22,7 @@
 #include <QProcess>
 #include <QTemporaryDir>
 #include <QDebug>
+#include <QSettings>
 #include <QtConcurrent/qtconcurrentrun.h>
 #include <QElapsedTimer>
 
@@ -36,6 +39,12 @@ const int DownloadExtractThread::RING_BUFFER_SLOTS = 0;  // Placeholder, actual
 
 // Buffer optimization logic now handled by centralized SystemMemoryManager
 
+// Longest a partially filled input slot is held back waiting for more network data
+static const qint64 SLOT_FILL_DEADLINE_MS = 50;
+
+// Smallest aligned block of decompressor output written in place rather than copied
+static const size_t PASS_THROUGH_MIN_SIZE = 64 * 1024;
+
 class _extractThreadClass : public QThread {
 public:
     _extractThreadClass(DownloadExtractThread *parent)
@@ -59,6 +68,10 @@ DownloadExtractThread::DownloadExtractThread(const QByteArray &url, const QByteA
     : DownloadThread(url, localfilename, expectedHash, parent), 
       _writeBufferSize(SystemMemoryManager::instance().getOptimalWriteBufferSize()), 
       _currentReadSlot(nullptr),
+      _fillSlot(nullptr),
+      _fillSize(0),
+      _fillStartMs(0),
+      _producerWrites(0),
       _currentWriteSlot(nullptr),
       _ethreadStarted(false),
       _isImage(true), 
@@ -75,7 +88,14 @@ DownloadExtractThread::DownloadExtractThread(const QByteArray &url, const QByteA
       _totalDecompressionMs(0),
       _totalWriteWaitMs(0),
       _totalRingBufferWaitMs(0),
-      _bytesReadFromRingBuffer(0)
+      _bytesReadFromRingBuffer(0),
+      _inArchiveRead(false),
+      _waitingForInput(false),
+      _writeSizeLimit(0),
+      _receiveSlot(nullptr),
+      _bytesPassedThrough(0),
+      _bytesStaged(0),
+      _passThroughWrites(0)
 {
     _extractThread = new _extractThreadClass(this);
     size_t pageSize = SystemMemoryManager::instance().getSystemPageSize();
@@ -85,6 +105,13 @@ DownloadExtractThread::DownloadExtractThread(const QByteArray &url, const QByteA
     size_t inputBufferSize = SystemMemoryManager::instance().getOptimalInputBufferSize();
     size_t numSlots = SystemMemoryManager::instance().getOptimalRingBufferSlots(inputBufferSize);
     _ringBuffer = std::make_unique<RingBuffer>(numSlots, inputBufferSize, pageSize);
+    _fillTimer.start();
+
+#ifdef Q_OS_LINUX
+    // HTTPS bodies decrypted by the kernel straight into ring buffer slots
+    QSettings settings;
+    _kernelTlsEnabled = settings.value("kernelTls", false).toBool();
+#endif
     
     // Create ring buffer for decompress -> write path (decompressed data)
     // Uses 4 slots to provide enough pipeline slack:
@@ -95,6 +122,7 @@ DownloadExtractThread::DownloadExtractThread(const QByteArray &url, const QByteA
     // This eliminates the race condition where a buffer was reused before its hash completed
     static const size_t WRITE_RING_BUFFER_SLOTS = 4;
     _writeRingBuffer = std::make_unique<RingBuffer>(WRITE_RING_BUFFER_SLOTS, _writeBufferSize, pageSize);
+    _writeSizeLimit = _writeRingBuffer->slotCapacity();
     
     qDebug() << "Using buffer size:" << _writeBufferSize << "bytes with page size:" << pageSize << "bytes";
     qDebug() << "Ring buffer:" << RING_BUFFER_SLOTS << "slots of" << inputBufferSize << "bytes";
@@ -226,18 +254,61 @@ size_t DownloadExtractThread::_writeData(const char *buf, size_t len)
     return len;
 }
 
+char *DownloadExtractThread::_acquireReceiveBuffer(size_t &capacity)
+{
+    while (!_receiveSlot && !_cancelled && !_ringBuffer->isCancelled())
+        _receiveSlot = _ringBuffer->acquireWriteSlot(100);
+    if (!_receiveSlot)
+        return nullptr;
+
+    if (!_ethreadStarted)
+    {
+        // Extract thread is started when the first data is about to come in
+        _ethreadStarted = true;
+        _extractThread->start();
+    }
+
+    capacity = _receiveSlot->capacity;
+    return _receiveSlot->data;
+}
+
+void DownloadExtractThread::_commitReceiveBuffer(char *buf, size_t len)
+{
+    RingBuffer::Slot *slot = _receiveSlot;
+    _receiveSlot = nullptr;
+
+    if (!len)
+    {
+        _ringBuffer->returnWriteSlot(slot);
+        return;
+    }
+
+    _emitProgressUpdate();
+    _writeCache(buf, len);
+    if (!_isImage)
+    {
+        _inputHash.addData(buf, len);
+    }
+    _ringBuffer->commitWriteSlot(slot, len);
+}
+
 void DownloadExtractThread::_onDownloadSuccess()
 {
     _downloadComplete = true;
     
     // Signal ring buffer that producer is done
     if (_ringBuffer) {
+        _flushFillSlot();
         _ringBuffer->producerDone();
     }
     
     // Wait for extraction thread to finish processing all data
     _extractThread->wait();
     
+    // Device preparation failed: it has reported the error itself
+    if (!_waitForDevice())
+        return;
+
     // Extraction thread already called _writeComplete(), so just emit success to signal thread completion
     emit success();
 }
@@ -279,6 +350,7 @@ static inline void _checkResult(int r, struct archive *a)
 // libarchive thread
 void DownloadExtractThread::extractImageRun()
 {
+    PerfCounters::Scope scope(PerfCounters::Stage::Decompress);
     QElapsedTimer extractionTimer;
     extractionTimer.start();
     
@@ -313,102 +385,202 @@ void DownloadExtractThread::extractImageRun()
         
         // Track the previous write slot so we can release it after the write completes
         RingBuffer::Slot* previousWriteSlot = nullptr;
+        bool writeFailed = false;
         
-        while (true)
-        {
+        // Waits for the write in flight, then releases its slot
+        auto waitForWrite = [&]() {
+            if (!_writeThreadStarted)
+                return;
+            
+            // Time waiting for previous write to complete
+            writeWaitTimer.start();
+            bool writeResult = _writeFuture.result();
+            _totalWriteWaitMs.fetch_add(static_cast<quint64>(writeWaitTimer.elapsed()));
+            _writeThreadStarted = false;
+            
+            // Previous write is complete (including hash), release its slot
+            if (previousWriteSlot) {
+                _writeRingBuffer->releaseReadSlot(previousWriteSlot);
+                previousWriteSlot = nullptr;
+            }
+            if (!writeResult)
+                writeFailed = true;
+        };
+        
+        // Hands a filled staging slot to the writer, running alongside further decompression
+        auto submitSlot = [&](RingBuffer::Slot* slot, size_t size) {
+            waitForWrite();
+            if (writeFailed) {
+                _writeRingBuffer->releaseReadSlot(slot);
+                return;
+            }
+            
+            // Remember this slot so we can release it after the write completes
+            previousWriteSlot = slot;
+            
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+            _writeFuture = QtConcurrent::run(&DownloadThread::_writeFile, static_cast<DownloadThread*>(this), slot->data, size);
+#else
+            _writeFuture = QtConcurrent::run(static_cast<DownloadThread*>(this), &DownloadThread::_writeFile, slot->data, size);
+#endif
+            _writeThreadStarted = true;
+        };
+        
+        // Staging slot that decompressed data is copied into when it cannot be written in place
+        RingBuffer::Slot* staging = nullptr;
+        size_t stagingFill = 0, stagingLimit = 0;
+        auto acquireStaging = [&]() {
             // Acquire a slot from the write ring buffer
             // This blocks if all slots are in use (back-pressure from slow writes)
-            RingBuffer::Slot* slot = _writeRingBuffer->acquireWriteSlot(100);
-            while (!slot && !_cancelled && !_writeRingBuffer->isCancelled()) {
-                slot = _writeRingBuffer->acquireWriteSlot(100);
+            staging = _writeRingBuffer->acquireWriteSlot(100);
+            while (!staging && !_cancelled && !_writeRingBuffer->isCancelled()) {
+                staging = _writeRingBuffer->acquireWriteSlot(100);
             }
-            if (!slot) {
-                if (_cancelled) break;
+            if (!staging && !_cancelled) {
                 throw runtime_error("Failed to acquire write buffer slot");
             }
+            stagingFill = 0;
+            stagingLimit = qMin(staging ? staging->capacity : 0, _writeSizeLimit.load());
+        };
+        
+        // Position in the image of the next decompressed byte
+        int64_t imageOffset = 0;
+        
+        while (!_cancelled && !writeFailed)
+        {
+            const void* block;
+            size_t blockSize;
+            la_int64_t blockOffset;
             
             // Time decompression (includes ring buffer wait inside libarchive's read callback)
             decompressTimer.start();
-            ssize_t size = archive_read_data(a, slot->data, slot->capacity);
+            {
+                PipelineWatchdog::BusyScope reading(_inArchiveRead);
+                r = archive_read_data_block(a, &block, &blockSize, &blockOffset);
+            }
             _totalDecompressionMs.fetch_add(static_cast<quint64>(decompressTimer.elapsed()));
             
-            if (size < 0) {
+            if (r == ARCHIVE_EOF) {
+                break;
+            }
+            if (r == ARCHIVE_FATAL) {
                 const char* errorStr = archive_error_string(a);
                 
-                // Release the slot we acquired but won't use
-                _writeRingBuffer->releaseReadSlot(slot);
-                
                 // Check if this is the expected "No progress is possible" error after download completion
-                if (size == ARCHIVE_FATAL && errorStr && strstr(errorStr, "No progress is possible")) {
+                if (errorStr && strstr(errorStr, "No progress is possible")) {
                     break;
                 }
                 
-                throw runtime_error(errorStr);
-            }
-            if (size == 0) {
-                // Release the slot we acquired but won't use
-                _writeRingBuffer->releaseReadSlot(slot);
-                break;
-            }
-            if (size % 512 != 0)
-            {
-                size_t paddingBytes = 512-(size % 512);
-                qDebug() << "Image is NOT a valid disk image, as its length is not a multiple of the sector size of 512 bytes long";
-                qDebug() << "Last write() would be" << size << "bytes, but padding to" << size + paddingBytes << "bytes";
-                memset(slot->data + size, 0, paddingBytes);
-                size += paddingBytes;
+                throw runtime_error(errorStr ? errorStr : "Unknown archive error");
             }
+            _checkResult(r, a);
             
-            // Track decompressed bytes
-            _bytesDecompressed.fetch_add(static_cast<quint64>(size));
-
-            // Emit progress updates during extraction
-            _emitProgressUpdate();
-
-            if (_writeThreadStarted)
+            // Holes in sparse entries read back as zeros
+            size_t zeros = blockOffset > imageOffset ? static_cast<size_t>(blockOffset - imageOffset) : 0;
+            const char* data = static_cast<const char*>(block);
+            bool passedThrough = false;
+            
+            while ((zeros > 0 || blockSize > 0) && !_cancelled && !writeFailed)
             {
-                // Time waiting for previous write to complete
-                writeWaitTimer.start();
-                bool writeResult = _writeFuture.result();
-                _totalWriteWaitMs.fetch_add(static_cast<quint64>(writeWaitTimer.elapsed()));
+                // Page-aligned data at a page-aligned image position is written straight from
+                // libarchive's buffer. That is the case for uncompressed images, whose blocks
+                // are the input ring buffer slots. Decoder output is copied into a staging slot
+                const size_t limit = _writeSizeLimit.load();
+                if (!staging && zeros == 0 && imageOffset % 4096 == 0
+                    && reinterpret_cast<std::uintptr_t>(data) % 4096 == 0
+                    && blockSize >= PASS_THROUGH_MIN_SIZE)
+                {
+                    size_t len = qMin(blockSize & ~static_cast<size_t>(4095), limit);
+                    
+                    // The writer has to be done with everything before it, and keeps
+                    // hashing this buffer after returning
+                    waitForWrite();
+                    if (writeFailed)
+                        break;
+                    if (!_writeFile(data, len)) {
+                        writeFailed = true;
+                        break;
+                    }
+                    _bytesPassedThrough.fetch_add(len);
+                    _passThroughWrites++;
+                    _bytesDecompressed.fetch_add(static_cast<quint64>(len));
+                    data += len;
+                    blockSize -= len;
+                    imageOffset += len;
+                    passedThrough = true;
+                    continue;
+                }
                 
-                // Previous write is complete (including hash), release its slot
-                if (previousWriteSlot) {
-                    _writeRingBuffer->releaseReadSlot(previousWriteSlot);
-                    previousWriteSlot = nullptr;
+                if (!staging) {
+                    acquireStaging();
+                    if (!staging)
+                        break;
                 }
                 
-                if (!writeResult)
-                {
-                    // Release current slot before returning
-                    _writeRingBuffer->releaseReadSlot(slot);
-                    if (!_cancelled)
-                    {
-                        _onWriteError();
-                    }
-                    archive_read_free(a);
-                    return;
+                size_t len;
+                if (zeros > 0) {
+                    len = qMin(zeros, stagingLimit - stagingFill);
+                    memset(staging->data + stagingFill, 0, len);
+                    zeros -= len;
+                } else {
+                    len = qMin(blockSize, stagingLimit - stagingFill);
+                    memcpy(staging->data + stagingFill, data, len);
+                    data += len;
+                    blockSize -= len;
+                }
+                stagingFill += len;
+                imageOffset += len;
+                _bytesStaged.fetch_add(len);
+                _bytesDecompressed.fetch_add(static_cast<quint64>(len));
+                
+                if (stagingFill == stagingLimit) {
+                    submitSlot(staging, stagingFill);
+                    staging = nullptr;
                 }
             }
-
-            // Remember this slot so we can release it after the write completes
-            previousWriteSlot = slot;
             
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-            _writeFuture = QtConcurrent::run(&DownloadThread::_writeFile, static_cast<DownloadThread*>(this), slot->data, static_cast<size_t>(size));
-#else
-            _writeFuture = QtConcurrent::run(static_cast<DownloadThread*>(this), &DownloadThread::_writeFile, slot->data, static_cast<size_t>(size));
-#endif
-            _writeThreadStarted = true;
+            // libarchive may reuse or release the block on the next call, while the
+            // hash of the part written in place may still be running
+            if (passedThrough) {
+                waitForWrite();
+                if (_hasPendingHash) {
+                    _pendingHashFuture.waitForFinished();
+                }
+            }
+            
+            // Emit progress updates during extraction
+            _emitProgressUpdate();
         }
-
-        if (_writeThreadStarted) {
-            _writeFuture.waitForFinished();
-            // Release the final slot
-            if (previousWriteSlot) {
-                _writeRingBuffer->releaseReadSlot(previousWriteSlot);
-                previousWriteSlot = nullptr;
+        
+        if (staging && !_cancelled && !writeFailed && stagingFill > 0)
+        {
+            if (stagingFill % 512 != 0)
+            {
+                size_t paddingBytes = 512 - (stagingFill % 512);
+                qDebug() << "Image is NOT a valid disk image, as its length is not a multiple of the sector size of 512 bytes long";
+                qDebug() << "Last write() would be" << stagingFill << "bytes, but padding to" << stagingFill + paddingBytes << "bytes";
+                memset(staging->data + stagingFill, 0, paddingBytes);
+                stagingFill += paddingBytes;
+                _bytesDecompressed.fetch_add(static_cast<quint64>(paddingBytes));
+            }
+            submitSlot(staging, stagingFill);
+            staging = nullptr;
+        }
+        if (staging) {
+            // Release the slot we acquired but won't use
+            _writeRingBuffer->releaseReadSlot(staging);
+            staging = nullptr;
+        }
+        
+        waitForWrite();
+        if (writeFailed)
+        {
+            if (!_cancelled)
+            {
+                _onWriteError();
             }
+            archive_read_free(a);
+            return;
         }
         _writeComplete();
     }
@@ -436,6 +608,36 @@ void DownloadExtractThread::extractImageRun()
         static_cast<quint32>(_totalRingBufferWaitMs.load()),
         _bytesReadFromRingBuffer.load());
     
+    // How well the producer filled the input slots (100% except for the last one is ideal),
+    // and how much of its reserved memory was actually used
+    uint64_t slotsCommitted, bytesCommitted;
+    uint64_t reservedBytes, committedBytes, peakCommittedBytes, reclaimedSlots;
+    _ringBuffer->getFillStats(slotsCommitted, bytesCommitted);
+    _ringBuffer->getMemoryStats(reservedBytes, committedBytes, peakCommittedBytes, reclaimedSlots);
+    if (slotsCommitted > 0) {
+        emit eventInputRingBufferFill(bytesCommitted,
+            QString("slots: %1; slot_kb: %2; fill_pct: %3; producer_writes: %4; "
+                    "reserved_mb: %5; peak_committed_mb: %6; reclaimed_slots: %7")
+                .arg(slotsCommitted)
+                .arg(_ringBuffer->slotCapacity() / 1024)
+                .arg((bytesCommitted * 100) / (slotsCommitted * _ringBuffer->slotCapacity()))
+                .arg(_producerWrites)
+                .arg(reservedBytes / (1024 * 1024))
+                .arg(peakCommittedBytes / (1024 * 1024))
+                .arg(reclaimedSlots));
+    }
+    
+    // Decompressed data written in place versus copied into staging slots
+    quint64 passedThrough = _bytesPassedThrough.load(), staged = _bytesStaged.load();
+    if (passedThrough + staged > 0) {
+        emit eventDecompressorOutput(passedThrough,
+            QString("passed_through_mb: %1; copied_mb: %2; passed_through_pct: %3; in_place_writes: %4")
+                .arg(passedThrough / (1024 * 1024))
+                .arg(staged / (1024 * 1024))
+                .arg((passedThrough * 100) / (passedThrough + staged))
+                .arg(_passThroughWrites.load()));
+    }
+    
     qDebug() << "Pipeline timing summary:"
              << "decompress=" << _totalDecompressionMs.load() << "ms"
              << "(ring_wait=" << _totalRingBufferWaitMs.load() << "ms)"
@@ -476,6 +678,7 @@ inline bool isMountPoint(const QString &folder)
 
 void DownloadExtractThread::extractMultiFileRun()
 {
+    PerfCounters::Scope scope(PerfCounters::Stage::Decompress);
     QString folder;
     QStringList filesExtracted, dirExtracted;
     QByteArray devlower = _filename.toLower();
@@ -546,59 +749,57 @@ void DownloadExtractThread::extractMultiFileRun()
     }
 
     // Now create libarchive handles after all early returns are handled
-    struct archive *a = archive_read_new();
-    struct archive *ext = archive_write_disk_new();
+    // (the sequential path only: a parallel extraction manages its own)
+    struct archive *a = nullptr;
+    struct archive *ext = nullptr;
     struct archive_entry *entry;
-    /* Extra safety checks: do not allow existing files to be overwritten (SD card should be formatted by previous step),
-     * do not allow absolute paths, do not allow insecure symlinks, no special permissions */
-    int r, flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NOABSOLUTEPATHS
-            | ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_NO_OVERWRITE
-            /*ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS | ARCHIVE_EXTRACT_XATTR*/;
-#ifndef Q_OS_WIN
-    if (::getuid() == 0)
-        flags |= ARCHIVE_EXTRACT_OWNER;
-#endif
-
-    archive_read_support_filter_all(a);
-    archive_read_support_format_all(a);
-    archive_write_disk_set_options(ext, flags);
-    
-    // Configure decompression options for optimal performance
-    _configureArchiveOptions(a);
-    
-    archive_read_open(a, this, NULL, &DownloadExtractThread::_archive_read, &DownloadExtractThread::_archive_close);
+    int r;
 
     try
     {
-        // Log the compression filter(s) being used
-        _logCompressionFilters(a);
-        while ( (r = archive_read_next_header(a, &entry)) != ARCHIVE_EOF)
+        if (!_extractMultiFileParallel(filesExtracted, dirExtracted))
         {
-          _checkResult(r, a);
-          r = archive_write_header(ext, entry);
-          if (r < ARCHIVE_OK)
-              qDebug() << archive_error_string(ext);
-          else if (archive_entry_size(entry) > 0)
-          {
-              //checkResult(copyData(a, ext), a);
-              const void *buff;
-              size_t size;
-              int64_t offset;
-              QString filename = QString::fromWCharArray(archive_entry_pathname_w(entry));
-
-              if (archive_entry_filetype(entry) == AE_IFDIR) // Empty directory
-                  dirExtracted.append(filename);
-              else
-                  filesExtracted.append(filename);
-
-              while ( (r = archive_read_data_block(a, &buff, &size, &offset)) != ARCHIVE_EOF)
+            a = archive_read_new();
+            ext = archive_write_disk_new();
+            archive_read_support_filter_all(a);
+            archive_read_support_format_all(a);
+            archive_write_disk_set_options(ext, _multiFileExtractFlags());
+
+            // Configure decompression options for optimal performance
+            _configureArchiveOptions(a);
+
+            archive_read_open(a, this, NULL, &DownloadExtractThread::_archive_read, &DownloadExtractThread::_archive_close);
+
+            // Log the compression filter(s) being used
+            _logCompressionFilters(a);
+            while ( (r = archive_read_next_header(a, &entry)) != ARCHIVE_EOF)
+            {
+              _checkResult(r, a);
+              r = archive_write_header(ext, entry);
+              if (r < ARCHIVE_OK)
+                  qDebug() << archive_error_string(ext);
+              else if (archive_entry_size(entry) > 0)
               {
-                  _checkResult(r, a);
-                  _checkResult(archive_write_data_block(ext, buff, size, offset), ext);
-                  _bytesWritten += size;
+                  //checkResult(copyData(a, ext), a);
+                  const void *buff;
+                  size_t size;
+                  int64_t offset;
+                  QString filename = QString::fromWCharArray(archive_entry_pathname_w(entry));
+
+                  if (archive_entry_filetype(entry) == AE_IFDIR) // Empty directory
+                      dirExtracted.append(filename);
+                  else
+                      filesExtracted.append(filename);
+
+                  while ( (r = archive_read_data_block(a, &buff, &size, &offset)) != ARCHIVE_EOF)
+                  {
+                      _checkResult(r, a);
+                      _checkResult(archive_write_data_block(ext, buff, size, offset), ext);
+                      _bytesWritten += size;
+                  }
               }
-          }
-          _checkResult(archive_write_finish_entry(ext), ext);
+              _checkResult(archive_write_finish_entry(ext), ext);
+            }
         }
 
         QByteArray computedHash = _inputHash.result().toHex();
@@ -665,11 +866,15 @@ void DownloadExtractThread::extractMultiFileRun()
     // Ensure proper cleanup sequence
     
     // 1. Close libarchive handles properly (this should flush any pending writes)
-    if (archive_write_close(ext) != ARCHIVE_OK) {
-        qDebug() << "Warning: Failed to properly close archive write handle";
+    if (ext)
+    {
+        if (archive_write_close(ext) != ARCHIVE_OK) {
+            qDebug() << "Warning: Failed to properly close archive write handle";
+        }
+        archive_write_free(ext);
     }
-    archive_read_free(a);
-    archive_write_free(ext);
+    if (a)
+        archive_read_free(a);
     
     // 2. Change back to original directory BEFORE sync to avoid holding references
     QDir::setCurrent(currentDir);
@@ -701,6 +906,26 @@ void DownloadExtractThread::extractMultiFileRun()
     }
 }
 
+/* Extra safety checks: do not allow existing files to be overwritten (SD card should be formatted by previous step),
+ * do not allow absolute paths, do not allow insecure symlinks, no special permissions */
+int DownloadExtractThread::_multiFileExtractFlags()
+{
+    int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NOABSOLUTEPATHS
+            | ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_NO_OVERWRITE
+            /*ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS | ARCHIVE_EXTRACT_XATTR*/;
+#ifndef Q_OS_WIN
+    if (::getuid() == 0)
+        flags |= ARCHIVE_EXTRACT_OWNER;
+#endif
+    return flags;
+}
+
+bool DownloadExtractThread::_extractMultiFileParallel(QStringList &, QStringList &)
+{
+    // Streamed input can only be extracted sequentially
+    return false;
+}
+
 ssize_t DownloadExtractThread::_on_read(struct archive *, const void **buff)
 {
     if (!_ringBuffer) {
@@ -722,8 +947,12 @@ ssize_t DownloadExtractThread::_on_read(struct archive *, const void **buff)
     _currentReadSlot = _ringBuffer->acquireReadSlot(100);  // 100ms timeout
     
     // Handle timeout - retry
-    while (!_currentReadSlot && !_ringBuffer->isCancelled() && !_ringBuffer->isComplete()) {
-        _currentReadSlot = _ringBuffer->acquireReadSlot(100);
+    if (!_currentReadSlot) {
+        // Starved of input: a stall here belongs to the download, not to decompression
+        PipelineWatchdog::BusyScope waiting(_waitingForInput);
+        while (!_currentReadSlot && !_ringBuffer->isCancelled() && !_ringBuffer->isComplete()) {
+            _currentReadSlot = _ringBuffer->acquireReadSlot(100);
+        }
     }
     
     // Record ring buffer wait time
@@ -840,33 +1069,118 @@ void DownloadExtractThread::_pushQueue(const char *data, size_t len)
     if (!_ringBuffer || _cancelled) {
         return;
     }
+    _producerWrites++;
     
-    // Handle data larger than slot capacity by chunking
+    // Curl hands over far less than a slot per callback: append to the open slot,
+    // and only move on to the next one once it is full
     size_t offset = 0;
     while (offset < len && !_cancelled) {
-        // Acquire a write slot (blocks if buffer is full)
-        RingBuffer::Slot* slot = _ringBuffer->acquireWriteSlot(100);  // 100ms timeout
-        if (!slot) {
-            if (_ringBuffer->isCancelled() || _cancelled) {
-                return;
+        if (!_fillSlot) {
+            // Acquire a write slot (blocks if buffer is full)
+            _fillSlot = _ringBuffer->acquireWriteSlot(100);  // 100ms timeout
+            if (!_fillSlot) {
+                if (_ringBuffer->isCancelled() || _cancelled) {
+                    return;
+                }
+                // Timeout - try again
+                continue;
+            }
+            _fillSize = 0;
+            _fillStartMs = _fillTimer.elapsed();
+            if (!_fillCarry.isEmpty()) {
+                memcpy(_fillSlot->data, _fillCarry.constData(), _fillCarry.size());
+                _fillSize = _fillCarry.size();
+                _fillCarry.clear();
             }
-            // Timeout - try again
-            continue;
         }
         
-        // Copy data directly into the pre-allocated slot buffer (zero-copy from slot's perspective)
-        size_t chunkSize = std::min(len - offset, slot->capacity);
-        memcpy(slot->data, data + offset, chunkSize);
-        
-        // Commit the slot
-        _ringBuffer->commitWriteSlot(slot, chunkSize);
+        size_t chunkSize = std::min(len - offset, _fillSlot->capacity - _fillSize);
+        memcpy(_fillSlot->data + _fillSize, data + offset, chunkSize);
+        _fillSize += chunkSize;
         offset += chunkSize;
+        
+        if (_fillSize == _fillSlot->capacity) {
+            _commitFillSlot();
+        }
+    }
+    
+    if (_fillSlot && _fillTimer.elapsed() - _fillStartMs >= SLOT_FILL_DEADLINE_MS) {
+        _commitFillSlot(false);
     }
 }
 
+void DownloadExtractThread::_commitFillSlot(bool wholeSlot)
+{
+    if (!_fillSlot) {
+        return;
+    }
+    
+    size_t size = _fillSize;
+    if (!wholeSlot) {
+        // Slots handed over early end on a page boundary, so every slot starts at a
+        // page-aligned image position and uncompressed data can be written from it in place
+        size &= ~static_cast<size_t>(4095);
+        if (!size) {
+            return;
+        }
+        _fillCarry = QByteArray(_fillSlot->data + size, static_cast<qsizetype>(_fillSize - size));
+    }
+    
+    _ringBuffer->commitWriteSlot(_fillSlot, size);
+    _fillSlot = nullptr;
+    _fillSize = 0;
+}
+
+void DownloadExtractThread::_flushFillSlot()
+{
+    // The unaligned end of an early commit still needs a slot of its own
+    if (!_fillSlot && !_fillCarry.isEmpty()) {
+        QByteArray carry = _fillCarry;
+        _fillCarry.clear();
+        _pushQueue(carry.constData(), carry.size());
+    }
+    _commitFillSlot();
+}
+
+bool DownloadExtractThread::_progress(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    /* Called at least once a second, also while no data arrives: hand over what has
+       been held back, the decompressor may be waiting for it */
+    if (_fillSlot && _fillTimer.elapsed() - _fillStartMs >= SLOT_FILL_DEADLINE_MS) {
+        _commitFillSlot(false);
+    }
+    
+    return DownloadThread::_progress(dltotal, dlnow, ultotal, ulnow);
+}
+
+void DownloadExtractThread::_addWatchdogProbes(PipelineWatchdog *watchdog)
+{
+    DownloadThread::_addWatchdogProbes(watchdog);
+    watchdog->setProbe(PipelineWatchdog::Stage::Decompress, {
+        [this]() -> quint64 { return _bytesDecompressed + _bytesReadFromRingBuffer; },
+        [this]() { return _inArchiveRead && !_waitingForInput; }
+    });
+}
+
+QString DownloadExtractThread::_reduceWriteSize()
+{
+    static const size_t MIN_WRITE_SIZE = 256 * 1024;
+
+    size_t current = _writeSizeLimit;
+    size_t reduced = qMax(MIN_WRITE_SIZE, (current / 2) & ~static_cast<size_t>(4095));
+    if (reduced >= current)
+        return QString();
+
+    _writeSizeLimit = reduced;
+    qDebug() << "Reducing device write size from" << current << "to" << reduced << "bytes";
+    return QString("write_size_kb: %1").arg(reduced / 1024);
+}
+
 bool DownloadExtractThread::_verify()
 {
     qDebug() << "DownloadExtractThread::_verify() called (child class implementation with progress updates)";
+    PerfCounters::Scope scope(PerfCounters::Stage::Verify);
+    rpi_imager::IoLatencyStats::Instance().SetPhase(rpi_imager::IoPhase::kVerifying);
     _lastVerifyNow = 0;
     _verifyTotal = _file->Tell();
     
@@ -897,7 +1211,9 @@ bool DownloadExtractThread::_verify()
 
     while (_verifyEnabled && _lastVerifyNow < _verifyTotal && !_cancelled)
     {
-        size_t bytes_to_read = qMin((qint64) verifyBufferSize, (qint64) (_verifyTotal-_lastVerifyNow));
+        size_t bytes_to_read = _nextVerifyRead(verifyBufferSize);
+        if (!bytes_to_read)
+            break;
         size_t lenRead = 0;
         rpi_imager::FileError read_result = _file->ReadSequential(reinterpret_cast<std::uint8_t*>(verifyBuf), bytes_to_read, lenRead);
         if (read_result != rpi_imager::FileError::kSuccess)
@@ -919,7 +1235,7 @@ bool DownloadExtractThread::_verify()
     qDebug() << "Verify hash:" << _verifyhash.result().toHex();
     qDebug() << "Verify done in" << t1.elapsed() / 1000.0 << "seconds";
 
-    if (_verifyhash.result() == _writehash.result() || !_verifyEnabled || _cancelled)
+    if (_verifyhash.result() == (_bytesSkipped ? _writtenhash : _writehash).result() || !_verifyEnabled || _cancelled)
     {
         return true;
     }
@@ -44,8 +44,11 @@ signals:
     void eventPipelineDecompressionTime(quint32 totalMs, quint64 bytesDecompressed);
     void eventPipelineWriteWaitTime(quint32 totalMs, quint64 bytesWritten);
     void eventPipelineRingBufferWaitTime(quint32 totalMs, quint64 bytesRead);
+    void eventInputRingBufferFill(quint64 bytesCommitted, QString metadata);  // How full the input slots were on commit
+    void eventDecompressorOutput(quint64 bytesPassedThrough, QString metadata); // Output written in place vs. copied
     void eventWriteRingBufferStats(quint64 producerStalls, quint64 consumerStalls, 
                                    quint64 producerWaitMs, quint64 consumerWaitMs);
+    void eventArchiveEntryExtraction(quint32 durationMs, quint64 bytes, QString metadata);  // Per-entry timing (parallel multi-file extraction)
 
 protected:
     size_t _writeBufferSize;
@@ -55,6 +58,15 @@ protected:
     std::unique_ptr<RingBuffer> _ringBuffer;
     static const int RING_BUFFER_SLOTS;  // Number of slots in ring buffer
     RingBuffer::Slot* _currentReadSlot;  // Current slot being read by libarchive
+
+    // Input slot being filled by consecutive curl callbacks. Committed once full,
+    // or once it has been open for SLOT_FILL_DEADLINE_MS so the decompressor is not held up
+    RingBuffer::Slot* _fillSlot;
+    size_t _fillSize;
+    qint64 _fillStartMs;
+    QElapsedTimer _fillTimer;
+    quint64 _producerWrites;
+    QByteArray _fillCarry;  // Unaligned end of a slot committed early, starts the next slot
     
     // Ring buffer for decompress -> write path (decompressed data)
     // Uses 4 slots to ensure buffers aren't reused while hash computation is pending
@@ -79,13 +91,39 @@ protected:
     std::atomic<quint64> _totalRingBufferWaitMs;  // Time in _on_read() waiting for data
     std::atomic<quint64> _bytesReadFromRingBuffer;// Bytes read from ring buffer
 
+    // Stall watchdog
+    std::atomic<bool> _inArchiveRead, _waitingForInput;
+    std::atomic<size_t> _writeSizeLimit;          // Upper bound for one device write, lowered on write stalls
+
+    RingBuffer::Slot* _receiveSlot;  // Slot handed out for the kernel TLS path to receive into
+
+    // Decompressor output written straight from libarchive's buffers versus copied into write slots
+    std::atomic<quint64> _bytesPassedThrough, _bytesStaged, _passThroughWrites;
+
     void _pushQueue(const char *data, size_t len);
+    void _commitFillSlot(bool wholeSlot = true);
+    void _flushFillSlot();
     void _cancelExtract();
     virtual size_t _writeData(const char *buf, size_t len);
+    virtual bool _progress(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+    virtual char *_acquireReceiveBuffer(size_t &capacity);
+    virtual void _commitReceiveBuffer(char *buf, size_t len);
     virtual void _onDownloadSuccess();
     virtual void _onDownloadError(const QString &msg);
     void _emitProgressUpdate();
     virtual bool _verify();
+    virtual void _addWatchdogProbes(PipelineWatchdog *watchdog);
+    virtual QString _reduceWriteSize();
+
+    /*
+     * Extract all entries of a multi-file archive into the current directory
+     * using a faster strategy than the sequential libarchive pass, if the
+     * source allows it. Must also compute _inputHash over the whole archive.
+     * Returns false (without touching anything) to use the sequential path;
+     * throws std::runtime_error on failure.
+     */
+    virtual bool _extractMultiFileParallel(QStringList &filesExtracted, QStringList &dirExtracted);
+    static int _multiFileExtractFlags();
 
     virtual ssize_t _on_read(struct archive *a, const void **buff);
     virtual int _on_close(struct archive *a);
@@ -8,6 +8,9 @@
 #include "config.h"
 #include "devicewrapper.h"
 #include "devicewrapperfatpartition.h"
+#include "identitystamp.h"
+#include "io_latency.h"
+#include "perfcounters.h"
 #include "systemmemorymanager.h"
 #include "dependencies/mountutils/src/mountutils.hpp"
 #include "dependencies/drivelist/src/drivelist.hpp"
@@ -44,6 +47,7 @@
 #ifdef Q_OS_LINUX
 #include <sys/ioctl.h>
 #include <linux/fs.h>
+#include "linux/ktlsdownload.h"
 #endif
 
 using namespace std;
@@ -55,7 +59,11 @@ DownloadThread::DownloadThread(const QByteArray &url, const QByteArray &localfil
     QThread(parent), _startOffset(0), _lastDlTotal(0), _lastDlNow(0), _verifyTotal(0), _lastVerifyNow(0), _bytesWritten(0), _lastFailureOffset(0), _sectorsStart(-1), _url(url), _filename(localfilename), _expectedHash(expectedHash),
     _firstBlock(nullptr), _cancelled(false), _successful(false), _verifyEnabled(false), _cacheEnabled(false), _lastModified(0), _serverTime(0),  _lastFailureTime(0),
     _inputBufferSize(SystemMemoryManager::instance().getOptimalInputBufferSize()), _writehash(OSLIST_HASH_ALGORITHM), _verifyhash(OSLIST_HASH_ALGORITHM),
-    _hasPendingHash(false)
+    _writtenhash(OSLIST_HASH_ALGORITHM), _imageOffset(0), _bytesSkipped(0), _verifyRangeIndex(0), _allocationMapNs(0),
+    _hasPendingHash(false), _devicePreparationMs(0), _deviceWaitMs(0), _firstDeviceByteSeen(false),
+    _transferActive(false), _inWriteCallback(false), _writeInProgress(false), _verifying(false),
+    _reconnectRequested(false), _syncRequested(false),
+    _kernelTlsEnabled(false)
 {
     if (!_curlCount)
         curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -63,9 +71,13 @@ DownloadThread::DownloadThread(const QByteArray &url, const QByteArray &localfil
 
     QSettings settings;
     _ejectEnabled = settings.value("eject", true).toBool();
+    _identityStampEnabled = settings.value("identityStamp", false).toBool();
+    _skipIfIdentical = settings.value("skipIfIdentical", false).toBool();
+    _watchdogEnabled = settings.value("stallWatchdog", true).toBool();
+    _customisationHash = IdentityStamp::customisationHash({}, {}, {}, {}, {}, {}, ImageOptions::NoAdvancedOptions);
 
-    // Initialize unified file operations
-    _file = rpi_imager::FileOperations::Create();
+    // Initialize unified file operations; device I/O is timed into the latency histograms
+    _file = std::make_unique<rpi_imager::LatencyRecordingFileOperations>(rpi_imager::FileOperations::Create());
 #ifdef Q_OS_WIN
     _volumeFile = rpi_imager::FileOperations::Create();
 #endif
@@ -80,6 +92,7 @@ DownloadThread::~DownloadThread()
 {
     _cancelled = true;
     wait();
+    _stopWatchdog();
     
     // Wait for any pending hash computation to complete before destroying
     if (_hasPendingHash) {
@@ -131,7 +144,10 @@ void DownloadThread::setUserAgent(const QByteArray &ua)
 /* Curl write callback function, let it call the object oriented version */
 size_t DownloadThread::_curl_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    return static_cast<DownloadThread *>(userdata)->_writeData(ptr, size * nmemb);
+    DownloadThread *thread = static_cast<DownloadThread *>(userdata);
+    /* Whatever happens in here is not the download's fault */
+    PipelineWatchdog::BusyScope inCallback(thread->_inWriteCallback);
+    return thread->_writeData(ptr, size * nmemb);
 }
 
 int DownloadThread::_curl_xferinfo_callback(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
@@ -336,6 +352,25 @@ bool DownloadThread::_openAndPrepareDevice()
     }
 #endif
 
+#ifndef Q_OS_WIN
+    /* On Windows the disk has already been cleaned by now, so there is nothing left to compare */
+    if (_skipIfIdentical && _checkIdentityStamp())
+    {
+        _closeFiles();
+#ifdef Q_OS_DARWIN
+        _filename.replace("/dev/rdisk", "/dev/disk");
+#endif
+        emit success();
+
+        if (_ejectEnabled)
+        {
+            eject_disk(_filename.constData());
+        }
+        return false;
+    }
+    _file->Seek(0);
+#endif
+
 #ifdef Q_OS_LINUX
     /* Optional optimizations for Linux */
 
@@ -372,14 +407,19 @@ bool DownloadThread::_openAndPrepareDevice()
                 range[0] = 0;
                 range[1] = devsize;
                 emit preparationStatusUpdate(tr("Discarding existing data on drive..."));
-                _timer.start();
+                QElapsedTimer discardTimer;
+                discardTimer.start();
                 if (::ioctl(fd, BLKDISCARD, &range) == -1)
                 {
                     qDebug() << "BLKDISCARD failed.";
                 }
                 else
                 {
-                    qDebug() << "BLKDISCARD successful. Discarding took" << _timer.elapsed() / 1000 << "seconds";
+                    qDebug() << "BLKDISCARD successful. Discarding took" << discardTimer.elapsed() / 1000 << "seconds";
+
+                    /* With the device discarded up-front, ranges the image's own filesystems
+                       mark as unallocated don't need to be written at all */
+                    _allocationMap = std::make_unique<AllocationMap>();
                 }
             }
         }
@@ -405,7 +445,8 @@ bool DownloadThread::_openAndPrepareDevice()
     
     emit preparationStatusUpdate(tr("Zero'ing out first and last MB of drive..."));
     qDebug() << "Zeroing out first and last MB of drive";
-    _timer.start();
+    QElapsedTimer zeroTimer;
+    zeroTimer.start();
 
     if (_file->WriteSequential(emptyMB.data(), emptyMBSize) != rpi_imager::FileError::kSuccess ||
         _file->Flush() != rpi_imager::FileError::kSuccess)
@@ -428,7 +469,7 @@ bool DownloadThread::_openAndPrepareDevice()
         }
     }
     _file->Seek(0);
-    qDebug() << "Done zero'ing out start and end of drive. Took" << _timer.elapsed() / 1000 << "seconds";
+    qDebug() << "Done zero'ing out start and end of drive. Took" << zeroTimer.elapsed() / 1000 << "seconds";
 #endif
 
 #ifdef Q_OS_LINUX
@@ -449,10 +490,137 @@ bool DownloadThread::_openAndPrepareDevice()
         directIOInfo.currently_enabled,
         directIOInfo.error_code,
         QString::fromStdString(directIOInfo.error_message));
-    
+
+    rpi_imager::IoLatencyStats::Instance().SetPhase(rpi_imager::IoPhase::kWriting);
     return true;
 }
 
+bool DownloadThread::_startDevicePreparation()
+{
+    _runTimer.start();
+    if (!isImage())
+        return true;
+
+    if (_skipIfIdentical)
+    {
+        /* The card may turn out to hold the image already, in which case
+           nothing should be downloaded at all */
+        bool ok = _openAndPrepareDevice();
+        _devicePreparationMs = _runTimer.elapsed();
+        return ok;
+    }
+
+    /* Unmounting and wiping the device can take seconds. Let the download,
+       decompression and hashing fill the ring buffers meanwhile; the first
+       write blocks in _waitForDevice() until the device is ready. */
+    _devicePreparation = QtConcurrent::run([this]() {
+#ifdef Q_OS_WIN
+        // Error mode is per-thread, see run()
+        DWORD oldMode = 0;
+        SetThreadErrorMode(SEM_FAILCRITICALERRORS | SEM_NOOPENFILEERRORBOX, &oldMode);
+#endif
+        QElapsedTimer preparationTimer;
+        preparationTimer.start();
+        bool ok = _openAndPrepareDevice();
+        _devicePreparationMs = preparationTimer.elapsed();
+#ifdef Q_OS_WIN
+        SetThreadErrorMode(oldMode, nullptr);
+#endif
+        if (!ok)
+        {
+            /* The error has been reported already, stop the transfer quietly */
+            cancelDownload();
+        }
+        return ok;
+    });
+    return true;
+}
+
+bool DownloadThread::_waitForDevice()
+{
+    if (!_devicePreparation.isValid())
+        return true;
+
+    if (!_devicePreparation.isFinished())
+    {
+        QElapsedTimer waitTimer;
+        waitTimer.start();
+        _devicePreparation.waitForFinished();
+        _deviceWaitMs += waitTimer.elapsed();
+        qDebug() << "Waited" << waitTimer.elapsed() << "ms for device preparation";
+    }
+    return _devicePreparation.result();
+}
+
+void DownloadThread::_startWatchdog()
+{
+    if (!_watchdogEnabled || _watchdog)
+        return;
+
+    _watchdog = std::make_unique<PipelineWatchdog>();
+    _addWatchdogProbes(_watchdog.get());
+
+    _watchdog->setRemedy([this](PipelineWatchdog::Stage stage, int level) -> QString {
+        switch (stage)
+        {
+            case PipelineWatchdog::Stage::Download:
+                /* A stuck connection rarely recovers by itself, resume on a new one */
+                _reconnectRequested = true;
+                return "reconnect";
+            case PipelineWatchdog::Stage::Write:
+            {
+                /* Smaller writes first, then make the kernel flush what it is holding back */
+                QString reduced = (level == 1) ? _reduceWriteSize() : QString();
+                if (!reduced.isEmpty())
+                    return reduced;
+                _syncRequested = true;
+                return "sync";
+            }
+            default:
+                /* Nothing to adjust for decompression or verification, only report */
+                return QString();
+        }
+    });
+    _watchdog->setEventHandler([this](quint32 stalledMs, const QString &metadata) {
+        emit eventPipelineStall(stalledMs, metadata);
+    });
+    _watchdog->start();
+}
+
+void DownloadThread::_stopWatchdog()
+{
+    if (_watchdog)
+    {
+        _watchdog->stop();
+        _watchdog.reset();
+    }
+}
+
+void DownloadThread::_addWatchdogProbes(PipelineWatchdog *watchdog)
+{
+    watchdog->setProbe(PipelineWatchdog::Stage::Download, {
+        [this]() -> quint64 { return _lastDlNow; },
+        [this]() { return _transferActive && !_inWriteCallback; }
+    });
+    if (isImage())
+    {
+        watchdog->setProbe(PipelineWatchdog::Stage::Write, {
+            [this]() -> quint64 { return _bytesWritten; },
+            [this]() { return _writeInProgress.load(); }
+        });
+        watchdog->setProbe(PipelineWatchdog::Stage::Verify, {
+            [this]() -> quint64 { return _lastVerifyNow; },
+            [this]() { return _verifying.load(); }
+        });
+    }
+}
+
+QString DownloadThread::_reduceWriteSize()
+{
+    /* Writes are sized by what curl hands over */
+    return QString();
+}
+
 void DownloadThread::run()
 {
 #ifdef Q_OS_WIN
@@ -465,10 +633,11 @@ void DownloadThread::run()
 #endif
 
     qDebug() << "Download thread starting. isImage?" << isImage() << "filename:" << _filename;
-    if (isImage() && !_openAndPrepareDevice())
+    if (!_startDevicePreparation())
     {
         return;
     }
+    _startWatchdog();
 
     // URL logged only on error
     if (_url.startsWith("file://") && _url.at(7) != '/')
@@ -507,10 +676,6 @@ void DownloadThread::run()
     curl_easy_setopt(_c, CURLOPT_TCP_KEEPIDLE, 30L);   // Start keepalive after 30s idle
     curl_easy_setopt(_c, CURLOPT_TCP_KEEPINTVL, 15L);  // Send keepalive every 15s
     
-    // Track HTTP/2 failures for graceful fallback
-    int http2FailureCount = 0;
-    const int MAX_HTTP2_FAILURES = 3;
-    
     if (_inputBufferSize)
         curl_easy_setopt(_c, CURLOPT_BUFFERSIZE, _inputBufferSize);
 
@@ -553,55 +718,7 @@ void DownloadThread::run()
     emit preparationStatusUpdate(tr("Starting download..."));
     // Minimal logging during normal operation
     _timer.start();
-    CURLcode ret = curl_easy_perform(_c);
-
-    /* Deal with badly configured HTTP servers that terminate the connection quickly
-       if connections stalls for some seconds while kernel commits buffers to slow SD card.
-       And also reconnect if we detect from our end that transfer stalled for more than one minute */
-    while (ret == CURLE_PARTIAL_FILE || ret == CURLE_OPERATION_TIMEDOUT
-           || (ret == CURLE_HTTP2_STREAM && _lastDlNow != _lastFailureOffset)
-           || (ret == CURLE_HTTP2 && _lastDlNow != _lastFailureOffset)
-           || (ret == CURLE_RECV_ERROR && _lastDlNow != _lastFailureOffset) )
-    {
-        time_t t = time(NULL);
-        qDebug() << "HTTP connection lost. Error:" << curl_easy_strerror(ret) << "Time:" << t;
-
-        // Track HTTP/2 specific failures for graceful fallback
-        if (ret == CURLE_HTTP2_STREAM || ret == CURLE_HTTP2) {
-            http2FailureCount++;
-            qDebug() << "HTTP/2 failure count:" << http2FailureCount << "/" << MAX_HTTP2_FAILURES;
-            
-            if (http2FailureCount >= MAX_HTTP2_FAILURES) {
-                qDebug() << "Too many HTTP/2 failures, falling back to HTTP/1.1";
-                curl_easy_setopt(_c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-            }
-        }
-
-        /* If last failure happened less than 5 seconds ago, something else may
-           be wrong. Sleep some time to prevent hammering server */
-        quint32 sleepMs = 0;
-        if (t - _lastFailureTime < 5)
-        {
-            qDebug() << "Sleeping 5 seconds";
-            sleepMs = 5000;
-            ::sleep(5);
-        }
-        
-        // Emit network retry event for performance tracking
-        QString retryMetadata = QString("error: %1; offset: %2 MB; http2_failures: %3")
-            .arg(curl_easy_strerror(ret))
-            .arg(_lastDlNow / (1024 * 1024))
-            .arg(http2FailureCount);
-        emit eventNetworkRetry(sleepMs, retryMetadata);
-        
-        _lastFailureTime = t;
-
-        _startOffset = _lastDlNow;
-        _lastFailureOffset = _lastDlNow;
-        curl_easy_setopt(_c, CURLOPT_RESUME_FROM_LARGE, _startOffset);
-
-        ret = curl_easy_perform(_c);
-    }
+    CURLcode ret = _transfer();
 
     curl_easy_cleanup(_c);
 
@@ -611,6 +728,17 @@ void DownloadThread::run()
         {
             _successful = true;
             
+            if (!_kernelTlsDescription.isEmpty())
+            {
+                qDebug() << "Download done in" << _timer.elapsed() / 1000 << "seconds using kernel TLS:" << _kernelTlsDescription;
+                emit eventNetworkConnectionStats(QString("total_ms: %1; size_bytes: %2; http: HTTP/1.1; ktls: %3")
+                    .arg(_timer.elapsed())
+                    .arg(static_cast<qint64>(_lastDlNow))
+                    .arg(_kernelTlsDescription));
+                _onDownloadSuccess();
+                break;
+            }
+
             // Collect CURL connection timing metrics for performance analysis
             double dnsTime = 0, connectTime = 0, tlsTime = 0, startTransferTime = 0, totalTime = 0;
             curl_off_t downloadSpeed = 0;
@@ -680,6 +808,161 @@ void DownloadThread::run()
 
             _onDownloadError(tr("Error downloading: %1").arg(errorMsg));
     }
+
+    /* Device preparation must not outlive the thread, even if the transfer failed early */
+    _waitForDevice();
+    _stopWatchdog();
+}
+
+/* Runs the transfer, resuming it at the current offset after recoverable errors */
+CURLcode DownloadThread::_transfer()
+{
+    // Track HTTP/2 failures for graceful fallback
+    int http2FailureCount = 0;
+    const int MAX_HTTP2_FAILURES = 3;
+
+    CURLcode ret = CURLE_OK;
+    bool done = false;
+#ifdef Q_OS_LINUX
+    if (_kernelTlsEnabled)
+        done = _transferKernelTls(ret);
+#endif
+    if (!done)
+        ret = _performTransfer();
+
+    /* Deal with badly configured HTTP servers that terminate the connection quickly
+       if connections stalls for some seconds while kernel commits buffers to slow SD card.
+       And also reconnect if we detect from our end that transfer stalled for more than one minute */
+    while (ret == CURLE_PARTIAL_FILE || ret == CURLE_OPERATION_TIMEDOUT
+           || (ret == CURLE_HTTP2_STREAM && _lastDlNow != _lastFailureOffset)
+           || (ret == CURLE_HTTP2 && _lastDlNow != _lastFailureOffset)
+           || (ret == CURLE_RECV_ERROR && _lastDlNow != _lastFailureOffset)
+           || (ret == CURLE_ABORTED_BY_CALLBACK && _reconnectRequested.exchange(false) && !_cancelled) )
+    {
+        time_t t = time(NULL);
+        if (ret == CURLE_ABORTED_BY_CALLBACK)
+            qDebug() << "Reconnecting stalled download. Time:" << t;
+        else
+            qDebug() << "HTTP connection lost. Error:" << curl_easy_strerror(ret) << "Time:" << t;
+
+        // Track HTTP/2 specific failures for graceful fallback
+        if (ret == CURLE_HTTP2_STREAM || ret == CURLE_HTTP2) {
+            http2FailureCount++;
+            qDebug() << "HTTP/2 failure count:" << http2FailureCount << "/" << MAX_HTTP2_FAILURES;
+            
+            if (http2FailureCount >= MAX_HTTP2_FAILURES) {
+                qDebug() << "Too many HTTP/2 failures, falling back to HTTP/1.1";
+                curl_easy_setopt(_c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+            }
+        }
+
+        /* If last failure happened less than 5 seconds ago, something else may
+           be wrong. Sleep some time to prevent hammering server */
+        quint32 sleepMs = 0;
+        if (t - _lastFailureTime < 5)
+        {
+            qDebug() << "Sleeping 5 seconds";
+            sleepMs = 5000;
+            ::sleep(5);
+        }
+        
+        // Emit network retry event for performance tracking
+        QString retryMetadata = QString("error: %1; offset: %2 MB; http2_failures: %3")
+            .arg(curl_easy_strerror(ret))
+            .arg(_lastDlNow / (1024 * 1024))
+            .arg(http2FailureCount);
+        emit eventNetworkRetry(sleepMs, retryMetadata);
+        
+        _lastFailureTime = t;
+
+        _startOffset = _lastDlNow;
+        _lastFailureOffset = _lastDlNow;
+        curl_easy_setopt(_c, CURLOPT_RESUME_FROM_LARGE, _startOffset);
+
+        ret = _performTransfer();
+    }
+
+    return ret;
+}
+
+/* curl runs the transfer (and TLS) on the calling thread, so count it as the download stage */
+CURLcode DownloadThread::_performTransfer()
+{
+    PerfCounters::Scope scope(PerfCounters::Stage::Download);
+    PipelineWatchdog::BusyScope busy(_transferActive);
+    return curl_easy_perform(_c);
+}
+
+#ifdef Q_OS_LINUX
+/* Lets the kernel decrypt the HTTPS body straight into the buffers of _acquireReceiveBuffer().
+   Returns false if curl has to do the (rest of the) transfer, from _startOffset */
+bool DownloadThread::_transferKernelTls(CURLcode &ret)
+{
+    if (!_url.startsWith("https://") || !_proxy.isEmpty() || !KtlsDownload::kernelSupported())
+        return false;
+
+    KtlsDownload download(_url, _startOffset);
+    download.setUserAgent(_useragent);
+
+    KtlsDownload::Sink sink;
+    sink.acquire = [this](size_t &capacity) {
+        PipelineWatchdog::BusyScope inCallback(_inWriteCallback);
+        return _acquireReceiveBuffer(capacity);
+    };
+    sink.commit = [this](char *buf, size_t len) {
+        PipelineWatchdog::BusyScope inCallback(_inWriteCallback);
+        _commitReceiveBuffer(buf, len);
+    };
+    sink.progress = [this](quint64 now, quint64 total) {
+        return _progress(total - _startOffset, now - _startOffset, 0, 0);
+    };
+    sink.header = [this](const std::string &line) {
+        _header(line);
+    };
+
+    KtlsDownload::Result result;
+    {
+        PipelineWatchdog::BusyScope busy(_transferActive);
+        PerfCounters::Scope scope(PerfCounters::Stage::Download);
+        result = download.run(sink);
+    }
+
+    switch (result)
+    {
+        case KtlsDownload::Result::Complete:
+            _kernelTlsDescription = download.description();
+            ret = CURLE_OK;
+            return true;
+        case KtlsDownload::Result::Unsupported:
+            qDebug() << "Kernel TLS download not possible, using curl:" << download.errorString();
+            return false;
+        case KtlsDownload::Result::Cancelled:
+            if (!_reconnectRequested.exchange(false) || _cancelled)
+            {
+                ret = CURLE_ABORTED_BY_CALLBACK;
+                return true;
+            }
+            break;
+        case KtlsDownload::Result::Failed:
+            break;
+    }
+
+    /* Whatever was received has been handed over, curl continues from there */
+    _startOffset = download.offset() + download.bytesReceived();
+    qDebug() << "Kernel TLS download interrupted at" << _startOffset << "bytes:" << download.errorString();
+    curl_easy_setopt(_c, CURLOPT_RESUME_FROM_LARGE, _startOffset);
+    return false;
+}
+#endif
+
+char *DownloadThread::_acquireReceiveBuffer(size_t & /*capacity*/)
+{
+    /* Only subclasses with their own buffers take data this way */
+    return nullptr;
+}
+
+void DownloadThread::_commitReceiveBuffer(char * /*buf*/, size_t /*len*/)
+{
 }
 
 size_t DownloadThread::_writeData(const char *buf, size_t len)
@@ -767,7 +1050,11 @@ void DownloadThread::setCacheFile(const QString &filename, qint64 filesize)
 
 void DownloadThread::_hashData(const char *buf, size_t len)
 {
+    PerfCounters::Scope scope(PerfCounters::Stage::Hash);
     _writehash.addData(buf, len);
+
+    for (const auto &span : _pendingWrittenSpans)
+        _writtenhash.addData(span.first, static_cast<int>(span.second));
 }
 
 size_t DownloadThread::_writeFile(const char *buf, size_t len)
@@ -775,9 +1062,42 @@ size_t DownloadThread::_writeFile(const char *buf, size_t len)
     if (_cancelled)
         return len;
 
+    /* A failed device preparation cancels the download: treat like the check above */
+    if (!_waitForDevice() || _cancelled)
+        return len;
+
+    if (!_firstDeviceByteSeen)
+    {
+        _firstDeviceByteSeen = true;
+        emit eventTimeToFirstDeviceByte(static_cast<quint32>(_runTimer.elapsed()),
+                                        QString("preparation_ms: %1; waited_ms: %2; overlapped: %3")
+                                            .arg(_devicePreparationMs)
+                                            .arg(_deviceWaitMs)
+                                            .arg(_devicePreparation.isValid() ? "yes" : "no"));
+    }
+
+    PerfCounters::Scope scope(PerfCounters::Stage::Write);
+    PipelineWatchdog::BusyScope writing(_writeInProgress);
+
+    const std::uint64_t chunkOffset = _imageOffset;
+    _imageOffset += len;
+
+    if (_allocationMap)
+    {
+        QElapsedTimer mapTimer;
+        mapTimer.start();
+        _allocationMap->feed(chunkOffset, buf, len);
+        _allocationMapNs += mapTimer.nsecsElapsed();
+    }
+
     if (!_firstBlock)
     {
         _writehash.addData(buf, len);
+        if (_allocationMap)
+        {
+            _writtenhash.addData(buf, len);
+            _writtenRanges.push_back({chunkOffset, chunkOffset + len});
+        }
         _firstBlock = (char *) qMallocAligned(len, 4096);
         _firstBlockSize = len;
         ::memcpy(_firstBlock, buf, len);
@@ -804,6 +1124,43 @@ size_t DownloadThread::_writeFile(const char *buf, size_t len)
         // Future is now finished, safe to reuse
     }
 
+    // Split the buffer into runs that must be written and runs the allocation map
+    // proves unallocated. Decisions are made per aligned granule so that every
+    // write keeps the buffer and device offset alignment O_DIRECT needs.
+    _pendingWrittenSpans.clear();
+    if (_allocationMap)
+    {
+        static const std::uint64_t SKIP_GRANULE_SIZE = 128 * 1024;
+        const bool aligned = chunkOffset % SKIP_GRANULE_SIZE == 0
+                && reinterpret_cast<std::uintptr_t>(buf) % 4096 == 0;
+
+        size_t pos = 0;
+        while (pos < len)
+        {
+            size_t granule = qMin(static_cast<size_t>(SKIP_GRANULE_SIZE), len - pos);
+            bool skip = aligned && granule == SKIP_GRANULE_SIZE
+                    && _allocationMap->isUnallocated(chunkOffset + pos, granule);
+
+            if (!skip)
+            {
+                if (!_pendingWrittenSpans.empty() && _pendingWrittenSpans.back().first + _pendingWrittenSpans.back().second == buf + pos)
+                    _pendingWrittenSpans.back().second += granule;
+                else
+                    _pendingWrittenSpans.push_back({buf + pos, granule});
+            }
+            pos += granule;
+        }
+
+        for (const auto &span : _pendingWrittenSpans)
+        {
+            std::uint64_t start = chunkOffset + (span.first - buf);
+            if (!_writtenRanges.empty() && _writtenRanges.back().second == start)
+                _writtenRanges.back().second += span.second;
+            else
+                _writtenRanges.push_back({start, start + span.second});
+        }
+    }
+
     // Start hash computation for current buffer (will be waited for in next iteration)
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
     _pendingHashFuture = QtConcurrent::run(&DownloadThread::_hashData, this, buf, len);
@@ -814,8 +1171,38 @@ size_t DownloadThread::_writeFile(const char *buf, size_t len)
 
     // Use unified FileOperations for writing
     size_t bytes_written = 0;
-    rpi_imager::FileError write_result = _file->WriteSequential(reinterpret_cast<const std::uint8_t*>(buf), len);
-    
+    rpi_imager::FileError write_result = rpi_imager::FileError::kSuccess;
+
+    if (!_allocationMap)
+    {
+        write_result = _file->WriteSequential(reinterpret_cast<const std::uint8_t*>(buf), len);
+    }
+    else
+    {
+        size_t skipped = len;
+        std::uint64_t position = chunkOffset;
+
+        for (const auto &span : _pendingWrittenSpans)
+        {
+            std::uint64_t start = chunkOffset + (span.first - buf);
+            if (start != position)
+                write_result = _file->Seek(start);
+            if (write_result == rpi_imager::FileError::kSuccess)
+                write_result = _file->WriteSequential(reinterpret_cast<const std::uint8_t*>(span.first), span.second);
+            if (write_result != rpi_imager::FileError::kSuccess)
+                break;
+            position = start + span.second;
+            skipped -= span.second;
+        }
+
+        // Leave the file position at the end of the chunk, as a full write would
+        if (write_result == rpi_imager::FileError::kSuccess && position != chunkOffset + len)
+            write_result = _file->Seek(chunkOffset + len);
+
+        if (write_result == rpi_imager::FileError::kSuccess)
+            _bytesSkipped += skipped;
+    }
+
     if (write_result == rpi_imager::FileError::kSuccess) {
         bytes_written = len;
         _bytesWritten += bytes_written;
@@ -844,7 +1231,8 @@ bool DownloadThread::_progress(curl_off_t dltotal, curl_off_t dlnow, curl_off_t
         _lastDlTotal = _startOffset + dltotal;
     _lastDlNow   = _startOffset + dlnow;
 
-    return !_cancelled;
+    /* The watchdog asks for a fresh connection by aborting the transfer; run() resumes it */
+    return !_cancelled && !_reconnectRequested;
 }
 
 void DownloadThread::_header(const string &header)
@@ -932,8 +1320,9 @@ uint64_t DownloadThread::verifyTotal()
 
 uint64_t DownloadThread::bytesWritten()
 {
+    // Skipped (unallocated) ranges never reach the device, so credit them separately
     if (_sectorsStart != -1)
-        return qMin((uint64_t) (_sectorsWritten()-_sectorsStart)*512, (uint64_t) _bytesWritten);
+        return qMin((uint64_t) (_sectorsWritten()-_sectorsStart)*512 + _bytesSkipped, (uint64_t) _bytesWritten);
     else
         return _bytesWritten;
 }
@@ -1006,6 +1395,8 @@ void DownloadThread::_onWriteError()
 
 void DownloadThread::_closeFiles()
 {
+    _waitForDevice();
+
     QElapsedTimer closeTimer;
     closeTimer.start();
     
@@ -1031,6 +1422,10 @@ void DownloadThread::_closeFiles()
 
 void DownloadThread::_writeComplete()
 {
+    /* Small images can be fully downloaded before the device is ready.
+       If preparing it failed, the download has been cancelled. */
+    _waitForDevice();
+
     // Don't report errors if the operation was cancelled
     if (_cancelled)
     {
@@ -1125,13 +1520,30 @@ void DownloadThread::_writeComplete()
 
     qDebug() << "Write done in" << _timer.elapsed() / 1000 << "seconds";
 
+    if (_allocationMap)
+    {
+        QByteArray summary = _allocationMap->summary();
+        qDebug() << "Allocation map:" << summary << "skipped" << _bytesSkipped / (1024 * 1024) << "MB";
+        emit eventAllocationMap(static_cast<quint32>(_allocationMapNs / 1000000), _bytesSkipped,
+                                QString("%1; skipped_mb: %2").arg(QString(summary)).arg(_bytesSkipped / (1024 * 1024)));
+    }
+
     /* Verify */
-    if (_verifyEnabled && !_verify())
+    if (_verifyEnabled)
     {
-        _closeFiles();
-        return;
+        bool verified;
+        {
+            PipelineWatchdog::BusyScope verifying(_verifying);
+            verified = _verify();
+        }
+        if (!verified)
+        {
+            _closeFiles();
+            return;
+        }
     }
 
+    rpi_imager::IoLatencyStats::Instance().SetPhase(rpi_imager::IoPhase::kFinalising);
     emit finalizing();
 
     if ((!_config.isEmpty() || !_cmdline.isEmpty() || !_firstrun.isEmpty() || !_cloudinit.isEmpty()) && !_initFormat.isEmpty())
@@ -1160,6 +1572,13 @@ void DownloadThread::_writeComplete()
         _firstBlock = nullptr;
     }
 
+    /* Only stamped when asked to, or when identical cards are to be skipped:
+       a card stamped now can be skipped next time */
+    if (_identityStampEnabled || _skipIfIdentical)
+    {
+        _writeIdentityStamp(computedHash);
+    }
+
     QElapsedTimer syncTimer;
     syncTimer.start();
     
@@ -1196,8 +1615,55 @@ void DownloadThread::_writeComplete()
     }
 }
 
+bool DownloadThread::_checkIdentityStamp()
+{
+    if (_expectedHash.isEmpty())
+        return false;
+
+    emit preparationStatusUpdate(tr("Checking if storage already contains this image..."));
+    QElapsedTimer timer;
+    timer.start();
+
+    IdentityStamp stamp;
+    if (!stamp.read(_file.get()))
+    {
+        emit eventIdentityStamp(static_cast<quint32>(timer.elapsed()), false, "check: no stamp");
+        return false;
+    }
+
+    bool matched = stamp.confirm(_file.get(), _expectedHash, _customisationHash);
+    QString metadata = QString("check: %1; samples: %2; written: %3")
+        .arg(matched ? "match" : "mismatch")
+        .arg(stamp.sampleCount())
+        .arg(QDateTime::fromSecsSinceEpoch(stamp.writeTime()).toString(Qt::ISODate));
+    qDebug() << "Identity stamp" << metadata << "in" << timer.elapsed() << "ms";
+    emit eventIdentityStamp(static_cast<quint32>(timer.elapsed()), matched, metadata);
+
+    if (matched)
+    {
+        /* Nothing is written, but report the image as if it had been */
+        _bytesWritten = stamp.imageSize();
+    }
+    return matched;
+}
+
+void DownloadThread::_writeIdentityStamp(const QByteArray &imageHash)
+{
+    /* Best effort: a card without a stamp is simply written in full next time */
+    QElapsedTimer timer;
+    timer.start();
+
+    IdentityStamp stamp;
+    bool written = stamp.write(_file.get(), imageHash, _customisationHash, bytesWritten());
+    QString metadata = QString("write: %1; samples: %2").arg(written ? "ok" : "skipped").arg(stamp.sampleCount());
+    qDebug() << "Identity stamp" << metadata << "in" << timer.elapsed() << "ms";
+    emit eventIdentityStamp(static_cast<quint32>(timer.elapsed()), written, metadata);
+}
+
 bool DownloadThread::_verify()
 {
+    PerfCounters::Scope scope(PerfCounters::Stage::Verify);
+    rpi_imager::IoLatencyStats::Instance().SetPhase(rpi_imager::IoPhase::kVerifying);
     _lastVerifyNow = 0;
     _verifyTotal = _file->Tell();
     
@@ -1228,7 +1694,9 @@ bool DownloadThread::_verify()
 
     while (_verifyEnabled && _lastVerifyNow < _verifyTotal && !_cancelled)
     {
-        size_t bytes_to_read = qMin((qint64) verifyBufferSize, (qint64) (_verifyTotal-_lastVerifyNow));
+        size_t bytes_to_read = _nextVerifyRead(verifyBufferSize);
+        if (!bytes_to_read)
+            break;
         size_t lenRead = 0;
         rpi_imager::FileError read_result = _file->ReadSequential(reinterpret_cast<std::uint8_t*>(verifyBuf), bytes_to_read, lenRead);
         if (read_result != rpi_imager::FileError::kSuccess)
@@ -1247,7 +1715,7 @@ bool DownloadThread::_verify()
     qDebug() << "Verify hash:" << _verifyhash.result().toHex();
     qDebug() << "Verify done in" << t1.elapsed() / 1000.0 << "seconds";
 
-    if (_verifyhash.result() == _writehash.result() || !_verifyEnabled || _cancelled)
+    if (_verifyhash.result() == (_bytesSkipped ? _writtenhash : _writehash).result() || !_verifyEnabled || _cancelled)
     {
         emit eventVerify(static_cast<quint32>(t1.elapsed()), true);
         return true;
@@ -1261,6 +1729,33 @@ bool DownloadThread::_verify()
     return false;
 }
 
+/* Returns how many bytes to read next during verification, or 0 when done.
+ * If the allocation map caused ranges to be skipped, those are never read back:
+ * _lastVerifyNow jumps over them and the device position follows. */
+size_t DownloadThread::_nextVerifyRead(size_t maxLen)
+{
+    if (!_bytesSkipped)
+        return static_cast<size_t>(qMin((std::uint64_t) maxLen, (std::uint64_t) (_verifyTotal - _lastVerifyNow)));
+
+    while (_verifyRangeIndex < _writtenRanges.size() && _writtenRanges[_verifyRangeIndex].second <= _lastVerifyNow)
+        _verifyRangeIndex++;
+
+    if (_verifyRangeIndex == _writtenRanges.size())
+    {
+        _lastVerifyNow = _verifyTotal.load();
+        return 0;
+    }
+
+    const auto &range = _writtenRanges[_verifyRangeIndex];
+    if (range.first > _lastVerifyNow)
+    {
+        _lastVerifyNow = range.first;
+        _file->Seek(range.first);
+    }
+
+    return static_cast<size_t>(qMin((std::uint64_t) maxLen, range.second - _lastVerifyNow));
+}
+
 void DownloadThread::_initializeSyncConfiguration()
 {
     _syncConfig = SystemMemoryManager::instance().calculateSyncConfiguration();
@@ -1271,11 +1766,12 @@ void DownloadThread::_periodicSync()
     qint64 currentBytes = _bytesWritten;
     qint64 bytesSinceLastSync = currentBytes - _lastSyncBytes;
     qint64 timeSinceLastSync = _lastSyncTime.elapsed();
+    bool forced = _syncRequested.exchange(false) && bytesSinceLastSync > 0;
     
     // Sync if we've written more than the configured sync interval
     // OR if it's been more than the time interval since last sync
     // AND we've written at least some data since last sync
-    if ((bytesSinceLastSync >= _syncConfig.syncIntervalBytes || 
+    if ((forced || bytesSinceLastSync >= _syncConfig.syncIntervalBytes || 
          (timeSinceLastSync >= _syncConfig.syncIntervalMs && bytesSinceLastSync > 0)) &&
         !_cancelled)
     {
@@ -1316,6 +1812,16 @@ void DownloadThread::setVerifyEnabled(bool verify)
     _verifyEnabled = verify;
 }
 
+void DownloadThread::setEjectEnabled(bool eject)
+{
+    _ejectEnabled = eject;
+}
+
+void DownloadThread::setSkipIfIdentical(bool skip)
+{
+    _skipIfIdentical = skip;
+}
+
 bool DownloadThread::isImage()
 {
     return true;
@@ -1361,6 +1867,7 @@ void DownloadThread::setImageCustomisation(const QByteArray &config, const QByte
     _cloudinitNetwork = cloudInitNetwork;
     _initFormat = initFormat;
     _advancedOptions = opts;
+    _customisationHash = IdentityStamp::customisationHash(config, cmdline, firstrun, cloudinit, cloudInitNetwork, initFormat, opts);
 }
 
 void DownloadThread::setChildDevices(const QStringList &devices)
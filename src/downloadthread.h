@@ -16,6 +16,7 @@
 #include <QElapsedTimer>
 #include <QFuture>
 #include <atomic>
+#include <vector>
 #include <time.h>
 #include <curl/curl.h>
 #include "acceleratedcryptographichash.h"
@@ -23,6 +24,8 @@
 #include "systemmemorymanager.h"
 #include "file_operations.h"
 #include "asynccachewriter.h"
+#include "allocationmap.h"
+#include "pipelinewatchdog.h"
 
 
 class DownloadThread : public QThread
@@ -100,6 +103,13 @@ public:
      */
     void setVerifyEnabled(bool verify);
 
+    /*
+     * Override the eject and skipIfIdentical settings read when the
+     * thread was created
+     */
+    void setEjectEnabled(bool eject);
+    void setSkipIfIdentical(bool skip);
+
     /*
      * Enable disk cache
      */
@@ -166,6 +176,10 @@ signals:
     void eventDeviceClose(quint32 durationMs, bool success);          // Device handle close
     void eventNetworkRetry(quint32 sleepMs, QString metadata);        // Network retry with reason
     void eventNetworkConnectionStats(QString metadata);               // CURL connection timing stats
+    void eventAllocationMap(quint32 durationMs, quint64 bytesSkipped, QString metadata); // Unallocated ranges skipped
+    void eventIdentityStamp(quint32 durationMs, bool success, QString metadata);          // On-card identity stamp check/write
+    void eventTimeToFirstDeviceByte(quint32 durationMs, QString metadata);                // Download start to first device write
+    void eventPipelineStall(quint32 durationMs, QString metadata);                        // Stall watchdog intervention or recovery
 
 protected:
     virtual void run();
@@ -178,6 +192,12 @@ protected:
     virtual bool _verify();
     int _authopen(const QByteArray &filename);
     bool _openAndPrepareDevice();
+    bool _startDevicePreparation();
+    bool _waitForDevice();
+    void _startWatchdog();
+    void _stopWatchdog();
+    virtual void _addWatchdogProbes(PipelineWatchdog *watchdog);
+    virtual QString _reduceWriteSize();
     void _writeCache(const char *buf, size_t len);
     qint64 _sectorsWritten();
     void _closeFiles();
@@ -185,12 +205,22 @@ protected:
     bool _customizeImage();
     bool _createSecureBootFiles(class DeviceWrapperFatPartition *fat);
     void _periodicSync();
+    size_t _nextVerifyRead(size_t maxLen);
+    bool _checkIdentityStamp();
+    void _writeIdentityStamp(const QByteArray &imageHash);
+    CURLcode _transfer();
+    CURLcode _performTransfer();
+#ifdef Q_OS_LINUX
+    bool _transferKernelTls(CURLcode &ret);
+#endif
+    virtual char *_acquireReceiveBuffer(size_t &capacity);
+    virtual void _commitReceiveBuffer(char *buf, size_t len);
 
     /*
      * libcurl callbacks
      */
     virtual size_t _writeData(const char *buf, size_t len);
-    bool _progress(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+    virtual bool _progress(curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
     void _header(const std::string &header);
 
     static size_t _curl_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
@@ -211,6 +241,8 @@ protected:
     static QByteArray _proxy;
     static int _curlCount;
     bool _cancelled, _successful, _verifyEnabled, _cacheEnabled, _ejectEnabled;
+    bool _identityStampEnabled, _skipIfIdentical;
+    QByteArray _customisationHash;  // Hex hash of the customisation inputs, recorded in the identity stamp
     time_t _lastModified, _serverTime, _lastFailureTime;
     QElapsedTimer _timer;
     int _inputBufferSize;
@@ -230,10 +262,41 @@ protected:
 
     AcceleratedCryptographicHash _writehash, _verifyhash;
 
+    // Allocation map derived from the image's own filesystems while streaming.
+    // Only created after a successful up-front discard; unallocated ranges are then
+    // skipped on write and verification is restricted to what was actually written,
+    // compared against _writtenhash instead of _writehash.
+    std::unique_ptr<AllocationMap> _allocationMap;
+    AcceleratedCryptographicHash _writtenhash;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> _writtenRanges;  // [start, end) in image order
+    std::vector<std::pair<const char *, size_t>> _pendingWrittenSpans;   // Spans of the buffer being hashed
+    std::uint64_t _imageOffset, _bytesSkipped;
+    size_t _verifyRangeIndex;
+    qint64 _allocationMapNs;
+
     // Pipelined hash computation - store future for previous hash operation
     QFuture<void> _pendingHashFuture;
     bool _hasPendingHash;
 
+    // Device preparation (unmount, open, wipe) runs alongside the start of the download.
+    // Anything that touches _file waits for it through _waitForDevice()
+    QFuture<bool> _devicePreparation;
+    QElapsedTimer _runTimer;
+    qint64 _devicePreparationMs, _deviceWaitMs;
+    bool _firstDeviceByteSeen;
+
+    // Stall watchdog: busy flags tell it which stages are expected to make progress,
+    // the request flags carry its remedies back to the threads doing the work
+    std::unique_ptr<PipelineWatchdog> _watchdog;
+    bool _watchdogEnabled;
+    std::atomic<bool> _transferActive, _inWriteCallback, _writeInProgress, _verifying;
+    std::atomic<bool> _reconnectRequested, _syncRequested;
+
+    // Linux kernel TLS receive path for HTTPS, if the subclass can hand out receive
+    // buffers (see _acquireReceiveBuffer()). Description is set if it did the download
+    bool _kernelTlsEnabled;
+    QString _kernelTlsDescription;
+
     // Cross-platform adaptive page cache flushing
     qint64 _lastSyncBytes;
     QElapsedTimer _lastSyncTime;
@@ -23,8 +23,8 @@
 #include "windows/diskpart_util.h"
 #endif
 
-DriveFormatThread::DriveFormatThread(const QByteArray &device, QObject *parent)
-    : QThread(parent), _device(device)
+DriveFormatThread::DriveFormatThread(const QByteArray &device, rpi_imager::Filesystem filesystem, QObject *parent)
+    : QThread(parent), _device(device), _filesystem(filesystem)
 {
 
 }
@@ -101,7 +101,7 @@ void DriveFormatThread::run()
     formatTimer.start();
     
     rpi_imager::DiskFormatter formatter;
-    auto formatResult = formatter.FormatDrive(_device.toStdString());
+    auto formatResult = formatter.FormatDrive(_device.toStdString(), _filesystem);
 
     quint32 formatDurationMs = static_cast<quint32>(formatTimer.elapsed());
     
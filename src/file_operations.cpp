@@ -35,11 +35,21 @@ void FileOperationsLog(const std::string& msg) {
 #endif
 }
 
+// Global factory override - used to substitute a simulated device
+static FileOperationsFactory g_factory = nullptr;
+
+void SetFileOperationsFactory(FileOperationsFactory factory) {
+    g_factory = factory;
+}
+
 // This function is implemented in the platform-specific source files
 // Each platform provides its own implementation
 extern std::unique_ptr<FileOperations> CreatePlatformFileOperations();
 
 std::unique_ptr<FileOperations> FileOperations::Create() {
+  if (g_factory) {
+    return g_factory();
+  }
   return CreatePlatformFileOperations();
 }
 
@@ -20,6 +20,13 @@ void SetFileOperationsLogCallback(LogCallback callback);
 // Internal helper for platform implementations to log messages
 void FileOperationsLog(const std::string& msg);
 
+class FileOperations;
+
+// Factory override - when set, FileOperations::Create() returns its product
+// instead of the platform implementation (e.g. a simulated device)
+using FileOperationsFactory = std::function<std::unique_ptr<FileOperations>()>;
+void SetFileOperationsFactory(FileOperationsFactory factory);
+
 // Error types for file operations
 enum class FileError {
   kSuccess,
@@ -31,7 +38,8 @@ enum class FileError {
   kCloseError,
   kLockError,
   kSyncError,
-  kFlushError
+  kFlushError,
+  kDiscardError
 };
 
 // Abstract interface for platform-specific file operations
@@ -75,6 +83,13 @@ class FileOperations {
   // Prepare for sequential read (e.g., verification)
   // Invalidates cache and enables read-ahead hints for optimal sequential read performance
   virtual void PrepareForSequentialRead(std::uint64_t offset, std::uint64_t length) = 0;
+
+  // Tell the device a range no longer holds data (TRIM/DISCARD, or punching a hole
+  // into a regular file). Afterwards the range reads as zeroes or as its old contents,
+  // depending on the device. Not every platform or device supports it
+  virtual FileError DiscardRange(std::uint64_t /*offset*/, std::uint64_t /*length*/) {
+    return FileError::kDiscardError;
+  }
   
   // Get platform-specific file handle (for compatibility with existing code)
   virtual int GetHandle() const = 0;
@@ -97,6 +112,7 @@ class FileOperations {
   virtual DirectIOInfo GetDirectIOInfo() const = 0;
 
   // Factory method to create platform-specific implementation
+  // (or the override installed with SetFileOperationsFactory)
   static std::unique_ptr<FileOperations> Create();
 };
 
@@ -0,0 +1,174 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "hottierindex.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <csignal>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+HotTierIndex::HotTierIndex(const QString& directory)
+    : directory_(directory)
+    , lock_(directory + "/index.lock")
+{
+    locked_ = lock_.tryLock(5000);
+    if (!locked_) {
+        qDebug() << "Cache hot tier index is locked:" << directory;
+        return;
+    }
+
+    QFile f(directory_.filePath("index.json"));
+    if (!f.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QJsonArray array = QJsonDocument::fromJson(f.readAll()).array();
+    for (const QJsonValue& value : array) {
+        const QJsonObject obj = value.toObject();
+        HotTierEntry entry;
+        entry.hash = obj["hash"].toString().toLatin1();
+        entry.fileName = directory_.filePath(obj["file"].toString());
+        entry.bytes = obj["bytes"].toInteger();
+        entry.lastUsed = obj["last_used"].toInteger();
+        // tmpfs is emptied on reboot, and files may have been removed by hand
+        if (!entry.hash.isEmpty() && QFile::exists(entry.fileName)) {
+            entries.push_back(entry);
+        }
+    }
+}
+
+bool HotTierIndex::save() const
+{
+    QJsonArray array;
+    for (const HotTierEntry& entry : entries) {
+        QJsonObject obj;
+        obj["hash"] = QString::fromLatin1(entry.hash);
+        obj["file"] = QFileInfo(entry.fileName).fileName();
+        obj["bytes"] = entry.bytes;
+        obj["last_used"] = entry.lastUsed;
+        array.append(obj);
+    }
+    QSaveFile f(directory_.filePath("index.json"));
+    return f.open(QIODevice::WriteOnly) && f.write(QJsonDocument(array).toJson()) >= 0 && f.commit();
+}
+
+qint64 HotTierIndex::usedBytes() const
+{
+    qint64 used = 0;
+    for (const HotTierEntry& entry : entries) {
+        used += entry.bytes;
+    }
+    return used;
+}
+
+bool HotTierIndex::evict(qint64 budget, qint64 needed)
+{
+    std::sort(entries.begin(), entries.end(), [](const HotTierEntry& a, const HotTierEntry& b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    while (!entries.empty() && usedBytes() + needed > budget) {
+        qDebug() << "Cache hot tier: evicting" << entries.front().fileName;
+        QFile::remove(entries.front().fileName);
+        entries.erase(entries.begin());
+    }
+    return usedBytes() + needed <= budget;
+}
+
+QString HotTierIndex::pin(const QByteArray& hash)
+{
+    if (!locked_ || hash.isEmpty()) {
+        return QString();
+    }
+    for (HotTierEntry& entry : entries) {
+        if (entry.hash != hash) {
+            continue;
+        }
+#ifdef Q_OS_UNIX
+        const QString pinFile = QString("%1.pin%2").arg(entry.fileName).arg(QCoreApplication::applicationPid());
+        const QByteArray pinPath = QFile::encodeName(pinFile);
+        ::unlink(pinPath.constData());
+        if (::link(QFile::encodeName(entry.fileName).constData(), pinPath.constData()) != 0) {
+            qDebug() << "Cache hot tier: cannot pin" << entry.fileName;
+            return QString();
+        }
+#else
+        const QString pinFile = entry.fileName;
+#endif
+        entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+        save();
+        return pinFile;
+    }
+    return QString();
+}
+
+void HotTierIndex::releasePin(const QString& pinFile)
+{
+#ifdef Q_OS_UNIX
+    if (!pinFile.isEmpty()) {
+        QFile::remove(pinFile);
+    }
+#else
+    Q_UNUSED(pinFile);
+#endif
+}
+
+bool HotTierIndex::secureDirectory(const QString& directory)
+{
+    if (directory.isEmpty()) {
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    const QString parent = QFileInfo(directory).absolutePath();
+    const QByteArray path = QFile::encodeName(directory);
+    if (!QDir().mkpath(parent) || (::mkdir(path.constData(), 0700) != 0 && errno != EEXIST)) {
+        return false;
+    }
+
+    // mkdir does nothing to a directory or link that someone else created first
+    struct stat st;
+    if (::lstat(path.constData(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != ::getuid()) {
+        qDebug() << "Cache hot tier: not a directory of this user:" << directory;
+        return false;
+    }
+    return (st.st_mode & 077) == 0 || ::chmod(path.constData(), 0700) == 0;
+#else
+    return QDir().mkpath(directory);
+#endif
+}
+
+void HotTierIndex::removeStaleFiles(const QString& directory)
+{
+    const QDateTime stale = QDateTime::currentDateTime().addSecs(-3600);
+    const QFileInfoList parts = QDir(directory).entryInfoList({"*.part"}, QDir::Files);
+    for (const QFileInfo& part : parts) {
+        if (part.lastModified() < stale) {
+            QFile::remove(part.filePath());
+        }
+    }
+
+#ifdef Q_OS_UNIX
+    const QFileInfoList pins = QDir(directory).entryInfoList({"*.pin*"}, QDir::Files);
+    for (const QFileInfo& pin : pins) {
+        bool ok = false;
+        const pid_t pid = static_cast<pid_t>(pin.suffix().mid(3).toLongLong(&ok));
+        if (ok && pid > 0 && ::kill(pid, 0) != 0 && errno == ESRCH) {
+            QFile::remove(pin.filePath());
+        }
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef HOTTIERINDEX_H
+#define HOTTIERINDEX_H
+
+#include <QByteArray>
+#include <QDir>
+#include <QLockFile>
+#include <QString>
+#include <vector>
+
+/* One image held in the RAM hot tier */
+struct HotTierEntry {
+    QByteArray hash;        // Uncompressed hash (extract_sha256), as looked up by writes
+    QString fileName;
+    qint64 bytes = 0;
+    qint64 lastUsed = 0;    // Milliseconds since epoch
+};
+
+/**
+ * @brief Index of the RAM hot tier of the cache
+ *
+ * Every Imager process (e.g. one per CLI write) shares the hot tier, so the
+ * index is read, changed and written back while holding a lock file, for as
+ * long as the object lives.
+ *
+ * A write does not read an entry under the lock, so it reads a pin instead:
+ * a hard link to the entry's file, named after the process, which eviction
+ * by another process does not remove. Its memory is only freed once the
+ * pin is released as well.
+ */
+class HotTierIndex
+{
+public:
+    explicit HotTierIndex(const QString& directory);
+
+    bool isLocked() const { return locked_; }
+
+    bool save() const;
+
+    qint64 usedBytes() const;
+
+    // Drop least recently used entries until `needed` more bytes fit in the budget
+    bool evict(qint64 budget, qint64 needed);
+
+    // Mark the entry of the image as used and pin its file; empty if there is no entry
+    QString pin(const QByteArray& hash);
+
+    static void releasePin(const QString& pinFile);
+
+    // Create the directory, or accept an existing one, only if it is a real
+    // directory owned by this user; the tier holds what writes trust as verified
+    static bool secureDirectory(const QString& directory);
+
+    // Partial copies of killed promotions, and pins of processes that are gone
+    static void removeStaleFiles(const QString& directory);
+
+    std::vector<HotTierEntry> entries;
+
+private:
+    QDir directory_;
+    QLockFile lock_;
+    bool locked_;
+};
+
+#endif // HOTTIERINDEX_H
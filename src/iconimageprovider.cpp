@@ -1,20 +1,320 @@
 #include "iconimageprovider.h"
 
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QQuickTextureFactory>
-#include <QUrl>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThread>
+#include <QDebug>
+#include <cstring>
 
-IconImageResponse::IconImageResponse(const QUrl &url)
-    : _nam(new QNetworkAccessManager(this))
+namespace {
+
+/* On-disk entry layout: header, validator (padded to 16 bytes), raw pixels
+ * in QImage::Format_ARGB32_Premultiplied so a hit is a single mmap with no
+ * decoding or format conversion */
+struct IconCacheHeader
+{
+    char magic[4];
+    quint32 version;
+    quint32 width;
+    quint32 height;
+    quint32 bytesPerLine;
+    quint32 validatorLength;
+    quint32 reserved[2];
+};
+
+constexpr char kIconCacheMagic[4] = {'R', 'P', 'I', 'C'};
+constexpr quint32 kIconCacheVersion = 1;
+constexpr int kMemoryCacheCostKb = 16 * 1024;
+/* Icons are a few KB each as pixels; the OS lists reference a few hundred */
+constexpr qint64 kDiskCacheBytes = 64 * 1024 * 1024;
+
+qint64 validatorPaddedLength(quint32 len)
+{
+    return (static_cast<qint64>(len) + 15) & ~static_cast<qint64>(15);
+}
+
+void unmapCachedIcon(void *info)
+{
+    /* Deleting the QFile also unmaps the region backing the QImage */
+    delete static_cast<QFile *>(info);
+}
+
+/* Convert to premultiplied ARGB and scale to the size QML asked for, so the
+ * cached copy can be handed straight to the scene graph */
+QImage prepareIcon(const QImage &src, const QSize &requestedSize)
+{
+    QImage img = src;
+    if (requestedSize.width() > 0 && requestedSize.height() > 0)
+        img = img.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    else if (requestedSize.width() > 0)
+        img = img.scaledToWidth(requestedSize.width(), Qt::SmoothTransformation);
+    else if (requestedSize.height() > 0)
+        img = img.scaledToHeight(requestedSize.height(), Qt::SmoothTransformation);
+
+    return img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+QByteArray validatorFromReply(QNetworkReply *reply)
+{
+    const QByteArray etag = reply->rawHeader("ETag");
+    if (!etag.isEmpty())
+        return "E:" + etag;
+    const QByteArray lastModified = reply->rawHeader("Last-Modified");
+    if (!lastModified.isEmpty())
+        return "L:" + lastModified;
+    return QByteArray();
+}
+
+void applyValidator(QNetworkRequest &req, const QByteArray &validator)
+{
+    if (validator.startsWith("E:"))
+        req.setRawHeader("If-None-Match", validator.mid(2));
+    else if (validator.startsWith("L:"))
+        req.setRawHeader("If-Modified-Since", validator.mid(2));
+}
+
+QNetworkRequest iconRequest(const QUrl &url)
 {
     QNetworkRequest req(url);
-    // Avoid HTTP/2 issues for small icon fetches; use HTTP/1.1
-    req.setAttribute(QNetworkRequest::Http2AllowedAttribute, false);
+    // All icons share one connection per host, so let them multiplex over HTTP/2
+    req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
     req.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
     req.setMaximumRedirectsAllowed(3);
+    return req;
+}
+
+} // namespace
+
+/* Two-level cache of decoded icons: an in-memory LRU in front of a persistent
+ * directory of pre-scaled pixel blobs keyed by URL and requested size. Each
+ * entry carries the HTTP validator it was fetched with so it can be
+ * revalidated cheaply with a conditional request. The directory is kept to
+ * kDiskCacheBytes by dropping the entries least recently loaded. */
+class IconCache
+{
+public:
+    IconCache()
+        : _memory(kMemoryCacheCostKb), _diskBytes(0)
+    {
+        _dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+QDir::separator()+"iconcache";
+        QDir().mkpath(_dir);
+        _trim(kDiskCacheBytes);
+    }
+
+    static QString key(const QUrl &url, const QSize &size)
+    {
+        QByteArray k = url.toString(QUrl::FullyEncoded).toUtf8();
+        k += '@' + QByteArray::number(size.width()) + 'x' + QByteArray::number(size.height());
+        return QString::fromLatin1(QCryptographicHash::hash(k, QCryptographicHash::Sha1).toHex());
+    }
+
+    bool lookup(const QString &key, QImage *image, QByteArray *validator)
+    {
+        QMutexLocker lock(&_mutex);
+
+        if (Entry *e = _memory.object(key))
+        {
+            *image = e->image;
+            *validator = e->validator;
+            return true;
+        }
+
+        Entry loaded;
+        if (!_load(key, &loaded))
+            return false;
+
+        *image = loaded.image;
+        *validator = loaded.validator;
+        _memory.insert(key, new Entry(loaded), _cost(loaded.image));
+        return true;
+    }
+
+    void store(const QString &key, const QImage &image, const QByteArray &validator)
+    {
+        QMutexLocker lock(&_mutex);
+
+        _memory.insert(key, new Entry{image, validator}, _cost(image));
+        _revalidated.insert(key);
+
+        QSaveFile f(_path(key));
+        if (!f.open(QIODevice::WriteOnly))
+            return;
+
+        IconCacheHeader h = {};
+        std::memcpy(h.magic, kIconCacheMagic, sizeof(h.magic));
+        h.version = kIconCacheVersion;
+        h.width = static_cast<quint32>(image.width());
+        h.height = static_cast<quint32>(image.height());
+        h.bytesPerLine = static_cast<quint32>(image.bytesPerLine());
+        h.validatorLength = static_cast<quint32>(validator.size());
+
+        QByteArray paddedValidator = validator;
+        paddedValidator.resize(validatorPaddedLength(h.validatorLength), '\0');
+
+        f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        f.write(paddedValidator);
+        f.write(reinterpret_cast<const char *>(image.constBits()), image.sizeInBytes());
+        if (!f.commit())
+        {
+            qDebug() << "IconCache: failed to write" << f.fileName();
+            return;
+        }
 
-    _reply = _nam->get(req);
+        /* Trimmed below the budget, so the directory is not rescanned on every store */
+        _diskBytes += f.size();
+        if (_diskBytes > kDiskCacheBytes)
+            _trim(kDiskCacheBytes * 3 / 4);
+    }
+
+    /* Returns true the first time it is called for a key in this session */
+    bool markRevalidated(const QString &key)
+    {
+        QMutexLocker lock(&_mutex);
+        if (_revalidated.contains(key))
+            return false;
+        _revalidated.insert(key);
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        QImage image;
+        QByteArray validator;
+    };
+
+    QString _path(const QString &key) const
+    {
+        return _dir+QDir::separator()+key+".argb";
+    }
+
+    void _trim(qint64 budget)
+    {
+        /* Oldest first; a load from disk counts as a use */
+        const QFileInfoList files = QDir(_dir).entryInfoList({"*.argb"}, QDir::Files, QDir::Time | QDir::Reversed);
+        _diskBytes = 0;
+        for (const QFileInfo &fi : files)
+            _diskBytes += fi.size();
+
+        for (const QFileInfo &fi : files)
+        {
+            if (_diskBytes <= budget)
+                break;
+            /* An entry still mapped elsewhere stays readable there (or, on Windows, is kept) */
+            if (QFile::remove(fi.filePath()))
+                _diskBytes -= fi.size();
+        }
+    }
+
+    static int _cost(const QImage &image)
+    {
+        return qMax(1, static_cast<int>(image.sizeInBytes() / 1024));
+    }
+
+    bool _load(const QString &key, Entry *entry)
+    {
+        auto *f = new QFile(_path(key));
+        if (!f->open(QIODevice::ReadOnly) || f->size() < static_cast<qint64>(sizeof(IconCacheHeader)))
+        {
+            delete f;
+            return false;
+        }
+
+        uchar *map = f->map(0, f->size());
+        if (!map)
+        {
+            delete f;
+            return false;
+        }
+
+        IconCacheHeader h;
+        std::memcpy(&h, map, sizeof(h));
+        const qint64 pixelOffset = sizeof(h) + validatorPaddedLength(h.validatorLength);
+        const qint64 pixelBytes = static_cast<qint64>(h.bytesPerLine) * h.height;
+
+        if (std::memcmp(h.magic, kIconCacheMagic, sizeof(h.magic)) != 0
+            || h.version != kIconCacheVersion
+            || h.width == 0 || h.height == 0
+            || h.bytesPerLine < h.width * 4
+            || f->size() != pixelOffset + pixelBytes)
+        {
+            qDebug() << "IconCache: discarding invalid entry" << f->fileName();
+            f->remove();
+            delete f;
+            return false;
+        }
+
+        f->setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+        entry->validator = QByteArray(reinterpret_cast<const char *>(map + sizeof(h)), h.validatorLength);
+        /* The image borrows the mapping; unmapCachedIcon releases it when the
+         * last copy goes away */
+        entry->image = QImage(static_cast<const uchar *>(map + pixelOffset),
+                              static_cast<int>(h.width), static_cast<int>(h.height),
+                              static_cast<qsizetype>(h.bytesPerLine),
+                              QImage::Format_ARGB32_Premultiplied,
+                              unmapCachedIcon, f);
+        return true;
+    }
+
+    QMutex _mutex;
+    QCache<QString, Entry> _memory;
+    QSet<QString> _revalidated;
+    QString _dir;
+    qint64 _diskBytes;
+};
+
+IconImageResponse::IconImageResponse(const QUrl &url, const QSize &requestedSize, QNetworkAccessManager *nam, std::shared_ptr<IconCache> cache)
+    : _url(url), _requestedSize(requestedSize), _nam(nam), _cache(std::move(cache))
+{
+    if (!_nam)
+        _nam = new QNetworkAccessManager(this);
+
+    const QString key = IconCache::key(url, requestedSize);
+    QByteArray validator;
+
+    if (_cache->lookup(key, &_image, &validator))
+    {
+        // finished() must not be emitted before the caller has connected to it
+        QMetaObject::invokeMethod(this, &IconImageResponse::finished, Qt::QueuedConnection);
+
+        if (validator.isEmpty() || !_cache->markRevalidated(key))
+            return;
+
+        /* Revalidate in the background. The reply is owned by the shared
+         * access manager rather than this response, which QML may destroy as
+         * soon as it has the texture, and keeps the cache alive itself, as the
+         * provider may be gone by the time it finishes. Updates take effect on
+         * the next load. */
+        QNetworkRequest req = iconRequest(url);
+        applyValidator(req, validator);
+        QNetworkReply *reply = _nam->get(req);
+        QObject::connect(reply, &QNetworkReply::finished, _nam, [reply, cache = _cache, key, requestedSize]() {
+            reply->deleteLater();
+            if (reply->error() != QNetworkReply::NoError
+                || reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304)
+                return;
+
+            QImage img;
+            img.loadFromData(reply->readAll());
+            if (!img.isNull())
+                cache->store(key, prepareIcon(img, requestedSize), validatorFromReply(reply));
+        });
+        return;
+    }
+
+    _reply = _nam->get(iconRequest(url));
     QObject::connect(_reply, &QNetworkReply::finished, this, &IconImageResponse::onFinished);
 }
 
@@ -33,12 +333,14 @@ void IconImageResponse::onFinished()
     }
 
     const QByteArray data = _reply->readAll();
+    const QByteArray validator = validatorFromReply(_reply);
     _reply->deleteLater();
 
     QImage img;
     img.loadFromData(data);
     if (!img.isNull()) {
-        _image = img;
+        _image = prepareIcon(img, _requestedSize);
+        _cache->store(IconCache::key(_url, _requestedSize), _image, validator);
     } else {
         _errorString = QStringLiteral("Failed to decode image");
     }
@@ -52,15 +354,37 @@ QQuickTextureFactory *IconImageResponse::textureFactory() const
 }
 
 IconImageProvider::IconImageProvider()
-    : QQuickAsyncImageProvider()
+    : QQuickAsyncImageProvider(), _cache(std::make_shared<IconCache>())
 {}
 
-IconImageProvider::~IconImageProvider() = default;
-
-QQuickImageResponse *IconImageProvider::requestImageResponse(const QString &id, const QSize &)
+IconImageProvider::~IconImageProvider()
 {
-    QUrl url(id);
-    return new IconImageResponse(url);
+    /* Otherwise the reader thread deletes it when it finishes, as a
+     * QNetworkAccessManager must not be torn down from another thread */
+    if (_nam && _nam->thread() == QThread::currentThread())
+        delete _nam;
 }
 
+QNetworkAccessManager *IconImageProvider::_sharedNetworkAccessManager()
+{
+    /* QML issues all async image requests from its image reader thread, so a
+     * single manager created there can serve every icon over one connection */
+    if (!_nam)
+    {
+        _nam = new QNetworkAccessManager;
+        QObject::connect(QThread::currentThread(), &QThread::finished, _nam, &QObject::deleteLater);
+    }
 
+    if (_nam->thread() != QThread::currentThread())
+        return nullptr;
+
+    return _nam;
+}
+
+QQuickImageResponse *IconImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    QUrl url(id);
+    /* A null manager (unexpected calling thread) makes the response fall
+     * back to a private one it owns */
+    return new IconImageResponse(url, requestedSize, _sharedNetworkAccessManager(), _cache);
+}
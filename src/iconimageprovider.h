@@ -5,12 +5,19 @@
 #include <QNetworkAccessManager>
 #include <QImage>
 #include <QPointer>
+#include <QSize>
+#include <QUrl>
+#include <memory>
+
+class IconCache;
 
 class IconImageResponse final : public QQuickImageResponse
 {
     Q_OBJECT
 public:
-    explicit IconImageResponse(const QUrl &url);
+    /* Serves a cached image immediately when one is available and revalidates
+     * it in the background; otherwise fetches, decodes and caches the icon */
+    IconImageResponse(const QUrl &url, const QSize &requestedSize, QNetworkAccessManager *nam, std::shared_ptr<IconCache> cache);
     QQuickTextureFactory *textureFactory() const override;
     QString errorString() const override { return _errorString; }
 
@@ -18,8 +25,11 @@ private slots:
     void onFinished();
 
 private:
+    QUrl _url;
+    QSize _requestedSize;
     QPointer<QNetworkAccessManager> _nam;
     QPointer<QNetworkReply> _reply;
+    std::shared_ptr<IconCache> _cache;
     QImage _image;
     QString _errorString;
 };
@@ -31,8 +41,14 @@ public:
     ~IconImageProvider() override;
 
     QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
-};
 
-#endif // ICONIMAGEPROVIDER_H
+private:
+    QNetworkAccessManager *_sharedNetworkAccessManager();
 
+    /* Shared with responses and background revalidations, which may outlive the provider */
+    std::shared_ptr<IconCache> _cache;
+    /* Owned by the image reader thread that first requested an icon, and deleted when it finishes */
+    QPointer<QNetworkAccessManager> _nam;
+};
 
+#endif // ICONIMAGEPROVIDER_H
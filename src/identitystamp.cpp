@@ -0,0 +1,301 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "identitystamp.h"
+#include "aligned_buffer.h"
+#include "file_operations.h"
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QtEndian>
+
+namespace {
+
+constexpr char kMagic[16] = {'R', 'P', 'I', '-', 'I', 'M', 'A', 'G', 'E', 'R', '-', 'S', 'T', 'A', 'M', 'P'};
+constexpr quint32 kVersion = 1;
+constexpr int kDigestSize = 32;              // SHA256
+constexpr int kChunkDigestSize = 8;          // Truncated SHA256 per sampled chunk
+constexpr quint32 kMaxChunks = 256;
+constexpr quint32 kSampleSize = 64 * 1024;
+constexpr std::uint64_t kSampleStart = IdentityStamp::Offset + IdentityStamp::Size;
+constexpr std::uint64_t kChunkAlign = 1024 * 1024;
+constexpr std::size_t kHeadSize = 1024 * 1024;
+
+bool readAt(rpi_imager::FileOperations *file, std::uint64_t offset, rpi_imager::AlignedBuffer &buf, std::size_t len)
+{
+    if (file->Seek(offset) != rpi_imager::FileError::kSuccess)
+        return false;
+
+    std::size_t total = 0;
+    while (total < len)
+    {
+        std::size_t bytesRead = 0;
+        if (file->ReadSequential(buf.data() + total, len - total, bytesRead) != rpi_imager::FileError::kSuccess || !bytesRead)
+            return false;
+        total += bytesRead;
+    }
+    return true;
+}
+
+/* Lowest start sector of any partition in the MBR (or the GPT behind a
+ * protective MBR), or 0 if it cannot be determined from the first MiB */
+std::uint64_t firstPartitionSector(const std::uint8_t *head)
+{
+    if (head[510] != 0x55 || head[511] != 0xAA)
+        return 0;
+
+    std::uint64_t first = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        const std::uint8_t *entry = head + 446 + i * 16;
+        std::uint8_t type = entry[4];
+        std::uint32_t start = qFromLittleEndian<quint32>(entry + 8);
+
+        if (type == 0x00 || !start)
+            continue;
+
+        if (type == 0xEE)
+        {
+            const std::uint8_t *gpt = head + 512;
+            if (std::memcmp(gpt, "EFI PART", 8) != 0)
+                return 0;
+
+            std::uint64_t entriesLba = qFromLittleEndian<quint64>(gpt + 72);
+            std::uint32_t numEntries = qFromLittleEndian<quint32>(gpt + 80);
+            std::uint32_t entrySize = qFromLittleEndian<quint32>(gpt + 84);
+            if (entrySize < 128 || entriesLba * 512 + static_cast<std::uint64_t>(numEntries) * entrySize > kHeadSize)
+                return 0;
+
+            static const std::uint8_t unusedGuid[16] = {};
+            for (std::uint32_t j = 0; j < numEntries; j++)
+            {
+                const std::uint8_t *gptEntry = head + entriesLba * 512 + j * entrySize;
+                if (std::memcmp(gptEntry, unusedGuid, 16) == 0)
+                    continue;
+                std::uint64_t gptStart = qFromLittleEndian<quint64>(gptEntry + 32);
+                if (!first || gptStart < first)
+                    first = gptStart;
+            }
+            continue;
+        }
+
+        if (!first || start < first)
+            first = start;
+    }
+
+    return first;
+}
+
+} // namespace
+
+QByteArray IdentityStamp::customisationHash(const QByteArray &config, const QByteArray &cmdline, const QByteArray &firstrun,
+                                            const QByteArray &cloudinit, const QByteArray &cloudinitNetwork,
+                                            const QByteArray &initFormat, ImageOptions::AdvancedOptions opts)
+{
+    QByteArray serialized;
+    QDataStream out(&serialized, QIODevice::WriteOnly);
+    /* QDataStream length-prefixes each array, so fields cannot run into each other */
+    out << config << cmdline << firstrun << cloudinit << cloudinitNetwork << initFormat << static_cast<quint32>(opts.toInt());
+
+    return QCryptographicHash::hash(serialized, QCryptographicHash::Sha256).toHex();
+}
+
+bool IdentityStamp::read(rpi_imager::FileOperations *file)
+{
+    rpi_imager::AlignedBuffer buf(Size);
+    if (!buf || !readAt(file, Offset, buf, Size))
+        return false;
+
+    return _parse(QByteArray(reinterpret_cast<const char *>(buf.data()), Size));
+}
+
+bool IdentityStamp::write(rpi_imager::FileOperations *file, const QByteArray &imageHash, const QByteArray &customisationHash,
+                          std::uint64_t imageSize)
+{
+    rpi_imager::AlignedBuffer head(kHeadSize);
+    if (!head || !readAt(file, 0, head, kHeadSize))
+        return false;
+
+    std::uint64_t firstSector = firstPartitionSector(head.data());
+    if (firstSector * 512 < Offset + Size)
+    {
+        qDebug() << "IdentityStamp: no room before the first partition (starts at sector" << firstSector << ")";
+        return false;
+    }
+
+    /* Some boards keep their bootloader in this gap; never overwrite anything the image put there */
+    for (std::size_t i = Offset; i < Offset + Size; i++)
+    {
+        if (head.data()[i])
+        {
+            qDebug() << "IdentityStamp: area in use by the image";
+            return false;
+        }
+    }
+
+    _imageSize = imageSize;
+    _imageHash = QByteArray::fromHex(imageHash);
+    _customisationHash = QByteArray::fromHex(customisationHash);
+    _writeTime = QDateTime::currentSecsSinceEpoch();
+    _sampleSize = kSampleSize;
+    _chunkSize = 0;
+    if (imageSize > kSampleStart)
+    {
+        std::uint64_t perChunk = (imageSize - kSampleStart + kMaxChunks - 1) / kMaxChunks;
+        _chunkSize = qMax(kChunkAlign, (perChunk + kChunkAlign - 1) / kChunkAlign * kChunkAlign);
+    }
+
+    if (_imageHash.size() != kDigestSize || _customisationHash.size() != kDigestSize
+        || !_sample(file, &_partitionTableDigest, &_chunkDigests))
+        return false;
+
+    QByteArray record = _serialize();
+    rpi_imager::AlignedBuffer buf(Size);
+    if (!buf)
+        return false;
+    std::memcpy(buf.data(), record.constData(), Size);
+
+    return file->Seek(Offset) == rpi_imager::FileError::kSuccess
+        && file->WriteSequential(buf.data(), Size) == rpi_imager::FileError::kSuccess;
+}
+
+bool IdentityStamp::confirm(rpi_imager::FileOperations *file, const QByteArray &imageHash, const QByteArray &customisationHash) const
+{
+    if (_imageHash != QByteArray::fromHex(imageHash) || _customisationHash != QByteArray::fromHex(customisationHash))
+        return false;
+
+    std::uint64_t deviceSize = 0;
+    if (file->GetSize(deviceSize) != rpi_imager::FileError::kSuccess || deviceSize < _imageSize)
+        return false;
+
+    QByteArray partitionTableDigest;
+    std::vector<QByteArray> chunkDigests;
+    if (!_sample(file, &partitionTableDigest, &chunkDigests))
+        return false;
+
+    if (chunkDigests.size() != _chunkDigests.size())
+        return false;
+
+    if (partitionTableDigest != _partitionTableDigest)
+    {
+        qDebug() << "IdentityStamp: partition table changed since the card was written";
+        return false;
+    }
+    for (std::size_t i = 0; i < chunkDigests.size(); i++)
+    {
+        if (chunkDigests[i] != _chunkDigests[i])
+        {
+            qDebug() << "IdentityStamp: chunk" << i << "changed since the card was written";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IdentityStamp::_sample(rpi_imager::FileOperations *file, QByteArray *partitionTableDigest, std::vector<QByteArray> *chunkDigests) const
+{
+    rpi_imager::AlignedBuffer buf(qMax<std::size_t>(_sampleSize, 4096));
+    if (!buf || !readAt(file, 0, buf, 4096))
+        return false;
+
+    *partitionTableDigest = QCryptographicHash::hash(QByteArrayView(buf.data(), 512), QCryptographicHash::Sha256);
+
+    chunkDigests->clear();
+    if (!_chunkSize)
+        return true;
+
+    for (std::uint64_t offset = kSampleStart; offset < _imageSize; offset += _chunkSize)
+    {
+        /* Always read whole aligned samples, but only hash what belongs to the image */
+        if (!readAt(file, offset, buf, _sampleSize))
+            return false;
+        qsizetype len = static_cast<qsizetype>(qMin<std::uint64_t>(_sampleSize, _imageSize - offset));
+        chunkDigests->push_back(QCryptographicHash::hash(QByteArrayView(buf.data(), len), QCryptographicHash::Sha256).left(kChunkDigestSize));
+    }
+    return true;
+}
+
+QByteArray IdentityStamp::_serialize() const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+
+    out.writeRawData(kMagic, sizeof(kMagic));
+    out << kVersion << quint64(_imageSize);
+    out.writeRawData(_imageHash.constData(), kDigestSize);
+    out.writeRawData(_customisationHash.constData(), kDigestSize);
+    out << qint64(_writeTime);
+    out.writeRawData(_partitionTableDigest.constData(), kDigestSize);
+    out << quint64(_chunkSize) << quint32(_sampleSize) << quint32(_chunkDigests.size());
+    for (const QByteArray &digest : _chunkDigests)
+        out.writeRawData(digest.constData(), kChunkDigestSize);
+
+    /* Trailing digest over the rest of the record */
+    data.resize(Size - kDigestSize, '\0');
+    data += QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+    return data;
+}
+
+bool IdentityStamp::_parse(const QByteArray &data)
+{
+    if (data.size() != static_cast<qsizetype>(Size)
+        || std::memcmp(data.constData(), kMagic, sizeof(kMagic)) != 0
+        || QCryptographicHash::hash(data.left(Size - kDigestSize), QCryptographicHash::Sha256) != data.right(kDigestSize))
+        return false;
+
+    QDataStream in(data);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.skipRawData(sizeof(kMagic));
+
+    quint32 version, sampleSize, numChunks;
+    quint64 imageSize, chunkSize;
+    qint64 writeTime;
+    QByteArray imageHash(kDigestSize, '\0'), customisationHash(kDigestSize, '\0'), partitionTableDigest(kDigestSize, '\0');
+
+    in >> version >> imageSize;
+    if (version != kVersion)
+        return false;
+    in.readRawData(imageHash.data(), kDigestSize);
+    in.readRawData(customisationHash.data(), kDigestSize);
+    in >> writeTime;
+    in.readRawData(partitionTableDigest.data(), kDigestSize);
+    in >> chunkSize >> sampleSize >> numChunks;
+    if (in.status() != QDataStream::Ok || numChunks > kMaxChunks || !sampleSize || sampleSize > kSampleSize)
+        return false;
+
+    /* The sample layout must follow from the image size, as it did when the stamp was written */
+    quint64 expectedChunks = 0;
+    if (imageSize > kSampleStart)
+    {
+        if (!chunkSize || chunkSize % kChunkAlign)
+            return false;
+        expectedChunks = (imageSize - kSampleStart + chunkSize - 1) / chunkSize;
+    }
+    if (numChunks != expectedChunks)
+        return false;
+
+    std::vector<QByteArray> chunkDigests;
+    for (quint32 i = 0; i < numChunks; i++)
+    {
+        QByteArray digest(kChunkDigestSize, '\0');
+        in.readRawData(digest.data(), kChunkDigestSize);
+        chunkDigests.push_back(digest);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    _imageSize = imageSize;
+    _imageHash = imageHash;
+    _customisationHash = customisationHash;
+    _writeTime = writeTime;
+    _partitionTableDigest = partitionTableDigest;
+    _chunkSize = chunkSize;
+    _sampleSize = sampleSize;
+    _chunkDigests = std::move(chunkDigests);
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef IDENTITYSTAMP_H
+#define IDENTITYSTAMP_H
+
+#include <cstdint>
+#include <vector>
+#include <QByteArray>
+#include "imageadvancedoptions.h"
+
+namespace rpi_imager {
+class FileOperations;
+}
+
+/**
+ * @brief Record of which image (and customisation) was last written to a card
+ *
+ * Written during finalisation into the unpartitioned gap just below 1 MiB,
+ * which the imager already zeroes before every write, so an interrupted write
+ * never leaves a stale stamp behind. It is only written when the image itself
+ * left that area empty and the first partition starts beyond it.
+ *
+ * Besides the image and customisation hashes the stamp carries a digest of the
+ * partition table and of a small sample at the start of each chunk of the
+ * image, read back from the card after customisation. Before re-imaging,
+ * confirm() re-reads those samples, so a card that has since been booted (and
+ * so modified) is not mistaken for a fresh one.
+ */
+class IdentityStamp
+{
+public:
+    static constexpr std::uint64_t Offset = 1024 * 1024 - 4096;
+    static constexpr std::size_t Size = 4096;
+
+    /**
+     * @brief Hash identifying the customisation inputs applied on top of the image
+     */
+    static QByteArray customisationHash(const QByteArray &config, const QByteArray &cmdline, const QByteArray &firstrun,
+                                        const QByteArray &cloudinit, const QByteArray &cloudinitNetwork,
+                                        const QByteArray &initFormat, ImageOptions::AdvancedOptions opts);
+
+    /**
+     * @brief Read the stamp from a card
+     * @return false if there is none, or it is not intact
+     */
+    bool read(rpi_imager::FileOperations *file);
+
+    /**
+     * @brief Build a stamp for the image just written and write it to the card
+     * @param imageHash Hex SHA256 of the uncompressed image
+     * @return false (leaving the card untouched) if there is no safe place for it
+     */
+    bool write(rpi_imager::FileOperations *file, const QByteArray &imageHash, const QByteArray &customisationHash,
+               std::uint64_t imageSize);
+
+    /**
+     * @brief True if the stamp describes this image and customisation and the card still matches its samples
+     */
+    bool confirm(rpi_imager::FileOperations *file, const QByteArray &imageHash, const QByteArray &customisationHash) const;
+
+    std::uint64_t imageSize() const { return _imageSize; }
+    qint64 writeTime() const { return _writeTime; }
+    std::size_t sampleCount() const { return _chunkDigests.size(); }
+
+private:
+    bool _sample(rpi_imager::FileOperations *file, QByteArray *partitionTableDigest, std::vector<QByteArray> *chunkDigests) const;
+    QByteArray _serialize() const;
+    bool _parse(const QByteArray &data);
+
+    std::uint64_t _imageSize = 0;
+    QByteArray _imageHash;             // Raw SHA256 of the uncompressed image
+    QByteArray _customisationHash;     // Raw SHA256 of the customisation inputs
+    qint64 _writeTime = 0;             // Seconds since epoch
+    QByteArray _partitionTableDigest;  // Raw SHA256 of the first sector as left on the card
+    std::uint64_t _chunkSize = 0;
+    std::uint32_t _sampleSize = 0;
+    std::vector<QByteArray> _chunkDigests;  // Truncated SHA256 of the sample at the start of each chunk
+};
+
+#endif // IDENTITYSTAMP_H
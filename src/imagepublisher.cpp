@@ -0,0 +1,487 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "imagepublisher.h"
+#include "allocationmap.h"
+#include "config.h"
+#include "zstdseekable.h"
+#include <QCryptographicHash>
+#include <QDate>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <lzma.h>
+#include <zstd.h>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/* Block size of the block map, as bmaptool uses */
+constexpr qint64 BmapBlockSize = 4096;
+
+/* Blocks [first, last] of the image that hold data */
+struct MappedRange {
+    qint64 first;
+    qint64 last;
+    QByteArray sha256;
+};
+
+/* The compressed image, hashed as a whole and in chunks as it is written */
+struct DownloadOutput {
+    QSaveFile file;
+    QCryptographicHash hash{QCryptographicHash::Sha256};
+    QCryptographicHash chunkHash{QCryptographicHash::Sha256};
+    qint64 chunkSize = IMAGEWRITER_PUBLISH_CHUNK_SIZE;
+    qint64 chunkFill = 0;
+    qint64 size = 0;
+    QJsonArray chunks;
+
+    explicit DownloadOutput(const QString &fileName) : file(fileName) {}
+
+    bool write(const char *data, qint64 len)
+    {
+        if (file.write(data, len) != len)
+            return false;
+
+        hash.addData(QByteArrayView(data, len));
+        size += len;
+        while (len > 0)
+        {
+            const qint64 n = std::min(len, chunkSize - chunkFill);
+            chunkHash.addData(QByteArrayView(data, n));
+            chunkFill += n;
+            data += n;
+            len -= n;
+            if (chunkFill == chunkSize)
+                finishChunk();
+        }
+        return true;
+    }
+
+    void finishChunk()
+    {
+        chunks.append(QString::fromLatin1(chunkHash.result().toHex()));
+        chunkHash.reset();
+        chunkFill = 0;
+    }
+
+    bool commit()
+    {
+        if (chunkFill)
+            finishChunk();
+        return file.commit();
+    }
+};
+
+/* Reads until len bytes or the end of the file. Returns the number read, -1 on error */
+qint64 readFully(QFile &f, char *buf, qint64 len)
+{
+    qint64 done = 0;
+    while (done < len)
+    {
+        const qint64 n = f.read(buf + done, len - done);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+/* Name of the compression the file starts with, empty for a raw image */
+QString compressedFormat(const QByteArray &head)
+{
+    if (head.startsWith("\xFD" "7zXZ"))
+        return "xz";
+    if (head.startsWith("\x28\xB5\x2F\xFD"))
+        return "zstd";
+    if (head.startsWith("\x1F\x8B"))
+        return "gzip";
+    if (head.startsWith("BZh"))
+        return "bzip2";
+    if (head.startsWith("PK\x03\x04"))
+        return "zip";
+    return QString();
+}
+
+/* Byte ranges [start, end) of the image that are not holes */
+std::vector<std::pair<qint64, qint64>> dataRanges(const QString &fileName, qint64 size)
+{
+    std::vector<std::pair<qint64, qint64>> ranges;
+#if defined(Q_OS_UNIX) && defined(SEEK_HOLE)
+    QFile f(fileName);
+    if (f.open(QIODevice::ReadOnly))
+    {
+        const int fd = f.handle();
+        off_t pos = 0;
+        bool ok = true;
+        while (pos < size)
+        {
+            const off_t data = ::lseek(fd, pos, SEEK_DATA);
+            if (data < 0)
+            {
+                ok = (errno == ENXIO);      // No data after pos
+                break;
+            }
+            const off_t hole = ::lseek(fd, data, SEEK_HOLE);
+            if (hole < 0)
+            {
+                ok = false;
+                break;
+            }
+            ranges.emplace_back(data, std::min<qint64>(hole, size));
+            pos = hole;
+        }
+        if (ok)
+            return ranges;
+        ranges.clear();
+    }
+#else
+    Q_UNUSED(fileName);
+#endif
+    if (size)
+        ranges.emplace_back(0, size);
+    return ranges;
+}
+
+/* Blocks holding data that the image's filesystems do not mark as free */
+std::vector<MappedRange> mappedRanges(const std::vector<std::pair<qint64, qint64>> &data,
+                                      const AllocationMap &allocationMap, qint64 imageSize)
+{
+    std::vector<MappedRange> ranges;
+    for (const auto &range : data)
+    {
+        for (qint64 block = range.first / BmapBlockSize; block <= (range.second - 1) / BmapBlockSize; block++)
+        {
+            if (!ranges.empty() && block <= ranges.back().last)
+                continue;
+
+            const qint64 offset = block * BmapBlockSize;
+            const qint64 len = std::min(BmapBlockSize, imageSize - offset);
+            if (allocationMap.isUnallocated(static_cast<uint64_t>(offset), static_cast<uint64_t>(len)))
+                continue;
+
+            if (!ranges.empty() && ranges.back().last == block - 1)
+                ranges.back().last = block;
+            else
+                ranges.push_back({block, block, QByteArray()});
+        }
+    }
+    return ranges;
+}
+
+/* bmaptool's format 2.0. The file checksum is taken with the checksum field all zeroes */
+QByteArray bmapFile(qint64 imageSize, const std::vector<MappedRange> &ranges)
+{
+    const qint64 blocks = (imageSize + BmapBlockSize - 1) / BmapBlockSize;
+    qint64 mapped = 0;
+    for (const MappedRange &r : ranges)
+        mapped += r.last - r.first + 1;
+
+    const QByteArray zeroChecksum(64, '0');
+    QByteArray xml;
+    QTextStream s(&xml);
+    s << "<?xml version=\"1.0\" ?>\n"
+      << "<!-- Block map of the image: the blocks worth writing, with the SHA256 of each range.\n"
+      << "     Generated by rpi-imager --publish -->\n"
+      << "<bmap version=\"2.0\">\n"
+      << "    <ImageSize> " << imageSize << " </ImageSize>\n"
+      << "    <BlockSize> " << BmapBlockSize << " </BlockSize>\n"
+      << "    <BlocksCount> " << blocks << " </BlocksCount>\n"
+      << "    <!-- " << QString::number(blocks ? 100.0 * mapped / blocks : 0, 'f', 1) << "% of the image -->\n"
+      << "    <MappedBlocksCount> " << mapped << " </MappedBlocksCount>\n"
+      << "    <ChecksumType> sha256 </ChecksumType>\n"
+      << "    <BmapFileChecksum> " << zeroChecksum << " </BmapFileChecksum>\n"
+      << "    <BlockMap>\n";
+    for (const MappedRange &r : ranges)
+    {
+        s << "        <Range chksum=\"" << r.sha256 << "\"> " << r.first;
+        if (r.last != r.first)
+            s << "-" << r.last;
+        s << " </Range>\n";
+    }
+    s << "    </BlockMap>\n"
+      << "</bmap>\n";
+    s.flush();
+
+    const QByteArray checksum = QCryptographicHash::hash(xml, QCryptographicHash::Sha256).toHex();
+    xml.replace(xml.indexOf(zeroChecksum), zeroChecksum.size(), checksum);
+    return xml;
+}
+
+QByteArray compressZstdFrame(const QByteArray &data, int level)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+    QByteArray out(static_cast<qsizetype>(ZSTD_compressBound(data.size())), Qt::Uninitialized);
+    const size_t n = ZSTD_compress2(cctx, out.data(), out.size(), data.constData(), data.size());
+    ZSTD_freeCCtx(cctx);
+
+    if (ZSTD_isError(n))
+        return QByteArray();
+    out.resize(static_cast<qsizetype>(n));
+    return out;
+}
+
+/* SHA256 of bytes [start, end) of the file, hex encoded. Empty on error */
+QByteArray hashRange(const QString &fileName, qint64 start, qint64 end)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly) || !f.seek(start))
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray buf(IMAGEWRITER_BLOCKSIZE, Qt::Uninitialized);
+    for (qint64 pos = start; pos < end; )
+    {
+        const qint64 n = readFully(f, buf.data(), std::min<qint64>(buf.size(), end - pos));
+        if (n <= 0)
+            return QByteArray();
+        hash.addData(QByteArrayView(buf.constData(), n));
+        pos += n;
+    }
+    return hash.result().toHex();
+}
+
+bool writeFile(const QString &fileName, const QByteArray &contents)
+{
+    QSaveFile f(fileName);
+    return f.open(QIODevice::WriteOnly) && f.write(contents) == contents.size() && f.commit();
+}
+
+} // namespace
+
+int ImagePublisher::publish(const QString &imagePath, const QString &outputDir, const Options &options,
+                            QTextStream &out, QTextStream &err)
+{
+    const QFileInfo imageInfo(imagePath);
+    QFile in(imagePath);
+    if (!imageInfo.isFile() || !in.open(QIODevice::ReadOnly))
+    {
+        err << "Error: cannot read image " << imagePath << Qt::endl;
+        return 1;
+    }
+    const qint64 imageSize = in.size();
+    const QString format = compressedFormat(in.peek(8));
+    if (imageSize == 0 || !format.isEmpty())
+    {
+        err << "Error: " << imagePath << (imageSize ? " is " + format + " compressed" : QString(" is empty"))
+            << ", --publish takes a raw image" << Qt::endl;
+        return 1;
+    }
+
+    QDir dir(outputDir);
+    if (!dir.mkpath("."))
+    {
+        err << "Error: cannot create output directory " << outputDir << Qt::endl;
+        return 1;
+    }
+
+    const bool zstd = options.compression == Compression::Zstd;
+    const int threads = options.threads > 0 ? options.threads : QThread::idealThreadCount();
+    const qint64 blockSize = IMAGEWRITER_PUBLISH_BLOCK_SIZE;
+    const QString downloadName = imageInfo.fileName() + (zstd ? ".zst" : ".xz");
+
+    DownloadOutput download(dir.filePath(downloadName));
+    if (!download.file.open(QIODevice::WriteOnly))
+    {
+        err << "Error: cannot create " << download.file.fileName() << Qt::endl;
+        return 1;
+    }
+
+    /* First pass: compress, hash the image and find the blocks its filesystems leave free */
+    QCryptographicHash extractHash(OSLIST_HASH_ALGORITHM);
+    AllocationMap allocationMap;
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QString error;
+
+    std::deque<std::pair<QFuture<QByteArray>, quint32>> inFlight;      // Frame, uncompressed size
+    ZstdSeekable::SeekTable seekTable;
+    auto writeFrame = [&]() {
+        QByteArray frame = inFlight.front().first.result();
+        if (frame.isEmpty())
+            error = "zstd compression error";
+        else if (!download.write(frame.constData(), frame.size()))
+            error = "write error";
+        else
+            seekTable.emplace_back(static_cast<quint32>(frame.size()), inFlight.front().second);
+        inFlight.pop_front();
+    };
+
+    lzma_stream strm = LZMA_STREAM_INIT;
+    QByteArray xzOut;
+    auto xzCode = [&](lzma_action action) {
+        lzma_ret ret = LZMA_OK;
+        do {
+            strm.next_out = reinterpret_cast<uint8_t *>(xzOut.data());
+            strm.avail_out = static_cast<size_t>(xzOut.size());
+            ret = lzma_code(&strm, action);
+            const qint64 produced = xzOut.size() - static_cast<qint64>(strm.avail_out);
+            if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+                error = QStringLiteral("xz compression error %1").arg(static_cast<int>(ret));
+            else if (produced && !download.write(xzOut.constData(), produced))
+                error = "write error";
+        } while (error.isEmpty() && ret != LZMA_STREAM_END && (strm.avail_in || action == LZMA_FINISH));
+    };
+
+    if (!zstd)
+    {
+        lzma_mt mt = {};
+        mt.threads = static_cast<uint32_t>(threads);
+        mt.block_size = static_cast<uint64_t>(blockSize);
+        mt.preset = static_cast<uint32_t>(options.level >= 0 ? options.level : IMAGEWRITER_PUBLISH_XZ_PRESET);
+        mt.check = LZMA_CHECK_CRC64;
+        if (lzma_stream_encoder_mt(&strm, &mt) != LZMA_OK)
+        {
+            err << "Error: cannot initialise the xz encoder" << Qt::endl;
+            return 1;
+        }
+        xzOut.resize(1024 * 1024);
+    }
+    const int zstdLevel = options.level >= 0 ? options.level : IMAGEWRITER_PUBLISH_ZSTD_LEVEL;
+
+    qint64 offset = 0;
+    while (error.isEmpty())
+    {
+        QByteArray block(blockSize, Qt::Uninitialized);
+        const qint64 n = readFully(in, block.data(), blockSize);
+        if (n < 0)
+        {
+            error = "read error";
+            break;
+        }
+        if (n == 0)
+            break;
+        block.resize(n);
+
+        extractHash.addData(block);
+        allocationMap.feed(static_cast<uint64_t>(offset), block.constData(), static_cast<size_t>(n));
+        offset += n;
+
+        if (zstd)
+        {
+            /* Frames are compressed on the pool and written in order, keeping every thread busy */
+            inFlight.emplace_back(QtConcurrent::run(&pool, compressZstdFrame, block, zstdLevel), static_cast<quint32>(n));
+            while (error.isEmpty() && inFlight.size() > static_cast<size_t>(threads))
+                writeFrame();
+        }
+        else
+        {
+            strm.next_in = reinterpret_cast<const uint8_t *>(block.constData());
+            strm.avail_in = static_cast<size_t>(n);
+            xzCode(LZMA_RUN);
+        }
+    }
+
+    if (zstd)
+    {
+        while (!inFlight.empty())
+        {
+            if (error.isEmpty())
+                writeFrame();
+            else
+            {
+                inFlight.front().first.waitForFinished();
+                inFlight.pop_front();
+            }
+        }
+        if (error.isEmpty())
+        {
+            const QByteArray table = ZstdSeekable::seekTableFrame(seekTable);
+            if (!download.write(table.constData(), table.size()))
+                error = "write error";
+        }
+    }
+    else
+    {
+        if (error.isEmpty())
+            xzCode(LZMA_FINISH);
+        lzma_end(&strm);
+    }
+
+    if (error.isEmpty() && offset != imageSize)
+        error = "image changed while reading it";
+    if (!error.isEmpty() || !download.commit())
+    {
+        download.file.cancelWriting();
+        err << "Error: compressing " << imagePath << " failed: " << (error.isEmpty() ? QString("write error") : error) << Qt::endl;
+        return 1;
+    }
+    in.close();
+
+    /* Second pass: hash the ranges of the block map */
+    std::vector<MappedRange> ranges = mappedRanges(dataRanges(imagePath, imageSize), allocationMap, imageSize);
+    std::vector<QFuture<QByteArray>> hashes;
+    for (const MappedRange &r : ranges)
+        hashes.push_back(QtConcurrent::run(&pool, hashRange, imagePath, r.first * BmapBlockSize,
+                                           std::min((r.last + 1) * BmapBlockSize, imageSize)));
+    bool readError = false;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        ranges[i].sha256 = hashes[i].result();
+        readError |= ranges[i].sha256.isEmpty();
+    }
+    if (readError)
+    {
+        err << "Error: reading " << imagePath << " for the block map failed" << Qt::endl;
+        return 1;
+    }
+
+    const QByteArray downloadSha256 = download.hash.result().toHex();
+
+    QJsonObject manifest;
+    manifest["file"] = downloadName;
+    manifest["size"] = download.size;
+    manifest["sha256"] = QString::fromLatin1(downloadSha256);
+    manifest["chunk_size"] = download.chunkSize;
+    manifest["chunks"] = download.chunks;
+
+    QString url = downloadName;
+    if (!options.baseUrl.isEmpty())
+        url = options.baseUrl + (options.baseUrl.endsWith('/') ? "" : "/") + downloadName;
+
+    QJsonObject entry;
+    entry["name"] = imageInfo.completeBaseName();
+    entry["description"] = "";
+    entry["url"] = url;
+    entry["extract_size"] = imageSize;
+    entry["extract_sha256"] = QString::fromLatin1(extractHash.result().toHex());
+    entry["image_download_size"] = download.size;
+    entry["image_download_sha256"] = QString::fromLatin1(downloadSha256);
+    entry["release_date"] = QDate::currentDate().toString(Qt::ISODate);
+
+    const QByteArray entryJson = QJsonDocument(entry).toJson(QJsonDocument::Indented);
+    if (!writeFile(dir.filePath(imageInfo.fileName() + ".bmap"), bmapFile(imageSize, ranges))
+        || !writeFile(dir.filePath(downloadName + ".chunks.json"), QJsonDocument(manifest).toJson(QJsonDocument::Indented))
+        || !writeFile(dir.filePath(imageInfo.completeBaseName() + ".json"), entryJson))
+    {
+        err << "Error: cannot write to " << outputDir << Qt::endl;
+        return 1;
+    }
+
+    out << entryJson;
+    out.flush();
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef IMAGEPUBLISHER_H
+#define IMAGEPUBLISHER_H
+
+#include <QString>
+
+class QTextStream;
+
+/**
+ * @brief Package a raw image for publishing (rpi-imager --cli --publish)
+ *
+ * Produces, in the output directory, for an image named NAME.img:
+ *
+ * - NAME.img.zst: seekable zstd, IMAGEWRITER_PUBLISH_BLOCK_SIZE per frame
+ *   (or NAME.img.xz, with one xz block per IMAGEWRITER_PUBLISH_BLOCK_SIZE),
+ *   so the image can be decoded on several cores and from any block
+ * - NAME.img.bmap: bmaptool 2.0 block map of the ranges that hold data, with
+ *   the SHA256 of each range. Holes of a sparse image and blocks the image's
+ *   own FAT and ext4 filesystems mark as free are left out
+ * - NAME.img.zst.chunks.json: SHA256 of every IMAGEWRITER_PUBLISH_CHUNK_SIZE
+ *   chunk of the download, so a corrupted download can be detected, and
+ *   resumed, at the first bad chunk instead of after the whole file
+ * - NAME.json: the image's OS list entry (extract_size, extract_sha256,
+ *   image_download_size, image_download_sha256, ...), also printed to out
+ *
+ * Compression runs on all cores. The image is read twice: once to compress
+ * and hash it, once to hash the ranges of the block map.
+ */
+class ImagePublisher
+{
+public:
+    enum class Compression {
+        Zstd,
+        Xz
+    };
+
+    struct Options {
+        Compression compression = Compression::Zstd;
+        int level = -1;             // -1: IMAGEWRITER_PUBLISH_ZSTD_LEVEL or IMAGEWRITER_PUBLISH_XZ_PRESET
+        int threads = 0;            // 0: one per core
+        QString baseUrl;            // Prefix of the download URL in the OS list entry
+    };
+
+    /* Returns 0 on success, 1 on failure (reported on err) */
+    static int publish(const QString &imagePath, const QString &outputDir, const Options &options,
+                       QTextStream &out, QTextStream &err);
+};
+
+#endif // IMAGEPUBLISHER_H
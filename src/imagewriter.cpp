@@ -10,11 +10,12 @@
 #include "file_operations.h"
 #include "drivelistitem.h"
 #include "customization_generator.h"
+#include "customization_template.h"
+#include "sourcecatalogue.h"
 #include "dependencies/drivelist/src/drivelist.hpp"
-#include "dependencies/sha256crypt/sha256crypt.h"
-#include "dependencies/yescrypt/yescrypt_wrapper.h"
 #include "driveformatthread.h"
 #include "localfileextractthread.h"
+#include "chunkstoreextractthread.h"
 #include "downloadstatstelemetry.h"
 #include "wlancredentials.h"
 #include "device_info.h"
@@ -78,6 +79,7 @@
 
 #ifdef Q_OS_LINUX
 #include "linux/stpanalyzer.h"
+#include "linux/blockstatsampler.h"
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
@@ -95,6 +97,7 @@ bool ImageWriter::_forceSecureBootEnabled = false;
 ImageWriter::ImageWriter(QObject *parent)
     : QObject(parent),
       _cacheManager(nullptr),
+      _sourceCatalogue(nullptr),
       _waitingForCacheVerification(false),
       _networkManager(this),
       _src(), _repo(QUrl(QString(OSLIST_URL))),
@@ -131,6 +134,9 @@ ImageWriter::ImageWriter(QObject *parent)
     
     // Initialise PerformanceStats
     _performanceStats = new PerformanceStats(this);
+#ifdef Q_OS_LINUX
+    _blockStatSampler = new BlockStatSampler(_performanceStats, 1000, this);
+#endif
     
     // Set up file operations logging to use Qt's debug output
     rpi_imager::SetFileOperationsLogCallback([](const std::string& msg) {
@@ -416,6 +422,11 @@ ImageWriter::~ImageWriter()
         _cacheManager = nullptr;
     }
 
+    if (_sourceCatalogue) {
+        delete _sourceCatalogue;
+        _sourceCatalogue = nullptr;
+    }
+
     // Ensure any running thread is properly cleaned up
     if (_thread) {
         if (_thread->isRunning()) {
@@ -583,7 +594,8 @@ void ImageWriter::startWrite()
     {
         // For formatting operations, skip all cache operations since we don't need cached files
         qDebug() << "Starting format operation - skipping cache operations";
-        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), this);
+        // A plain erase: exFAT on cards above 32 GB, as SD cards are formatted
+        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), rpi_imager::Filesystem::kAuto, this);
         connect(dft, SIGNAL(success()), SLOT(onSuccess()));
         connect(dft, SIGNAL(error(QString)), SLOT(onError(QString)));
         connect(dft, SIGNAL(preparationStatusUpdate(QString)), SLOT(onPreparationStatusUpdate(QString)));
@@ -650,20 +662,53 @@ void ImageWriter::startWrite()
         return;
     }
 
+    // Hardware counters per pipeline stage are opt-in (perf_event_open on Linux)
+    PerfCounters::setEnabled(getBoolSetting("perfCounters"));
+
     // Start performance stats session early so cache lookup is captured
     _performanceStats->startSession(_osName.isEmpty() ? _src.fileName() : _osName, 
                                     _extrLen > 0 ? _extrLen : _downloadLen, 
                                     _dst);
 
+#ifdef Q_OS_LINUX
+    // Sample the target's block layer on the same timeline as the progress samples
+    _blockStatSampler->start(_dst);
+#endif
+
     // Time cache lookup for performance tracking
     QElapsedTimer cacheLookupTimer;
     cacheLookupTimer.start();
-    bool cacheHit = !_expectedHash.isEmpty() && _cacheManager->isCached(_expectedHash);
+    // The RAM hot tier, if enabled, is checked before the disk cache, and the chunk store after it
+    const QString hotTierFile = _cacheManager->hotTierFile(_expectedHash);
+    bool cacheHit = hotTierFile.isEmpty() && !_expectedHash.isEmpty() && _cacheManager->useCacheFile(_expectedHash);
+    const QString chunkStoreRecipe = hotTierFile.isEmpty() && !cacheHit
+        ? _cacheManager->chunkStoreRecipe(_expectedHash) : QString();
+    const CacheManager::CacheTier cacheTier = !hotTierFile.isEmpty() ? CacheManager::CacheTier::Ram
+        : cacheHit ? CacheManager::CacheTier::Disk
+        : !chunkStoreRecipe.isEmpty() ? CacheManager::CacheTier::ChunkStore : CacheManager::CacheTier::None;
+    if (!_expectedHash.isEmpty()) {
+        _cacheManager->recordLookup(_expectedHash, cacheTier);
+    }
     _performanceStats->recordEvent(PerformanceStats::EventType::CacheLookup,
         static_cast<quint32>(cacheLookupTimer.elapsed()), true,
-        cacheHit ? "hit" : (_expectedHash.isEmpty() ? "no_hash" : "miss"));
-    
-    if (cacheHit)
+        QString("%1; %2").arg(!hotTierFile.isEmpty() ? "hit: ram" : cacheHit ? "hit: disk"
+                                  : !chunkStoreRecipe.isEmpty() ? "hit: chunks"
+                                  : (_expectedHash.isEmpty() ? "no_hash" : "miss"),
+                              _cacheManager->tierStatistics()));
+
+    if (!hotTierFile.isEmpty())
+    {
+        // Verified when it was promoted, and read from RAM
+        qDebug() << "Using cache file from the RAM hot tier:" << hotTierFile;
+        urlstr = QUrl::fromLocalFile(hotTierFile).toString(_src.FullyEncoded).toLatin1();
+    }
+    else if (!chunkStoreRecipe.isEmpty())
+    {
+        // Chunks are checked as they are decompressed, and the image as it is written
+        qDebug() << "Using image from the chunk store:" << chunkStoreRecipe;
+        urlstr = QUrl::fromLocalFile(chunkStoreRecipe).toString(_src.FullyEncoded).toLatin1();
+    }
+    else if (cacheHit)
     {
         // Use background cache manager to check cache file integrity
         CacheManager::CacheStatus cacheStatus = _cacheManager->getCacheStatus();
@@ -715,7 +760,11 @@ void ImageWriter::startWrite()
         }
     }
 
-    if (QUrl(urlstr).isLocalFile())
+    if (!chunkStoreRecipe.isEmpty())
+    {
+        _thread = new ChunkStoreExtractThread(urlstr, _dst.toLatin1(), _expectedHash, this);
+    }
+    else if (QUrl(urlstr).isLocalFile())
     {
         _thread = new LocalFileExtractThread(urlstr, _dst.toLatin1(), _expectedHash, this);
     }
@@ -734,11 +783,12 @@ void ImageWriter::startWrite()
     connect(_thread, SIGNAL(error(QString)), SLOT(onError(QString)));
     connect(_thread, SIGNAL(finalizing()), SLOT(onFinalizing()));
     connect(_thread, SIGNAL(preparationStatusUpdate(QString)), SLOT(onPreparationStatusUpdate(QString)));
-    // Ensure cleanup of thread pointer on finish in all paths
-    connect(_thread, &QThread::finished, this, [this]() {
-        if (_thread)
+    // Ensure cleanup of thread pointer on finish in all paths.
+    // The next write may already have started by the time this one finishes
+    connect(_thread, &QThread::finished, _thread, &QObject::deleteLater);
+    connect(_thread, &QThread::finished, this, [this, thread = _thread]() {
+        if (_thread == thread)
         {
-            _thread->deleteLater();
             _thread = nullptr;
         }
     });
@@ -812,6 +862,18 @@ void ImageWriter::startWrite()
                         totalMs, bytesRead, true,
                         QString("bytes: %1 MB").arg(bytesRead / (1024*1024)));
                 });
+        connect(downloadThread, &DownloadExtractThread::eventInputRingBufferFill,
+                this, [this](quint64 bytesCommitted, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::InputRingBufferFill,
+                        0, bytesCommitted, true, metadata);
+                });
+        connect(downloadThread, &DownloadExtractThread::eventDecompressorOutput,
+                this, [this](quint64 bytesPassedThrough, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::DecompressorOutput,
+                        0, bytesPassedThrough, true, metadata);
+                });
         connect(downloadThread, &DownloadExtractThread::eventWriteRingBufferStats,
                 this, [this](quint64 producerStalls, quint64 consumerStalls, 
                              quint64 producerWaitMs, quint64 consumerWaitMs){
@@ -824,6 +886,22 @@ void ImageWriter::startWrite()
                         PerformanceStats::EventType::WriteRingBufferStats,
                         totalWaitMs, true, metadata);
                 });
+        connect(downloadThread, &DownloadExtractThread::eventArchiveEntryExtraction,
+                this, [this](quint32 durationMs, quint64 bytes, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::ArchiveEntryExtraction,
+                        durationMs, bytes, true, metadata);
+                });
+    }
+
+    ChunkStoreExtractThread *chunkStoreThread = qobject_cast<ChunkStoreExtractThread*>(_thread);
+    if (chunkStoreThread) {
+        connect(chunkStoreThread, &ChunkStoreExtractThread::eventChunkStoreRead,
+                this, [this](quint32 durationMs, quint64 bytes, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::ChunkStoreRead,
+                        durationMs, bytes, true, metadata);
+                });
     }
     
     // Connect performance event signals from DownloadThread
@@ -898,8 +976,26 @@ void ImageWriter::startWrite()
             this, [this](QString metadata){
                 _performanceStats->recordEvent(PerformanceStats::EventType::NetworkConnectionStats, 0, true, metadata);
             });
+    connect(_thread, &DownloadThread::eventAllocationMap,
+            this, [this](quint32 durationMs, quint64 bytesSkipped, QString metadata){
+                _performanceStats->recordTransferEvent(PerformanceStats::EventType::AllocationMap, durationMs, bytesSkipped, true, metadata);
+            });
+    connect(_thread, &DownloadThread::eventIdentityStamp,
+            this, [this](quint32 durationMs, bool success, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::IdentityStamp, durationMs, success, metadata);
+            });
+    connect(_thread, &DownloadThread::eventTimeToFirstDeviceByte,
+            this, [this](quint32 durationMs, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::TimeToFirstDeviceByte, durationMs, true, metadata);
+            });
+    connect(_thread, &DownloadThread::eventPipelineStall,
+            this, [this](quint32 durationMs, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::PipelineStall, durationMs,
+                                               metadata.contains("recovered: yes"), metadata);
+            });
 
     _thread->setVerifyEnabled(_verifyEnabled);
+    _applyWriteOverrides();
     _thread->setUserAgent(QString("Mozilla/5.0 rpi-imager/%1").arg(staticVersion()).toUtf8());
     _thread->setImageCustomisation(_config, _cmdline, _firstrun, _cloudinit, _cloudinitNetwork, _initFormat, _advancedOptions);
 #ifdef Q_OS_DARWIN
@@ -938,7 +1034,8 @@ void ImageWriter::startWrite()
     if (_multipleFilesInZip)
     {
         static_cast<DownloadExtractThread *>(_thread)->enableMultipleFileExtraction();
-        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), this);
+        // The files extracted onto it are booted from, and the boot ROM only reads FAT
+        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), rpi_imager::Filesystem::kFat32, this);
         connect(dft, SIGNAL(success()), _thread, SLOT(start()));
         connect(dft, SIGNAL(error(QString)), SLOT(onError(QString)));
         connect(dft, SIGNAL(preparationStatusUpdate(QString)), SLOT(onPreparationStatusUpdate(QString)));
@@ -1031,7 +1128,12 @@ void ImageWriter::onCancelled()
     }
 
     // End performance stats session
+#ifdef Q_OS_LINUX
+    _blockStatSampler->stop();
+#endif
     _performanceStats->endSession(false, _cancelledDueToDeviceRemoval ? "Device removed" : "Cancelled by user");
+    _cacheManager->releaseHotTierFile();
+    _cacheManager->releaseCacheFile();
 
     // If cancellation was due to device removal, emit a dedicated signal (localization-safe for QML routing)
     if (_cancelledDueToDeviceRemoval) {
@@ -1490,7 +1592,7 @@ QJsonDocument ImageWriter::getFilteredOSlistDocument() {
 
     reference_os_list_array.append(QJsonObject({
             {"name", QCoreApplication::translate("main", "Erase")},
-            {"description", QCoreApplication::translate("main", "Format card as FAT32")},
+            {"description", QCoreApplication::translate("main", "Format card as FAT32, or exFAT if larger than 32 GB")},
             {"icon", "../icons/erase.png"},
             {"url", "internal://format"},
         }));
@@ -1617,6 +1719,24 @@ void ImageWriter::setCustomCacheFile(const QString &cacheFile, const QByteArray
     _cacheManager->setCustomCacheFile(cacheFile, sha256);
 }
 
+void ImageWriter::setCacheReadOnly(bool readOnly)
+{
+    _cacheManager->setReadOnly(readOnly);
+}
+
+void ImageWriter::setWriteOverride(const QString &key, const QVariant &value)
+{
+    _writeOverrides.insert(key, value);
+}
+
+void ImageWriter::_applyWriteOverrides()
+{
+    if (_writeOverrides.contains("eject"))
+        _thread->setEjectEnabled(_writeOverrides.value("eject").toBool());
+    if (_writeOverrides.contains("skipIfIdentical"))
+        _thread->setSkipIfIdentical(_writeOverrides.value("skipIfIdentical").toBool());
+}
+
 /* Drive list polling runs continuously in background - no explicit start/stop needed */
 
 DriveListModel *ImageWriter::getDriveList()
@@ -1675,6 +1795,8 @@ void ImageWriter::setWriteState(WriteState state)
         case WriteState::Idle:
             // Back to device selection - resume normal scanning
             _drivelist.resumePolling();
+            if (_sourceCatalogue)
+                _sourceCatalogue->setHashingPaused(false);
             break;
             
         case WriteState::Preparing:
@@ -1688,6 +1810,9 @@ void ImageWriter::setWriteState(WriteState state)
                 qDebug() << "Pausing drive scanning during write operation";
                 _drivelist.pausePolling();
             }
+            // Hashing USB source media would compete with the write for the same media
+            if (_sourceCatalogue)
+                _sourceCatalogue->setHashingPaused(true);
             break;
             
         case WriteState::Succeeded:
@@ -1697,6 +1822,8 @@ void ImageWriter::setWriteState(WriteState state)
             // Full resume happens when returning to device selection (Idle state)
             qDebug() << "Write complete, switching to slow drive scanning";
             _drivelist.setSlowPolling();
+            if (_sourceCatalogue)
+                _sourceCatalogue->setHashingPaused(false);
             break;
     }
     
@@ -1717,7 +1844,12 @@ void ImageWriter::onSuccess()
     stopProgressPolling();
     
     // End performance stats session
+#ifdef Q_OS_LINUX
+    _blockStatSampler->stop();
+#endif
     _performanceStats->endSession(true);
+    _cacheManager->releaseHotTierFile();
+    _cacheManager->releaseCacheFile();
     
     // Clear Pi Connect token on successful write completion
     clearConnectToken();
@@ -1744,7 +1876,12 @@ void ImageWriter::onError(QString msg)
     stopProgressPolling();
     
     // End performance stats session with error
+#ifdef Q_OS_LINUX
+    _blockStatSampler->stop();
+#endif
     _performanceStats->endSession(false, msg);
+    _cacheManager->releaseHotTierFile();
+    _cacheManager->releaseCacheFile();
     
     emit error(msg);
 
@@ -2002,24 +2139,36 @@ QByteArray ImageWriter::getUsbSourceOSlist()
     QJsonArray oslist;
     QDir dir("/media");
     const QStringList medialist = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
-    QStringList namefilters = {"*.img", "*.zip", "*.gz", "*.xz", "*.zst", "*.wic"};
+
+    if (!_sourceCatalogue)
+    {
+        _sourceCatalogue = new SourceCatalogue(this);
+        connect(_sourceCatalogue, &SourceCatalogue::catalogueUpdated, this, &ImageWriter::usbSourceOSlistChanged);
+    }
 
     for (const QString &devname : medialist)
     {
-        QDir subdir("/media/"+devname);
-        const QStringList files = subdir.entryList(namefilters, QDir::Files, QDir::Name);
-        for (const QString &file : files)
+        const QString mountPoint = "/media/"+devname;
+        const QList<SourceCatalogue::Image> images = _sourceCatalogue->images(mountPoint, devname);
+
+        for (const SourceCatalogue::Image &image : images)
         {
-            QString path = "/media/"+devname+"/"+file;
-            QFileInfo fi(path);
+            QString path = mountPoint+"/"+image.name;
 
             QJsonObject f = {
-                {"name", file},
-                {"description", devname+"/"+file},
+                {"name", image.name},
+                {"description", devname+"/"+image.name},
                 {"url", QUrl::fromLocalFile(path).toString() },
                 {"release_date", ""},
-                {"image_download_size", fi.size()}
+                {"image_download_size", image.size}
             };
+            /* Known sizes save probing the image when it is selected, a known hash has the write verified against it */
+            if (image.extractSize)
+                f["extract_size"] = static_cast<qint64>(image.extractSize);
+            if (!image.extractSha256.isEmpty())
+                f["extract_sha256"] = QString::fromLatin1(image.extractSha256);
+            if (image.multipleFiles)
+                f["contains_multiple_files"] = true;
             oslist.append(f);
         }
     }
@@ -2066,12 +2215,7 @@ bool ImageWriter::hasPubKey()
 
 QString ImageWriter::_sshKeyGen()
 {
-#ifdef Q_OS_WIN
-    QString windir = QProcessEnvironment::systemEnvironment().value("windir");
-    return QDir::fromNativeSeparators(windir+"\\SysNative\\OpenSSH\\ssh-keygen.exe");
-#else
-    return "ssh-keygen";
-#endif
+    return rpi_imager::CustomisationTemplate::sshKeygenProgram();
 }
 
 bool ImageWriter::hasSshKeyGen()
@@ -2476,12 +2620,6 @@ void ImageWriter::_applyCloudInitCustomisationFromSettings(const QVariantMap &s)
 
 QString ImageWriter::crypt(const QByteArray &password)
 {
-    QByteArray saltchars =
-      "./0123456789ABCDEFGHIJKLMNOPQRST"
-      "UVWXYZabcdefghijklmnopqrstuvwxyz";
-    std::mt19937 gen(static_cast<unsigned>(QDateTime::currentMSecsSinceEpoch()));
-    std::uniform_int_distribution<> uid(0, saltchars.length()-1);
-
     // Determine whether to use yescrypt (for OS released after Jan 1, 2023) or sha256crypt
     bool useYescrypt = false;
     if (!_osReleaseDate.isEmpty()) {
@@ -2493,22 +2631,7 @@ QString ImageWriter::crypt(const QByteArray &password)
         }
     }
 
-    if (useYescrypt) {
-        // Use yescrypt for newer OS releases
-        QByteArray salt;
-        for (int i=0; i<16; i++)  // yescrypt uses longer salts
-            salt += saltchars[uid(gen)];
-        
-        char *result = yescrypt_crypt(password.constData(), salt.constData());
-        return result ? QString(result) : QString();
-    } else {
-        // Use sha256crypt for older OS releases
-        QByteArray salt = "$5$";
-        for (int i=0; i<10; i++)
-            salt += saltchars[uid(gen)];
-        
-        return sha256_crypt(password.constData(), salt.constData());
-    }
+    return rpi_imager::CustomisationTemplate::cryptPassword(password, useYescrypt);
 }
 
 QString ImageWriter::pbkdf2(const QByteArray &psk, const QByteArray &ssid)
@@ -2894,11 +3017,12 @@ void ImageWriter::_continueStartWriteAfterCacheVerification(bool cacheIsValid)
     connect(_thread, SIGNAL(error(QString)), SLOT(onError(QString)));
     connect(_thread, SIGNAL(finalizing()), SLOT(onFinalizing()));
     connect(_thread, SIGNAL(preparationStatusUpdate(QString)), SLOT(onPreparationStatusUpdate(QString)));
-    // Ensure cleanup of thread pointer on finish in all paths
-    connect(_thread, &QThread::finished, this, [this]() {
-        if (_thread)
+    // Ensure cleanup of thread pointer on finish in all paths.
+    // The next write may already have started by the time this one finishes
+    connect(_thread, &QThread::finished, _thread, &QObject::deleteLater);
+    connect(_thread, &QThread::finished, this, [this, thread = _thread]() {
+        if (_thread == thread)
         {
-            _thread->deleteLater();
             _thread = nullptr;
         }
     });
@@ -2972,6 +3096,18 @@ void ImageWriter::_continueStartWriteAfterCacheVerification(bool cacheIsValid)
                         totalMs, bytesRead, true,
                         QString("bytes: %1 MB").arg(bytesRead / (1024*1024)));
                 });
+        connect(downloadThread, &DownloadExtractThread::eventInputRingBufferFill,
+                this, [this](quint64 bytesCommitted, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::InputRingBufferFill,
+                        0, bytesCommitted, true, metadata);
+                });
+        connect(downloadThread, &DownloadExtractThread::eventDecompressorOutput,
+                this, [this](quint64 bytesPassedThrough, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::DecompressorOutput,
+                        0, bytesPassedThrough, true, metadata);
+                });
         connect(downloadThread, &DownloadExtractThread::eventWriteRingBufferStats,
                 this, [this](quint64 producerStalls, quint64 consumerStalls, 
                              quint64 producerWaitMs, quint64 consumerWaitMs){
@@ -2984,6 +3120,12 @@ void ImageWriter::_continueStartWriteAfterCacheVerification(bool cacheIsValid)
                         PerformanceStats::EventType::WriteRingBufferStats,
                         totalWaitMs, true, metadata);
                 });
+        connect(downloadThread, &DownloadExtractThread::eventArchiveEntryExtraction,
+                this, [this](quint32 durationMs, quint64 bytes, QString metadata){
+                    _performanceStats->recordTransferEvent(
+                        PerformanceStats::EventType::ArchiveEntryExtraction,
+                        durationMs, bytes, true, metadata);
+                });
     }
     
     // Connect performance event signals from DownloadThread
@@ -3058,8 +3200,26 @@ void ImageWriter::_continueStartWriteAfterCacheVerification(bool cacheIsValid)
             this, [this](QString metadata){
                 _performanceStats->recordEvent(PerformanceStats::EventType::NetworkConnectionStats, 0, true, metadata);
             });
+    connect(_thread, &DownloadThread::eventAllocationMap,
+            this, [this](quint32 durationMs, quint64 bytesSkipped, QString metadata){
+                _performanceStats->recordTransferEvent(PerformanceStats::EventType::AllocationMap, durationMs, bytesSkipped, true, metadata);
+            });
+    connect(_thread, &DownloadThread::eventIdentityStamp,
+            this, [this](quint32 durationMs, bool success, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::IdentityStamp, durationMs, success, metadata);
+            });
+    connect(_thread, &DownloadThread::eventTimeToFirstDeviceByte,
+            this, [this](quint32 durationMs, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::TimeToFirstDeviceByte, durationMs, true, metadata);
+            });
+    connect(_thread, &DownloadThread::eventPipelineStall,
+            this, [this](quint32 durationMs, QString metadata){
+                _performanceStats->recordEvent(PerformanceStats::EventType::PipelineStall, durationMs,
+                                               metadata.contains("recovered: yes"), metadata);
+            });
 
     _thread->setVerifyEnabled(_verifyEnabled);
+    _applyWriteOverrides();
     _thread->setUserAgent(QString("Mozilla/5.0 rpi-imager/%1").arg(staticVersion()).toUtf8());
     _thread->setImageCustomisation(_config, _cmdline, _firstrun, _cloudinit, _cloudinitNetwork, _initFormat, _advancedOptions);
 #ifdef Q_OS_DARWIN
@@ -3100,7 +3260,8 @@ void ImageWriter::_continueStartWriteAfterCacheVerification(bool cacheIsValid)
     if (_multipleFilesInZip)
     {
         static_cast<DownloadExtractThread *>(_thread)->enableMultipleFileExtraction();
-        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), this);
+        // The files extracted onto it are booted from, and the boot ROM only reads FAT
+        DriveFormatThread *dft = new DriveFormatThread(_dst.toLatin1(), rpi_imager::Filesystem::kFat32, this);
         connect(dft, SIGNAL(success()), _thread, SLOT(start()));
         connect(dft, SIGNAL(error(QString)), SLOT(onError(QString)));
         connect(dft, SIGNAL(preparationStatusUpdate(QString)), SLOT(onPreparationStatusUpdate(QString)));
@@ -40,6 +40,8 @@ class DownloadThread;
 class DownloadExtractThread;
 class QNetworkReply;
 class QTranslator;
+class BlockStatSampler;
+class SourceCatalogue;
 #ifndef CLI_ONLY_BUILD
 class NativeFileDialog;
 #endif
@@ -85,6 +87,13 @@ public:
     /* Set custom cache file - now handled by CacheManager */
     Q_INVOKABLE void setCustomCacheFile(const QString &cacheFile, const QByteArray &sha256);
 
+    /* Only read the download cache, for additional writers in the same process (CLI --jobs) */
+    void setCacheReadOnly(bool readOnly);
+
+    /* Use a value instead of the "eject" or "skipIfIdentical" setting,
+       for the writes of this writer only and without saving it (CLI --jobs) */
+    void setWriteOverride(const QString &key, const QVariant &value);
+
     /* Returns true if src and dst are set */
     Q_INVOKABLE bool readyToWrite();
 
@@ -229,7 +238,8 @@ public:
        Returns true if at least one device was mounted */
     Q_INVOKABLE bool mountUsbSourceMedia();
 
-    /* Returns a json formatted list of the OS images found on USB stick */
+    /* Returns a json formatted list of the OS images found on USB stick.
+       Comes from a catalogue of each stick, which is rescanned and hashed in the background (usbSourceOSlistChanged) */
     Q_INVOKABLE QByteArray getUsbSourceOSlist();
 
     /* Functions to collect information from computer running imager to make image customization easier */
@@ -349,6 +359,7 @@ signals:
     void permissionWarning(QVariant msg);
     void locationPermissionGranted();
     void performanceSaveDialogNeeded(const QString &suggestedFilename, const QString &initialDir);
+    void usbSourceOSlistChanged();
 
 protected slots:
     void startProgressPolling();
@@ -372,6 +383,7 @@ private:
     WriteState writeState() const { return _writeState; }
     // Cache management
     CacheManager* _cacheManager;
+    SourceCatalogue* _sourceCatalogue;      // Created on first use, embedded mode only
     bool _waitingForCacheVerification;
     QElapsedTimer _cacheVerificationTimer;  // Tracks cache verification duration
     
@@ -411,6 +423,7 @@ protected:
     DownloadThread *_thread;
     bool _verifyEnabled, _multipleFilesInZip, _online;
     QSettings _settings;
+    QVariantMap _writeOverrides;
     QMap<QString,QString> _translations;
     QTranslator *_trans;
     int _refreshIntervalOverrideMinutes;
@@ -425,6 +438,9 @@ protected:
 
     // Performance statistics capture
     PerformanceStats *_performanceStats;
+#ifdef Q_OS_LINUX
+    BlockStatSampler *_blockStatSampler;
+#endif
 
     void _parseCompressedFile();
     void _parseXZFile();
@@ -435,6 +451,7 @@ protected:
     void _applySystemdCustomisationFromSettings(const QVariantMap &s);
     void _applyCloudInitCustomisationFromSettings(const QVariantMap &s);
     void _continueStartWriteAfterCacheVerification(bool cacheIsValid);
+    void _applyWriteOverrides();
     void scheduleOsListRefresh();
 };
 
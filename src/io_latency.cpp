@@ -0,0 +1,198 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "io_latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace rpi_imager {
+
+namespace {
+
+std::uint64_t NowNs() {
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+int HighestBit(std::uint64_t v) {
+  int bit = 0;
+  while (v >>= 1) {
+    bit++;
+  }
+  return bit;
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() {
+  for (auto& c : counts_) {
+    c.store(0, std::memory_order_relaxed);
+  }
+}
+
+int LatencyHistogram::BucketIndex(std::uint64_t us) {
+  if (us < static_cast<std::uint64_t>(kSubBuckets)) {
+    return static_cast<int>(us);
+  }
+
+  us = std::min<std::uint64_t>(us, (1ull << kMaxExponent) - 1);
+  const int exponent = HighestBit(us);
+  const int shift = exponent - kSubBucketBits;
+  const int sub = static_cast<int>(us >> shift) - kSubBuckets;
+  return (shift + 1) * kSubBuckets + sub;
+}
+
+std::uint64_t LatencyHistogram::BucketLowerBound(int index) {
+  const int group = index / kSubBuckets;
+  const std::uint64_t sub = static_cast<std::uint64_t>(index % kSubBuckets);
+  if (group == 0) {
+    return sub;
+  }
+  return (kSubBuckets + sub) << (group - 1);
+}
+
+std::uint64_t LatencyHistogram::BucketUpperBound(int index) {
+  const int group = index / kSubBuckets;
+  const std::uint64_t width = group == 0 ? 1 : 1ull << (group - 1);
+  return BucketLowerBound(index) + width - 1;
+}
+
+void LatencyHistogram::RecordNs(std::uint64_t ns) {
+  const std::uint64_t us = ns / 1000;
+  counts_[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(us, std::memory_order_relaxed);
+
+  std::uint64_t max = max_us_.load(std::memory_order_relaxed);
+  while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& c : counts_) {
+    c.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_us_.store(0, std::memory_order_relaxed);
+  max_us_.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Snap() const {
+  Snapshot s;
+  if (!Count()) {
+    return s;  // Keep snapshots of unused histograms small
+  }
+
+  s.counts.resize(kBucketCount);
+  for (int i = 0; i < kBucketCount; i++) {
+    s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    s.count += s.counts[i];
+  }
+  s.sum_us = sum_us_.load(std::memory_order_relaxed);
+  s.max_us = max_us_.load(std::memory_order_relaxed);
+  return s;
+}
+
+std::uint64_t LatencyHistogram::Snapshot::ValueAtPercentile(double percentile) const {
+  if (!count) {
+    return 0;
+  }
+
+  const double clamped = std::min(100.0, std::max(0.0, percentile));
+  const std::uint64_t target = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(count))));
+  std::uint64_t seen = 0;
+  for (int i = 0; i < static_cast<int>(counts.size()); i++) {
+    seen += counts[i];
+    if (seen >= target) {
+      return std::min(BucketUpperBound(i), max_us);
+    }
+  }
+  return max_us;
+}
+
+IoLatencyStats& IoLatencyStats::Instance() {
+  static IoLatencyStats instance;
+  return instance;
+}
+
+void IoLatencyStats::Record(IoOperation op, std::uint64_t ns) {
+  histograms_[static_cast<int>(op)][phase_.load(std::memory_order_relaxed)].RecordNs(ns);
+}
+
+const LatencyHistogram& IoLatencyStats::Histogram(IoOperation op, IoPhase phase) const {
+  return histograms_[static_cast<int>(op)][static_cast<int>(phase)];
+}
+
+void IoLatencyStats::Reset() {
+  for (auto& perOp : histograms_) {
+    for (auto& h : perOp) {
+      h.Reset();
+    }
+  }
+  SetPhase(IoPhase::kPreparing);
+}
+
+IoLatencyStats::Snapshot IoLatencyStats::Snap() const {
+  Snapshot s;
+  for (int op = 0; op < kOperationCount; op++) {
+    for (int phase = 0; phase < kPhaseCount; phase++) {
+      s[op][phase] = histograms_[op][phase].Snap();
+    }
+  }
+  return s;
+}
+
+const char* IoLatencyStats::OperationName(IoOperation op) {
+  switch (op) {
+    case IoOperation::kWrite: return "write";
+    case IoOperation::kRead: return "read";
+    case IoOperation::kFlush: return "flush";
+    case IoOperation::kSync: return "sync";
+    default: return "unknown";
+  }
+}
+
+const char* IoLatencyStats::PhaseName(IoPhase phase) {
+  switch (phase) {
+    case IoPhase::kPreparing: return "preparing";
+    case IoPhase::kWriting: return "writing";
+    case IoPhase::kVerifying: return "verifying";
+    case IoPhase::kFinalising: return "finalising";
+    default: return "unknown";
+  }
+}
+
+FileError LatencyRecordingFileOperations::WriteSequential(const std::uint8_t* data, std::size_t size) {
+  const std::uint64_t start = NowNs();
+  FileError result = inner_->WriteSequential(data, size);
+  IoLatencyStats::Instance().Record(IoOperation::kWrite, NowNs() - start);
+  return result;
+}
+
+FileError LatencyRecordingFileOperations::ReadSequential(std::uint8_t* data, std::size_t size, std::size_t& bytes_read) {
+  const std::uint64_t start = NowNs();
+  FileError result = inner_->ReadSequential(data, size, bytes_read);
+  IoLatencyStats::Instance().Record(IoOperation::kRead, NowNs() - start);
+  return result;
+}
+
+FileError LatencyRecordingFileOperations::ForceSync() {
+  const std::uint64_t start = NowNs();
+  FileError result = inner_->ForceSync();
+  IoLatencyStats::Instance().Record(IoOperation::kSync, NowNs() - start);
+  return result;
+}
+
+FileError LatencyRecordingFileOperations::Flush() {
+  const std::uint64_t start = NowNs();
+  FileError result = inner_->Flush();
+  IoLatencyStats::Instance().Record(IoOperation::kFlush, NowNs() - start);
+  return result;
+}
+
+}  // namespace rpi_imager
@@ -0,0 +1,145 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef IO_LATENCY_H_
+#define IO_LATENCY_H_
+
+#include "file_operations.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace rpi_imager {
+
+// Fixed-memory log-linear latency histogram (HDR style) with microsecond
+// resolution. Each power of two is split into 16 linear sub-buckets, so a
+// recorded value is off by at most 1/16 (6.25%). Recording is lock-free
+// and may happen from any number of threads.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  // Values are clamped to 2^36 us (~19 hours)
+  static constexpr int kMaxExponent = 36;
+  static constexpr int kBucketCount = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+  struct Snapshot {
+    std::vector<std::uint64_t> counts;   // kBucketCount entries, empty if nothing was recorded
+    std::uint64_t count = 0;
+    std::uint64_t sum_us = 0;
+    std::uint64_t max_us = 0;
+
+    // Highest value equivalent to the bucket holding the given percentile
+    // (0-100), capped at the maximum recorded value
+    std::uint64_t ValueAtPercentile(double percentile) const;
+    double MeanUs() const { return count ? static_cast<double>(sum_us) / count : 0.0; }
+  };
+
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void RecordNs(std::uint64_t ns);
+  void Reset();
+  Snapshot Snap() const;
+  std::uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+  static int BucketIndex(std::uint64_t us);
+  static std::uint64_t BucketLowerBound(int index);
+  static std::uint64_t BucketUpperBound(int index);
+
+ private:
+  std::array<std::atomic<std::uint64_t>, kBucketCount> counts_;
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint64_t> sum_us_{0};
+  std::atomic<std::uint64_t> max_us_{0};
+};
+
+enum class IoOperation { kWrite, kRead, kFlush, kSync, kCount };
+enum class IoPhase { kPreparing, kWriting, kVerifying, kFinalising, kCount };
+
+// Process-wide device I/O latency histograms, per operation and phase.
+// The phase is set by the write pipeline as it progresses.
+class IoLatencyStats {
+ public:
+  static constexpr int kOperationCount = static_cast<int>(IoOperation::kCount);
+  static constexpr int kPhaseCount = static_cast<int>(IoPhase::kCount);
+
+  // Indexed [operation][phase]
+  using Snapshot = std::array<std::array<LatencyHistogram::Snapshot, kPhaseCount>, kOperationCount>;
+
+  static IoLatencyStats& Instance();
+
+  void SetPhase(IoPhase phase) { phase_.store(static_cast<int>(phase), std::memory_order_relaxed); }
+  IoPhase Phase() const { return static_cast<IoPhase>(phase_.load(std::memory_order_relaxed)); }
+
+  void Record(IoOperation op, std::uint64_t ns);
+  const LatencyHistogram& Histogram(IoOperation op, IoPhase phase) const;
+
+  // Clear all histograms and return to kPreparing (start of an imaging cycle)
+  void Reset();
+  Snapshot Snap() const;
+
+  static const char* OperationName(IoOperation op);
+  static const char* PhaseName(IoPhase phase);
+
+ private:
+  IoLatencyStats() = default;
+
+  std::atomic<int> phase_{static_cast<int>(IoPhase::kPreparing)};
+  std::array<std::array<LatencyHistogram, kPhaseCount>, kOperationCount> histograms_;
+};
+
+// Forwards to another FileOperations, timing WriteSequential, ReadSequential,
+// Flush and ForceSync into IoLatencyStats
+class LatencyRecordingFileOperations : public FileOperations {
+ public:
+  explicit LatencyRecordingFileOperations(std::unique_ptr<FileOperations> inner)
+      : inner_(std::move(inner)) {}
+  ~LatencyRecordingFileOperations() override = default;
+
+  FileError OpenDevice(const std::string& path) override { return inner_->OpenDevice(path); }
+  FileError CreateTestFile(const std::string& path, std::uint64_t size) override {
+    return inner_->CreateTestFile(path, size);
+  }
+  FileError WriteAtOffset(std::uint64_t offset, const std::uint8_t* data, std::size_t size) override {
+    return inner_->WriteAtOffset(offset, data, size);
+  }
+  FileError GetSize(std::uint64_t& size) override { return inner_->GetSize(size); }
+  FileError Close() override { return inner_->Close(); }
+  bool IsOpen() const override { return inner_->IsOpen(); }
+
+  FileError WriteSequential(const std::uint8_t* data, std::size_t size) override;
+  FileError ReadSequential(std::uint8_t* data, std::size_t size, std::size_t& bytes_read) override;
+
+  FileError Seek(std::uint64_t position) override { return inner_->Seek(position); }
+  std::uint64_t Tell() const override { return inner_->Tell(); }
+
+  FileError ForceSync() override;
+  FileError Flush() override;
+
+  void PrepareForSequentialRead(std::uint64_t offset, std::uint64_t length) override {
+    inner_->PrepareForSequentialRead(offset, length);
+  }
+
+  int GetHandle() const override { return inner_->GetHandle(); }
+  int GetLastErrorCode() const override { return inner_->GetLastErrorCode(); }
+  bool IsDirectIOEnabled() const override { return inner_->IsDirectIOEnabled(); }
+  DirectIOInfo GetDirectIOInfo() const override { return inner_->GetDirectIOInfo(); }
+
+  FileOperations* Inner() const { return inner_.get(); }
+
+ private:
+  std::unique_ptr<FileOperations> inner_;
+};
+
+}  // namespace rpi_imager
+
+#endif  // IO_LATENCY_H_
@@ -7,11 +7,15 @@ set(PLATFORM_SOURCES
     linux/linuxdrivelist.cpp
     linux/stpanalyzer.h
     linux/stpanalyzer.cpp
+    linux/blockstatsampler.h
+    linux/blockstatsampler.cpp
     linux/acceleratedcryptographichash_gnutls.cpp
     linux/bootimgcreator_linux.cpp
     linux/rsakeyfingerprint_linux.cpp
     linux/file_operations_linux.cpp
     linux/platformquirks_linux.cpp
+    linux/ktlsdownload.h
+    linux/ktlsdownload.cpp
 )
 
 # Only include DBus-dependent and GUI components for non-CLI builds
@@ -0,0 +1,139 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ *
+ * Samples the target device's block-layer statistics
+ * from sysfs while an image is written
+ */
+
+#include "blockstatsampler.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+static QByteArray readSysfs(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return f.readAll().trimmed();
+}
+
+BlockStatSampler::BlockStatSampler(PerformanceStats *stats, int intervalMs, QObject *parent)
+    : QObject(parent), _stats(stats)
+{
+    _timer.setInterval(intervalMs);
+    connect(&_timer, &QTimer::timeout, this, &BlockStatSampler::onTimeout);
+}
+
+BlockStatSampler::~BlockStatSampler()
+{
+    stop();
+}
+
+void BlockStatSampler::start(const QString &devicePath)
+{
+    stop();
+
+    /* Follow /dev/disk/by-* style symlinks to the kernel's name for the device */
+    QString name = QFileInfo(QFileInfo(devicePath).canonicalFilePath()).fileName();
+    QString dir = "/sys/class/block/"+name;
+    if (name.isEmpty() || !QFile::exists(dir+"/stat"))
+    {
+        qDebug() << "BlockStatSampler: no block layer statistics for" << devicePath;
+        return;
+    }
+
+    _sysfsDir = dir;
+    PerformanceStats::BlockDeviceInfo info;
+    if (_readInfo(info))
+        _stats->setBlockDeviceInfo(info);
+
+    /* Baseline sample, so the first interval already yields rates */
+    onTimeout();
+    _timer.start();
+}
+
+void BlockStatSampler::stop()
+{
+    if (_timer.isActive())
+    {
+        /* Final sample covers the tail of the write */
+        onTimeout();
+        _timer.stop();
+    }
+    _sysfsDir.clear();
+}
+
+bool BlockStatSampler::_readInfo(PerformanceStats::BlockDeviceInfo &info)
+{
+    /* Queue settings belong to the whole disk, also when given a partition */
+    QString queueDir = _sysfsDir+"/queue";
+    if (QFile::exists(_sysfsDir+"/partition"))
+        queueDir = QFileInfo(QFileInfo(_sysfsDir).canonicalFilePath()).path()+"/queue";
+
+    info.name = QFileInfo(_sysfsDir).fileName();
+    info.nrRequests = readSysfs(queueDir+"/nr_requests").toInt();
+    info.maxSectorsKb = readSysfs(queueDir+"/max_sectors_kb").toInt();
+    info.maxHwSectorsKb = readSysfs(queueDir+"/max_hw_sectors_kb").toInt();
+    info.rotational = readSysfs(queueDir+"/rotational").toInt() != 0;
+
+    /* e.g. "mq-deadline kyber [bfq] none", active one in brackets */
+    QByteArray scheduler = readSysfs(queueDir+"/scheduler");
+    int open = scheduler.indexOf('['), close = scheduler.indexOf(']');
+    info.scheduler = QString::fromLatin1(open != -1 && close > open ? scheduler.mid(open+1, close-open-1) : scheduler);
+
+    /* Walk up from the disk to the USB device it hangs off, if any */
+    info.usbSpeedMbps = 0;
+    QDir dev(QFileInfo(_sysfsDir+"/device").canonicalFilePath());
+    while (dev.path().startsWith("/sys/devices/"))
+    {
+        if (dev.exists("speed") && dev.exists("idVendor"))
+        {
+            info.usbSpeedMbps = readSysfs(dev.filePath("speed")).toInt();
+            info.usbVersion = QString::fromLatin1(readSysfs(dev.filePath("version")));
+            break;
+        }
+        if (!dev.cdUp())
+            break;
+    }
+
+    qDebug() << "BlockStatSampler:" << info.name << "nr_requests:" << info.nrRequests
+             << "max_sectors_kb:" << info.maxSectorsKb << "scheduler:" << info.scheduler
+             << "usb speed:" << info.usbSpeedMbps;
+    return true;
+}
+
+void BlockStatSampler::onTimeout()
+{
+    if (_sysfsDir.isEmpty())
+        return;
+
+    QList<QByteArray> stat = readSysfs(_sysfsDir+"/stat").simplified().split(' ');
+    if (stat.size() < 11)
+    {
+        /* Device went away */
+        _timer.stop();
+        return;
+    }
+
+    PerformanceStats::BlockDeviceSample sample;
+    sample.timestampMs = 0;
+    sample.readIos = stat[0].toULongLong();
+    sample.readMerges = stat[1].toULongLong();
+    sample.readSectors = stat[2].toULongLong();
+    sample.readTicksMs = stat[3].toULongLong();
+    sample.writeIos = stat[4].toULongLong();
+    sample.writeMerges = stat[5].toULongLong();
+    sample.writeSectors = stat[6].toULongLong();
+    sample.writeTicksMs = stat[7].toULongLong();
+    sample.ioTicksMs = stat[9].toULongLong();
+    sample.timeInQueueMs = stat[10].toULongLong();
+
+    QList<QByteArray> inflight = readSysfs(_sysfsDir+"/inflight").simplified().split(' ');
+    sample.inflightReads = inflight.size() >= 2 ? inflight[0].toUInt() : 0;
+    sample.inflightWrites = inflight.size() >= 2 ? inflight[1].toUInt() : stat[8].toUInt();
+
+    _stats->recordBlockDeviceSample(sample);
+}
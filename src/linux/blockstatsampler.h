@@ -0,0 +1,42 @@
+#ifndef BLOCKSTATSAMPLER_H
+#define BLOCKSTATSAMPLER_H
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <QObject>
+#include <QTimer>
+#include "../performancestats.h"
+
+/*
+ * Low-rate sampler of the target device's block-layer counters
+ * (/sys/block/<dev>/stat and inflight), so queue saturation, request
+ * sizes reaching the device and kernel-side merging can be correlated
+ * with the pipeline's progress samples.
+ */
+class BlockStatSampler : public QObject
+{
+    Q_OBJECT
+public:
+    BlockStatSampler(PerformanceStats *stats, int intervalMs = 1000, QObject *parent = nullptr);
+    virtual ~BlockStatSampler();
+
+    /* Start sampling the block device behind devicePath (e.g. /dev/sdb).
+     * Does nothing if it is not a block device known to sysfs. */
+    void start(const QString &devicePath);
+    void stop();
+
+protected:
+    PerformanceStats *_stats;
+    QTimer _timer;
+    QString _sysfsDir;
+
+    bool _readInfo(PerformanceStats::BlockDeviceInfo &info);
+
+protected slots:
+    void onTimeout();
+};
+
+#endif // BLOCKSTATSAMPLER_H
@@ -8,6 +8,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <errno.h>
 #include <sstream>
 
@@ -109,10 +111,52 @@ FileError LinuxFileOperations::GetSize(std::uint64_t& size) {
     return FileError::kSizeError;
   }
 
+  // st_size is 0 for block devices
+  if (S_ISBLK(st.st_mode)) {
+    std::uint64_t device_size = 0;
+    if (ioctl(fd_, BLKGETSIZE64, &device_size) == -1) {
+      last_error_code_ = errno;
+      return FileError::kSizeError;
+    }
+    size = device_size;
+    return FileError::kSuccess;
+  }
+
   size = static_cast<std::uint64_t>(st.st_size);
   return FileError::kSuccess;
 }
 
+FileError LinuxFileOperations::DiscardRange(std::uint64_t offset, std::uint64_t length) {
+  if (!IsOpen()) {
+    return FileError::kOpenError;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    last_error_code_ = errno;
+    return FileError::kDiscardError;
+  }
+
+  if (S_ISBLK(st.st_mode)) {
+    std::uint64_t range[2] = {offset, length};
+    if (ioctl(fd_, BLKDISCARD, &range) == -1) {
+      last_error_code_ = errno;
+      std::ostringstream oss;
+      oss << "BLKDISCARD of " << length << " bytes at " << offset << " failed, errno " << errno;
+      Log(oss.str());
+      return FileError::kDiscardError;
+    }
+    return FileError::kSuccess;
+  }
+
+  if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+    last_error_code_ = errno;
+    return FileError::kDiscardError;
+  }
+  return FileError::kSuccess;
+}
+
 FileError LinuxFileOperations::Close() {
   if (fd_ >= 0) {
     if (close(fd_) != 0) {
@@ -46,6 +46,9 @@ class LinuxFileOperations : public FileOperations {
   
   // Sequential read optimization
   void PrepareForSequentialRead(std::uint64_t offset, std::uint64_t length) override;
+
+  // BLKDISCARD on block devices, hole punching on regular files
+  FileError DiscardRange(std::uint64_t offset, std::uint64_t length) override;
   
   // Handle access
   int GetHandle() const override;
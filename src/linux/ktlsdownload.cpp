@@ -0,0 +1,534 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ *
+ * HTTPS download with kernel TLS receive offload
+ */
+
+#include "ktlsdownload.h"
+#include <QDebug>
+#include <QUrl>
+#include <cstring>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+namespace {
+    const int MaxRedirects = 10;
+    const int ConnectTimeoutMs = 30000;
+    const int MaxHeaderBytes = 64 * 1024;
+
+    // Largest TLS record plus overhead. Control records are never split, so
+    // a buffer is handed over once less than this is left in it
+    const size_t MinRecvRoom = 16384 + 256;
+
+    const unsigned char RecordAlert = 21;
+    const unsigned char RecordHandshake = 22;
+    const unsigned char RecordApplicationData = 23;
+    const unsigned char HandshakeNewSessionTicket = 4;
+
+    // Ciphers the kernel can decrypt
+    const char *Priority = "NORMAL:-VERS-ALL:+VERS-TLS1.3:+VERS-TLS1.2:"
+                           "-CIPHER-ALL:+AES-128-GCM:+AES-256-GCM:+CHACHA20-POLY1305";
+
+    QByteArray headerValue(const QByteArray &line, const char *name)
+    {
+        int colon = line.indexOf(':');
+        if (colon < 0 || line.left(colon).trimmed().toLower() != name)
+            return QByteArray();
+        return line.mid(colon + 1).trimmed();
+    }
+}
+
+KtlsDownload::KtlsDownload(const QByteArray &url, quint64 offset)
+    : _url(url), _offset(offset), _received(0), _stallTimeoutMs(60000), _fd(-1),
+      _session(nullptr), _credentials(nullptr)
+{
+}
+
+KtlsDownload::~KtlsDownload()
+{
+    _close();
+}
+
+bool KtlsDownload::kernelSupported()
+{
+    static int supported = -1;
+    if (supported == -1)
+    {
+        /* Needs a connected TCP socket: try against a listener on loopback */
+        supported = 0;
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (listener >= 0 && client >= 0
+            && bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0
+            && listen(listener, 1) == 0
+            && getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &len) == 0
+            && ::connect(client, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+        {
+            supported = setsockopt(client, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+        }
+        if (client >= 0)
+            ::close(client);
+        if (listener >= 0)
+            ::close(listener);
+        qDebug() << "Kernel TLS receive offload" << (supported ? "available" : "not available");
+    }
+    return supported;
+}
+
+KtlsDownload::Result KtlsDownload::_fail(Result result, const QString &error)
+{
+    _error = error;
+    _close();
+    return result;
+}
+
+void KtlsDownload::_close()
+{
+    if (_session)
+    {
+        gnutls_deinit(_session);
+        _session = nullptr;
+    }
+    if (_credentials)
+    {
+        gnutls_certificate_free_credentials(_credentials);
+        _credentials = nullptr;
+    }
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+KtlsDownload::Result KtlsDownload::run(const Sink &sink)
+{
+    QUrl url = QUrl::fromEncoded(_url);
+
+    for (int redirects = 0; redirects <= MaxRedirects; redirects++)
+    {
+        if (url.scheme() != "https" || url.host().isEmpty())
+            return _fail(Result::Unsupported, "Not an https URL");
+
+        QString host = url.host();
+        quint16 port = static_cast<quint16>(url.port(443));
+        QString path = url.path(QUrl::FullyEncoded);
+        if (path.isEmpty())
+            path = "/";
+        if (url.hasQuery())
+            path += "?" + url.query(QUrl::FullyEncoded);
+
+        _close();
+        if (!_connect(host, port) || !_handshake(host) || !_enableKernelRx() || !_sendRequest(host, port, path))
+            return _fail(Result::Unsupported, _error);
+
+        QByteArray location, bodyStart;
+        quint64 contentLength = 0;
+        Result result = _readHeaders(sink, location, contentLength, bodyStart);
+        if (result != Result::Complete)
+            return result;
+
+        if (location.isEmpty())
+        {
+            result = _readBody(sink, contentLength, bodyStart);
+            _close();
+            return result;
+        }
+
+        qDebug() << "kTLS download: redirected to" << location;
+        url = url.resolved(QUrl::fromEncoded(location));
+    }
+
+    return _fail(Result::Unsupported, "Too many redirects");
+}
+
+bool KtlsDownload::_connect(const QString &host, quint16 port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    int r = getaddrinfo(host.toUtf8().constData(), QByteArray::number(port).constData(), &hints, &addresses);
+    if (r != 0)
+    {
+        _error = QString("Cannot resolve %1: %2").arg(host, gai_strerror(r));
+        return false;
+    }
+
+    for (addrinfo *ai = addresses; ai && _fd < 0; ai = ai->ai_next)
+    {
+        _fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (_fd < 0)
+            continue;
+
+        timeval timeout = {ConnectTimeoutMs / 1000, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        /* The handshake receives through GnuTLS, without the stall check of _recv() */
+        timeval stallTimeout = {_stallTimeoutMs / 1000, (_stallTimeoutMs % 1000) * 1000};
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &stallTimeout, sizeof(stallTimeout));
+        if (::connect(_fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            _error = QString("Cannot connect to %1: %2").arg(host, strerror(errno));
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (_fd < 0)
+        return false;
+
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+bool KtlsDownload::_handshake(const QString &host)
+{
+    QByteArray hostName = host.toUtf8();
+
+    gnutls_certificate_allocate_credentials(&_credentials);
+    int r = _caFile.isEmpty()
+                ? gnutls_certificate_set_x509_system_trust(_credentials)
+                : gnutls_certificate_set_x509_trust_file(_credentials, _caFile.toLocal8Bit().constData(), GNUTLS_X509_FMT_PEM);
+    if (r <= 0)
+    {
+        _error = "No trusted certificates";
+        return false;
+    }
+
+    /* No session tickets: they would arrive as handshake records after the keys moved to the kernel */
+    gnutls_init(&_session, GNUTLS_CLIENT | GNUTLS_NO_TICKETS);
+    gnutls_priority_set_direct(_session, Priority, nullptr);
+    gnutls_credentials_set(_session, GNUTLS_CRD_CERTIFICATE, _credentials);
+    /* No SNI for address literals, the certificate is still checked against the address */
+    in6_addr address;
+    if (inet_pton(AF_INET, hostName.constData(), &address) != 1 && inet_pton(AF_INET6, hostName.constData(), &address) != 1)
+        gnutls_server_name_set(_session, GNUTLS_NAME_DNS, hostName.constData(), hostName.size());
+    gnutls_session_set_verify_cert(_session, hostName.constData(), 0);
+
+    gnutls_datum_t alpn = {reinterpret_cast<unsigned char *>(const_cast<char *>("http/1.1")), 8};
+    gnutls_alpn_set_protocols(_session, &alpn, 1, 0);
+
+    gnutls_transport_set_int(_session, _fd);
+    gnutls_handshake_set_timeout(_session, ConnectTimeoutMs);
+
+    do {
+        r = gnutls_handshake(_session);
+    } while (r < 0 && !gnutls_error_is_fatal(r));
+
+    if (r < 0)
+    {
+        _error = QString("TLS handshake failed: %1").arg(gnutls_strerror(r));
+        return false;
+    }
+
+    char *info = gnutls_session_get_desc(_session);
+    _description = info;
+    gnutls_free(info);
+    return true;
+}
+
+bool KtlsDownload::_enableKernelRx()
+{
+    gnutls_datum_t macKey, iv, key;
+    unsigned char sequence[8];
+    if (gnutls_record_get_state(_session, 1, &macKey, &iv, &key, sequence) < 0)
+    {
+        _error = "Cannot read TLS session state";
+        return false;
+    }
+
+    bool tls13 = gnutls_protocol_get_version(_session) == GNUTLS_TLS1_3;
+    unsigned short version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+
+    /* Same layout as GnuTLS's own kTLS support: for AES-GCM the first
+       4 bytes of the IV are the salt, TLS 1.2 uses the sequence number as
+       explicit nonce. ChaCha20-Poly1305 takes the whole 12 byte IV. */
+    union {
+        tls12_crypto_info_aes_gcm_128 aes128;
+        tls12_crypto_info_aes_gcm_256 aes256;
+        tls12_crypto_info_chacha20_poly1305 chacha;
+    } crypto;
+    memset(&crypto, 0, sizeof(crypto));
+    socklen_t cryptoSize = 0;
+
+    switch (gnutls_cipher_get(_session))
+    {
+        case GNUTLS_CIPHER_AES_128_GCM:
+            if (key.size != TLS_CIPHER_AES_GCM_128_KEY_SIZE
+                || iv.size != (tls13 ? TLS_CIPHER_AES_GCM_128_SALT_SIZE + TLS_CIPHER_AES_GCM_128_IV_SIZE : TLS_CIPHER_AES_GCM_128_SALT_SIZE))
+                break;
+            crypto.aes128.info = {version, TLS_CIPHER_AES_GCM_128};
+            memcpy(crypto.aes128.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_128_SALT_SIZE : sequence, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+            memcpy(crypto.aes128.salt, iv.data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+            memcpy(crypto.aes128.key, key.data, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+            memcpy(crypto.aes128.rec_seq, sequence, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+            cryptoSize = sizeof(crypto.aes128);
+            break;
+        case GNUTLS_CIPHER_AES_256_GCM:
+            if (key.size != TLS_CIPHER_AES_GCM_256_KEY_SIZE
+                || iv.size != (tls13 ? TLS_CIPHER_AES_GCM_256_SALT_SIZE + TLS_CIPHER_AES_GCM_256_IV_SIZE : TLS_CIPHER_AES_GCM_256_SALT_SIZE))
+                break;
+            crypto.aes256.info = {version, TLS_CIPHER_AES_GCM_256};
+            memcpy(crypto.aes256.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_256_SALT_SIZE : sequence, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+            memcpy(crypto.aes256.salt, iv.data, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+            memcpy(crypto.aes256.key, key.data, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+            memcpy(crypto.aes256.rec_seq, sequence, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+            cryptoSize = sizeof(crypto.aes256);
+            break;
+        case GNUTLS_CIPHER_CHACHA20_POLY1305:
+            if (key.size != TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE || iv.size != TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE)
+                break;
+            crypto.chacha.info = {version, TLS_CIPHER_CHACHA20_POLY1305};
+            memcpy(crypto.chacha.iv, iv.data, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+            memcpy(crypto.chacha.key, key.data, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE);
+            memcpy(crypto.chacha.rec_seq, sequence, TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE);
+            cryptoSize = sizeof(crypto.chacha);
+            break;
+        default:
+            break;
+    }
+
+    if (!cryptoSize)
+    {
+        _error = QString("Cipher not supported by kernel TLS: %1").arg(_description);
+        return false;
+    }
+
+    if (setsockopt(_fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0)
+    {
+        _error = QString("Kernel TLS not available: %1").arg(strerror(errno));
+        return false;
+    }
+    if (setsockopt(_fd, SOL_TLS, TLS_RX, &crypto, cryptoSize) != 0)
+    {
+        _error = QString("Kernel TLS receive offload refused: %1").arg(strerror(errno));
+        return false;
+    }
+
+    memset(&crypto, 0, sizeof(crypto));
+    return true;
+}
+
+bool KtlsDownload::_sendRequest(const QString &host, quint16 port, const QString &path)
+{
+    QByteArray request = "GET " + path.toLatin1() + " HTTP/1.1\r\n"
+                         "Host: " + QUrl::toAce(host) + (port != 443 ? ":" + QByteArray::number(port) : QByteArray()) + "\r\n"
+                         "Accept: */*\r\n"
+                         "Connection: close\r\n";
+    if (!_userAgent.isEmpty())
+        request += "User-Agent: " + _userAgent + "\r\n";
+    if (_offset)
+        request += "Range: bytes=" + QByteArray::number(_offset) + "-\r\n";
+    request += "\r\n";
+
+    /* Sending stays in GnuTLS, only the receive side moved to the kernel */
+    qsizetype sent = 0;
+    while (sent < request.size())
+    {
+        ssize_t r = gnutls_record_send(_session, request.constData() + sent, request.size() - sent);
+        if (r == GNUTLS_E_AGAIN || r == GNUTLS_E_INTERRUPTED)
+            continue;
+        if (r < 0)
+        {
+            _error = QString("Sending request failed: %1").arg(gnutls_strerror(static_cast<int>(r)));
+            return false;
+        }
+        sent += r;
+    }
+    return true;
+}
+
+ssize_t KtlsDownload::_recv(char *buf, size_t len)
+{
+    while (true)
+    {
+        pollfd pfd = {_fd, POLLIN, 0};
+        int r = poll(&pfd, 1, _stallTimeoutMs);
+        if (r == 0)
+        {
+            _error = "No data received for too long";
+            return -1;
+        }
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            _error = strerror(errno);
+            return -1;
+        }
+
+        char control[CMSG_SPACE(sizeof(unsigned char))];
+        iovec iov = {buf, len};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(_fd, &msg, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            _error = QString("Receive failed: %1").arg(strerror(errno));
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+
+        /* The kernel reports records other than application data in a control message */
+        unsigned char recordType = RecordApplicationData;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+            recordType = *CMSG_DATA(cmsg);
+
+        if (recordType == RecordApplicationData)
+            return n;
+        if (recordType == RecordAlert && n >= 2 && buf[1] == 0)
+            return 0;   // close_notify
+        if (recordType == RecordHandshake && buf[0] == HandshakeNewSessionTicket)
+            continue;
+
+        /* Other alerts, or a key update the kernel cannot follow */
+        _error = QString("Unexpected TLS record (type %1)").arg(recordType);
+        return -1;
+    }
+}
+
+KtlsDownload::Result KtlsDownload::_readHeaders(const Sink &sink, QByteArray &location, quint64 &contentLength, QByteArray &bodyStart)
+{
+    QByteArray response;
+    int end = -1;
+    char buf[MinRecvRoom];
+    while ((end = response.indexOf("\r\n\r\n")) < 0)
+    {
+        if (response.size() > MaxHeaderBytes)
+            return _fail(Result::Unsupported, "Response header too large");
+        ssize_t n = _recv(buf, sizeof(buf));
+        if (n <= 0)
+            return _fail(Result::Unsupported, n == 0 ? QString("Connection closed") : _error);
+        response.append(buf, n);
+    }
+    bodyStart = response.mid(end + 4);
+
+    QList<QByteArray> lines = response.left(end).split('\n');
+    QList<QByteArray> status = lines.first().trimmed().split(' ');
+    int code = status.size() > 1 ? status[1].toInt() : 0;
+
+    bool hasLength = false;
+    for (const QByteArray &rawLine : lines.mid(1))
+    {
+        QByteArray line = rawLine.trimmed();
+        QByteArray value;
+        if (!(value = headerValue(line, "location")).isEmpty())
+            location = value;
+        else if (!(value = headerValue(line, "content-length")).isEmpty())
+            contentLength = value.toULongLong(&hasLength);
+        else if (!headerValue(line, "transfer-encoding").isEmpty())
+            return _fail(Result::Unsupported, "Chunked response");
+        else if (!(value = headerValue(line, "content-encoding")).isEmpty() && value.toLower() != "identity")
+            return _fail(Result::Unsupported, "Encoded response");
+    }
+
+    if (code == 301 || code == 302 || code == 303 || code == 307 || code == 308)
+    {
+        if (location.isEmpty())
+            return _fail(Result::Unsupported, "Redirect without location");
+        return Result::Complete;
+    }
+    location.clear();
+
+    /* Errors and surprises are left to curl, which reports them properly */
+    if (code != (_offset ? 206 : 200))
+        return _fail(Result::Unsupported, QString("HTTP status %1").arg(code));
+    if (!hasLength)
+        return _fail(Result::Unsupported, "No content length");
+
+    if (sink.header)
+    {
+        for (const QByteArray &line : lines)
+            sink.header(line.toStdString() + "\n");
+    }
+    return Result::Complete;
+}
+
+KtlsDownload::Result KtlsDownload::_readBody(const Sink &sink, quint64 contentLength, const QByteArray &bodyStart)
+{
+    const quint64 total = _offset + contentLength;
+    qsizetype pending = 0;   // Part of bodyStart not handed over yet
+    quint64 reported = _offset;
+
+    if (!sink.progress(_offset, total))
+        return _fail(Result::Cancelled, "Cancelled");
+
+    /* Every byte is reported before it is handed over, as the caller resumes
+       from what was reported if the connection is lost afterwards */
+    auto handOver = [&](char *buf, size_t fill) {
+        const quint64 now = _offset + _received + fill;
+        const bool carryOn = now == reported || sink.progress(now, total);
+        reported = now;
+        sink.commit(buf, fill);
+        _received += fill;
+        return carryOn;
+    };
+
+    while (_received < contentLength)
+    {
+        size_t capacity = 0;
+        char *buf = sink.acquire(capacity);
+        if (!buf)
+            return _fail(Result::Cancelled, "Cancelled");
+
+        size_t fill = 0;
+        const quint64 remaining = contentLength - _received;
+        const size_t wanted = static_cast<size_t>(qMin<quint64>(capacity, remaining));
+        const bool last = wanted == remaining;
+
+        /* Body bytes that came with the header: the only copy on this path */
+        if (pending < bodyStart.size())
+        {
+            fill = qMin<size_t>(wanted, bodyStart.size() - pending);
+            memcpy(buf, bodyStart.constData() + pending, fill);
+            pending += fill;
+        }
+
+        while (fill < wanted && (fill == 0 || last || wanted - fill >= MinRecvRoom))
+        {
+            ssize_t n = _recv(buf + fill, wanted - fill);
+            if (n <= 0)
+            {
+                handOver(buf, fill);
+                return _fail(Result::Failed, n == 0 ? QString("Connection closed early") : _error);
+            }
+            fill += n;
+            reported = _offset + _received + fill;
+            if (!sink.progress(reported, total))
+            {
+                handOver(buf, fill);
+                return _fail(Result::Cancelled, "Cancelled");
+            }
+        }
+
+        if (!handOver(buf, fill))
+            return _fail(Result::Cancelled, "Cancelled");
+    }
+
+    return Result::Complete;
+}
@@ -0,0 +1,84 @@
+#ifndef KTLSDOWNLOAD_H
+#define KTLSDOWNLOAD_H
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <QByteArray>
+#include <QString>
+#include <functional>
+#include <string>
+#include <gnutls/gnutls.h>
+
+/*
+ * HTTPS download with kernel TLS receive offload (Linux only).
+ *
+ * The TLS handshake is done by GnuTLS. The receive keys are then handed to
+ * the kernel (TCP_ULP "tls", TLS_RX), so the kernel decrypts and recv()
+ * returns plaintext. The body is received straight into the buffers
+ * handed out by the sink, normally ring buffer slots, without going
+ * through curl or an intermediate copy.
+ *
+ * Only plain HTTP/1.1 GET responses with a Content-Length are handled,
+ * redirects are followed. Anything else - no kTLS support in the kernel, a
+ * cipher the kernel cannot decrypt, chunked or encoded responses, HTTP
+ * errors - is reported as Unsupported before any payload is delivered,
+ * so the caller can fall back to curl from the same offset.
+ */
+class KtlsDownload
+{
+public:
+    enum class Result {
+        Complete,
+        Unsupported,    // Nothing delivered: use another path from the same offset
+        Failed,         // Connection lost after delivering payload: resume from offset()+bytesReceived()
+        Cancelled
+    };
+
+    struct Sink {
+        std::function<char *(size_t &capacity)> acquire;      // Buffer to receive into, nullptr to stop
+        std::function<void(char *buf, size_t len)> commit;    // Hand over a filled buffer
+        std::function<bool(quint64 now, quint64 total)> progress;  // Absolute offsets; false to cancel
+        std::function<void(const std::string &line)> header;  // Each response header line
+    };
+
+    KtlsDownload(const QByteArray &url, quint64 offset = 0);
+    ~KtlsDownload();
+
+    void setUserAgent(const QByteArray &userAgent) { _userAgent = userAgent; }
+    void setCaFile(const QString &path) { _caFile = path; }           // Default: system trust store
+    void setStallTimeout(int ms) { _stallTimeoutMs = ms; }
+
+    Result run(const Sink &sink);
+
+    QString errorString() const { return _error; }
+    QString description() const { return _description; }          // Protocol and cipher once connected
+    quint64 bytesReceived() const { return _received; }
+    quint64 offset() const { return _offset; }
+
+    // Whether the running kernel accepts the "tls" upper layer protocol at all
+    static bool kernelSupported();
+
+protected:
+    QByteArray _url, _userAgent;
+    QString _caFile, _error, _description;
+    quint64 _offset, _received;
+    int _stallTimeoutMs;
+    int _fd;
+    gnutls_session_t _session;
+    gnutls_certificate_credentials_t _credentials;
+
+    Result _fail(Result result, const QString &error);
+    void _close();
+    bool _connect(const QString &host, quint16 port);
+    bool _handshake(const QString &host);
+    bool _enableKernelRx();
+    bool _sendRequest(const QString &host, quint16 port, const QString &path);
+    ssize_t _recv(char *buf, size_t len);
+    Result _readHeaders(const Sink &sink, QByteArray &location, quint64 &contentLength, QByteArray &bodyStart);
+    Result _readBody(const Sink &sink, quint64 contentLength, const QByteArray &bodyStart);
+};
+
+#endif // KTLSDOWNLOAD_H
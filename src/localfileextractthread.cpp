@@ -5,12 +5,19 @@
 
 #include "localfileextractthread.h"
 #include "config.h"
+#include "perfcounters.h"
 #include "systemmemorymanager.h"
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <QUrl>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QFuture>
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <algorithm>
+#include <stdexcept>
 
 LocalFileExtractThread::LocalFileExtractThread(const QByteArray &url, const QByteArray &dst, const QByteArray &expectedHash, QObject *parent)
     : DownloadExtractThread(url, dst, expectedHash, parent)
@@ -58,7 +65,7 @@ void LocalFileExtractThread::_cancelExtract()
 
 void LocalFileExtractThread::run()
 {
-    if (isImage() && !_openAndPrepareDevice())
+    if (!_startDevicePreparation())
         return;
 
     emit preparationStatusUpdate(tr("Opening image file..."));
@@ -71,6 +78,7 @@ void LocalFileExtractThread::run()
         return;
     }
     _lastDlTotal = _inputfile.size();
+    _startWatchdog();
     
     emit preparationStatusUpdate(tr("Starting extraction..."));
 
@@ -90,6 +98,9 @@ void LocalFileExtractThread::run()
 
     if (_cancelled)
         _closeFiles();
+
+    _waitForDevice();
+    _stopWatchdog();
 }
 
 ssize_t LocalFileExtractThread::_on_read(struct archive *, const void **buff)
@@ -123,6 +134,8 @@ int LocalFileExtractThread::_on_close(struct archive *)
 
 void LocalFileExtractThread::extractRawImageRun()
 {
+    /* Nothing to decompress; reading the source is this path's download stage */
+    PerfCounters::Scope scope(PerfCounters::Stage::Download);
     qDebug() << "Extracting raw disk image (ISO/IMG/RAW) directly";
     
     qint64 totalBytes = _inputfile.size();
@@ -238,3 +251,221 @@ int LocalFileExtractThread::_archive_close_test(struct archive *, void *client_d
     // Don't actually close the file during testing
     return ARCHIVE_OK;
 }
+
+// Raise exception on libarchive errors (same policy as the sequential extraction)
+static inline void _checkEntryResult(int r, struct archive *a)
+{
+    if (r == ARCHIVE_FATAL)
+        throw std::runtime_error(archive_error_string(a));
+    if (r < ARCHIVE_OK)
+        qDebug() << archive_error_string(a);
+}
+
+/* Open a zip with the seekable reader, which walks the central directory and
+ * seeks straight to each entry instead of inflating everything in between */
+static struct archive *_openSeekableZip(const QString &path)
+{
+    struct archive *a = archive_read_new();
+    archive_read_support_format_zip_seekable(a);
+#ifdef Q_OS_WIN
+    int r = archive_read_open_filename_w(a, reinterpret_cast<const wchar_t *>(path.utf16()), 65536);
+#else
+    int r = archive_read_open_filename(a, QFile::encodeName(path).constData(), 65536);
+#endif
+    if (r != ARCHIVE_OK)
+    {
+        qDebug() << "Cannot open" << path << "as seekable zip:" << archive_error_string(a);
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+bool LocalFileExtractThread::_extractMultiFileParallel(QStringList &filesExtracted, QStringList &dirExtracted)
+{
+    static const int MAX_EXTRACT_WORKERS = 4;  // Beyond this the target card, not the CPU, is the bottleneck
+    int numWorkers = qMin(QThread::idealThreadCount(), MAX_EXTRACT_WORKERS);
+
+    if (numWorkers < 2 || _inputfile.peek(4) != QByteArray("PK\x03\x04", 4))
+        return false;
+
+    _inputPath = _inputfile.fileName();
+    struct archive *a = _openSeekableZip(_inputPath);
+    if (!a)
+        return false;
+
+    /* First pass over the central directory. Directories, empty files and anything
+     * that is not a regular file are created right away, in archive order. This writer
+     * stays open until all workers are done, so that directory timestamps get fixed up
+     * last, exactly as in the sequential extraction. */
+    struct archive *ext = archive_write_disk_new();
+    archive_write_disk_set_options(ext, _multiFileExtractFlags());
+
+    struct Job {
+        int index;
+        qint64 size;
+    };
+    QVector<Job> jobs;
+    struct archive_entry *entry;
+    int r, index = 0;
+
+    try
+    {
+        while ( (r = archive_read_next_header(a, &entry)) != ARCHIVE_EOF)
+        {
+            _checkEntryResult(r, a);
+            QString filename = QString::fromWCharArray(archive_entry_pathname_w(entry));
+
+            if (archive_entry_filetype(entry) == AE_IFREG && archive_entry_size(entry) > 0)
+            {
+                jobs.append({index, archive_entry_size(entry)});
+                filesExtracted.append(filename);
+            }
+            else
+            {
+                if (archive_entry_filetype(entry) == AE_IFDIR)
+                    dirExtracted.append(filename);
+                r = archive_write_header(ext, entry);
+                if (r < ARCHIVE_OK)
+                    qDebug() << archive_error_string(ext);
+                _checkEntryResult(archive_write_finish_entry(ext), ext);
+            }
+            index++;
+        }
+    }
+    catch (...)
+    {
+        archive_read_free(a);
+        archive_write_free(ext);
+        throw;
+    }
+    archive_read_free(a);
+
+    if (jobs.size() < 2)
+        numWorkers = 1;
+    qDebug() << "Parallel zip extraction:" << jobs.size() << "files on" << numWorkers << "workers";
+
+    /* Largest entries first onto the least loaded worker, so the pool drains evenly.
+     * Each worker then walks its own entries in archive order: reads only ever seek
+     * forwards, and every file is written start to finish by a single thread. */
+    std::sort(jobs.begin(), jobs.end(), [](const Job &x, const Job &y) { return x.size > y.size; });
+    QVector<QVector<int>> assignments(numWorkers);
+    QVector<qint64> load(numWorkers, 0);
+    for (const Job &job : jobs)
+    {
+        int w = static_cast<int>(std::min_element(load.begin(), load.end()) - load.begin());
+        assignments[w].append(job.index);
+        load[w] += job.size;
+    }
+
+    _parallelError.clear();
+    QThreadPool pool;
+    pool.setMaxThreadCount(numWorkers);
+    QVector<QFuture<void>> futures;
+    for (int w = 0; w < numWorkers; w++)
+    {
+        std::sort(assignments[w].begin(), assignments[w].end());
+        futures.append(QtConcurrent::run(&pool, &LocalFileExtractThread::_extractEntriesWorker, this, assignments[w], w));
+    }
+
+    /* Meanwhile hash the archive itself, which the sequential path does as a side effect of reading it */
+    qint64 len;
+    while (!_cancelled && (len = _inputfile.read(_inputBuf, _inputBufSize)) > 0)
+    {
+        _inputHash.addData(_inputBuf, len);
+        _lastDlNow += len;
+        _emitProgressUpdate();
+    }
+
+    for (auto &future : futures)
+    {
+        while (!future.isFinished())
+        {
+            _emitProgressUpdate();
+            QThread::msleep(PROGRESS_UPDATE_INTERVAL);
+        }
+    }
+
+    if (archive_write_close(ext) != ARCHIVE_OK)
+        qDebug() << "Warning: Failed to properly close archive write handle";
+    archive_write_free(ext);
+
+    if (!_parallelError.isEmpty())
+        throw std::runtime_error(_parallelError.toStdString());
+    if (_cancelled)
+        throw std::runtime_error("Cancelled");
+
+    return true;
+}
+
+void LocalFileExtractThread::_extractEntriesWorker(const QVector<int> &entryIndexes, int worker)
+{
+    PerfCounters::Scope scope(PerfCounters::Stage::Decompress);
+    if (entryIndexes.isEmpty())
+        return;
+
+    struct archive *a = _openSeekableZip(_inputPath);
+    if (!a)
+    {
+        QMutexLocker lock(&_parallelErrorMutex);
+        if (_parallelError.isEmpty())
+            _parallelError = tr("Error opening image file");
+        return;
+    }
+    struct archive *ext = archive_write_disk_new();
+    archive_write_disk_set_options(ext, _multiFileExtractFlags());
+
+    struct archive_entry *entry;
+    int r, index = 0, next = 0;
+
+    try
+    {
+        while (next < entryIndexes.size() && !_cancelled
+               && (r = archive_read_next_header(a, &entry)) != ARCHIVE_EOF)
+        {
+            _checkEntryResult(r, a);
+            if (index++ != entryIndexes[next])
+                continue;  // Not ours: the next header call skips its data without inflating it
+            next++;
+
+            QElapsedTimer entryTimer;
+            entryTimer.start();
+            quint64 entryBytes = 0;
+
+            r = archive_write_header(ext, entry);
+            if (r < ARCHIVE_OK)
+            {
+                qDebug() << archive_error_string(ext);
+            }
+            else
+            {
+                const void *buff;
+                size_t size;
+                int64_t offset;
+
+                while (!_cancelled && (r = archive_read_data_block(a, &buff, &size, &offset)) != ARCHIVE_EOF)
+                {
+                    _checkEntryResult(r, a);
+                    _checkEntryResult(archive_write_data_block(ext, buff, size, offset), ext);
+                    _bytesWritten += size;
+                    entryBytes += size;
+                }
+            }
+            _checkEntryResult(archive_write_finish_entry(ext), ext);
+
+            emit eventArchiveEntryExtraction(static_cast<quint32>(entryTimer.elapsed()), entryBytes,
+                QString("entry: %1; worker: %2").arg(QString::fromWCharArray(archive_entry_pathname_w(entry))).arg(worker));
+        }
+    }
+    catch (std::exception &e)
+    {
+        QMutexLocker lock(&_parallelErrorMutex);
+        if (_parallelError.isEmpty())
+            _parallelError = QString::fromUtf8(e.what());
+    }
+
+    if (archive_write_close(ext) != ARCHIVE_OK)
+        qDebug() << "Warning: Failed to properly close archive write handle";
+    archive_write_free(ext);
+    archive_read_free(a);
+}
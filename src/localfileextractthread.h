@@ -9,6 +9,8 @@
 #include "downloadextractthread.h"
 #include "suspend_inhibitor.h"
 #include <QFile>
+#include <QMutex>
+#include <QVector>
 
 // Forward declarations for libarchive
 struct archive;
@@ -28,12 +30,19 @@ protected:
     virtual int _on_close(struct archive *a);
     void extractRawImageRun();
     bool _testArchiveFormat();
+    virtual bool _extractMultiFileParallel(QStringList &filesExtracted, QStringList &dirExtracted);
+    void _extractEntriesWorker(const QVector<int> &entryIndexes, int worker);
     static ssize_t _archive_read_test(struct archive *, void *client_data, const void **buff);
     static int _archive_close_test(struct archive *, void *client_data);
     QFile _inputfile;
     char *_inputBuf;
     size_t _inputBufSize;
 
+    // Parallel multi-file extraction state (shared with worker threads)
+    QString _inputPath;
+    QMutex _parallelErrorMutex;
+    QString _parallelError;
+
 private:
     SuspendInhibitor *_suspendInhibitor;
 };
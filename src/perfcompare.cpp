@@ -0,0 +1,438 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "perfcompare.h"
+#include "io_latency.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+
+using rpi_imager::LatencyHistogram;
+
+namespace {
+
+constexpr int BootstrapIterations = 1000;
+constexpr int MaxLatencyDraws = 5000;     // Per resample, keeps large histograms cheap
+const char *const PhaseNames[] = {"download", "decompress", "write", "verify"};
+
+struct Cycle {
+    QString image;
+    QString device;
+    double durationMs = 0;
+    double stallMs = 0;
+    QMap<QString, QVector<double>> throughputKBps;         // Per phase, one value per histogram slice
+    QMap<QString, LatencyHistogram::Snapshot> latency;     // "operation/phase"
+};
+
+struct Group {
+    QString image;
+    QString device;
+    QVector<Cycle> base;
+    QVector<Cycle> candidate;
+};
+
+using Interval = PerfCompare::Interval;
+
+// Statistic over the original samples (rng == nullptr) or over a resample of them
+using Statistic = std::function<double(std::mt19937 *)>;
+
+LatencyHistogram::Snapshot latencyFromJson(const QJsonObject &stats)
+{
+    LatencyHistogram::Snapshot s;
+    s.counts.assign(LatencyHistogram::kBucketCount, 0);
+    for (const QJsonValue &v : stats["buckets"].toArray()) {
+        QJsonArray bucket = v.toArray();
+        quint64 count = static_cast<quint64>(bucket.at(2).toDouble());
+        s.counts[LatencyHistogram::BucketIndex(static_cast<quint64>(bucket.at(0).toDouble()))] += count;
+        s.count += count;
+    }
+    s.max_us = static_cast<quint64>(stats["maxUs"].toDouble());
+    return s;
+}
+
+void mergeLatency(LatencyHistogram::Snapshot &into, const LatencyHistogram::Snapshot &from)
+{
+    if (into.counts.empty())
+        into.counts.assign(LatencyHistogram::kBucketCount, 0);
+    for (size_t i = 0; i < from.counts.size(); i++)
+        into.counts[i] += from.counts[i];
+    into.count += from.count;
+    into.max_us = std::max(into.max_us, from.max_us);
+}
+
+bool loadExport(const QString &path, QVector<Cycle> &cycles, QString &error)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        error = QString("cannot open %1").arg(path);
+        return false;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &parseError);
+    if (parseError.error != QJsonParseError::NoError || !doc.isObject()) {
+        error = QString("%1 is not a performance data export (%2)").arg(path, parseError.errorString());
+        return false;
+    }
+
+    QJsonObject root = doc.object();
+    QJsonArray events = root["events"].toArray();
+    QJsonObject histograms = root["histograms"].toObject();
+
+    QMap<int, QJsonObject> ioLatency;
+    for (const QJsonValue &v : root["ioLatency"].toArray())
+        ioLatency[v.toObject()["cycle"].toInt()] = v.toObject()["operations"].toObject();
+
+    QJsonArray cycleArray = root["cycles"].toArray();
+    if (cycleArray.isEmpty()) {
+        // Older exports have no per-cycle ranges: treat the whole file as one cycle
+        QJsonObject summary = root["summary"].toObject();
+        QJsonObject whole;
+        whole["cycle"] = 1;
+        whole["imageName"] = summary["imageName"];
+        whole["deviceName"] = summary["deviceName"];
+        whole["success"] = summary["success"].toBool(true);
+        whole["durationMs"] = summary["durationMs"];
+        whole["events"] = QJsonArray({0, static_cast<int>(events.size())});
+        QJsonObject slices;
+        for (const char *phase : PhaseNames)
+            slices[phase] = QJsonArray({0, static_cast<int>(histograms[phase].toArray().size())});
+        whole["histograms"] = slices;
+        cycleArray.append(whole);
+    }
+
+    for (const QJsonValue &v : cycleArray) {
+        QJsonObject c = v.toObject();
+        // Failed or interrupted cycles say nothing about steady-state performance
+        if (!c["success"].toBool() || !c["ended"].toBool(true))
+            continue;
+
+        Cycle cycle;
+        cycle.image = c["imageName"].toString();
+        cycle.device = c["deviceName"].toString();
+        cycle.durationMs = c["durationMs"].toDouble();
+
+        QJsonArray eventRange = c["events"].toArray();
+        for (int i = eventRange.at(0).toInt(); i < std::min(eventRange.at(1).toInt(), static_cast<int>(events.size())); i++) {
+            QJsonObject e = events.at(i).toObject();
+            if (e["type"].toString() == "ringBufferStarvation")
+                cycle.stallMs += e["durationMs"].toDouble();
+        }
+
+        QJsonObject sliceRanges = c["histograms"].toObject();
+        for (const char *phase : PhaseNames) {
+            QJsonArray slices = histograms[phase].toArray();
+            QJsonArray range = sliceRanges[phase].toArray();
+            QVector<double> kbps;
+            for (int i = range.at(0).toInt(); i < std::min(range.at(1).toInt(), static_cast<int>(slices.size())); i++)
+                kbps.append(slices.at(i).toArray().at(3).toDouble());   // avgKBps, see histogramSliceFormat
+            if (!kbps.isEmpty())
+                cycle.throughputKBps[phase] = kbps;
+        }
+
+        QJsonObject operations = ioLatency.value(c["cycle"].toInt());
+        for (auto op = operations.begin(); op != operations.end(); ++op) {
+            QJsonObject phases = op.value().toObject();
+            for (auto phase = phases.begin(); phase != phases.end(); ++phase)
+                cycle.latency[op.key() + "/" + phase.key()] = latencyFromJson(phase.value().toObject());
+        }
+
+        cycles.append(cycle);
+    }
+
+    return true;
+}
+
+bool loadPath(const QString &path, QVector<Cycle> &cycles, QString &error)
+{
+    QFileInfo info(path);
+    if (!info.isDir())
+        return loadExport(path, cycles, error);
+
+    QStringList files = QDir(path).entryList({"*.json"}, QDir::Files, QDir::Name);
+    if (files.isEmpty()) {
+        error = QString("no .json files in %1").arg(path);
+        return false;
+    }
+    for (const QString &file : files) {
+        if (!loadExport(QDir(path).filePath(file), cycles, error))
+            return false;
+    }
+    return true;
+}
+
+Statistic meanOf(const QVector<double> &samples)
+{
+    return [samples](std::mt19937 *rng) {
+        double sum = 0;
+        if (!rng) {
+            for (double v : samples)
+                sum += v;
+        } else {
+            std::uniform_int_distribution<int> pick(0, samples.size() - 1);
+            for (int i = 0; i < samples.size(); i++)
+                sum += samples[pick(*rng)];
+        }
+        return sum / samples.size();
+    };
+}
+
+Statistic percentileOf(const LatencyHistogram::Snapshot &histogram, double percentile)
+{
+    // Resample from the histogram's own distribution
+    auto cumulative = std::make_shared<std::vector<quint64>>();
+    quint64 running = 0;
+    for (quint64 c : histogram.counts) {
+        running += c;
+        cumulative->push_back(running);
+    }
+
+    return [histogram, percentile, cumulative](std::mt19937 *rng) {
+        if (!rng)
+            return static_cast<double>(histogram.ValueAtPercentile(percentile));
+
+        LatencyHistogram::Snapshot resample;
+        resample.counts.assign(histogram.counts.size(), 0);
+        resample.count = std::min<quint64>(histogram.count, MaxLatencyDraws);
+        resample.max_us = histogram.max_us;
+        std::uniform_int_distribution<quint64> pick(0, histogram.count - 1);
+        for (quint64 i = 0; i < resample.count; i++) {
+            auto bucket = std::upper_bound(cumulative->begin(), cumulative->end(), pick(*rng));
+            resample.counts[bucket - cumulative->begin()]++;
+        }
+        return static_cast<double>(resample.ValueAtPercentile(percentile));
+    };
+}
+
+// Change from base to candidate: relative (fraction) or absolute difference
+Interval bootstrap(const Statistic &base, const Statistic &candidate, bool relative, std::mt19937 &rng)
+{
+    auto change = [relative](double b, double c) { return relative ? (c - b) / b : c - b; };
+
+    Interval result;
+    double b = base(nullptr);
+    if (relative && b <= 0)
+        return result;
+    result.point = change(b, candidate(nullptr));
+
+    std::vector<double> changes;
+    changes.reserve(BootstrapIterations);
+    for (int i = 0; i < BootstrapIterations; i++) {
+        double rb = base(&rng);
+        double rc = candidate(&rng);
+        if (relative && rb <= 0)
+            continue;
+        changes.push_back(change(rb, rc));
+    }
+    if (changes.size() < BootstrapIterations / 2)
+        return result;
+
+    std::sort(changes.begin(), changes.end());
+    result.low = changes[static_cast<size_t>(changes.size() * 0.025)];
+    result.high = changes[std::min(changes.size() - 1, static_cast<size_t>(changes.size() * 0.975))];
+    result.valid = true;
+    return result;
+}
+
+class Report
+{
+public:
+    Report(QTextStream &out, double thresholdPercent)
+        : _out(out), _threshold(thresholdPercent), _regressions(0) {}
+
+    // relative: change in percent, otherwise in the metric's own unit (percentage points)
+    void metric(const QString &name, double base, double candidate, const Interval &interval,
+                bool relative, bool higherIsBetter, bool enoughSamples)
+    {
+        double scale = relative ? 100.0 : 1.0;
+        const char *unit = relative ? "%" : "pp";
+        QString change = QString::asprintf("%+.1f%s", interval.point * scale, unit);
+        QString range;
+        QString verdict = "too few samples";
+
+        if (enoughSamples && interval.valid) {
+            range = QString::asprintf("[%+.1f, %+.1f]", interval.low * scale, interval.high * scale);
+            switch (PerfCompare::judge(interval, relative, higherIsBetter, _threshold)) {
+            case PerfCompare::Verdict::Regression:
+                verdict = "REGRESSION";
+                _regressions++;
+                break;
+            case PerfCompare::Verdict::Improved:
+                verdict = "improved";
+                break;
+            default:
+                verdict = "ok";
+                break;
+            }
+        }
+
+        _out << QString::asprintf("  %-28s %12.2f %12.2f %9s  %-18s %s",
+                                  qPrintable(name), base, candidate, qPrintable(change),
+                                  qPrintable(range), qPrintable(verdict)) << Qt::endl;
+    }
+
+    int regressions() const { return _regressions; }
+
+private:
+    QTextStream &_out;
+    double _threshold;
+    int _regressions;
+};
+
+void compareGroup(const Group &g, Report &report, QTextStream &out, std::mt19937 &rng)
+{
+    out << Qt::endl << g.image << " on " << g.device << ": "
+        << g.base.size() << " base, " << g.candidate.size() << " candidate cycles" << Qt::endl;
+    out << QString::asprintf("  %-28s %12s %12s %9s  %-18s %s",
+                             "metric", "base", "candidate", "change", "95% interval", "verdict") << Qt::endl;
+
+    // Throughput of each phase, over all 1 second slices
+    for (const char *phase : PhaseNames) {
+        QVector<double> base, candidate;
+        for (const Cycle &c : g.base)
+            base += c.throughputKBps.value(phase);
+        for (const Cycle &c : g.candidate)
+            candidate += c.throughputKBps.value(phase);
+        if (base.isEmpty() || candidate.isEmpty())
+            continue;
+
+        Statistic b = meanOf(base), c = meanOf(candidate);
+        report.metric(QString("%1 MB/s").arg(phase), b(nullptr) / 1024, c(nullptr) / 1024,
+                      bootstrap(b, c, true, rng), true, true, base.size() >= 2 && candidate.size() >= 2);
+    }
+
+    // Per cycle: duration and share of it lost to ring buffer stalls
+    QVector<double> baseDuration, candidateDuration, baseStalls, candidateStalls;
+    for (const Cycle &c : g.base) {
+        if (c.durationMs > 0) {
+            baseDuration.append(c.durationMs / 1000);
+            baseStalls.append(c.stallMs / c.durationMs * 100);
+        }
+    }
+    for (const Cycle &c : g.candidate) {
+        if (c.durationMs > 0) {
+            candidateDuration.append(c.durationMs / 1000);
+            candidateStalls.append(c.stallMs / c.durationMs * 100);
+        }
+    }
+    if (!baseDuration.isEmpty() && !candidateDuration.isEmpty()) {
+        bool enough = baseDuration.size() >= 2 && candidateDuration.size() >= 2;
+        Statistic b = meanOf(baseDuration), c = meanOf(candidateDuration);
+        report.metric("cycle duration s", b(nullptr), c(nullptr), bootstrap(b, c, true, rng), true, false, enough);
+        b = meanOf(baseStalls);
+        c = meanOf(candidateStalls);
+        report.metric("ring buffer stalls % of cycle", b(nullptr), c(nullptr), bootstrap(b, c, false, rng), false, false, enough);
+    }
+
+    // Device I/O latency, pooled over cycles
+    QMap<QString, LatencyHistogram::Snapshot> baseLatency, candidateLatency;
+    for (const Cycle &c : g.base) {
+        for (auto it = c.latency.begin(); it != c.latency.end(); ++it)
+            mergeLatency(baseLatency[it.key()], it.value());
+    }
+    for (const Cycle &c : g.candidate) {
+        for (auto it = c.latency.begin(); it != c.latency.end(); ++it)
+            mergeLatency(candidateLatency[it.key()], it.value());
+    }
+    for (auto it = baseLatency.begin(); it != baseLatency.end(); ++it) {
+        if (!candidateLatency.contains(it.key()))
+            continue;
+        const LatencyHistogram::Snapshot &base = it.value();
+        const LatencyHistogram::Snapshot &candidate = candidateLatency[it.key()];
+        bool enough = base.count >= 2 && candidate.count >= 2;
+        for (double percentile : {50.0, 99.0}) {
+            Statistic b = percentileOf(base, percentile), c = percentileOf(candidate, percentile);
+            report.metric(QString("%1 p%2 ms").arg(it.key()).arg(percentile), b(nullptr) / 1000, c(nullptr) / 1000,
+                          bootstrap(b, c, true, rng), true, false, enough);
+        }
+    }
+}
+
+} // namespace
+
+int PerfCompare::compare(const QString &basePath, const QString &candidatePath,
+                         double thresholdPercent, QTextStream &out, QTextStream &err)
+{
+    QVector<Cycle> base, candidate;
+    QString error;
+    if (!loadPath(basePath, base, error) || !loadPath(candidatePath, candidate, error)) {
+        err << "Error: " << error << Qt::endl;
+        return Failed;
+    }
+
+    // Align cycles by image and device
+    QMap<QString, Group> groups;
+    for (const Cycle &c : base) {
+        Group &g = groups[c.image + '\n' + c.device];
+        g.image = c.image;
+        g.device = c.device;
+        g.base.append(c);
+    }
+    for (const Cycle &c : candidate) {
+        Group &g = groups[c.image + '\n' + c.device];
+        g.image = c.image;
+        g.device = c.device;
+        g.candidate.append(c);
+    }
+
+    out << "Comparing " << candidatePath << " against " << basePath
+        << QString::asprintf(" (threshold %.1f%%, 95%% bootstrap intervals)", thresholdPercent) << Qt::endl;
+
+    // Fixed seed: the same inputs always give the same verdict
+    std::mt19937 rng(1);
+    Report report(out, thresholdPercent);
+    int compared = 0;
+    for (const Group &g : groups) {
+        if (g.base.isEmpty() || g.candidate.isEmpty()) {
+            out << Qt::endl << g.image << " on " << g.device << ": only in "
+                << (g.base.isEmpty() ? "candidate" : "base") << ", not compared" << Qt::endl;
+            continue;
+        }
+        compareGroup(g, report, out, rng);
+        compared++;
+    }
+
+    if (!compared) {
+        err << "Error: no successful cycles with the same image and device in both sets" << Qt::endl;
+        return Failed;
+    }
+
+    out << Qt::endl << report.regressions() << " regression(s)" << Qt::endl;
+    return report.regressions() ? Regression : NoRegression;
+}
+
+PerfCompare::Interval PerfCompare::meanChange(const QVector<double> &base, const QVector<double> &candidate,
+                                              bool relative, unsigned int seed)
+{
+    if (base.isEmpty() || candidate.isEmpty())
+        return Interval();
+
+    std::mt19937 rng(seed);
+    return bootstrap(meanOf(base), meanOf(candidate), relative, rng);
+}
+
+PerfCompare::Verdict PerfCompare::judge(const Interval &interval, bool relative, bool higherIsBetter, double threshold)
+{
+    if (!interval.valid)
+        return Verdict::TooFewSamples;
+
+    bool significant = interval.low > 0 || interval.high < 0;
+    double worse = (higherIsBetter ? -interval.point : interval.point) * (relative ? 100.0 : 1.0);
+    if (significant && worse > threshold)
+        return Verdict::Regression;
+    if (significant && -worse > threshold)
+        return Verdict::Improved;
+    return Verdict::NoChange;
+}
@@ -0,0 +1,74 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef PERFCOMPARE_H
+#define PERFCOMPARE_H
+
+#include <QString>
+#include <QVector>
+
+class QTextStream;
+
+/**
+ * @brief Compare two sets of performance data exports (rpi-imager --cli --perf-compare)
+ *
+ * Base and candidate are either single exports or directories of them.
+ * Cycles are aligned by image and device name, and pooled across files.
+ * For every aligned pair the following are compared:
+ *
+ * - Throughput of each phase (mean of the 1 second histogram slices)
+ * - Share of the cycle spent in ring buffer stalls
+ * - Cycle duration
+ * - p50/p99 latency of each device operation and phase (ioLatency)
+ *
+ * Differences are judged with bootstrapped 95% confidence intervals, so
+ * run-to-run noise is not reported as a regression. A metric regresses
+ * when its interval excludes "no change" and the change is worse than the
+ * threshold (stall share: percentage points, all others: percent).
+ */
+class PerfCompare
+{
+public:
+    enum ExitCode {
+        NoRegression = 0,
+        Failed = 1,       // Unreadable input, or nothing to compare
+        Regression = 2
+    };
+
+    static int compare(const QString &basePath, const QString &candidatePath,
+                       double thresholdPercent, QTextStream &out, QTextStream &err);
+
+    /**
+     * @brief Change from base to candidate with its 95% confidence interval
+     */
+    struct Interval {
+        bool valid = false;   // False if there are too few samples to judge
+        double point = 0;
+        double low = 0;
+        double high = 0;
+    };
+
+    enum class Verdict {
+        TooFewSamples,
+        NoChange,         // Within noise or within the threshold
+        Improved,
+        Regression
+    };
+
+    /**
+     * @brief Bootstrap the change in the mean, relative (fraction of base) or absolute
+     *
+     * The same samples and seed always give the same interval.
+     */
+    static Interval meanChange(const QVector<double> &base, const QVector<double> &candidate,
+                               bool relative, unsigned int seed);
+
+    /**
+     * @brief Judge a change against the threshold (relative: percent, otherwise the metric's own unit)
+     */
+    static Verdict judge(const Interval &interval, bool relative, bool higherIsBetter, double threshold);
+};
+
+#endif // PERFCOMPARE_H
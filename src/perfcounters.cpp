@@ -0,0 +1,584 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "perfcounters.h"
+#include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+/* Hardware counters first, then resources, so both are charged the same way */
+constexpr int kResourceBase = PerfCounters::CounterCount;
+constexpr int kValueCount = PerfCounters::CounterCount + PerfCounters::ResourceCount;
+using Values = std::array<uint64_t, kValueCount>;
+
+std::atomic<bool> g_enabled{false};
+std::array<std::array<std::atomic<uint64_t>, kValueCount>, PerfCounters::StageCount> g_totals{};
+std::array<std::atomic<uint64_t>, PerfCounters::StageCount> g_scopes{};
+std::atomic<uint32_t> g_availableMask{0};
+std::atomic<bool> g_peakRssReset{false};
+
+QMutex g_reasonMutex;
+QString g_unavailableReason;
+
+/* Updated by operator new below; plain thread locals so counting never
+ * allocates or takes a lock. Only counted while the thread is inside a
+ * Scope: outside the pipeline, allocations cost nothing extra */
+thread_local bool t_counting = false;
+thread_local uint64_t t_allocations = 0;
+thread_local uint64_t t_allocatedBytes = 0;
+
+void noteUnavailable(const QString &reason)
+{
+    QMutexLocker locker(&g_reasonMutex);
+    if (g_unavailableReason.isEmpty())
+    {
+        g_unavailableReason = reason;
+        qDebug() << "PerfCounters:" << reason;
+    }
+}
+
+uint64_t threadCpuNs()
+{
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    auto toU64 = [](const FILETIME &ft) {
+        return (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    };
+    return (toU64(kernel) + toU64(user)) * 100;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+#ifdef Q_OS_LINUX
+
+struct CounterDefinition {
+    uint32_t type;
+    uint64_t config;
+};
+
+/* Same order as PerfCounters::Counter */
+constexpr CounterDefinition kDefinitions[PerfCounters::CounterCount] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+int openCounter(const CounterDefinition &def, bool excludeKernel)
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = def.type;
+    attr.config = def.config;
+    attr.exclude_kernel = excludeKernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    /* pid 0, cpu -1: the calling thread only, on whatever CPU it runs */
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+QString paranoidLevel()
+{
+    QFile f("/proc/sys/kernel/perf_event_paranoid");
+    if (!f.open(QIODevice::ReadOnly))
+        return "unknown";
+    return QString::fromLatin1(f.readAll().trimmed());
+}
+
+#endif
+
+/* Counters of the current thread, plus which stage it is currently charging */
+struct ThreadCounters {
+    std::array<int, PerfCounters::CounterCount> fds;
+    bool attempted = false;
+    bool anyOpen = false;
+    bool inStage = false;
+    PerfCounters::Stage stage = PerfCounters::Stage::_Count;
+    Values baseline{};
+
+    ThreadCounters()
+    {
+        fds.fill(-1);
+    }
+
+    ~ThreadCounters()
+    {
+#ifdef Q_OS_LINUX
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+#endif
+    }
+
+    bool ensureOpen()
+    {
+        if (attempted)
+            return anyOpen;
+        attempted = true;
+
+#ifdef Q_OS_LINUX
+        for (int i = 0; i < PerfCounters::CounterCount; i++)
+        {
+            int fd = openCounter(kDefinitions[i], false);
+            /* Unprivileged processes may only count user space at perf_event_paranoid >= 2 */
+            if (fd < 0 && (errno == EACCES || errno == EPERM))
+                fd = openCounter(kDefinitions[i], true);
+
+            if (fd < 0)
+            {
+                int err = errno;
+                if (err == EACCES || err == EPERM)
+                    noteUnavailable(QString("perf_event_open not permitted (perf_event_paranoid=%1)").arg(paranoidLevel()));
+                else if (err == ENOENT || err == EOPNOTSUPP)
+                    noteUnavailable(QString("%1 not supported by this CPU or hypervisor")
+                                    .arg(PerfCounters::counterName(static_cast<PerfCounters::Counter>(i))));
+                else
+                    noteUnavailable(QString("%1 not supported: %2")
+                                    .arg(PerfCounters::counterName(static_cast<PerfCounters::Counter>(i)), QString::fromLocal8Bit(std::strerror(err))));
+                continue;
+            }
+
+            fds[i] = fd;
+            anyOpen = true;
+            g_availableMask.fetch_or(1u << i, std::memory_order_relaxed);
+        }
+#else
+        noteUnavailable("hardware counters are only supported on Linux");
+#endif
+        return anyOpen;
+    }
+
+    void read(Values &out) const
+    {
+        out.fill(0);
+#ifdef Q_OS_LINUX
+        if (anyOpen && g_enabled.load(std::memory_order_relaxed))
+        {
+            for (int i = 0; i < PerfCounters::CounterCount; i++)
+            {
+                if (fds[i] < 0)
+                    continue;
+
+                uint64_t data[3];   // value, time enabled, time running
+                if (::read(fds[i], data, sizeof(data)) != sizeof(data) || !data[2])
+                    continue;
+
+                /* Scale if the PMU had to multiplex this counter with others */
+                if (data[2] < data[1])
+                    out[i] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+                else
+                    out[i] = data[0];
+            }
+        }
+
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        {
+            out[kResourceBase + static_cast<int>(PerfCounters::Resource::MinorFaults)] = static_cast<uint64_t>(usage.ru_minflt);
+            out[kResourceBase + static_cast<int>(PerfCounters::Resource::MajorFaults)] = static_cast<uint64_t>(usage.ru_majflt);
+        }
+#endif
+        out[kResourceBase + static_cast<int>(PerfCounters::Resource::CpuNs)] = threadCpuNs();
+        out[kResourceBase + static_cast<int>(PerfCounters::Resource::Allocations)] = t_allocations;
+        out[kResourceBase + static_cast<int>(PerfCounters::Resource::AllocatedBytes)] = t_allocatedBytes;
+    }
+
+    void charge(PerfCounters::Stage to, const Values &now) const
+    {
+        auto &totals = g_totals[static_cast<int>(to)];
+        for (int i = 0; i < kValueCount; i++)
+        {
+            if (now[i] > baseline[i])
+                totals[i].fetch_add(now[i] - baseline[i], std::memory_order_relaxed);
+        }
+    }
+};
+
+thread_local ThreadCounters t_counters;
+
+} // namespace
+
+PerfCounters::Scope::Scope(Stage stage)
+    : _previous(Stage::_Count), _hadPrevious(false)
+{
+    ThreadCounters &t = t_counters;
+    if (g_enabled.load(std::memory_order_relaxed))
+        t.ensureOpen();
+
+    Values now;
+    t.read(now);
+    if (t.inStage)
+    {
+        /* Charge the outer stage up to here; it resumes when this scope ends */
+        t.charge(t.stage, now);
+        _previous = t.stage;
+        _hadPrevious = true;
+    }
+
+    t.stage = stage;
+    t.inStage = true;
+    t.baseline = now;
+    t_counting = true;
+    g_scopes[static_cast<int>(stage)].fetch_add(1, std::memory_order_relaxed);
+}
+
+PerfCounters::Scope::~Scope()
+{
+    ThreadCounters &t = t_counters;
+    Values now;
+    t.read(now);
+    t.charge(t.stage, now);
+
+    if (_hadPrevious)
+    {
+        t.stage = _previous;
+        t.baseline = now;
+    }
+    else
+    {
+        t.inStage = false;
+        t_counting = false;
+    }
+}
+
+void PerfCounters::setEnabled(bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool PerfCounters::isEnabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void PerfCounters::reset()
+{
+    for (auto &stage : g_totals)
+    {
+        for (auto &value : stage)
+            value.store(0, std::memory_order_relaxed);
+    }
+    for (auto &scopes : g_scopes)
+        scopes.store(0, std::memory_order_relaxed);
+}
+
+PerfCounters::Snapshot PerfCounters::snapshot()
+{
+    Snapshot s;
+    for (int i = 0; i < StageCount; i++)
+    {
+        for (int j = 0; j < CounterCount; j++)
+            s.stages[i].counters[j] = g_totals[i][j].load(std::memory_order_relaxed);
+        for (int j = 0; j < ResourceCount; j++)
+            s.stages[i].resources[j] = g_totals[i][kResourceBase + j].load(std::memory_order_relaxed);
+        s.stages[i].scopes = g_scopes[i].load(std::memory_order_relaxed);
+    }
+    s.availableMask = g_availableMask.load(std::memory_order_relaxed);
+
+    QMutexLocker locker(&g_reasonMutex);
+    s.unavailableReason = g_unavailableReason;
+    return s;
+}
+
+bool PerfCounters::resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    /* "5" resets only the peak RSS (VmHWM) of this process */
+    QFile f("/proc/self/clear_refs");
+    bool ok = f.open(QIODevice::WriteOnly) && f.write("5") == 1;
+    g_peakRssReset.store(ok, std::memory_order_relaxed);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+PerfCounters::ProcessUsage PerfCounters::processUsage()
+{
+    ProcessUsage u;
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    {
+        u.peakRssBytes = pmc.PeakWorkingSetSize;
+        u.minorFaults = pmc.PageFaultCount;   // Windows does not split soft and hard faults here
+    }
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        u.minorFaults = static_cast<uint64_t>(usage.ru_minflt);
+        u.majorFaults = static_cast<uint64_t>(usage.ru_majflt);
+#ifdef Q_OS_DARWIN
+        u.peakRssBytes = static_cast<uint64_t>(usage.ru_maxrss);          // bytes
+#else
+        u.peakRssBytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;   // KiB
+#endif
+    }
+#endif
+
+#ifdef Q_OS_LINUX
+    if (g_peakRssReset.load(std::memory_order_relaxed))
+    {
+        QFile f("/proc/self/status");
+        if (f.open(QIODevice::ReadOnly))
+        {
+            for (const QByteArray &line : f.readAll().split('\n'))
+            {
+                if (line.startsWith("VmHWM:"))
+                {
+                    u.peakRssBytes = line.mid(6).trimmed().split(' ').first().toULongLong() * 1024;
+                    u.peakSinceReset = true;
+                    break;
+                }
+            }
+        }
+    }
+#endif
+    return u;
+}
+
+QString PerfCounters::stageName(Stage stage)
+{
+    switch (stage) {
+        case Stage::Download: return "download";
+        case Stage::Decompress: return "decompress";
+        case Stage::Write: return "write";
+        case Stage::Hash: return "hash";
+        case Stage::Verify: return "verify";
+        case Stage::CacheWriter: return "cacheWriter";
+        default: return "unknown";
+    }
+}
+
+QString PerfCounters::counterName(Counter counter)
+{
+    switch (counter) {
+        case Counter::TaskClockNs: return "taskClockNs";
+        case Counter::Cycles: return "cycles";
+        case Counter::Instructions: return "instructions";
+        case Counter::CacheMisses: return "cacheMisses";
+        case Counter::BranchMisses: return "branchMisses";
+        case Counter::ContextSwitches: return "contextSwitches";
+        case Counter::PageFaults: return "pageFaults";
+        default: return "unknown";
+    }
+}
+
+QString PerfCounters::resourceName(Resource resource)
+{
+    switch (resource) {
+        case Resource::CpuNs: return "cpuNs";
+        case Resource::Allocations: return "allocations";
+        case Resource::AllocatedBytes: return "allocatedBytes";
+        case Resource::MinorFaults: return "minorFaults";
+        case Resource::MajorFaults: return "majorFaults";
+        default: return "unknown";
+    }
+}
+
+/*
+ * Replacement global operator new/delete, counting allocations per thread
+ * for the stage accounting above. Aligned (align_val_t) allocations are
+ * replaced as well, as one half of a new/delete pair cannot be left to
+ * the standard library once the other half is ours.
+ */
+namespace {
+
+void *alignedMalloc(std::size_t size, std::size_t alignment)
+{
+#ifdef Q_OS_WIN
+    return _aligned_malloc(size, alignment);
+#else
+    /* Not aligned_alloc(): macOS only has it from 10.15 */
+    if (alignment < sizeof(void *))
+        alignment = sizeof(void *);
+    void *p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+void alignedFree(void *p)
+{
+#ifdef Q_OS_WIN
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *countedAlloc(std::size_t size, std::size_t alignment = 0)
+{
+    if (!size)
+        size = 1;
+
+    void *p;
+    while (!(p = alignment ? alignedMalloc(size, alignment) : std::malloc(size)))
+    {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            return nullptr;
+        handler();
+    }
+
+    if (t_counting)
+    {
+        t_allocations++;
+        t_allocatedBytes += size;
+    }
+    return p;
+}
+
+} // namespace
+
+void *operator new(std::size_t size)
+{
+    void *p = countedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    void *p = countedAlloc(size, static_cast<std::size_t>(alignment));
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try {
+        return countedAlloc(size, static_cast<std::size_t>(alignment));
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, alignment, tag);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    alignedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    alignedFree(p);
+}
@@ -0,0 +1,137 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <QString>
+#include <array>
+#include <cstdint>
+
+/**
+ * @brief Resource accounting per pipeline stage
+ *
+ * Pipeline threads mark the work they do with a Scope. While a thread is
+ * inside a scope, its costs accumulate into process-wide per-stage
+ * totals, which PerformanceStats snapshots at the end of each imaging
+ * cycle:
+ *
+ * - Always: thread CPU time, C++ heap allocations (operator new) and,
+ *   on Linux, the thread's minor/major page faults.
+ * - Optionally (setEnabled): hardware counters via perf_event_open
+ *   (Linux only). Each thread opens its own set the first time it
+ *   enters a scope.
+ *
+ * Scopes nest: while an inner scope is active on a thread, the outer
+ * stage is not charged, so stages never double count.
+ *
+ * If the kernel refuses access to hardware counters (perf_event_paranoid,
+ * seccomp, no PMU in a VM) the counters that could not be opened are
+ * reported as unavailable.
+ */
+class PerfCounters
+{
+public:
+    enum class Stage : uint8_t {
+        Download,
+        Decompress,
+        Write,
+        Hash,
+        Verify,
+        CacheWriter,
+        _Count
+    };
+
+    enum class Counter : uint8_t {
+        TaskClockNs,       // CPU time of the thread while in the stage
+        Cycles,
+        Instructions,
+        CacheMisses,       // Last level cache misses
+        BranchMisses,
+        ContextSwitches,
+        PageFaults,
+        _Count
+    };
+
+    enum class Resource : uint8_t {
+        CpuNs,             // CLOCK_THREAD_CPUTIME_ID (GetThreadTimes on Windows)
+        Allocations,       // operator new calls, aligned ones included
+        AllocatedBytes,
+        MinorFaults,       // Linux only (RUSAGE_THREAD)
+        MajorFaults,       // Linux only (RUSAGE_THREAD)
+        _Count
+    };
+
+    static constexpr int StageCount = static_cast<int>(Stage::_Count);
+    static constexpr int CounterCount = static_cast<int>(Counter::_Count);
+    static constexpr int ResourceCount = static_cast<int>(Resource::_Count);
+
+    struct StageValues {
+        std::array<uint64_t, CounterCount> counters{};
+        std::array<uint64_t, ResourceCount> resources{};
+        uint64_t scopes = 0;   // Number of times the stage was entered
+    };
+
+    struct Snapshot {
+        std::array<StageValues, StageCount> stages;
+        uint32_t availableMask = 0;   // Bit per Counter that at least one thread could open
+        QString unavailableReason;    // Why counters are missing, if any are
+    };
+
+    /**
+     * @brief Whole-process memory usage
+     */
+    struct ProcessUsage {
+        uint64_t peakRssBytes = 0;
+        bool peakSinceReset = false;  // False: peak since process start (reset unsupported)
+        uint64_t minorFaults = 0;
+        uint64_t majorFaults = 0;
+    };
+
+    /**
+     * @brief RAII marker for "this thread is now working on stage X"
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(Stage stage);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Stage _previous;
+        bool _hadPrevious;
+    };
+
+    /**
+     * @brief Enable or disable the hardware counters (resource accounting is always on)
+     */
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    /**
+     * @brief Clear the per-stage totals (start of an imaging cycle)
+     */
+    static void reset();
+
+    /**
+     * @brief Current per-stage totals
+     */
+    static Snapshot snapshot();
+
+    /**
+     * @brief Reset the process peak RSS where the OS allows it (Linux clear_refs)
+     */
+    static bool resetPeakRss();
+    static ProcessUsage processUsage();
+
+    static QString stageName(Stage stage);
+    static QString counterName(Counter counter);
+    static QString resourceName(Resource resource);
+};
+
+#endif // PERFCOUNTERS_H
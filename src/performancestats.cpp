@@ -24,6 +24,8 @@ PerformanceStats::PerformanceStats(QObject *parent)
     , _writeTotal(0)
     , _verifyTotal(0)
     , _hasSystemInfo(false)
+    , _hasBlockDeviceInfo(false)
+    , _cycleCount(0)
 {
     std::memset(_phaseStartTimes, 0, sizeof(_phaseStartTimes));
     std::memset(_lastSampleTime, 0, sizeof(_lastSampleTime));
@@ -43,6 +45,21 @@ void PerformanceStats::startSession(const QString &imageName, quint64 imageSize,
         _events.reserve(100);
     }
     
+    CycleInfo info;
+    info.cycle = _cycleCount + 1;
+    info.imageName = imageName;
+    info.deviceName = deviceName;
+    info.imageSize = imageSize;
+    info.firstEvent = _events.size();
+    info.firstSample[0] = _downloadSamples.size();
+    info.firstSample[1] = _decompressSamples.size();
+    info.firstSample[2] = _writeSamples.size();
+    info.firstSample[3] = _verifySamples.size();
+    info.ended = false;
+    info.success = false;
+    info.durationMs = 0;
+    _cycles.append(info);
+    
     // Emit CycleStart event to mark the beginning of a new imaging cycle
     // This allows multiple cycles to be captured and analysed separately
     TimedEvent cycleStartEvent;
@@ -77,6 +94,14 @@ void PerformanceStats::startSession(const QString &imageName, quint64 imageSize,
     
     _hasSystemInfo = false;
     std::memset(&_systemInfo, 0, sizeof(_systemInfo));
+    _hasBlockDeviceInfo = false;
+    
+    // Per-stage accounting is accumulated per cycle
+    _cycleCount++;
+    PerfCounters::reset();
+    PerfCounters::resetPeakRss();
+    _cycleStartUsage = PerfCounters::processUsage();
+    rpi_imager::IoLatencyStats::Instance().Reset();
     
     // Start/restart the session timer for this cycle
     _sessionTimer.start();
@@ -94,6 +119,11 @@ void PerformanceStats::reset()
     // Clear all accumulated data
     _events.clear();
     _pendingEvents.clear();
+    _cycleCounters.clear();
+    _cycles.clear();
+    _cycleCount = 0;
+    _blockDeviceSamples.clear();
+    _hasBlockDeviceInfo = false;
     _downloadSamples.clear();
     _decompressSamples.clear();
     _writeSamples.clear();
@@ -153,6 +183,23 @@ void PerformanceStats::endSession(bool success, const QString &errorMessage)
     cycleEndEvent.bytesTransferred = 0;
     _events.append(cycleEndEvent);
     
+    CycleCounters counters;
+    counters.cycle = _cycleCount;
+    counters.imageBytes = _imageSize;
+    counters.hardwareEnabled = PerfCounters::isEnabled();
+    counters.snapshot = PerfCounters::snapshot();
+    counters.usage = PerfCounters::processUsage();
+    counters.minorFaults = counters.usage.minorFaults - qMin(counters.usage.minorFaults, _cycleStartUsage.minorFaults);
+    counters.majorFaults = counters.usage.majorFaults - qMin(counters.usage.majorFaults, _cycleStartUsage.majorFaults);
+    counters.ioLatency = rpi_imager::IoLatencyStats::Instance().Snap();
+    _cycleCounters.append(counters);
+    
+    if (!_cycles.isEmpty()) {
+        _cycles.last().ended = true;
+        _cycles.last().success = success;
+        _cycles.last().durationMs = static_cast<quint32>(_sessionTimer.elapsed());
+    }
+    
     _sessionEndTime = QDateTime::currentMSecsSinceEpoch();
     _sessionSuccess = success;
     _errorMessage = errorMessage;
@@ -287,6 +334,25 @@ void PerformanceStats::recordVerifyProgress(quint64 bytesVerified, quint64 bytes
     _verifyTotal = bytesTotal;
 }
 
+void PerformanceStats::setBlockDeviceInfo(const BlockDeviceInfo &info)
+{
+    QMutexLocker locker(&_mutex);
+    _blockDeviceInfo = info;
+    _hasBlockDeviceInfo = true;
+}
+
+void PerformanceStats::recordBlockDeviceSample(const BlockDeviceSample &sample)
+{
+    QMutexLocker locker(&_mutex);
+    
+    if (!_sessionActive || _blockDeviceSamples.size() >= MAX_SAMPLES_PER_PHASE)
+        return;
+    
+    BlockDeviceSample s = sample;
+    s.timestampMs = static_cast<uint32_t>(_sessionTimer.elapsed());
+    _blockDeviceSamples.append(s);
+}
+
 void PerformanceStats::recordFinalising()
 {
     QMutexLocker locker(&_mutex);
@@ -381,12 +447,16 @@ QString PerformanceStats::eventTypeName(EventType type)
         case EventType::DriveDiskClean: return "driveDiskClean";
         case EventType::DriveRescan: return "driveRescan";
         case EventType::DriveFormat: return "driveFormat";
+        case EventType::IdentityStamp: return "identityStamp";
+        case EventType::TimeToFirstDeviceByte: return "timeToFirstDeviceByte";
+        case EventType::PipelineStall: return "pipelineStall";
         
         // Cache operations
         case EventType::CacheLookup: return "cacheLookup";
         case EventType::CacheVerification: return "cacheVerification";
         case EventType::CacheWrite: return "cacheWrite";
         case EventType::CacheFlush: return "cacheFlush";
+        case EventType::ChunkStoreRead: return "chunkStoreRead";
         
         // Memory management
         case EventType::MemoryAllocation: return "memoryAllocation";
@@ -398,11 +468,15 @@ QString PerformanceStats::eventTypeName(EventType type)
         case EventType::ImageDecompressInit: return "imageDecompressInit";
         case EventType::ImageExtraction: return "imageExtraction";
         case EventType::HashComputation: return "hashComputation";
+        case EventType::AllocationMap: return "allocationMap";
+        case EventType::ArchiveEntryExtraction: return "archiveEntryExtraction";
         
         // Pipeline timing
         case EventType::PipelineDecompressionTime: return "pipelineDecompressionTime";
         case EventType::PipelineWriteWaitTime: return "pipelineWriteWaitTime";
         case EventType::PipelineRingBufferWaitTime: return "pipelineRingBufferWaitTime";
+        case EventType::InputRingBufferFill: return "inputRingBufferFill";
+        case EventType::DecompressorOutput: return "decompressorOutput";
         case EventType::WriteRingBufferStats: return "writeRingBufferStats";
         
         // Cycle boundaries
@@ -520,22 +594,70 @@ QJsonArray PerformanceStats::buildHistogramForPhase(const QVector<RawSample> &sa
 QJsonObject PerformanceStats::buildHistograms() const
 {
     // Build all histograms - complex processing done only at export
+    // Each cycle is built separately so that buildCycles() can point at its slices
     QJsonObject histograms;
+    const QVector<RawSample> *phases[4] = {&_downloadSamples, &_decompressSamples, &_writeSamples, &_verifySamples};
+    const char *names[4] = {"download", "decompress", "write", "verify"};
     
-    if (!_downloadSamples.isEmpty()) {
-        histograms["download"] = buildHistogramForPhase(_downloadSamples);
-    }
-    if (!_decompressSamples.isEmpty()) {
-        histograms["decompress"] = buildHistogramForPhase(_decompressSamples);
+    for (int p = 0; p < 4; p++) {
+        const QVector<RawSample> &samples = *phases[p];
+        if (samples.isEmpty())
+            continue;
+        
+        QJsonArray slices;
+        for (int c = -1; c < _cycles.size(); c++) {
+            int first = c < 0 ? 0 : _cycles[c].firstSample[p];
+            int end = c + 1 < _cycles.size() ? _cycles[c + 1].firstSample[p] : samples.size();
+            for (const QJsonValue &slice : buildHistogramForPhase(samples.mid(first, end - first)))
+                slices.append(slice);
+        }
+        histograms[names[p]] = slices;
     }
-    if (!_writeSamples.isEmpty()) {
-        histograms["write"] = buildHistogramForPhase(_writeSamples);
+    
+    return histograms;
+}
+
+QJsonArray PerformanceStats::buildCycles() const
+{
+    const QVector<RawSample> *phases[4] = {&_downloadSamples, &_decompressSamples, &_writeSamples, &_verifySamples};
+    const char *names[4] = {"download", "decompress", "write", "verify"};
+    
+    // Slices before the first cycle (if any) come first in the histograms
+    int sliceOffset[4];
+    for (int p = 0; p < 4; p++) {
+        int end = _cycles.isEmpty() ? phases[p]->size() : _cycles.first().firstSample[p];
+        sliceOffset[p] = buildHistogramForPhase(phases[p]->mid(0, end)).size();
     }
-    if (!_verifySamples.isEmpty()) {
-        histograms["verify"] = buildHistogramForPhase(_verifySamples);
+    
+    QJsonArray cycles;
+    for (int c = 0; c < _cycles.size(); c++) {
+        const CycleInfo &info = _cycles[c];
+        int lastEvent = c + 1 < _cycles.size() ? _cycles[c + 1].firstEvent : _events.size();
+        
+        // [first, end) ranges into "events" and each phase of "histograms"
+        QJsonObject slices;
+        for (int p = 0; p < 4; p++) {
+            int end = c + 1 < _cycles.size() ? _cycles[c + 1].firstSample[p] : phases[p]->size();
+            int count = buildHistogramForPhase(phases[p]->mid(info.firstSample[p], end - info.firstSample[p])).size();
+            if (count)
+                slices[names[p]] = QJsonArray({sliceOffset[p], sliceOffset[p] + count});
+            sliceOffset[p] += count;
+        }
+        
+        QJsonObject cycle;
+        cycle["cycle"] = info.cycle;
+        cycle["imageName"] = info.imageName;
+        cycle["deviceName"] = info.deviceName;
+        cycle["imageSize"] = static_cast<qint64>(info.imageSize);
+        cycle["ended"] = info.ended;
+        cycle["success"] = info.success;
+        cycle["durationMs"] = static_cast<qint64>(info.durationMs);
+        cycle["events"] = QJsonArray({info.firstEvent, lastEvent});
+        cycle["histograms"] = slices;
+        cycles.append(cycle);
     }
     
-    return histograms;
+    return cycles;
 }
 
 QJsonObject PerformanceStats::buildSummary() const
@@ -635,6 +757,232 @@ QJsonObject PerformanceStats::buildSummary() const
     return summary;
 }
 
+QJsonObject PerformanceStats::buildHardwareCounters() const
+{
+    QJsonObject result;
+    
+    // Availability as seen by the most recent cycle (or now, if none has ended yet)
+    PerfCounters::Snapshot latest = PerfCounters::snapshot();
+    for (const CycleCounters &c : _cycleCounters) {
+        if (c.hardwareEnabled)
+            latest = c.snapshot;
+    }
+    QJsonArray available;
+    for (int i = 0; i < PerfCounters::CounterCount; i++) {
+        if (latest.availableMask & (1u << i))
+            available.append(PerfCounters::counterName(static_cast<PerfCounters::Counter>(i)));
+    }
+    result["available"] = available;
+    if (!latest.unavailableReason.isEmpty())
+        result["unavailableReason"] = latest.unavailableReason;
+    
+    QJsonArray cycles;
+    for (const CycleCounters &c : _cycleCounters) {
+        if (!c.hardwareEnabled)
+            continue;
+        
+        QJsonObject stages;
+        for (int s = 0; s < PerfCounters::StageCount; s++) {
+            const PerfCounters::StageValues &v = c.snapshot.stages[s];
+            if (!v.scopes)
+                continue;
+            
+            QJsonObject stage;
+            stage["scopes"] = static_cast<qint64>(v.scopes);
+            for (int i = 0; i < PerfCounters::CounterCount; i++) {
+                if (c.snapshot.availableMask & (1u << i))
+                    stage[PerfCounters::counterName(static_cast<PerfCounters::Counter>(i))] = static_cast<qint64>(v.counters[i]);
+            }
+            
+            // Derived ratios, only where both sides were counted
+            auto has = [&c](PerfCounters::Counter counter) {
+                return (c.snapshot.availableMask & (1u << static_cast<int>(counter))) != 0;
+            };
+            auto value = [&v](PerfCounters::Counter counter) {
+                return static_cast<double>(v.counters[static_cast<int>(counter)]);
+            };
+            double instructions = value(PerfCounters::Counter::Instructions);
+            if (has(PerfCounters::Counter::Instructions) && instructions > 0) {
+                if (has(PerfCounters::Counter::Cycles) && value(PerfCounters::Counter::Cycles) > 0)
+                    stage["ipc"] = instructions / value(PerfCounters::Counter::Cycles);
+                if (has(PerfCounters::Counter::CacheMisses))
+                    stage["cacheMissesPerKiloInstruction"] = value(PerfCounters::Counter::CacheMisses) * 1000.0 / instructions;
+                if (has(PerfCounters::Counter::BranchMisses))
+                    stage["branchMissesPerKiloInstruction"] = value(PerfCounters::Counter::BranchMisses) * 1000.0 / instructions;
+            }
+            
+            stages[PerfCounters::stageName(static_cast<PerfCounters::Stage>(s))] = stage;
+        }
+        
+        QJsonObject cycle;
+        cycle["cycle"] = c.cycle;
+        cycle["stages"] = stages;
+        cycles.append(cycle);
+    }
+    result["cycles"] = cycles;
+    
+    return result;
+}
+
+QJsonArray PerformanceStats::buildResourceUsage() const
+{
+    QJsonArray cycles;
+    for (const CycleCounters &c : _cycleCounters) {
+        // Normalised per GB (10^9 bytes) of image, so cycles of different images compare
+        double gb = c.imageBytes / 1e9;
+        
+        QJsonObject stages;
+        for (int s = 0; s < PerfCounters::StageCount; s++) {
+            const PerfCounters::StageValues &v = c.snapshot.stages[s];
+            if (!v.scopes)
+                continue;
+            
+            auto value = [&v](PerfCounters::Resource resource) {
+                return v.resources[static_cast<int>(resource)];
+            };
+            
+            QJsonObject stage;
+            stage["cpuMs"] = static_cast<qint64>(value(PerfCounters::Resource::CpuNs) / 1000000);
+            stage["allocations"] = static_cast<qint64>(value(PerfCounters::Resource::Allocations));
+            stage["allocatedBytes"] = static_cast<qint64>(value(PerfCounters::Resource::AllocatedBytes));
+#ifdef Q_OS_LINUX
+            stage["minorFaults"] = static_cast<qint64>(value(PerfCounters::Resource::MinorFaults));
+            stage["majorFaults"] = static_cast<qint64>(value(PerfCounters::Resource::MajorFaults));
+#endif
+            if (gb > 0) {
+                stage["cpuSecondsPerGB"] = value(PerfCounters::Resource::CpuNs) / 1e9 / gb;
+                stage["allocationsPerGB"] = value(PerfCounters::Resource::Allocations) / gb;
+                stage["allocatedBytesPerGB"] = value(PerfCounters::Resource::AllocatedBytes) / gb;
+            }
+            stages[PerfCounters::stageName(static_cast<PerfCounters::Stage>(s))] = stage;
+        }
+        
+        QJsonObject cycle;
+        cycle["cycle"] = c.cycle;
+        cycle["imageBytes"] = static_cast<qint64>(c.imageBytes);
+        cycle["peakRssBytes"] = static_cast<qint64>(c.usage.peakRssBytes);
+        // Without a reset the peak may stem from before this cycle
+        cycle["peakRssSinceCycleStart"] = c.usage.peakSinceReset;
+        cycle["minorFaults"] = static_cast<qint64>(c.minorFaults);
+        cycle["majorFaults"] = static_cast<qint64>(c.majorFaults);
+        cycle["stages"] = stages;
+        cycles.append(cycle);
+    }
+    
+    return cycles;
+}
+
+QJsonArray PerformanceStats::buildIoLatency() const
+{
+    using rpi_imager::IoLatencyStats;
+    using rpi_imager::LatencyHistogram;
+    
+    QJsonArray cycles;
+    for (const CycleCounters &c : _cycleCounters) {
+        QJsonObject operations;
+        for (int op = 0; op < IoLatencyStats::kOperationCount; op++) {
+            QJsonObject phases;
+            for (int phase = 0; phase < IoLatencyStats::kPhaseCount; phase++) {
+                const LatencyHistogram::Snapshot &h = c.ioLatency[op][phase];
+                if (!h.count)
+                    continue;
+                
+                // Only occupied buckets: [lowerUs, upperUs, count]
+                QJsonArray buckets;
+                for (int i = 0; i < static_cast<int>(h.counts.size()); i++) {
+                    if (!h.counts[i])
+                        continue;
+                    buckets.append(QJsonArray({
+                        static_cast<qint64>(LatencyHistogram::BucketLowerBound(i)),
+                        static_cast<qint64>(LatencyHistogram::BucketUpperBound(i)),
+                        static_cast<qint64>(h.counts[i])
+                    }));
+                }
+                
+                QJsonObject stats;
+                stats["count"] = static_cast<qint64>(h.count);
+                stats["meanUs"] = h.MeanUs();
+                stats["p50Us"] = static_cast<qint64>(h.ValueAtPercentile(50.0));
+                stats["p90Us"] = static_cast<qint64>(h.ValueAtPercentile(90.0));
+                stats["p99Us"] = static_cast<qint64>(h.ValueAtPercentile(99.0));
+                stats["p999Us"] = static_cast<qint64>(h.ValueAtPercentile(99.9));
+                stats["maxUs"] = static_cast<qint64>(h.max_us);
+                stats["buckets"] = buckets;
+                phases[IoLatencyStats::PhaseName(static_cast<rpi_imager::IoPhase>(phase))] = stats;
+            }
+            if (!phases.isEmpty())
+                operations[IoLatencyStats::OperationName(static_cast<rpi_imager::IoOperation>(op))] = phases;
+        }
+        
+        QJsonObject cycle;
+        cycle["cycle"] = c.cycle;
+        cycle["operations"] = operations;
+        cycles.append(cycle);
+    }
+    
+    return cycles;
+}
+
+QJsonObject PerformanceStats::buildBlockDevice() const
+{
+    QJsonObject result;
+    
+    if (_hasBlockDeviceInfo) {
+        QJsonObject info;
+        info["name"] = _blockDeviceInfo.name;
+        info["nrRequests"] = _blockDeviceInfo.nrRequests;
+        info["maxSectorsKb"] = _blockDeviceInfo.maxSectorsKb;
+        info["maxHwSectorsKb"] = _blockDeviceInfo.maxHwSectorsKb;
+        info["rotational"] = _blockDeviceInfo.rotational;
+        info["scheduler"] = _blockDeviceInfo.scheduler;
+        if (_blockDeviceInfo.usbSpeedMbps > 0) {
+            info["usbSpeedMbps"] = _blockDeviceInfo.usbSpeedMbps;
+            info["usbVersion"] = _blockDeviceInfo.usbVersion;
+        }
+        result["info"] = info;
+    }
+    
+    // One slice per pair of consecutive samples. Samples from different cycles
+    // are not paired, as the session timer restarts with each cycle.
+    QJsonArray slices;
+    for (int i = 1; i < _blockDeviceSamples.size(); ++i) {
+        const BlockDeviceSample &prev = _blockDeviceSamples[i - 1];
+        const BlockDeviceSample &curr = _blockDeviceSamples[i];
+        if (curr.timestampMs <= prev.timestampMs || curr.writeIos < prev.writeIos || curr.readIos < prev.readIos)
+            continue;
+        
+        double seconds = (curr.timestampMs - prev.timestampMs) / 1000.0;
+        uint64_t writeIos = curr.writeIos - prev.writeIos;
+        uint64_t writeBytes = (curr.writeSectors - prev.writeSectors) * 512;
+        uint64_t readIos = curr.readIos - prev.readIos;
+        uint64_t readBytes = (curr.readSectors - prev.readSectors) * 512;
+        
+        QJsonArray slice;
+        slice.append(static_cast<qint64>(curr.timestampMs));
+        slice.append(qRound(writeIos / seconds));
+        slice.append(qRound((curr.writeMerges - prev.writeMerges) / seconds));
+        slice.append(writeIos ? qRound(writeBytes / 1024.0 / writeIos) : 0);
+        slice.append(qRound(writeBytes / 1024.0 / seconds));
+        slice.append(writeIos ? (curr.writeTicksMs - prev.writeTicksMs) / static_cast<double>(writeIos) : 0.0);
+        slice.append(static_cast<qint64>(curr.inflightWrites));
+        slice.append(qRound(readIos / seconds));
+        slice.append(readIos ? qRound(readBytes / 1024.0 / readIos) : 0);
+        slice.append(qRound(readBytes / 1024.0 / seconds));
+        slice.append(static_cast<qint64>(curr.inflightReads));
+        slice.append(qMin(100.0, (curr.ioTicksMs - prev.ioTicksMs) / (seconds * 10.0)));
+        slice.append((curr.timeInQueueMs - prev.timeInQueueMs) / (seconds * 1000.0));
+        slices.append(slice);
+    }
+    result["samples"] = slices;
+    result["sliceFormat"] = QJsonArray({
+        "timestampMs", "writeIops", "writeMergesPerSec", "avgWriteRequestKB", "writeKBps",
+        "avgWriteLatencyMs", "inflightWrites", "readIops", "avgReadRequestKB", "readKBps",
+        "inflightReads", "utilisationPct", "avgQueueDepth"
+    });
+    
+    return result;
+}
+
 QJsonDocument PerformanceStats::exportToJson() const
 {
     QMutexLocker locker(&_mutex);
@@ -720,6 +1068,19 @@ QJsonDocument PerformanceStats::exportToJson() const
     
     // Build time-series histograms (complex processing)
     root["histograms"] = buildHistograms();
+    root["cycles"] = buildCycles();
+    
+    root["resourceUsage"] = buildResourceUsage();
+    root["ioLatency"] = buildIoLatency();
+    
+    if (_hasBlockDeviceInfo || !_blockDeviceSamples.isEmpty())
+        root["blockDevice"] = buildBlockDevice();
+    
+    bool anyHardwareCounters = PerfCounters::isEnabled();
+    for (const CycleCounters &c : _cycleCounters)
+        anyHardwareCounters |= c.hardwareEnabled;
+    if (anyHardwareCounters)
+        root["hardwareCounters"] = buildHardwareCounters();
     
     // Schema for parsing
     QJsonObject schema;
@@ -731,6 +1092,7 @@ QJsonDocument PerformanceStats::exportToJson() const
     });
     schema["histogramWindowMs"] = HISTOGRAM_WINDOW_MS;
     schema["throughputUnit"] = "KB/s";
+    schema["ioLatencyBucketFormat"] = QJsonArray({"lowerUs", "upperUs", "count"});
     root["schema"] = schema;
     
     return QJsonDocument(root);
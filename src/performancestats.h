@@ -16,6 +16,8 @@
 #include <QMap>
 #include <QMutex>
 #include <array>
+#include "io_latency.h"
+#include "perfcounters.h"
 
 /**
  * @brief Lightweight performance data capture for all imaging operations
@@ -26,6 +28,9 @@
  * Captures:
  * - Discrete events: OS list fetch, drive open, customisation, etc.
  * - Raw progress samples: Timestamp + bytes (processing deferred to export)
+ * - Raw block-layer counters of the target device (Linux), on the same timeline
+ * - Per-stage CPU time and allocations, plus optional hardware counters
+ *   (see PerfCounters), one snapshot per cycle
  */
 class PerformanceStats : public QObject
 {
@@ -52,12 +57,16 @@ public:
         DriveDiskClean,        // Time to clean disk/remove partitions (Windows)
         DriveRescan,           // Time to rescan disk after cleaning (Windows)
         DriveFormat,           // Time to format drive (for multi-file zips)
+        IdentityStamp,         // On-card identity stamp check (before writing) or write (finalisation)
+        TimeToFirstDeviceByte, // From thread start until the first image data goes to the device
+        PipelineStall,         // Stall watchdog intervention, or end of a stall
         
         // Cache operations
         CacheLookup,           // Time to look up file in cache
         CacheVerification,     // Time to verify cached file hash
         CacheWrite,            // Time to write data to cache file
         CacheFlush,            // Time to flush cache to disk
+        ChunkStoreRead,        // Image read from the chunk store (readahead stalls, dedup ratio)
         
         // Memory management
         MemoryAllocation,      // Time for large memory allocations
@@ -69,11 +78,15 @@ public:
         ImageDecompressInit,   // Time to initialise decompression
         ImageExtraction,       // Time for archive extraction setup
         HashComputation,       // Time spent on hash computations
+        AllocationMap,         // Filesystem-derived allocation map (parse time, bytes skipped)
+        ArchiveEntryExtraction,// Per-entry extraction time (parallel multi-file zip extraction)
         
         // Pipeline timing (summary events emitted at end of extraction)
         PipelineDecompressionTime, // Total time spent in libarchive decompression
         PipelineWriteWaitTime,     // Total time blocked waiting for disk writes
         PipelineRingBufferWaitTime,// Total time waiting for ring buffer data (input buffer)
+        InputRingBufferFill,       // How full input ring buffer slots were when committed
+        DecompressorOutput,        // Decompressed data written in place versus copied
         WriteRingBufferStats,      // Write ring buffer stall statistics (decompress->write)
         
         // Cycle boundaries (for multi-write sessions)
@@ -162,6 +175,40 @@ public:
         QString qtBuildVersion;         // Qt version used at compile time
     };
 
+    /**
+     * @brief Raw block-layer counters of the target device (/sys/block/<dev>/stat and inflight)
+     * Rates, request sizes and utilisation are derived at export time
+     */
+    struct BlockDeviceSample {
+        uint32_t timestampMs;      // Set by recordBlockDeviceSample()
+        uint64_t readIos;
+        uint64_t readMerges;
+        uint64_t readSectors;      // 512-byte units, regardless of the device's sector size
+        uint64_t readTicksMs;
+        uint64_t writeIos;
+        uint64_t writeMerges;
+        uint64_t writeSectors;
+        uint64_t writeTicksMs;
+        uint64_t ioTicksMs;        // Time the device had I/O in flight
+        uint64_t timeInQueueMs;    // Weighted by the number of requests in flight
+        uint32_t inflightReads;
+        uint32_t inflightWrites;
+    };
+
+    /**
+     * @brief Queue settings and link of the target device
+     */
+    struct BlockDeviceInfo {
+        QString name;              // e.g. "sdb", "mmcblk0"
+        int nrRequests;
+        int maxSectorsKb;
+        int maxHwSectorsKb;
+        bool rotational;
+        QString scheduler;         // Active I/O scheduler
+        int usbSpeedMbps;          // 0 if not attached via USB
+        QString usbVersion;
+    };
+
     explicit PerformanceStats(QObject *parent = nullptr);
     ~PerformanceStats() = default;
 
@@ -251,6 +298,16 @@ public:
      */
     void recordVerifyProgress(quint64 bytesVerified, quint64 bytesTotal);
     
+    /**
+     * @brief Set the target device's block-layer settings for the current cycle
+     */
+    void setBlockDeviceInfo(const BlockDeviceInfo &info);
+    
+    /**
+     * @brief Record block-layer counters of the target device (lightweight - just stores raw sample)
+     */
+    void recordBlockDeviceSample(const BlockDeviceSample &sample);
+    
     /**
      * @brief Mark operation as finalising
      */
@@ -300,6 +357,11 @@ private:
     QJsonObject buildSummary() const;
     QJsonObject buildHistograms() const;
     QJsonArray buildHistogramForPhase(const QVector<RawSample> &samples) const;
+    QJsonObject buildHardwareCounters() const;
+    QJsonArray buildResourceUsage() const;
+    QJsonArray buildIoLatency() const;
+    QJsonArray buildCycles() const;
+    QJsonObject buildBlockDevice() const;
     int getThroughputBucket(uint32_t kbps) const;
     
     mutable QMutex _mutex;
@@ -345,8 +407,42 @@ private:
     quint64 _writeTotal;
     quint64 _verifyTotal;
 
+    // Block-layer samples of the target device
+    BlockDeviceInfo _blockDeviceInfo;
+    bool _hasBlockDeviceInfo;
+    QVector<BlockDeviceSample> _blockDeviceSamples;
+
     // Rate limiting state
     qint64 _lastSampleTime[4];  // Per-phase last sample time (download, decompress, write, verify)
+
+    // Per-stage accounting, captured at the end of each cycle
+    struct CycleCounters {
+        int cycle;
+        quint64 imageBytes;
+        bool hardwareEnabled;          // Snapshot includes hardware counters
+        PerfCounters::Snapshot snapshot;
+        PerfCounters::ProcessUsage usage;
+        quint64 minorFaults;           // Whole process, during the cycle
+        quint64 majorFaults;
+        rpi_imager::IoLatencyStats::Snapshot ioLatency;
+    };
+    QVector<CycleCounters> _cycleCounters;
+
+    // Where each cycle starts in the event and sample vectors, so exports can be split per cycle
+    struct CycleInfo {
+        int cycle;
+        QString imageName;
+        QString deviceName;
+        quint64 imageSize;
+        int firstEvent;
+        int firstSample[4];         // download, decompress, write, verify
+        bool ended;
+        bool success;
+        quint32 durationMs;
+    };
+    QVector<CycleInfo> _cycles;
+    PerfCounters::ProcessUsage _cycleStartUsage;
+    int _cycleCount;
 };
 
 #endif // PERFORMANCESTATS_H
@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "pipelinewatchdog.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+PipelineWatchdog::PipelineWatchdog(QObject *parent)
+    : QThread(parent)
+    , _stopRequested(false)
+{
+}
+
+PipelineWatchdog::~PipelineWatchdog()
+{
+    stop();
+}
+
+void PipelineWatchdog::setProbe(Stage stage, const Probe &probe)
+{
+    _probes[static_cast<int>(stage)] = probe;
+}
+
+void PipelineWatchdog::setRemedy(const Remedy &remedy)
+{
+    _remedy = remedy;
+}
+
+void PipelineWatchdog::setEventHandler(const EventHandler &handler)
+{
+    _eventHandler = handler;
+}
+
+void PipelineWatchdog::stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopRequested = true;
+        _stopCondition.wakeAll();
+    }
+    wait();
+}
+
+QString PipelineWatchdog::stageName(Stage stage)
+{
+    switch (stage) {
+        case Stage::Download: return "download";
+        case Stage::Decompress: return "decompress";
+        case Stage::Write: return "write";
+        case Stage::Verify: return "verify";
+        default: return "unknown";
+    }
+}
+
+qint64 PipelineWatchdog::_threshold(const StageState &state) const
+{
+    return qBound(MinStallMs, static_cast<qint64>(state.typicalGapMs * GapFactor), MaxStallMs);
+}
+
+void PipelineWatchdog::run()
+{
+    QElapsedTimer clock;
+    clock.start();
+
+    for (int s = 0; s < StageCount; s++) {
+        if (_probes[s].progress)
+            _states[s].lastValue = _probes[s].progress();
+    }
+
+    QMutexLocker locker(&_mutex);
+    while (!_stopRequested) {
+        _stopCondition.wait(&_mutex, PollIntervalMs);
+        if (_stopRequested)
+            break;
+
+        locker.unlock();
+        for (int s = 0; s < StageCount; s++) {
+            if (_probes[s].progress && _probes[s].busy)
+                _check(s, clock.elapsed());
+        }
+        locker.relock();
+    }
+}
+
+void PipelineWatchdog::_check(int stage, qint64 nowMs)
+{
+    StageState &state = _states[stage];
+    const Stage s = static_cast<Stage>(stage);
+    quint64 value = _probes[stage].progress();
+    bool busy = _probes[stage].busy();
+
+    if (value != state.lastValue || !busy) {
+        qint64 gapMs = nowMs - state.lastProgressMs;
+        if (state.level) {
+            QString metadata = QString("stage: %1; recovered: yes; level: %2")
+                                   .arg(stageName(s))
+                                   .arg(state.level);
+            qDebug() << "Pipeline watchdog:" << metadata << "after" << gapMs << "ms";
+            if (_eventHandler)
+                _eventHandler(static_cast<quint32>(gapMs), metadata);
+        } else if (value != state.lastValue && state.lastProgressMs) {
+            // Learn the normal interval from stall-free progress only
+            state.typicalGapMs = 0.8 * state.typicalGapMs + 0.2 * gapMs;
+        }
+        state.lastValue = value;
+        state.lastProgressMs = nowMs;
+        state.level = 0;
+        return;
+    }
+
+    // Busy without progress: escalate once per threshold the stall lasts
+    qint64 stalledMs = nowMs - state.lastProgressMs;
+    qint64 threshold = _threshold(state);
+    if (stalledMs < threshold * (state.level + 1))
+        return;
+
+    state.level++;
+    QString action = _remedy ? _remedy(s, state.level) : QString();
+    QString metadata = QString("stage: %1; level: %2; threshold_ms: %3; remedy: %4")
+                           .arg(stageName(s))
+                           .arg(state.level)
+                           .arg(threshold)
+                           .arg(action.isEmpty() ? "none" : action);
+    qDebug() << "Pipeline watchdog: stall," << metadata << "stalled for" << stalledMs << "ms";
+    if (_eventHandler)
+        _eventHandler(static_cast<quint32>(stalledMs), metadata);
+}
@@ -0,0 +1,104 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef PIPELINEWATCHDOG_H
+#define PIPELINEWATCHDOG_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <functional>
+
+/**
+ * @brief Watches the write pipeline for stalls and escalates remedies
+ *
+ * Each stage (download, decompress, write, verify) is described by a
+ * probe: a monotonic progress counter and whether the stage is currently
+ * expected to make progress (i.e. it is not waiting on another stage).
+ *
+ * The expected interval between progress is learned per stage while it
+ * runs normally. A stage that is busy but makes no progress for several
+ * times that interval (bounded to a few seconds either way) is stalled.
+ * The remedy callback is then invoked with an escalating level, once per
+ * further threshold the stall lasts. Every intervention, and the end of
+ * every stall, is reported through the event callback.
+ */
+class PipelineWatchdog : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum class Stage {
+        Download,
+        Decompress,
+        Write,
+        Verify,
+        _Count
+    };
+
+    struct Probe {
+        std::function<quint64()> progress;   // Monotonic, e.g. bytes done
+        std::function<bool()> busy;          // False while the stage is idle or waiting on another stage
+    };
+
+    // Apply the remedy for this escalation level (1, 2, ...). Returns what was done, empty if nothing
+    using Remedy = std::function<QString(Stage stage, int level)>;
+    using EventHandler = std::function<void(quint32 stalledMs, const QString &metadata)>;
+
+    // Sets a busy flag for the lifetime of the scope
+    class BusyScope {
+    public:
+        explicit BusyScope(std::atomic<bool> &flag) : _flag(flag) { _flag = true; }
+        ~BusyScope() { _flag = false; }
+    private:
+        std::atomic<bool> &_flag;
+    };
+
+    explicit PipelineWatchdog(QObject *parent = nullptr);
+    ~PipelineWatchdog();
+
+    // Configure before start()
+    void setProbe(Stage stage, const Probe &probe);
+    void setRemedy(const Remedy &remedy);
+    void setEventHandler(const EventHandler &handler);
+
+    void stop();
+
+    static QString stageName(Stage stage);
+
+protected:
+    void run() override;
+
+private:
+    static constexpr int StageCount = static_cast<int>(Stage::_Count);
+    static constexpr int PollIntervalMs = 250;
+    static constexpr qint64 MinStallMs = 5000;
+    static constexpr qint64 MaxStallMs = 15000;
+    static constexpr double GapFactor = 8.0;    // Stall after this many typical intervals without progress
+
+    struct StageState {
+        quint64 lastValue = 0;
+        qint64 lastProgressMs = 0;
+        double typicalGapMs = MinStallMs / GapFactor;
+        int level = 0;               // 0: not stalled
+    };
+
+    void _check(int stage, qint64 nowMs);
+    qint64 _threshold(const StageState &state) const;
+
+    std::array<Probe, StageCount> _probes;
+    std::array<StageState, StageCount> _states;
+    Remedy _remedy;
+    EventHandler _eventHandler;
+
+    QMutex _mutex;
+    QWaitCondition _stopCondition;
+    bool _stopRequested;
+};
+
+#endif // PIPELINEWATCHDOG_H
@@ -7,10 +7,40 @@
 #include <QtGlobal>
 #include <chrono>
 
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace {
+    size_t systemPageSize()
+    {
+#ifdef Q_OS_WIN
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+}
+
 RingBuffer::RingBuffer(size_t numSlots, size_t slotSize, size_t alignment)
     : _numSlots(numSlots)
     , _slotSize(slotSize)
     , _alignment(alignment)
+    , _region(nullptr)
+    , _regionSize(0)
+    , _slotStride(0)
+    , _committedBytes(0)
+    , _peakCommittedBytes(0)
+    , _reclaimedSlots(0)
+    , _occupancyWindowStart(std::chrono::steady_clock::now())
+    , _windowPeakOccupancy(0)
+    , _underOccupied(false)
     , _writeIndex(0)
     , _readIndex(0)
     , _committedCount(0)
@@ -21,30 +51,39 @@ RingBuffer::RingBuffer(size_t numSlots, size_t slotSize, size_t alignment)
     , _consumerStalls(0)
     , _producerWaitMs(0)
     , _consumerWaitMs(0)
+    , _slotsCommitted(0)
+    , _bytesCommitted(0)
     , _sessionTimer(nullptr)
 {
     _slots.resize(numSlots);
-    _memory.reserve(numSlots);
+    _slotCommitted.assign(numSlots, 0);
+    
+    // Reserve address space for all slots at once. Nothing is backed by memory
+    // until a slot is first used, so a ring that never fills never costs its full size
+    // The region is page aligned, which is all direct I/O needs
+    size_t granularity = qMax(alignment, systemPageSize());
+    Q_ASSERT(granularity == systemPageSize() || granularity <= 65536);
+    _slotStride = (slotSize + granularity - 1) / granularity * granularity;
+    _regionSize = numSlots * _slotStride;
+#ifdef Q_OS_WIN
+    // Reservations are 64 KB aligned, which covers any alignment asked for here
+    _region = static_cast<char*>(VirtualAlloc(nullptr, _regionSize, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    void* mem = mmap(nullptr, _regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    _region = mem == MAP_FAILED ? nullptr : static_cast<char*>(mem);
+#endif
+    if (!_region) {
+        qDebug() << "RingBuffer: Failed to reserve" << _regionSize / (1024 * 1024) << "MB of address space";
+        throw std::bad_alloc();
+    }
     
-    // Pre-allocate aligned memory for each slot
     for (size_t i = 0; i < numSlots; ++i) {
-        char* mem = static_cast<char*>(qMallocAligned(slotSize, alignment));
-        if (!mem) {
-            qDebug() << "RingBuffer: Failed to allocate slot" << i;
-            // Clean up already allocated
-            for (char* ptr : _memory) {
-                qFreeAligned(ptr);
-            }
-            _memory.clear();
-            throw std::bad_alloc();
-        }
-        _memory.push_back(mem);
-        _slots[i].data = mem;
+        _slots[i].data = _region + i * _slotStride;
         _slots[i].capacity = slotSize;
         _slots[i].size = 0;
     }
     
-    qDebug() << "RingBuffer: Allocated" << numSlots << "slots of" 
+    qDebug() << "RingBuffer: Reserved" << numSlots << "slots of" 
              << slotSize / 1024 << "KB each (" << (numSlots * slotSize) / (1024 * 1024) << "MB total)";
 }
 
@@ -69,11 +108,78 @@ RingBuffer::~RingBuffer()
         }
     }
     
-    // Free all allocated memory
-    for (char* ptr : _memory) {
-        qFreeAligned(ptr);
+    if (_slotsCommitted > 0) {
+        qDebug() << "RingBuffer fill:" << _slotsCommitted.load() << "slots,"
+                 << (_bytesCommitted * 100) / (_slotsCommitted * _slotSize) << "% full on average";
+        qDebug() << "RingBuffer memory: peak" << _peakCommittedBytes.load() / (1024 * 1024) << "MB committed of"
+                 << _regionSize / (1024 * 1024) << "MB reserved," << _reclaimedSlots.load() << "slots reclaimed";
+    }
+    
+#ifdef Q_OS_WIN
+    VirtualFree(_region, 0, MEM_RELEASE);
+#else
+    munmap(_region, _regionSize);
+#endif
+    _region = nullptr;
+}
+
+bool RingBuffer::_commitSlot(size_t index)
+{
+    if (_slotCommitted[index])
+        return true;
+    
+#ifdef Q_OS_WIN
+    if (!VirtualAlloc(_slots[index].data, _slotStride, MEM_COMMIT, PAGE_READWRITE)) {
+        qDebug() << "RingBuffer: Failed to commit slot" << index << "error" << GetLastError();
+        return false;
+    }
+#endif
+    // Elsewhere the pages are backed by the kernel as they are first touched
+    
+    _slotCommitted[index] = 1;
+    uint64_t committed = (_committedBytes += _slotStride);
+    uint64_t peak = _peakCommittedBytes;
+    while (committed > peak && !_peakCommittedBytes.compare_exchange_weak(peak, committed)) {
     }
-    _memory.clear();
+    return true;
+}
+
+void RingBuffer::_decommitSlot(size_t index)
+{
+    if (!_slotCommitted[index])
+        return;
+    
+#ifdef Q_OS_WIN
+    VirtualFree(_slots[index].data, _slotStride, MEM_DECOMMIT);
+#else
+    // MADV_FREE lets the kernel take the pages only when it needs them, and costs
+    // nothing if the slot is reused first. Older kernels only know MADV_DONTNEED
+#ifdef MADV_FREE
+    if (madvise(_slots[index].data, _slotStride, MADV_FREE) != 0 && errno == EINVAL)
+#endif
+        madvise(_slots[index].data, _slotStride, MADV_DONTNEED);
+#endif
+    
+    _slotCommitted[index] = 0;
+    _committedBytes -= _slotStride;
+    _reclaimedSlots++;
+}
+
+/* Whether the ring has stayed mostly empty over the last full window. Then the network
+   is the bottleneck, and slots are given back as they are released */
+bool RingBuffer::_shouldReclaim()
+{
+    if (_numSlots < RECLAIM_MIN_SLOTS)
+        return false;
+    
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (now - _occupancyWindowStart >= std::chrono::milliseconds(RECLAIM_WINDOW_MS)) {
+        _underOccupied = _windowPeakOccupancy * RECLAIM_OCCUPANCY_DIVISOR <= _numSlots;
+        _occupancyWindowStart = now;
+        _windowPeakOccupancy = _numSlots - _availableCount;
+    }
+    return _underOccupied;
 }
 
 RingBuffer::Slot* RingBuffer::acquireWriteSlot(int timeoutMs)
@@ -126,6 +232,14 @@ RingBuffer::Slot* RingBuffer::acquireWriteSlot(int timeoutMs)
     // Advance write index and decrement available count
     _writeIndex++;
     _availableCount--;
+    _windowPeakOccupancy = qMax(_windowPeakOccupancy, _numSlots - _availableCount);
+    lock.unlock();
+    
+    // The slot is ours now: back it with memory outside the lock
+    if (!_commitSlot(index)) {
+        returnWriteSlot(slot);
+        return nullptr;
+    }
     
     return slot;
 }
@@ -135,6 +249,8 @@ void RingBuffer::commitWriteSlot(Slot* slot, size_t dataSize)
     if (!slot) return;
     
     slot->size = dataSize;
+    _slotsCommitted++;
+    _bytesCommitted += dataSize;
     
     {
         std::lock_guard<std::mutex> lock(_mutex);
@@ -145,6 +261,21 @@ void RingBuffer::commitWriteSlot(Slot* slot, size_t dataSize)
     _readAvailable.notify_one();
 }
 
+void RingBuffer::returnWriteSlot(Slot* slot)
+{
+    if (!slot) return;
+    
+    slot->size = 0;
+    
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _writeIndex--;
+        _availableCount++;
+    }
+    
+    _writeAvailable.notify_one();
+}
+
 RingBuffer::Slot* RingBuffer::acquireReadSlot(int timeoutMs)
 {
     std::unique_lock<std::mutex> lock(_mutex);
@@ -216,6 +347,11 @@ void RingBuffer::releaseReadSlot(Slot* slot)
     
     slot->size = 0;  // Reset size
     
+    // Still ours until counted as available again
+    if (_shouldReclaim()) {
+        _decommitSlot(static_cast<size_t>(slot - _slots.data()));
+    }
+    
     {
         std::lock_guard<std::mutex> lock(_mutex);
         _availableCount++;
@@ -276,6 +412,8 @@ void RingBuffer::reset()
     _consumerStalls = 0;
     _producerWaitMs = 0;
     _consumerWaitMs = 0;
+    _slotsCommitted = 0;
+    _bytesCommitted = 0;
     
     // Reset all slot sizes
     for (auto& slot : _slots) {
@@ -292,6 +430,21 @@ void RingBuffer::getStarvationStats(uint64_t& producerStalls, uint64_t& consumer
     totalConsumerWaitMs = _consumerWaitMs.load();
 }
 
+void RingBuffer::getFillStats(uint64_t& slotsCommitted, uint64_t& bytesCommitted) const
+{
+    slotsCommitted = _slotsCommitted.load();
+    bytesCommitted = _bytesCommitted.load();
+}
+
+void RingBuffer::getMemoryStats(uint64_t& reservedBytes, uint64_t& committedBytes,
+                                uint64_t& peakCommittedBytes, uint64_t& reclaimedSlots) const
+{
+    reservedBytes = _regionSize;
+    committedBytes = _committedBytes.load();
+    peakCommittedBytes = _peakCommittedBytes.load();
+    reclaimedSlots = _reclaimedSlots.load();
+}
+
 std::vector<RingBuffer::StallEvent> RingBuffer::getPendingStallEvents()
 {
     std::lock_guard<std::mutex> lock(_stallEventsMutex);
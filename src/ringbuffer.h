@@ -12,20 +12,22 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 #include <vector>
 #include <queue>
 #include <QDebug>
 #include <QElapsedTimer>
 
 /**
- * @brief Lock-free (for single producer/consumer) ring buffer with pre-allocated slots
+ * @brief Lock-free (for single producer/consumer) ring buffer with fixed-size slots
  * 
  * This ring buffer provides zero-copy data transfer between a producer and consumer
  * by pre-allocating fixed-size slots. The producer acquires a write slot, fills it,
  * and commits. The consumer acquires a read slot, processes data, and releases.
  * 
  * Key features:
- * - Pre-allocated memory to avoid allocation during data transfer
+ * - Address space reserved up front, slot memory committed on first use and
+ *   handed back to the OS while the ring stays mostly empty
  * - Zero-copy: producer writes directly to buffer, consumer reads directly
  * - Blocking acquire with timeout for graceful shutdown
  * - Thread-safe for single producer / single consumer pattern
@@ -37,7 +39,7 @@ public:
      * @brief A slot in the ring buffer
      */
     struct Slot {
-        char* data;         // Pointer to pre-allocated buffer
+        char* data;         // Slot memory, at a fixed address for the buffer's lifetime
         size_t capacity;    // Maximum capacity of this slot
         size_t size;        // Actual data size written
         
@@ -62,7 +64,7 @@ public:
     RingBuffer(size_t numSlots, size_t slotSize, size_t alignment = 4096);
     
     /**
-     * @brief Destructor - frees all pre-allocated memory
+     * @brief Destructor - releases the reserved address space
      */
     ~RingBuffer();
 
@@ -90,6 +92,16 @@ public:
      */
     void commitWriteSlot(Slot* slot, size_t dataSize);
 
+    /**
+     * @brief Give back a write slot without committing it (producer side)
+     * 
+     * Only valid for the most recently acquired slot, e.g. when the
+     * producer ended before it had anything to put in it.
+     * 
+     * @param slot The slot to return
+     */
+    void returnWriteSlot(Slot* slot);
+
     /**
      * @brief Acquire a slot for reading (consumer side)
      * 
@@ -154,6 +166,26 @@ public:
     void getStarvationStats(uint64_t& producerStalls, uint64_t& consumerStalls,
                            uint64_t& totalProducerWaitMs, uint64_t& totalConsumerWaitMs) const;
 
+    /**
+     * @brief Get slot fill statistics
+     * @param slotsCommitted Number of slots committed by the producer
+     * @param bytesCommitted Total data committed in those slots
+     *
+     * bytesCommitted / (slotsCommitted * slotCapacity()) is how well the
+     * producer fills the slots it uses.
+     */
+    void getFillStats(uint64_t& slotsCommitted, uint64_t& bytesCommitted) const;
+
+    /**
+     * @brief Get memory statistics
+     * @param reservedBytes Address space reserved for all slots
+     * @param committedBytes Memory of the slots currently in use or kept for reuse
+     * @param peakCommittedBytes Highest committedBytes so far
+     * @param reclaimedSlots Number of times an idle slot was given back to the OS
+     */
+    void getMemoryStats(uint64_t& reservedBytes, uint64_t& committedBytes,
+                        uint64_t& peakCommittedBytes, uint64_t& reclaimedSlots) const;
+
     /**
      * @brief Set the session timer for stall event timestamps
      * @param timer Pointer to QElapsedTimer started at session begin
@@ -172,7 +204,25 @@ private:
     size_t _alignment;
     
     std::vector<Slot> _slots;
-    std::vector<char*> _memory;  // Raw memory blocks for cleanup
+    std::vector<uint8_t> _slotCommitted;  // Owned by whoever holds the slot
+    char* _region;                        // Reserved address space for all slots
+    size_t _regionSize;
+    size_t _slotStride;                   // Slot size rounded up to pages and alignment
+    
+    // Lazy commit and reclaim
+    std::atomic<uint64_t> _committedBytes;
+    std::atomic<uint64_t> _peakCommittedBytes;
+    std::atomic<uint64_t> _reclaimedSlots;
+    std::chrono::steady_clock::time_point _occupancyWindowStart;  // Protected by _mutex
+    size_t _windowPeakOccupancy;                                  // Protected by _mutex
+    bool _underOccupied;                                          // Protected by _mutex
+    static constexpr int RECLAIM_WINDOW_MS = 2000;        // Occupancy is judged over windows this long
+    static constexpr size_t RECLAIM_OCCUPANCY_DIVISOR = 4; // Under-occupied: never more than 1/4 of slots in use
+    static constexpr size_t RECLAIM_MIN_SLOTS = 8;         // Smaller rings are kept as they are
+    
+    bool _commitSlot(size_t index);
+    void _decommitSlot(size_t index);
+    bool _shouldReclaim();
     
     // Ring buffer indices
     std::atomic<size_t> _writeIndex;  // Next slot to write
@@ -194,6 +244,8 @@ private:
     std::atomic<uint64_t> _consumerStalls;      // Times consumer waited for data
     std::atomic<uint64_t> _producerWaitMs;      // Total producer wait time
     std::atomic<uint64_t> _consumerWaitMs;      // Total consumer wait time
+    std::atomic<uint64_t> _slotsCommitted;      // Slots committed by the producer
+    std::atomic<uint64_t> _bytesCommitted;      // Data committed in those slots
     
     // Stall event queue for time-series correlation
     QElapsedTimer* _sessionTimer;               // External timer for timestamps (not owned)
@@ -0,0 +1,411 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "simulated_file_operations.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+namespace rpi_imager {
+
+// Use the common logging function from file_operations.cpp
+static void Log(const std::string& msg) {
+    FileOperationsLog(msg);
+}
+
+// Time to move size bytes at mbps (10^6 bytes per second), in nanoseconds
+static std::uint64_t TransferNs(std::uint64_t size, double mbps) {
+  if (mbps <= 0) {
+    return 0;
+  }
+  return static_cast<std::uint64_t>(static_cast<double>(size) * 1000.0 / mbps);
+}
+
+SimulatedCard::SimulatedCard(const SimulatedDeviceProfile& profile)
+    : profile_(profile), rng_(profile.seed) {}
+
+SimulatedCard::~SimulatedCard() {
+  if (file_.is_open()) {
+    file_.close();
+  }
+}
+
+FileError SimulatedCard::Attach(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (attached_) {
+    return FileError::kSuccess;
+  }
+
+  if (path.empty() || path == ":memory:") {
+    use_file_ = false;
+  } else {
+    // Create the backing file if needed, then make it span the whole card
+    // (sparse on filesystems that support it)
+    file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file_.is_open()) {
+      std::ofstream create(path, std::ios::out | std::ios::binary);
+      create.close();
+      file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    }
+    if (!file_.is_open()) {
+      Log("Simulated device: cannot open backing file " + path);
+      return FileError::kOpenError;
+    }
+
+    file_.seekg(0, std::ios::end);
+    std::uint64_t existing = static_cast<std::uint64_t>(file_.tellg());
+    if (existing < profile_.capacity) {
+      file_.seekp(static_cast<std::streamoff>(profile_.capacity - 1));
+      file_.put('\0');
+      file_.flush();
+    }
+    if (!file_.good()) {
+      Log("Simulated device: cannot size backing file " + path);
+      file_.close();
+      return FileError::kOpenError;
+    }
+    use_file_ = true;
+  }
+
+  std::ostringstream msg;
+  msg << "Simulated device '" << profile_.name << "': " << profile_.capacity << " bytes, backed by "
+      << (use_file_ ? path : std::string("memory"));
+  Log(msg.str());
+
+  attached_ = true;
+  return FileError::kSuccess;
+}
+
+std::uint64_t SimulatedCard::LatencyNs() {
+  if (profile_.latency_median_us <= 0) {
+    return 0;
+  }
+
+  // Log-normal through the given median and 99th percentile (z = 2.326)
+  double sigma = 0;
+  if (profile_.latency_p99_us > profile_.latency_median_us) {
+    sigma = std::log(profile_.latency_p99_us / profile_.latency_median_us) / 2.326;
+  }
+  std::lognormal_distribution<double> dist(std::log(profile_.latency_median_us), sigma);
+  return static_cast<std::uint64_t>(dist(rng_) * 1000.0);
+}
+
+bool SimulatedCard::InjectError(double rate) {
+  if (rate <= 0) {
+    return false;
+  }
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  return dist(rng_) < rate;
+}
+
+void SimulatedCard::Pace(std::uint64_t ns) const {
+  if (profile_.time_scale > 0 && ns) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(
+        static_cast<std::uint64_t>(static_cast<double>(ns) * profile_.time_scale)));
+  }
+}
+
+FileError SimulatedCard::Write(std::uint64_t offset, const std::uint8_t* data, std::size_t size) {
+  std::uint64_t ns = 0;
+  FileError result = FileError::kSuccess;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!attached_) {
+      return FileError::kOpenError;
+    }
+    if (offset > profile_.capacity || size > profile_.capacity - offset) {
+      return FileError::kWriteError;
+    }
+
+    stats_.writes++;
+    ns = LatencyNs();
+
+    bool hits_bad_offset = !fail_write_fired_ && profile_.fail_write_offset >= offset
+                           && profile_.fail_write_offset < offset + size;
+    if (hits_bad_offset || InjectError(profile_.write_error_rate)) {
+      fail_write_fired_ = fail_write_fired_ || hits_bad_offset;
+      stats_.injected_errors++;
+      result = FileError::kWriteError;
+    } else {
+      bool sequential = offset == last_write_end_;
+      double mbps = sequential ? profile_.sequential_write_mbps : profile_.random_write_mbps;
+
+      // Whatever no longer fits in the SLC cache goes at the slower native speed
+      std::uint64_t slc_left = stats_.bytes_written < profile_.slc_cache_bytes
+                               ? profile_.slc_cache_bytes - stats_.bytes_written : 0;
+      std::uint64_t fast = std::min<std::uint64_t>(size, slc_left);
+      std::uint64_t slow = size - fast;
+      ns += TransferNs(fast, mbps);
+      ns += TransferNs(slow, std::min(mbps, profile_.post_slc_write_mbps));
+      stats_.post_slc_bytes += slow;
+
+      if (profile_.page_size && (offset % profile_.page_size || size % profile_.page_size)) {
+        ns += static_cast<std::uint64_t>(profile_.misaligned_penalty_us * 1000.0);
+        stats_.misaligned_writes++;
+      }
+
+      if (profile_.allocation_unit && size) {
+        std::uint64_t au = offset / profile_.allocation_unit;
+        if (!sequential && au != open_au_ && open_au_ != std::numeric_limits<std::uint64_t>::max()) {
+          ns += static_cast<std::uint64_t>(profile_.au_switch_penalty_us * 1000.0);
+          stats_.au_switches++;
+        }
+        open_au_ = (offset + size - 1) / profile_.allocation_unit;
+      }
+
+      result = StoreWrite(offset, data, size);
+      if (result == FileError::kSuccess) {
+        last_write_end_ = offset + size;
+        stats_.bytes_written += size;
+      }
+    }
+
+    stats_.simulated_ns += ns;
+    last_write_ns_ = stats_.simulated_ns;
+  }
+
+  Pace(ns);
+  return result;
+}
+
+FileError SimulatedCard::Read(std::uint64_t offset, std::uint8_t* data, std::size_t size) {
+  std::uint64_t ns = 0;
+  FileError result = FileError::kSuccess;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!attached_) {
+      return FileError::kOpenError;
+    }
+    if (offset > profile_.capacity || size > profile_.capacity - offset) {
+      return FileError::kReadError;
+    }
+
+    stats_.reads++;
+    ns = LatencyNs();
+
+    bool recent_write = stats_.writes
+        && stats_.simulated_ns - last_write_ns_ < static_cast<std::uint64_t>(profile_.read_after_write_window_ms * 1000000.0);
+    ns += TransferNs(size, recent_write ? profile_.read_after_write_mbps : profile_.read_mbps);
+
+    bool hits_bad_offset = profile_.fail_read_offset >= offset && profile_.fail_read_offset < offset + size;
+    if (hits_bad_offset || InjectError(profile_.read_error_rate)) {
+      stats_.injected_errors++;
+      result = FileError::kReadError;
+    } else {
+      result = StoreRead(offset, data, size);
+      if (result == FileError::kSuccess) {
+        stats_.bytes_read += size;
+      }
+    }
+
+    stats_.simulated_ns += ns;
+  }
+
+  Pace(ns);
+  return result;
+}
+
+FileError SimulatedCard::Sync() {
+  std::uint64_t ns = 0;
+  FileError result = FileError::kSuccess;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!attached_) {
+      return FileError::kOpenError;
+    }
+
+    stats_.syncs++;
+    ns = static_cast<std::uint64_t>(profile_.sync_latency_us * 1000.0);
+    if (profile_.fail_sync) {
+      stats_.injected_errors++;
+      result = FileError::kSyncError;
+    } else if (use_file_) {
+      file_.flush();
+      if (!file_.good()) {
+        result = FileError::kSyncError;
+      }
+    }
+    stats_.simulated_ns += ns;
+  }
+
+  Pace(ns);
+  return result;
+}
+
+SimulatedDeviceStats SimulatedCard::Stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+FileError SimulatedCard::StoreWrite(std::uint64_t offset, const std::uint8_t* data, std::size_t size) {
+  if (use_file_) {
+    file_.seekp(static_cast<std::streamoff>(offset));
+    file_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!file_.good()) {
+      file_.clear();
+      return FileError::kWriteError;
+    }
+    return FileError::kSuccess;
+  }
+
+  while (size) {
+    std::uint64_t index = offset / kMemoryBlockSize;
+    std::size_t in_block = static_cast<std::size_t>(offset % kMemoryBlockSize);
+    std::size_t len = std::min<std::size_t>(size, kMemoryBlockSize - in_block);
+
+    std::vector<std::uint8_t>& block = blocks_[index];
+    if (block.empty()) {
+      block.resize(kMemoryBlockSize, 0);
+    }
+    std::memcpy(block.data() + in_block, data, len);
+
+    offset += len;
+    data += len;
+    size -= len;
+  }
+  return FileError::kSuccess;
+}
+
+FileError SimulatedCard::StoreRead(std::uint64_t offset, std::uint8_t* data, std::size_t size) {
+  if (use_file_) {
+    file_.seekg(static_cast<std::streamoff>(offset));
+    file_.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+    std::size_t got = static_cast<std::size_t>(file_.gcount());
+    if (got < size) {
+      // Past the end of a backing file that was never extended: reads as zeroes
+      std::memset(data + got, 0, size - got);
+    }
+    file_.clear();
+    return FileError::kSuccess;
+  }
+
+  while (size) {
+    std::uint64_t index = offset / kMemoryBlockSize;
+    std::size_t in_block = static_cast<std::size_t>(offset % kMemoryBlockSize);
+    std::size_t len = std::min<std::size_t>(size, kMemoryBlockSize - in_block);
+
+    auto it = blocks_.find(index);
+    if (it == blocks_.end()) {
+      std::memset(data, 0, len);
+    } else {
+      std::memcpy(data, it->second.data() + in_block, len);
+    }
+
+    offset += len;
+    data += len;
+    size -= len;
+  }
+  return FileError::kSuccess;
+}
+
+SimulatedFileOperations::SimulatedFileOperations(std::shared_ptr<SimulatedCard> card)
+    : card_(std::move(card)) {}
+
+FileError SimulatedFileOperations::Result(FileError error) {
+  last_error_code_ = error == FileError::kSuccess ? 0 : EIO;
+  return error;
+}
+
+FileError SimulatedFileOperations::OpenDevice(const std::string& path) {
+  FileError result = card_->Attach(path);
+  if (result == FileError::kSuccess) {
+    open_ = true;
+    position_ = 0;
+  }
+  return Result(result);
+}
+
+FileError SimulatedFileOperations::CreateTestFile(const std::string& path, std::uint64_t /*size*/) {
+  // The card's capacity comes from its profile
+  return OpenDevice(path);
+}
+
+FileError SimulatedFileOperations::WriteAtOffset(
+    std::uint64_t offset,
+    const std::uint8_t* data,
+    std::size_t size) {
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+  return Result(card_->Write(offset, data, size));
+}
+
+FileError SimulatedFileOperations::GetSize(std::uint64_t& size) {
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+  size = card_->Profile().capacity;
+  return FileError::kSuccess;
+}
+
+FileError SimulatedFileOperations::Close() {
+  open_ = false;
+  return FileError::kSuccess;
+}
+
+FileError SimulatedFileOperations::WriteSequential(const std::uint8_t* data, std::size_t size) {
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+
+  FileError result = card_->Write(position_, data, size);
+  if (result == FileError::kSuccess) {
+    position_ += size;
+  }
+  return Result(result);
+}
+
+FileError SimulatedFileOperations::ReadSequential(std::uint8_t* data, std::size_t size, std::size_t& bytes_read) {
+  bytes_read = 0;
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+
+  std::uint64_t capacity = card_->Profile().capacity;
+  if (position_ >= capacity) {
+    return Result(FileError::kSuccess);
+  }
+
+  std::size_t len = static_cast<std::size_t>(std::min<std::uint64_t>(size, capacity - position_));
+  FileError result = card_->Read(position_, data, len);
+  if (result == FileError::kSuccess) {
+    position_ += len;
+    bytes_read = len;
+  }
+  return Result(result);
+}
+
+FileError SimulatedFileOperations::Seek(std::uint64_t position) {
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+  if (position > card_->Profile().capacity) {
+    return Result(FileError::kSeekError);
+  }
+  position_ = position;
+  return FileError::kSuccess;
+}
+
+FileError SimulatedFileOperations::ForceSync() {
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+  return Result(card_->Sync());
+}
+
+FileError SimulatedFileOperations::Flush() {
+  // No user-space buffering in front of the simulated medium
+  if (!open_) {
+    return FileError::kOpenError;
+  }
+  return FileError::kSuccess;
+}
+
+}  // namespace rpi_imager
@@ -0,0 +1,182 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#ifndef SIMULATED_FILE_OPERATIONS_H_
+#define SIMULATED_FILE_OPERATIONS_H_
+
+#include "file_operations.h"
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rpi_imager {
+
+// Behaviour of a simulated SD card. Bandwidths are in MB/s (10^6 bytes),
+// latencies in microseconds. Field names match the keys of the JSON
+// profiles accepted by --simulate-device.
+struct SimulatedDeviceProfile {
+  std::string name = "generic";
+  std::uint64_t capacity = 32ull * 1000 * 1000 * 1000;
+
+  double sequential_write_mbps = 30.0;   // Writes continuing where the previous one ended
+  double random_write_mbps = 4.0;        // Any other write
+  double read_mbps = 90.0;
+  double read_after_write_mbps = 45.0;   // Reads while the card is still busy after writing
+  double read_after_write_window_ms = 2000.0;
+
+  // Per-I/O latency, log-normally distributed
+  double latency_median_us = 300.0;
+  double latency_p99_us = 3000.0;
+  double sync_latency_us = 20000.0;
+
+  // Writes not aligned to a flash page need a read-modify-write
+  std::uint64_t page_size = 16 * 1024;
+  double misaligned_penalty_us = 1500.0;
+  // Opening a different allocation unit out of order triggers garbage collection
+  std::uint64_t allocation_unit = 4 * 1024 * 1024;
+  double au_switch_penalty_us = 8000.0;
+
+  // Fast SLC cache; once full, sequential writes drop to post_slc_write_mbps
+  std::uint64_t slc_cache_bytes = 2ull * 1000 * 1000 * 1000;
+  double post_slc_write_mbps = 10.0;
+
+  // Error injection
+  std::uint64_t fail_write_offset = std::numeric_limits<std::uint64_t>::max();  // First write touching it fails
+  std::uint64_t fail_read_offset = std::numeric_limits<std::uint64_t>::max();   // Every read touching it fails
+  double write_error_rate = 0.0;         // Probability per write
+  double read_error_rate = 0.0;          // Probability per read
+  bool fail_sync = false;
+
+  std::uint64_t seed = 1;
+  // 1.0 paces I/O in real time, 0 only accounts simulated time (fast, for tests)
+  double time_scale = 1.0;
+};
+
+struct SimulatedDeviceStats {
+  std::uint64_t bytes_written = 0;
+  std::uint64_t bytes_read = 0;
+  std::uint64_t writes = 0;
+  std::uint64_t reads = 0;
+  std::uint64_t syncs = 0;
+  std::uint64_t misaligned_writes = 0;
+  std::uint64_t au_switches = 0;
+  std::uint64_t post_slc_bytes = 0;      // Bytes written after the SLC cache was exhausted
+  std::uint64_t injected_errors = 0;
+  std::uint64_t simulated_ns = 0;        // Total simulated device busy time
+};
+
+// The simulated card itself: backing storage plus the state that makes its
+// performance depend on history (SLC fill, open allocation unit, recent
+// writes). Shared by every FileOperations handle opened on it, the way
+// several handles to one real device would be.
+class SimulatedCard {
+ public:
+  explicit SimulatedCard(const SimulatedDeviceProfile& profile);
+  ~SimulatedCard();
+
+  SimulatedCard(const SimulatedCard&) = delete;
+  SimulatedCard& operator=(const SimulatedCard&) = delete;
+
+  // Attach backing storage: a sparse file at path, or memory if path is
+  // empty or ":memory:". Only the first call has any effect.
+  FileError Attach(const std::string& path);
+
+  FileError Write(std::uint64_t offset, const std::uint8_t* data, std::size_t size);
+  FileError Read(std::uint64_t offset, std::uint8_t* data, std::size_t size);
+  FileError Sync();
+
+  const SimulatedDeviceProfile& Profile() const { return profile_; }
+  SimulatedDeviceStats Stats() const;
+
+ private:
+  static constexpr std::uint64_t kMemoryBlockSize = 1024 * 1024;
+
+  std::uint64_t LatencyNs();
+  bool InjectError(double rate);
+  void Pace(std::uint64_t ns) const;
+  FileError StoreWrite(std::uint64_t offset, const std::uint8_t* data, std::size_t size);
+  FileError StoreRead(std::uint64_t offset, std::uint8_t* data, std::size_t size);
+
+  SimulatedDeviceProfile profile_;
+  mutable std::mutex mutex_;
+  SimulatedDeviceStats stats_;
+  std::mt19937_64 rng_;
+
+  bool attached_ = false;
+  bool use_file_ = false;
+  std::fstream file_;
+  std::map<std::uint64_t, std::vector<std::uint8_t>> blocks_;   // Sparse in-memory medium
+
+  std::uint64_t last_write_end_ = std::numeric_limits<std::uint64_t>::max();
+  std::uint64_t open_au_ = std::numeric_limits<std::uint64_t>::max();
+  std::uint64_t last_write_ns_ = 0;
+  bool fail_write_fired_ = false;
+};
+
+// FileOperations handle onto a SimulatedCard
+class SimulatedFileOperations : public FileOperations {
+ public:
+  explicit SimulatedFileOperations(std::shared_ptr<SimulatedCard> card);
+  ~SimulatedFileOperations() override = default;
+
+  SimulatedFileOperations(const SimulatedFileOperations&) = delete;
+  SimulatedFileOperations& operator=(const SimulatedFileOperations&) = delete;
+
+  FileError OpenDevice(const std::string& path) override;
+  FileError CreateTestFile(const std::string& path, std::uint64_t size) override;
+  FileError WriteAtOffset(
+      std::uint64_t offset,
+      const std::uint8_t* data,
+      std::size_t size) override;
+  FileError GetSize(std::uint64_t& size) override;
+  FileError Close() override;
+  bool IsOpen() const override { return open_; }
+
+  FileError WriteSequential(const std::uint8_t* data, std::size_t size) override;
+  FileError ReadSequential(std::uint8_t* data, std::size_t size, std::size_t& bytes_read) override;
+
+  FileError Seek(std::uint64_t position) override;
+  std::uint64_t Tell() const override { return position_; }
+
+  FileError ForceSync() override;
+  FileError Flush() override;
+
+  void PrepareForSequentialRead(std::uint64_t /*offset*/, std::uint64_t /*length*/) override {}
+
+  // There is no OS handle behind a simulated card
+  int GetHandle() const override { return -1; }
+  int GetLastErrorCode() const override { return last_error_code_; }
+
+  // Nothing sits between the caller and the simulated medium
+  bool IsDirectIOEnabled() const override { return true; }
+  DirectIOInfo GetDirectIOInfo() const override {
+      DirectIOInfo info;
+      info.attempted = true;
+      info.succeeded = true;
+      info.currently_enabled = true;
+      return info;
+  }
+
+  SimulatedCard* Card() const { return card_.get(); }
+
+ private:
+  FileError Result(FileError error);
+
+  std::shared_ptr<SimulatedCard> card_;
+  bool open_ = false;
+  std::uint64_t position_ = 0;
+  int last_error_code_ = 0;
+};
+
+}  // namespace rpi_imager
+
+#endif  // SIMULATED_FILE_OPERATIONS_H_
@@ -0,0 +1,494 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include "sourcecatalogue.h"
+#include "config.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <vector>
+#include <archive.h>
+#include <archive_entry.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From linux/ioprio.h, which glibc does not provide
+#define SOURCE_IOPRIO_CLASS_SHIFT   13
+#define SOURCE_IOPRIO_CLASS_IDLE    3
+#define SOURCE_IOPRIO_WHO_PROCESS   1
+#endif
+
+#define SOURCE_CATALOGUE_VERSION    1
+#define SOURCE_HASH_BLOCK_SIZE      (1024 * 1024)
+
+SourceCatalogue::SourceCatalogue(QObject *parent)
+    : QObject(parent)
+    , hashThread_(new QThread())
+    , hashWorker_(new SourceHashWorker())
+    , storageDir_(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/source-catalogue")
+{
+    // At most one scan per medium, and blkid waiting on one medium does not hold up the others
+    scanPool_.setMaxThreadCount(4);
+
+    hashWorker_->moveToThread(hashThread_);
+    connect(hashWorker_, &SourceHashWorker::imageHashed,
+            this, &SourceCatalogue::onImageHashed);
+
+    // Hashing is only done ahead of time, so it only ever gets idle CPU time
+    hashThread_->start(QThread::IdlePriority);
+}
+
+SourceCatalogue::~SourceCatalogue()
+{
+    disconnect(hashWorker_, nullptr, this, nullptr);
+
+    // Results of running scans are dropped along with their watchers
+    scanPool_.clear();
+    scanPool_.waitForDone();
+
+    // The image being hashed is abandoned at its next block, queued ones are never started
+    hashWorker_->abort();
+    hashThread_->quit();
+    if (!hashThread_->wait(5000)) {
+        qDebug() << "SourceCatalogue: Hash thread did not quit within 5 seconds, terminating";
+        hashThread_->terminate();
+        hashThread_->wait(2000);
+    }
+    delete hashWorker_;
+    delete hashThread_;
+}
+
+QList<SourceCatalogue::Image> SourceCatalogue::images(const QString &mountPoint, const QString &devname)
+{
+    Medium &medium = media_[mountPoint];
+    medium.devname = devname;
+    startScan(mountPoint);
+
+    return medium.images.values();
+}
+
+void SourceCatalogue::setHashingPaused(bool paused)
+{
+    hashWorker_->setPaused(paused);
+}
+
+QString SourceCatalogue::filesystemUuid(const QString &devname)
+{
+#ifdef Q_OS_LINUX
+    const QString device = "/dev/" + devname;
+
+    // Maintained by udev, if it runs
+    const QFileInfoList links = QDir("/dev/disk/by-uuid").entryInfoList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+    for (const QFileInfo &link : links) {
+        if (link.symLinkTarget() == device) {
+            return link.fileName();
+        }
+    }
+
+    QProcess blkid;
+    blkid.start("blkid", {"-s", "UUID", "-o", "value", device});
+    if (blkid.waitForFinished(5000) && blkid.exitStatus() == QProcess::NormalExit && blkid.exitCode() == 0) {
+        return QString::fromLatin1(blkid.readAllStandardOutput()).trimmed();
+    }
+#else
+    Q_UNUSED(devname);
+#endif
+    return QString();
+}
+
+void SourceCatalogue::startScan(const QString &mountPoint)
+{
+    Medium &medium = media_[mountPoint];
+    if (medium.scanning) {
+        medium.rescan = true;
+        return;
+    }
+    medium.scanning = true;
+    medium.rescan = false;
+
+    auto *watcher = new QFutureWatcher<Scan>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, mountPoint]() {
+        onScanFinished(mountPoint, watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&scanPool_, [this, mountPoint, known = medium]() {
+        return scanMedium(mountPoint, known);
+    }));
+}
+
+void SourceCatalogue::onScanFinished(const QString &mountPoint, Scan result)
+{
+    Medium &medium = media_[mountPoint];
+    const bool rescan = medium.rescan;
+    medium.scanning = false;
+    medium.rescan = false;
+
+    if (result.reloaded) {
+        // Another medium at the same mount point starts from its own catalogue
+        const QString devname = medium.devname;
+        medium = Medium();
+        medium.uuid = result.uuid;
+        medium.devname = devname;
+        medium.loaded = true;
+    } else {
+        // Keep hashes that came in while the scan ran
+        for (auto it = result.images.begin(); it != result.images.end(); ++it) {
+            auto known = medium.images.constFind(it.key());
+            if (it->extractSha256.isEmpty() && known != medium.images.constEnd()
+                && known->size == it->size && known->mtime == it->mtime) {
+                it.value() = known.value();
+            }
+        }
+    }
+
+    medium.images = result.images;
+    if (result.changed) {
+        save(medium);
+    }
+
+    for (const Image &image : std::as_const(medium.images)) {
+        if (!image.extractSha256.isEmpty() || medium.queued.contains(image.name)) {
+            continue;
+        }
+
+        medium.queued.insert(image.name);
+        QMetaObject::invokeMethod(hashWorker_, "hashImage", Qt::QueuedConnection,
+                                  Q_ARG(QString, mountPoint), Q_ARG(QString, image.name),
+                                  Q_ARG(qint64, image.size), Q_ARG(qint64, image.mtime),
+                                  Q_ARG(bool, image.format != "raw"));
+    }
+
+    if (result.reloaded || result.changed) {
+        emit catalogueUpdated(mountPoint);
+    }
+    if (rescan) {
+        startScan(mountPoint);
+    }
+}
+
+/* Runs on the scan pool: only reads the files and the stored catalogue */
+SourceCatalogue::Scan SourceCatalogue::scanMedium(const QString &mountPoint, const Medium &known) const
+{
+    static const QStringList nameFilters = {"*.img", "*.zip", "*.gz", "*.xz", "*.zst", "*.wic"};
+
+    Scan result;
+    result.uuid = filesystemUuid(known.devname);
+
+    Medium previous = known;
+    if (previous.uuid != result.uuid || !previous.loaded) {
+        previous = Medium();
+        previous.uuid = result.uuid;
+        load(previous);
+        result.reloaded = true;
+    }
+
+    const QFileInfoList files = QDir(mountPoint).entryInfoList(nameFilters, QDir::Files, QDir::Name);
+
+    for (const QFileInfo &fi : files) {
+        const qint64 mtime = fi.lastModified().toMSecsSinceEpoch();
+        auto it = previous.images.constFind(fi.fileName());
+
+        if (it != previous.images.constEnd() && it->size == fi.size() && it->mtime == mtime) {
+            result.images.insert(it.key(), it.value());
+            continue;
+        }
+
+        Image image;
+        image.name = fi.fileName();
+        image.size = fi.size();
+        image.mtime = mtime;
+        image.format = detectFormat(fi.filePath());
+        if (image.format == "raw") {
+            image.extractSize = image.size;
+        }
+        result.images.insert(image.name, image);
+        result.changed = true;
+    }
+
+    // Also catches removed files
+    if (result.images.size() != previous.images.size()) {
+        result.changed = true;
+    }
+    return result;
+}
+
+void SourceCatalogue::onImageHashed(const QString &mountPoint, const QString &name, qint64 size, qint64 mtime,
+                                    bool ok, quint64 extractSize, const QByteArray &sha256, bool multipleFiles)
+{
+    auto medium = media_.find(mountPoint);
+    if (medium == media_.end()) {
+        return;
+    }
+    medium->queued.remove(name);
+
+    // The file may have been replaced since, or the medium swapped
+    auto it = medium->images.find(name);
+    if (it == medium->images.end() || it->size != size || it->mtime != mtime) {
+        return;
+    }
+    if (!ok) {
+        qDebug() << "SourceCatalogue: Could not hash" << name << "on" << mountPoint;
+        return;
+    }
+
+    it->extractSize = extractSize;
+    it->extractSha256 = sha256;
+    it->multipleFiles = multipleFiles;
+    save(medium.value());
+
+    qDebug() << "SourceCatalogue: Hashed" << name << "on" << mountPoint << ":" << sha256;
+    emit catalogueUpdated(mountPoint);
+}
+
+QString SourceCatalogue::catalogueFile(const QString &uuid) const
+{
+    QString fileName = uuid;
+    fileName.replace('/', '_');
+    return storageDir_ + "/" + fileName + ".json";
+}
+
+void SourceCatalogue::load(Medium &medium) const
+{
+    if (medium.uuid.isEmpty()) {
+        return;
+    }
+
+    QFile f(catalogueFile(medium.uuid));
+    if (!f.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    const QJsonObject root = QJsonDocument::fromJson(f.readAll()).object();
+    if (root.value("version").toInt() != SOURCE_CATALOGUE_VERSION) {
+        return;
+    }
+
+    for (const QJsonValue &v : root.value("images").toArray()) {
+        const QJsonObject o = v.toObject();
+        Image image;
+        image.name = o.value("name").toString();
+        image.size = o.value("size").toInteger();
+        image.mtime = o.value("mtime").toInteger();
+        image.format = o.value("format").toString();
+        image.extractSize = o.value("extract_size").toInteger();
+        image.extractSha256 = o.value("extract_sha256").toString().toLatin1();
+        image.multipleFiles = o.value("contains_multiple_files").toBool();
+        if (!image.name.isEmpty()) {
+            medium.images.insert(image.name, image);
+        }
+    }
+}
+
+void SourceCatalogue::save(const Medium &medium)
+{
+    if (medium.uuid.isEmpty()) {
+        return;
+    }
+
+    QJsonArray images;
+    for (const Image &image : medium.images) {
+        QJsonObject o;
+        o["name"] = image.name;
+        o["size"] = image.size;
+        o["mtime"] = image.mtime;
+        o["format"] = image.format;
+        o["extract_size"] = static_cast<qint64>(image.extractSize);
+        if (!image.extractSha256.isEmpty()) {
+            o["extract_sha256"] = QString::fromLatin1(image.extractSha256);
+        }
+        if (image.multipleFiles) {
+            o["contains_multiple_files"] = true;
+        }
+        images.append(o);
+    }
+
+    QJsonObject root;
+    root["version"] = SOURCE_CATALOGUE_VERSION;
+    root["uuid"] = medium.uuid;
+    root["images"] = images;
+
+    QDir().mkpath(storageDir_);
+    QSaveFile f(catalogueFile(medium.uuid));
+    if (!f.open(QIODevice::WriteOnly) || f.write(QJsonDocument(root).toJson()) == -1 || !f.commit()) {
+        qDebug() << "SourceCatalogue: Could not save" << f.fileName();
+    }
+}
+
+QString SourceCatalogue::detectFormat(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return "raw";
+    }
+    const QByteArray magic = f.read(6);
+
+    if (magic.startsWith(QByteArray("\xfd" "7zXZ\x00", 6)))
+        return "xz";
+    if (magic.startsWith("\x1f\x8b"))
+        return "gzip";
+    if (magic.startsWith("\x28\xb5\x2f\xfd"))
+        return "zstd";
+    if (magic.startsWith("BZh"))
+        return "bzip2";
+    if (magic.startsWith("PK\x03\x04"))
+        return "zip";
+    return "raw";
+}
+
+SourceHashWorker::SourceHashWorker(QObject *parent)
+    : QObject(parent)
+    , abort_(false)
+    , paused_(false)
+    , ioPrioritySet_(false)
+{
+}
+
+void SourceHashWorker::hashImage(const QString &mountPoint, const QString &name, qint64 size, qint64 mtime, bool compressed)
+{
+    if (abort_) {
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    // Thread priority does not cover the reads, which compete with writes from the same medium
+    if (!ioPrioritySet_) {
+        syscall(SYS_ioprio_set, SOURCE_IOPRIO_WHO_PROCESS, 0, SOURCE_IOPRIO_CLASS_IDLE << SOURCE_IOPRIO_CLASS_SHIFT);
+        ioPrioritySet_ = true;
+    }
+#endif
+
+    const QString path = mountPoint + "/" + name;
+    quint64 extractSize = 0;
+    QByteArray sha256;
+    bool multipleFiles = false;
+    bool ok = waitWhilePaused();
+
+    // Skip files that changed while queued
+    QFileInfo fi(path);
+    if (ok && (fi.size() != size || fi.lastModified().toMSecsSinceEpoch() != mtime)) {
+        ok = false;
+    }
+
+    if (ok) {
+        ok = compressed ? hashArchive(path, extractSize, sha256, multipleFiles)
+                        : hashFile(path, extractSize, sha256);
+    }
+
+    emit imageHashed(mountPoint, name, size, mtime, ok && !abort_, extractSize, sha256, multipleFiles);
+}
+
+bool SourceHashWorker::waitWhilePaused()
+{
+    while (paused_ && !abort_) {
+        QThread::msleep(100);
+    }
+    return !abort_;
+}
+
+bool SourceHashWorker::hashFile(const QString &path, quint64 &length, QByteArray &sha256)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QCryptographicHash hash(OSLIST_HASH_ALGORITHM);
+    std::vector<char> buf(SOURCE_HASH_BLOCK_SIZE);
+    qint64 n;
+    length = 0;
+
+    while ((n = f.read(buf.data(), buf.size())) > 0) {
+        if (!waitWhilePaused()) {
+            return false;
+        }
+        hash.addData(QByteArrayView(buf.data(), n));
+        length += n;
+    }
+    if (n < 0) {
+        return false;
+    }
+
+    sha256 = hash.result().toHex();
+    return true;
+}
+
+bool SourceHashWorker::hashArchive(const QString &path, quint64 &extractSize, QByteArray &sha256, bool &multipleFiles)
+{
+    // Same formats as the write path
+    struct archive *a = archive_read_new();
+    struct archive_entry *entry;
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    archive_read_support_format_raw(a);
+
+    const QByteArray fn = QFile::encodeName(path);
+    if (archive_read_open_filename(a, fn.constData(), SOURCE_HASH_BLOCK_SIZE) != ARCHIVE_OK) {
+        archive_read_free(a);
+        return false;
+    }
+
+    QCryptographicHash hash(OSLIST_HASH_ALGORITHM);
+    std::vector<char> buf(SOURCE_HASH_BLOCK_SIZE);
+    int entries = 0, r = ARCHIVE_OK;
+    bool ok = true;
+    extractSize = 0;
+    multipleFiles = false;
+
+    while (ok && (r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+        if (archive_entry_filetype(entry) == AE_IFDIR) {
+            continue;
+        }
+
+        if (++entries > 1) {
+            // Extracted as files rather than written as an image, so only the sizes are needed
+            multipleFiles = true;
+            extractSize += qMax<la_int64_t>(archive_entry_size(entry), 0);
+            ok = archive_read_data_skip(a) == ARCHIVE_OK && waitWhilePaused();
+            continue;
+        }
+
+        la_ssize_t n;
+        while ((n = archive_read_data(a, buf.data(), buf.size())) > 0) {
+            if (!waitWhilePaused()) {
+                ok = false;
+                break;
+            }
+            hash.addData(QByteArrayView(buf.data(), n));
+            extractSize += n;
+        }
+        if (n < 0) {
+            ok = false;
+        }
+    }
+    if (ok && r != ARCHIVE_EOF) {
+        ok = false;
+    }
+    archive_read_free(a);
+
+    if (!ok || !entries) {
+        return false;
+    }
+    if (multipleFiles) {
+        // Multi-file archives are verified against the hash of the archive itself
+        quint64 archiveLength;
+        return hashFile(path, archiveLength, sha256);
+    }
+
+    sha256 = hash.result().toHex();
+    return true;
+}
@@ -0,0 +1,140 @@
+#ifndef SOURCECATALOGUE_H
+#define SOURCECATALOGUE_H
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+
+class SourceHashWorker;
+
+/**
+ * @brief Catalogue of the images on USB source media (embedded mode)
+ *
+ * Each medium has a catalogue, keyed by its filesystem UUID and kept in the
+ * application data directory (the media themselves are mounted read-only).
+ * It records the size, modification time and format of every image file and,
+ * once known, its uncompressed size and SHA256.
+ *
+ * Listing a medium returns its images as of the last scan and starts another
+ * one on a worker thread, as finding the UUID may have to wait for blkid. A scan
+ * only stats the files: entries whose size and mtime are unchanged are reused as
+ * they are, new and changed files are added without their hash, and removed
+ * ones dropped. Missing hashes are then computed on an idle-priority thread,
+ * which is paused while an image is being written. With
+ * a hash in the catalogue, writes from the medium are verified like images
+ * from the OS list, without having to read the image beforehand.
+ */
+class SourceCatalogue : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Image {
+        QString name;               // File name, relative to the mount point
+        qint64 size = 0;
+        qint64 mtime = 0;           // ms since epoch
+        QString format;             // "raw", "xz", "gzip", "zstd", "bzip2" or "zip"
+        quint64 extractSize = 0;    // Uncompressed size, 0 if not known yet
+        QByteArray extractSha256;   // Hash the write is verified against; of the archive itself for multi-file zips
+        bool multipleFiles = false;
+    };
+
+    explicit SourceCatalogue(QObject *parent = nullptr);
+    ~SourceCatalogue();
+
+    // Images on the medium of block device devname (e.g. "sda1") mounted at mountPoint,
+    // as of the last scan. Also rescans it in the background, catalogueUpdated tells of
+    // changes. Without a filesystem UUID the catalogue is only kept in memory
+    QList<Image> images(const QString &mountPoint, const QString &devname);
+
+    // Thread safe: stop reading the media while an image is written
+    void setHashingPaused(bool paused);
+
+    // Filesystem UUID of a block device (e.g. "sda1"), empty if it has none
+    static QString filesystemUuid(const QString &devname);
+
+signals:
+    // A scan or hashes changed the catalogue of the medium mounted at mountPoint
+    void catalogueUpdated(const QString &mountPoint);
+
+private slots:
+    void onImageHashed(const QString &mountPoint, const QString &name, qint64 size, qint64 mtime,
+                       bool ok, quint64 extractSize, const QByteArray &sha256, bool multipleFiles);
+
+private:
+    struct Medium {
+        QString uuid;
+        QString devname;
+        QMap<QString, Image> images;
+        QSet<QString> queued;           // Images waiting for the hash worker
+        bool loaded = false;
+        bool scanning = false;
+        bool rescan = false;            // Asked for again while scanning
+    };
+
+    struct Scan {
+        QString uuid;
+        QMap<QString, Image> images;
+        bool reloaded = false;          // Started from the stored catalogue, not the one in memory
+        bool changed = false;           // Files were added, changed or removed
+    };
+
+    QHash<QString, Medium> media_;     // By mount point
+    QThread* hashThread_;
+    SourceHashWorker* hashWorker_;
+    QString storageDir_;
+    QThreadPool scanPool_;
+
+    void startScan(const QString &mountPoint);
+    void onScanFinished(const QString &mountPoint, Scan result);
+    Scan scanMedium(const QString &mountPoint, const Medium &known) const;
+    QString catalogueFile(const QString &uuid) const;
+    void load(Medium &medium) const;
+    void save(const Medium &medium);
+    static QString detectFormat(const QString &path);
+};
+
+/**
+ * @brief Worker that hashes source images on an idle-priority thread
+ *
+ * Jobs queue up in the thread's event loop and are processed one at a time.
+ */
+class SourceHashWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SourceHashWorker(QObject *parent = nullptr);
+
+    // Thread safe
+    void abort() { abort_ = true; }
+    void setPaused(bool paused) { paused_ = paused; }
+
+public slots:
+    void hashImage(const QString &mountPoint, const QString &name, qint64 size, qint64 mtime, bool compressed);
+
+signals:
+    void imageHashed(const QString &mountPoint, const QString &name, qint64 size, qint64 mtime,
+                     bool ok, quint64 extractSize, const QByteArray &sha256, bool multipleFiles);
+
+private:
+    std::atomic<bool> abort_, paused_;
+    bool ioPrioritySet_;
+
+    bool waitWhilePaused();
+    bool hashFile(const QString &path, quint64 &length, QByteArray &sha256);
+    bool hashArchive(const QString &path, quint64 &extractSize, QByteArray &sha256, bool &multipleFiles);
+};
+
+#endif // SOURCECATALOGUE_H
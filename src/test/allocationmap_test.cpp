@@ -0,0 +1,298 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "allocationmap.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+constexpr uint64_t PartStart = MiB;      // First partition at the usual 1 MiB
+
+void put16(QByteArray &image, uint64_t offset, uint16_t value)
+{
+    image[static_cast<qsizetype>(offset)] = static_cast<char>(value & 0xFF);
+    image[static_cast<qsizetype>(offset + 1)] = static_cast<char>(value >> 8);
+}
+
+void put32(QByteArray &image, uint64_t offset, uint32_t value)
+{
+    put16(image, offset, static_cast<uint16_t>(value & 0xFFFF));
+    put16(image, offset + 2, static_cast<uint16_t>(value >> 16));
+}
+
+void putSignature(QByteArray &image, uint64_t sectorOffset)
+{
+    image[static_cast<qsizetype>(sectorOffset + 510)] = static_cast<char>(0x55);
+    image[static_cast<qsizetype>(sectorOffset + 511)] = static_cast<char>(0xAA);
+}
+
+void putPartition(QByteArray &image, int index, uint8_t type, uint64_t start, uint64_t length)
+{
+    const uint64_t entry = 446 + index * 16;
+    image[static_cast<qsizetype>(entry + 4)] = static_cast<char>(type);
+    put32(image, entry + 8, static_cast<uint32_t>(start / 512));
+    put32(image, entry + 12, static_cast<uint32_t>(length / 512));
+    putSignature(image, 0);
+}
+
+/*
+ * FAT16: 512 byte sectors, 4 sectors per cluster, 4 reserved sectors,
+ * two FATs of 20 sectors and 512 root entries, then 5000 clusters.
+ * The first usedClusters clusters are in use, the rest are free.
+ */
+struct Fat16 {
+    static constexpr uint32_t ClusterBytes = 4 * 512;
+    static constexpr uint32_t Clusters = 5000;
+    static constexpr uint64_t MetaSectors = 4 + 2 * 20 + 32;
+    static constexpr uint64_t TotalSectors = MetaSectors + Clusters * 4;
+    static constexpr uint64_t Bytes = TotalSectors * 512;
+    static constexpr uint64_t DataStart = PartStart + MetaSectors * 512;
+    static constexpr uint64_t FatStart = PartStart + 4 * 512;
+};
+
+QByteArray fat16Image(uint32_t usedClusters)
+{
+    QByteArray image(static_cast<qsizetype>(PartStart + Fat16::Bytes), '\0');
+    putPartition(image, 0, 0x0e, PartStart, Fat16::Bytes);
+
+    put16(image, PartStart + 11, 512);              // Bytes per sector
+    image[static_cast<qsizetype>(PartStart + 13)] = 4; // Sectors per cluster
+    put16(image, PartStart + 14, 4);                // Reserved sectors
+    image[static_cast<qsizetype>(PartStart + 16)] = 2; // FATs
+    put16(image, PartStart + 17, 512);              // Root entries
+    put16(image, PartStart + 19, 0);
+    put32(image, PartStart + 32, static_cast<uint32_t>(Fat16::TotalSectors));
+    put16(image, PartStart + 22, 20);               // Sectors per FAT
+    putSignature(image, PartStart);
+
+    put16(image, Fat16::FatStart, 0xFFF8);
+    put16(image, Fat16::FatStart + 2, 0xFFFF);
+    for (uint32_t c = 2; c < usedClusters + 2; c++)
+        put16(image, Fat16::FatStart + c * 2, c + 1 < usedClusters + 2 ? c + 1 : 0xFFFF);
+    return image;
+}
+
+/*
+ * ext4 with 4 KiB blocks and two groups of 2048 blocks, the second one
+ * short: superblock in block 0, descriptors in block 1, bitmaps in 2 and 3.
+ * Group 0 has its first 100 blocks in use, group 1 is empty.
+ */
+struct Ext4 {
+    static constexpr uint64_t BlockSize = 4096;
+    static constexpr uint64_t BlocksPerGroup = 2048;
+    static constexpr uint64_t Blocks = 3000;
+    static constexpr uint64_t UsedBlocks = 100;
+    static constexpr uint64_t Bytes = Blocks * BlockSize;
+};
+
+QByteArray ext4Image()
+{
+    QByteArray image(static_cast<qsizetype>(PartStart + Ext4::Bytes), '\0');
+    putPartition(image, 0, 0x83, PartStart, Ext4::Bytes);
+
+    const uint64_t sb = PartStart + 1024;
+    put32(image, sb + 0x04, Ext4::Blocks);
+    put32(image, sb + 0x14, 0);                     // First data block
+    put32(image, sb + 0x18, 2);                     // log2(block size) - 10
+    put32(image, sb + 0x20, Ext4::BlocksPerGroup);
+    put16(image, sb + 0x38, 0xEF53);
+
+    const uint64_t gdt = PartStart + Ext4::BlockSize;
+    put32(image, gdt, 2);
+    put32(image, gdt + 32, 3);
+
+    const uint64_t bitmap = PartStart + 2 * Ext4::BlockSize;
+    for (uint64_t i = 0; i < Ext4::UsedBlocks; i++)
+        image[static_cast<qsizetype>(bitmap + i / 8)] |= static_cast<char>(1 << (i % 8));
+    return image;
+}
+
+void feedAll(AllocationMap &map, const QByteArray &image, size_t chunk = 65536, size_t limit = SIZE_MAX)
+{
+    const size_t end = std::min(static_cast<size_t>(image.size()), limit);
+    for (size_t offset = 0; offset < end; offset += chunk)
+        map.feed(offset, image.constData() + offset, std::min(chunk, end - offset));
+}
+
+} // namespace
+
+TEST_CASE("AllocationMap maps free FAT16 clusters", "[allocationmap]") {
+    const QByteArray image = fat16Image(10);
+    AllocationMap map;
+    feedAll(map, image);
+
+    const uint64_t freeStart = Fat16::DataStart + 10 * Fat16::ClusterBytes;
+    const uint64_t freeEnd = Fat16::DataStart + Fat16::Clusters * Fat16::ClusterBytes;
+    CHECK(map.unallocatedBytes() == freeEnd - freeStart);
+    CHECK(map.isUnallocated(freeStart, freeEnd - freeStart));
+    CHECK_FALSE(map.isUnallocated(freeStart - 1, 2));
+    CHECK_FALSE(map.isUnallocated(Fat16::DataStart, Fat16::ClusterBytes));
+    CHECK(map.summary().contains("fat_partitions: 1"));
+}
+
+TEST_CASE("AllocationMap maps free ext4 blocks from the block bitmaps", "[allocationmap]") {
+    const QByteArray image = ext4Image();
+    AllocationMap map;
+    feedAll(map, image);
+
+    // Both groups: one range from the first free block to the end of the filesystem
+    const uint64_t freeStart = PartStart + Ext4::UsedBlocks * Ext4::BlockSize;
+    const uint64_t freeEnd = PartStart + Ext4::Blocks * Ext4::BlockSize;
+    CHECK(map.unallocatedBytes() == freeEnd - freeStart);
+    CHECK(map.isUnallocated(freeStart, freeEnd - freeStart));
+    CHECK_FALSE(map.isUnallocated(freeStart - Ext4::BlockSize, Ext4::BlockSize));
+    CHECK(map.summary().contains("ext4_partitions: 1"));
+    CHECK(map.summary().contains("groups_mapped: 2"));
+}
+
+TEST_CASE("AllocationMap leaves ext4 groups without a stored bitmap allocated", "[allocationmap]") {
+    QByteArray image = ext4Image();
+    put16(image, PartStart + Ext4::BlockSize + 32 + 0x12, 0x2);   // Group 1: BLOCK_UNINIT
+    AllocationMap map;
+    feedAll(map, image);
+
+    const uint64_t group1 = PartStart + Ext4::BlocksPerGroup * Ext4::BlockSize;
+    CHECK(map.unallocatedBytes() == (Ext4::BlocksPerGroup - Ext4::UsedBlocks) * Ext4::BlockSize);
+    CHECK_FALSE(map.isUnallocated(group1, Ext4::BlockSize));
+    CHECK(map.summary().contains("groups_uninit: 1"));
+}
+
+TEST_CASE("AllocationMap writes images without a usable partition table in full", "[allocationmap][negative]") {
+    SECTION("no MBR signature") {
+        QByteArray image = fat16Image(10);
+        image[510] = 0;
+        AllocationMap map;
+        feedAll(map, image);
+        CHECK(map.unallocatedBytes() == 0);
+    }
+
+    SECTION("GPT protective MBR") {
+        QByteArray image = fat16Image(10);
+        putPartition(image, 1, 0x0e, PartStart, Fat16::Bytes);
+        putPartition(image, 0, 0xEE, 512, Fat16::Bytes);
+        AllocationMap map;
+        feedAll(map, image);
+        CHECK(map.unallocatedBytes() == 0);
+        CHECK(map.summary().contains("fat_partitions: 0"));
+    }
+
+    SECTION("image shorter than a sector") {
+        const QByteArray image = fat16Image(10).left(300);
+        AllocationMap map;
+        feedAll(map, image);
+        CHECK(map.unallocatedBytes() == 0);
+    }
+}
+
+TEST_CASE("AllocationMap rejects corrupt FAT boot sectors", "[allocationmap][negative]") {
+    QByteArray image = fat16Image(10);
+
+    SECTION("bad bytes per sector") {
+        put16(image, PartStart + 11, 500);
+    }
+    SECTION("cluster size not a power of two") {
+        image[static_cast<qsizetype>(PartStart + 13)] = 3;
+    }
+    SECTION("filesystem larger than its partition") {
+        putPartition(image, 0, 0x0e, PartStart, Fat16::Bytes - 512);
+    }
+    SECTION("FAT too short for the clusters") {
+        put16(image, PartStart + 22, 2);
+    }
+    SECTION("missing boot sector signature") {
+        image[static_cast<qsizetype>(PartStart + 511)] = 0;
+    }
+
+    AllocationMap map;
+    feedAll(map, image);
+    CHECK(map.unallocatedBytes() == 0);
+    CHECK(map.summary().contains("fat_partitions: 0"));
+}
+
+TEST_CASE("AllocationMap rejects corrupt ext4 superblocks", "[allocationmap][negative]") {
+    QByteArray image = ext4Image();
+    const uint64_t sb = PartStart + 1024;
+
+    SECTION("bad magic") {
+        put16(image, sb + 0x38, 0x1234);
+    }
+    SECTION("filesystem larger than its partition") {
+        putPartition(image, 0, 0x83, PartStart, Ext4::Bytes - Ext4::BlockSize);
+    }
+    SECTION("more blocks per group than a bitmap holds") {
+        put32(image, sb + 0x20, Ext4::BlockSize * 8 + 1);
+    }
+    SECTION("absurd block size") {
+        put32(image, sb + 0x18, 7);
+    }
+    SECTION("meta_bg layout") {
+        put32(image, sb + 0x60, 0x10);
+    }
+
+    AllocationMap map;
+    feedAll(map, image);
+    CHECK(map.unallocatedBytes() == 0);
+    CHECK(map.summary().contains("ext4_partitions: 0"));
+}
+
+TEST_CASE("AllocationMap skips ext4 groups with an impossible bitmap location", "[allocationmap][negative]") {
+    QByteArray image = ext4Image();
+    put32(image, PartStart + Ext4::BlockSize + 32, Ext4::Blocks);   // Group 1 bitmap past the end
+    AllocationMap map;
+    feedAll(map, image);
+
+    CHECK(map.unallocatedBytes() == (Ext4::BlocksPerGroup - Ext4::UsedBlocks) * Ext4::BlockSize);
+    CHECK(map.summary().contains("groups_mapped: 1"));
+}
+
+TEST_CASE("AllocationMap keeps data allocated when its metadata comes too late", "[allocationmap][negative]") {
+    QByteArray image = ext4Image();
+    /* Data starting at block 1 moves the descriptors to block 2. Group 0
+       keeps its bitmap in block 1, which has streamed past by then */
+    put32(image, PartStart + 1024 + 0x14, 1);
+    const uint64_t gdt = PartStart + 2 * Ext4::BlockSize;
+    image.replace(static_cast<qsizetype>(gdt), Ext4::BlockSize, QByteArray(Ext4::BlockSize, '\0'));
+    put32(image, gdt, 1);
+    put32(image, gdt + 32, 3);
+    AllocationMap map;
+    feedAll(map, image, Ext4::BlockSize);
+
+    // Group 1 (blocks 2049 to the end) is still mapped from its own bitmap
+    const uint64_t group1 = PartStart + (Ext4::BlocksPerGroup + 1) * Ext4::BlockSize;
+    CHECK(map.unallocatedBytes() == PartStart + Ext4::Bytes - group1);
+    CHECK(map.isUnallocated(group1, PartStart + Ext4::Bytes - group1));
+    CHECK_FALSE(map.isUnallocated(PartStart + Ext4::UsedBlocks * Ext4::BlockSize, Ext4::BlockSize));
+    CHECK(map.summary().contains("late_metadata: 1"));
+    CHECK(map.summary().contains("groups_mapped: 1"));
+}
+
+TEST_CASE("AllocationMap maps nothing from a truncated stream", "[allocationmap][negative]") {
+    SECTION("FAT cut short") {
+        const QByteArray image = fat16Image(10);
+        AllocationMap map;
+        feedAll(map, image, 4096, Fat16::FatStart + 1000);
+        CHECK(map.unallocatedBytes() == 0);
+    }
+
+    SECTION("ext4 descriptors cut short") {
+        const QByteArray image = ext4Image();
+        AllocationMap map;
+        feedAll(map, image, 4096, PartStart + Ext4::BlockSize + 40);
+        CHECK(map.unallocatedBytes() == 0);
+    }
+
+    SECTION("out of order input drops what was pending") {
+        const QByteArray image = fat16Image(10);
+        AllocationMap map;
+        map.feed(0, image.constData(), 4096);
+        map.feed(Fat16::DataStart, image.constData() + Fat16::DataStart, 4096);
+        CHECK(map.unallocatedBytes() == 0);
+        CHECK(map.summary().contains("late_metadata: 1"));
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "cachemanager.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <zstd.h>
+
+namespace {
+
+/* CacheManager runs its workers on threads, and reports back through the event loop */
+void ensureApplication()
+{
+    static int argc = 1;
+    static char name[] = "cachemanager_test";
+    static char *argv[] = {name, nullptr};
+    if (!QCoreApplication::instance()) {
+        // Settings and cache locations of the test, not the user's
+        QStandardPaths::setTestModeEnabled(true);
+        QCoreApplication::setOrganizationName("cachemanager_test");
+        new QCoreApplication(argc, argv);
+    }
+}
+
+QString writeCacheFile(const QTemporaryDir &dir)
+{
+    const QString fileName = dir.filePath("image.cache");
+    QFile f(fileName);
+    if (f.open(QIODevice::WriteOnly)) {
+        f.write(QByteArray(4096, 'x'));
+    }
+    return fileName;
+}
+
+/* A download as published: one plain zstd frame, which the transcode makes seekable */
+QByteArray writeCompressedCacheFile(const QString &fileName, qsizetype imageSize)
+{
+    QByteArray image(imageSize, Qt::Uninitialized);
+    for (qsizetype i = 0; i < image.size(); i++) {
+        image[i] = static_cast<char>((i / 4096) * 31 + (i % 251));
+    }
+    QByteArray compressed(static_cast<qsizetype>(ZSTD_compressBound(image.size())), Qt::Uninitialized);
+    const size_t len = ZSTD_compress(compressed.data(), compressed.size(), image.constData(), image.size(), 1);
+    compressed.truncate(static_cast<qsizetype>(len));
+
+    QFile f(fileName);
+    if (f.open(QIODevice::WriteOnly)) {
+        f.write(compressed);
+    }
+    return QCryptographicHash::hash(compressed, QCryptographicHash::Sha256).toHex();
+}
+
+QByteArray readFile(const QString &fileName)
+{
+    QFile f(fileName);
+    return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+}
+
+void useCustomCacheFile(CacheManager &manager, const QString &fileName, const QByteArray &hash)
+{
+    manager.setCustomCacheFile(fileName, hash);
+    manager.updateCacheFile(hash, "filehash");
+}
+
+} // namespace
+
+TEST_CASE("Read-only cache leaves the file to its owner when invalidated", "[cachemanager]") {
+    ensureApplication();
+    QTemporaryDir dir;
+    const QString fileName = writeCacheFile(dir);
+
+    CacheManager reader;
+    reader.setReadOnly(true);
+    useCustomCacheFile(reader, fileName, "aaaa");
+    REQUIRE(reader.isCached("aaaa"));
+
+    reader.invalidateCache();
+    CHECK_FALSE(reader.isCached("aaaa"));
+    CHECK(QFile::exists(fileName));
+
+    QString path;
+    CHECK_FALSE(reader.setupCacheForDownload("aaaa", 0, path));
+}
+
+TEST_CASE("Owner does not replace the cache file while another writer reads it", "[cachemanager]") {
+    ensureApplication();
+    QTemporaryDir dir;
+    const QString fileName = writeCacheFile(dir);
+
+    CacheManager owner;
+    CacheManager reader;
+    reader.setReadOnly(true);
+
+    owner.startBackgroundOperations();
+    QDeadlineTimer deadline(10000);
+    while (!owner.isReady() && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+    REQUIRE(owner.isReady());
+    if (!owner.getCacheStatus().hasAvailableSpace) {
+        SKIP("Not enough free space for caching");
+    }
+
+    useCustomCacheFile(owner, fileName, "aaaa");
+    useCustomCacheFile(reader, fileName, "aaaa");
+    REQUIRE(reader.useCacheFile("aaaa"));
+
+    QString path;
+    CHECK_FALSE(owner.setupCacheForDownload("bbbb", 0, path));
+    CHECK(QFile::exists(fileName));
+    CHECK(reader.isCached("aaaa"));
+
+    reader.releaseCacheFile();
+    REQUIRE(owner.setupCacheForDownload("bbbb", 0, path));
+    CHECK(path == fileName);
+
+    // Whatever the owner puts there next is not what the reader verified
+    CHECK_FALSE(reader.isCached("aaaa"));
+    CHECK_FALSE(reader.useCacheFile("aaaa"));
+}
+
+TEST_CASE("Cache transcode replaces the file when left alone", "[cachemanager][transcode]") {
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("image.cache");
+    const QByteArray fileHash = writeCompressedCacheFile(fileName, 20 * 1024 * 1024);
+
+    CacheTranscodeWorker worker;
+    bool transcoded = false;
+    QByteArray originalHash;
+    QObject::connect(&worker, &CacheTranscodeWorker::transcodeFinished, &worker,
+                     [&](bool done, const QString &, const QByteArray &, const QByteArray &original) {
+        transcoded = done;
+        originalHash = original;
+    }, Qt::DirectConnection);
+
+    worker.clearAbort();
+    worker.transcodeCacheFile(fileName, fileHash, false);
+    CHECK(transcoded);
+    CHECK(originalHash == fileHash);
+    CHECK(QCryptographicHash::hash(readFile(fileName), QCryptographicHash::Sha256).toHex() != fileHash);
+}
+
+TEST_CASE("Aborted cache transcode never replaces a file written after it", "[cachemanager][transcode]") {
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("image.cache");
+    const QByteArray fileHash = writeCompressedCacheFile(fileName, 64 * 1024 * 1024);
+    const QByteArray download(1024 * 1024, 'd');
+
+    CacheTranscodeWorker worker;
+    bool transcoded = true;
+    QByteArray originalHash = "unset";
+    QObject::connect(&worker, &CacheTranscodeWorker::transcodeFinished, &worker,
+                     [&](bool done, const QString &, const QByteArray &, const QByteArray &original) {
+        transcoded = done;
+        originalHash = original;
+    }, Qt::DirectConnection);
+
+    worker.clearAbort();
+    std::atomic<bool> finished = false;
+    std::thread job([&]() {
+        worker.transcodeCacheFile(fileName, fileHash, false);
+        finished = true;
+    });
+
+    // Wait for the transcoded copy to be started next to the file
+    QDeadlineTimer deadline(30000);
+    while (QDir(dir.path()).entryList(QDir::Files).size() < 2 && !finished && !deadline.hasExpired()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (finished) {
+        job.join();
+        FAIL("Transcode finished before it could be aborted");
+    }
+
+    // As setupCacheForDownload() does, then the download starts writing the same file
+    worker.abort();
+    {
+        QFile f(fileName);
+        CHECK(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        f.write(download);
+    }
+    job.join();
+
+    CHECK_FALSE(transcoded);
+    CHECK(originalHash.isEmpty());
+    CHECK(readFile(fileName) == download);
+    // The partial transcoded copy is gone as well
+    CHECK(QDir(dir.path()).entryList(QDir::Files) == QStringList{"image.cache"});
+}
@@ -0,0 +1,153 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "chunkstore.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+
+namespace {
+
+QByteArray randomData(qsizetype size, quint32 seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    QRandomGenerator rng(seed);
+    rng.fillRange(reinterpret_cast<quint32 *>(data.data()), size / 4);
+    return data;
+}
+
+QByteArray sha256(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+/* Feeds the image in odd-sized pieces, as a decompressor would */
+bool import(ChunkStore &store, const QByteArray &image)
+{
+    ChunkStore::Importer importer(store);
+    for (qsizetype pos = 0; pos < image.size(); pos += 100000) {
+        if (!importer.write(image.constData() + pos, static_cast<size_t>(qMin<qsizetype>(100000, image.size() - pos)))) {
+            return false;
+        }
+    }
+    return importer.finish(sha256(image));
+}
+
+QByteArray readBack(const ChunkStore &store, const QByteArray &imageHash)
+{
+    ChunkStore::Recipe recipe;
+    if (!ChunkStore::readRecipe(store.recipePath(imageHash), recipe)) {
+        return QByteArray();
+    }
+    QByteArray image;
+    for (const ChunkStore::Chunk &chunk : recipe.chunks) {
+        QByteArray data(chunk.length, Qt::Uninitialized);
+        if (!store.readChunk(chunk, data.data())) {
+            return QByteArray();
+        }
+        image += data;
+    }
+    return image;
+}
+
+} // namespace
+
+TEST_CASE("Chunk boundaries stay within the size limits", "[chunkstore]") {
+    const QByteArray data = randomData(8 * 1024 * 1024, 1);
+    const auto *p = reinterpret_cast<const uint8_t *>(data.constData());
+    size_t pos = 0, chunks = 0;
+    while (pos < static_cast<size_t>(data.size())) {
+        size_t len = ChunkStore::cutPoint(p + pos, data.size() - pos);
+        CHECK(len <= ChunkStore::MaxChunkSize);
+        if (pos + len < static_cast<size_t>(data.size())) {
+            CHECK(len >= ChunkStore::MinChunkSize);
+        }
+        pos += len;
+        chunks++;
+    }
+    // Averages a little above AvgChunkSize
+    CHECK(chunks >= 16);
+    CHECK(chunks <= 48);
+}
+
+TEST_CASE("Chunk store deduplicates shifted content", "[chunkstore]") {
+    QTemporaryDir dir;
+    ChunkStore store(dir.path());
+
+    // A variant with data inserted near the start and in the middle, and a zeroed tail
+    const QByteArray base = randomData(12 * 1024 * 1024, 2) + QByteArray(4 * 1024 * 1024, '\0');
+    const QByteArray variant = randomData(3000, 3) + base.left(6 * 1024 * 1024)
+                               + randomData(70000, 4) + base.mid(6 * 1024 * 1024);
+
+    REQUIRE(import(store, base));
+    REQUIRE(import(store, variant));
+    CHECK(store.contains(sha256(base)));
+    CHECK(store.contains(sha256(variant)));
+
+    CHECK(readBack(store, sha256(base)) == base);
+    CHECK(readBack(store, sha256(variant)) == variant);
+
+    // Only the chunks around the insertions differ
+    const ChunkStore::Statistics stats = store.statistics();
+    CHECK(stats.images == 2);
+    CHECK(stats.logicalBytes == base.size() + variant.size());
+    CHECK(stats.uniqueBytes < base.size() + 4 * 1024 * 1024);
+    CHECK(stats.dedupRatio() > 1.8);
+}
+
+TEST_CASE("Chunk store keeps the figures of the last import", "[chunkstore]") {
+    QTemporaryDir dir;
+    ChunkStore store(dir.path());
+    CHECK(store.savedStatistics().images == 0);
+
+    REQUIRE(import(store, randomData(2 * 1024 * 1024, 5)));
+    const ChunkStore::Statistics stats = store.statistics();
+    REQUIRE(store.saveStatistics(stats));
+
+    const ChunkStore::Statistics saved = ChunkStore(dir.path()).savedStatistics();
+    CHECK(saved.images == 1);
+    CHECK(saved.logicalBytes == stats.logicalBytes);
+    CHECK(saved.uniqueBytes == stats.uniqueBytes);
+    CHECK(saved.storedBytes == stats.storedBytes);
+
+    // Not counted as part of the store itself
+    CHECK(store.statistics().storedBytes == stats.storedBytes);
+}
+
+TEST_CASE("Chunk store rejects an image that does not match its hash", "[chunkstore][negative]") {
+    QTemporaryDir dir;
+    ChunkStore store(dir.path());
+    const QByteArray image = randomData(2 * 1024 * 1024, 5);
+
+    ChunkStore::Importer importer(store);
+    REQUIRE(importer.write(image.constData(), image.size()));
+    CHECK_FALSE(importer.finish(sha256("something else")));
+    CHECK_FALSE(importer.errorString().isEmpty());
+    CHECK_FALSE(store.contains(sha256(image)));
+    CHECK_FALSE(store.contains(sha256("something else")));
+}
+
+TEST_CASE("Chunk store detects a corrupted chunk", "[chunkstore][negative]") {
+    QTemporaryDir dir;
+    ChunkStore store(dir.path());
+    const QByteArray image = randomData(2 * 1024 * 1024, 6);
+    REQUIRE(import(store, image));
+
+    ChunkStore::Recipe recipe;
+    REQUIRE(ChunkStore::readRecipe(store.recipePath(sha256(image)), recipe));
+    const ChunkStore::Chunk &chunk = recipe.chunks.front();
+    const QString path = QString("%1/chunks/%2/%3").arg(dir.path(), QString::fromLatin1(chunk.hash.left(2)), QString::fromLatin1(chunk.hash));
+    QFile f(path);
+    REQUIRE(f.open(QIODevice::ReadWrite));
+    f.seek(f.size() / 2);
+    f.write("corrupt");
+    f.close();
+
+    QByteArray out(chunk.length, Qt::Uninitialized);
+    CHECK_FALSE(store.readChunk(chunk, out.data()));
+}
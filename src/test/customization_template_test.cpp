@@ -0,0 +1,217 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include "customization_template.h"
+
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <memory>
+
+using namespace rpi_imager;
+using Catch::Matchers::ContainsSubstring;
+using Catch::Matchers::StartsWith;
+
+namespace {
+
+QString writeFile(const QTemporaryDir &dir, const QString &name, const QByteArray &contents)
+{
+    QFile f(dir.filePath(name));
+    f.open(QIODevice::WriteOnly);
+    f.write(contents);
+    return f.fileName();
+}
+
+bool haveSshKeygen()
+{
+    return !QStandardPaths::findExecutable(CustomisationTemplate::sshKeygenProgram()).isEmpty();
+}
+
+} // namespace
+
+TEST_CASE("CustomisationTemplate expands placeholders", "[template]") {
+    QVariantMap vars;
+    vars["hostname"] = "pi01";
+    vars["site.id"] = 7;
+
+    QStringList missing;
+    CHECK(CustomisationTemplate::expand("{{hostname}}-{{ site.id }}", vars, &missing) == "pi01-7");
+    CHECK(missing.isEmpty());
+
+    CHECK(CustomisationTemplate::expand("{{hostname}} {{serial}} {not} {{}}", vars, &missing) == "pi01 {{serial}} {not} {{}}");
+    CHECK(missing == QStringList{"serial"});
+}
+
+TEST_CASE("CustomisationTemplate loads CSV variables", "[template]") {
+    QTemporaryDir dir;
+    const QString file = writeFile(dir, "fleet.csv",
+        "hostname,destination,motd\r\n"
+        "pi01,/dev/sdb,\"Hello, \"\"world\"\"\"\r\n"
+        "pi02,/dev/sdc,\"two\nlines\"\r\n"
+        "\r\n");
+
+    QList<QVariantMap> rows;
+    QString error;
+    REQUIRE(CustomisationTemplate::loadVariables(file, rows, error));
+    REQUIRE(rows.size() == 2);
+    CHECK(rows[0]["hostname"] == "pi01");
+    CHECK(rows[0]["motd"] == "Hello, \"world\"");
+    CHECK(rows[1]["destination"] == "/dev/sdc");
+    CHECK(rows[1]["motd"] == "two\nlines");
+}
+
+TEST_CASE("CustomisationTemplate rejects malformed CSV variables", "[template][negative]") {
+    QTemporaryDir dir;
+    QList<QVariantMap> rows;
+    QString error;
+
+    CHECK_FALSE(CustomisationTemplate::loadVariables(writeFile(dir, "short.csv", "hostname,destination\npi01\n"), rows, error));
+    CHECK_THAT(error.toStdString(), ContainsSubstring("expected 2 fields"));
+
+    CHECK_FALSE(CustomisationTemplate::loadVariables(writeFile(dir, "noname.csv", "hostname,\npi01,x\n"), rows, error));
+    CHECK_FALSE(CustomisationTemplate::loadVariables(dir.filePath("absent.csv"), rows, error));
+}
+
+TEST_CASE("CustomisationTemplate loads JSON variables", "[template]") {
+    QTemporaryDir dir;
+    QList<QVariantMap> rows;
+    QString error;
+
+    REQUIRE(CustomisationTemplate::loadVariables(writeFile(dir, "fleet.json", R"([{"hostname": "pi01"}, {"hostname": "pi02"}])"), rows, error));
+    REQUIRE(rows.size() == 2);
+    CHECK(rows[1]["hostname"] == "pi02");
+
+    CHECK_FALSE(CustomisationTemplate::loadVariables(writeFile(dir, "bad.json", R"({"hostname": "pi01"})"), rows, error));
+}
+
+TEST_CASE("CustomisationTemplate hashes passwords with a fresh salt", "[template]") {
+    const QString a = CustomisationTemplate::cryptPassword("secret", false);
+    const QString b = CustomisationTemplate::cryptPassword("secret", false);
+    CHECK_THAT(a.toStdString(), StartsWith("$5$"));
+    CHECK(a != b);
+
+    const QString y = CustomisationTemplate::cryptPassword("secret", true);
+    CHECK_THAT(y.toStdString(), StartsWith("$y$"));
+}
+
+TEST_CASE("CustomisationTemplate generates per-device settings", "[template]") {
+    QVariantMap settings;
+    settings["hostname"] = "{{hostname}}";
+    settings["sshUserName"] = "admin";
+    settings["sshUserPassword"] = "{{password}}";
+    settings["recommendedWifiCountry"] = "GB";
+    CustomisationTemplate t(settings, false);
+
+    QVariantMap vars;
+    vars["hostname"] = "pi01";
+    vars["password"] = "secret";
+    CustomisationTemplate::Artifacts a = t.generate(vars);
+
+    REQUIRE(a.error.isEmpty());
+    CHECK_THAT(a.firstRun.toStdString(), ContainsSubstring("set_hostname pi01"));
+    CHECK_THAT(a.firstRun.toStdString(), ContainsSubstring("$5$"));
+    CHECK_FALSE(a.firstRun.contains("secret"));
+    CHECK(a.cmdline == " cfg80211.ieee80211_regdom=GB");
+    CHECK(a.cloudInit.isEmpty());
+
+    vars.remove("password");
+    a = t.generate(vars);
+    CHECK_THAT(a.error.toStdString(), ContainsSubstring("password"));
+    CHECK(a.firstRun.isEmpty());
+}
+
+TEST_CASE("CustomisationTemplate expands literal cloud-init files", "[template][cloudinit]") {
+    CustomisationTemplate t(QVariantMap(), true);
+    t.setCloudInitTemplates("#cloud-config\nhostname: {{hostname}}\n", "network:\n  version: 2\n");
+
+    QVariantMap vars;
+    vars["hostname"] = "pi02";
+    CustomisationTemplate::Artifacts a = t.generate(vars);
+
+    REQUIRE(a.error.isEmpty());
+    CHECK(a.cloudInit == "#cloud-config\nhostname: \"pi02\"\n");
+    CHECK(a.cloudInitNetwork == "network:\n  version: 2\n");
+    CHECK(a.firstRun.isEmpty());
+}
+
+TEST_CASE("CustomisationTemplate quotes values in literal files", "[template]") {
+    QVariantMap vars;
+    vars["hostname"] = "pi03";
+    vars["motd"] = "it's \"$(reboot)\"\nline two";
+
+    CustomisationTemplate firstRun(QVariantMap(), false);
+    firstRun.setFirstRunTemplate("#!/bin/sh\nhostnamectl set-hostname {{hostname}}\necho {{motd}} > /etc/motd\n");
+    CustomisationTemplate::Artifacts a = firstRun.generate(vars);
+    REQUIRE(a.error.isEmpty());
+    CHECK(a.firstRun == "#!/bin/sh\nhostnamectl set-hostname 'pi03'\n"
+                        "echo 'it'\"'\"'s \"$(reboot)\"\nline two' > /etc/motd\n");
+
+    CustomisationTemplate cloudInit(QVariantMap(), true);
+    cloudInit.setCloudInitTemplates("#cloud-config\nhostname: {{hostname}}\nwrite_files:\n- path: /etc/motd\n  content: {{motd}}\n",
+                                    QByteArray());
+    a = cloudInit.generate(vars);
+    REQUIRE(a.error.isEmpty());
+    CHECK(a.cloudInit == "#cloud-config\nhostname: \"pi03\"\nwrite_files:\n- path: /etc/motd\n"
+                         "  content: \"it's \\\"$(reboot)\\\"\\nline two\"\n");
+
+    // Settings are quoted by the generator itself, not twice
+    CHECK(CustomisationTemplate::expand("{{motd}}", vars) == vars["motd"].toString());
+}
+
+TEST_CASE("CustomisationTemplate generates a distinct SSH host key per device", "[template][ssh]") {
+    if (!haveSshKeygen())
+        SKIP("ssh-keygen not available");
+
+    QVariantMap settings;
+    settings["hostname"] = "{{hostname}}";
+    settings["sshEnabled"] = true;
+    settings["sshHostKeys"] = true;
+    auto t = std::make_shared<CustomisationTemplate>(settings, false);
+
+    QVariantMap vars;
+    vars["hostname"] = "pi01";
+    CustomisationTemplate::Artifacts a = t->generate(vars);
+    vars["hostname"] = "pi02";
+    CustomisationTemplate::Artifacts b = t->generate(vars);
+
+    INFO(a.error.toStdString());
+    REQUIRE(a.error.isEmpty());
+    CHECK_THAT(a.firstRun.toStdString(), ContainsSubstring("BEGIN OPENSSH PRIVATE KEY"));
+    CHECK_THAT(a.firstRun.toStdString(), ContainsSubstring("root@pi01"));
+    CHECK_THAT(b.firstRun.toStdString(), ContainsSubstring("root@pi02"));
+    CHECK(a.firstRun != b.firstRun);
+}
+
+TEST_CASE("CustomisationPregenerator returns every device in order", "[template]") {
+    QVariantMap settings;
+    settings["hostname"] = "{{hostname}}";
+    settings["sshUserName"] = "admin";
+    settings["sshUserPassword"] = "secret";
+    auto t = std::make_shared<const CustomisationTemplate>(settings, false);
+
+    CustomisationPregenerator pregenerator(3);
+    QList<int> tickets;
+    for (int i = 0; i < 10; i++)
+    {
+        QVariantMap vars;
+        vars["hostname"] = QStringLiteral("pi%1").arg(i);
+        tickets.append(pregenerator.enqueue(t, vars));
+    }
+    pregenerator.start();
+
+    // Taken without waiting: the writes carry on once each is ready
+    QList<QFuture<CustomisationTemplate::Artifacts>> futures;
+    for (int ticket : tickets)
+        futures.append(pregenerator.take(ticket));
+
+    for (int i = 0; i < futures.size(); i++)
+    {
+        CustomisationTemplate::Artifacts a = futures[i].result();
+        REQUIRE(a.error.isEmpty());
+        CHECK_THAT(a.firstRun.toStdString(), ContainsSubstring(QStringLiteral("set_hostname pi%1\n").arg(i).toStdString()));
+    }
+}
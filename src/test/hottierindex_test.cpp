@@ -0,0 +1,151 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "hottierindex.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QTemporaryDir>
+
+namespace {
+
+HotTierEntry addEntry(HotTierIndex &index, const QString &directory, const QByteArray &hash, qint64 bytes, qint64 lastUsed)
+{
+    HotTierEntry entry;
+    entry.hash = hash;
+    entry.fileName = directory + "/" + QString::fromLatin1(hash) + ".cache";
+    entry.bytes = bytes;
+    entry.lastUsed = lastUsed;
+
+    QFile f(entry.fileName);
+    if (f.open(QIODevice::WriteOnly)) {
+        f.write(QByteArray(16, 'x'));
+    }
+    index.entries.push_back(entry);
+    return entry;
+}
+
+} // namespace
+
+TEST_CASE("Hot tier index survives a reload", "[hottier]") {
+    QTemporaryDir dir;
+    {
+        HotTierIndex index(dir.path());
+        REQUIRE(index.isLocked());
+        addEntry(index, dir.path(), "aaaa", 100, 1);
+        addEntry(index, dir.path(), "bbbb", 200, 2);
+        REQUIRE(index.save());
+    }
+
+    HotTierIndex index(dir.path());
+    REQUIRE(index.isLocked());
+    REQUIRE(index.entries.size() == 2);
+    CHECK(index.entries[0].hash == "aaaa");
+    CHECK(index.entries[0].fileName == dir.path() + "/aaaa.cache");
+    CHECK(index.entries[1].bytes == 200);
+    CHECK(index.entries[1].lastUsed == 2);
+    CHECK(index.usedBytes() == 300);
+}
+
+TEST_CASE("Hot tier index drops entries whose file is gone", "[hottier]") {
+    QTemporaryDir dir;
+    {
+        HotTierIndex index(dir.path());
+        const HotTierEntry removed = addEntry(index, dir.path(), "aaaa", 100, 1);
+        addEntry(index, dir.path(), "bbbb", 200, 2);
+        REQUIRE(index.save());
+        QFile::remove(removed.fileName);
+    }
+
+    HotTierIndex index(dir.path());
+    REQUIRE(index.entries.size() == 1);
+    CHECK(index.entries[0].hash == "bbbb");
+}
+
+TEST_CASE("Hot tier evicts the least recently used entries first", "[hottier]") {
+    QTemporaryDir dir;
+    HotTierIndex index(dir.path());
+    const HotTierEntry middle = addEntry(index, dir.path(), "aaaa", 100, 20);
+    const HotTierEntry oldest = addEntry(index, dir.path(), "bbbb", 100, 10);
+    const HotTierEntry newest = addEntry(index, dir.path(), "cccc", 100, 30);
+
+    CHECK(index.evict(400, 100));
+    CHECK(index.entries.size() == 3);
+
+    CHECK(index.evict(400, 150));
+    REQUIRE(index.entries.size() == 2);
+    CHECK_FALSE(QFile::exists(oldest.fileName));
+    CHECK(QFile::exists(middle.fileName));
+
+    CHECK(index.evict(400, 250));
+    REQUIRE(index.entries.size() == 1);
+    CHECK(index.entries[0].hash == "cccc");
+    CHECK_FALSE(QFile::exists(middle.fileName));
+    CHECK(QFile::exists(newest.fileName));
+}
+
+TEST_CASE("Hot tier eviction fails when the entry cannot fit", "[hottier][negative]") {
+    QTemporaryDir dir;
+    HotTierIndex index(dir.path());
+    addEntry(index, dir.path(), "aaaa", 100, 1);
+
+    CHECK_FALSE(index.evict(400, 500));
+    CHECK(index.entries.empty());
+    CHECK(index.usedBytes() == 0);
+}
+
+#ifdef Q_OS_UNIX
+TEST_CASE("Hot tier pins survive eviction", "[hottier]") {
+    QTemporaryDir dir;
+    HotTierIndex index(dir.path());
+    const HotTierEntry entry = addEntry(index, dir.path(), "aaaa", 100, 1);
+
+    const QString pinFile = index.pin("aaaa");
+    REQUIRE_FALSE(pinFile.isEmpty());
+    CHECK(index.entries[0].lastUsed > 1);
+    CHECK(index.pin("bbbb").isEmpty());
+
+    index.evict(50, 0);
+    CHECK_FALSE(QFile::exists(entry.fileName));
+    CHECK(QFile::exists(pinFile));
+
+    HotTierIndex::releasePin(pinFile);
+    CHECK_FALSE(QFile::exists(pinFile));
+}
+
+TEST_CASE("Hot tier directory must belong to this user", "[hottier][negative]") {
+    QTemporaryDir dir;
+    const QString tier = dir.path() + "/tier";
+    REQUIRE(HotTierIndex::secureDirectory(tier));
+    CHECK_FALSE(QFile::permissions(tier).testAnyFlags(QFileDevice::ReadGroup | QFileDevice::ReadOther));
+    // Existing directories are accepted and tightened
+    REQUIRE(QFile::setPermissions(tier, QFile::permissions(tier) | QFileDevice::WriteOther));
+    CHECK(HotTierIndex::secureDirectory(tier));
+    CHECK_FALSE(QFile::permissions(tier).testFlag(QFileDevice::WriteOther));
+
+    // A link planted where the tier is expected is not followed
+    const QString link = dir.path() + "/link";
+    REQUIRE(QFile::link(tier, link));
+    CHECK_FALSE(HotTierIndex::secureDirectory(link));
+
+    CHECK_FALSE(HotTierIndex::secureDirectory(QString()));
+}
+
+TEST_CASE("Hot tier removes pins of processes that are gone", "[hottier]") {
+    QTemporaryDir dir;
+    const QString ownPin = QString("%1/aaaa.cache.pin%2").arg(dir.path()).arg(QCoreApplication::applicationPid());
+    // Above any pid_max, so never a running process
+    const QString stalePin = dir.path() + "/bbbb.cache.pin2147483000";
+    for (const QString &name : {ownPin, stalePin}) {
+        QFile f(name);
+        REQUIRE(f.open(QIODevice::WriteOnly));
+    }
+
+    HotTierIndex::removeStaleFiles(dir.path());
+    CHECK(QFile::exists(ownPin));
+    CHECK_FALSE(QFile::exists(stalePin));
+}
+#endif
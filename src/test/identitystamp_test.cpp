@@ -0,0 +1,203 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "identitystamp.h"
+#include "simulated_file_operations.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QtEndian>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace rpi_imager;
+
+namespace {
+
+constexpr std::uint64_t MiB = 1024 * 1024;
+constexpr std::uint64_t ImageSize = 8 * MiB;
+constexpr int DigestSize = 32;
+
+// Field offsets in the record, as laid out by IdentityStamp::_serialize()
+constexpr int VersionOffset = 16;
+constexpr int SampleSizeOffset = 140;
+constexpr int ChunkCountOffset = 144;
+
+SimulatedDeviceProfile quietProfile()
+{
+    SimulatedDeviceProfile p;
+    p.capacity = 64 * MiB;
+    p.latency_median_us = 0;
+    p.sync_latency_us = 0;
+    p.misaligned_penalty_us = 0;
+    p.au_switch_penalty_us = 0;
+    p.time_scale = 0;
+    return p;
+}
+
+QByteArray readAt(FileOperations &dev, std::uint64_t offset, std::size_t size)
+{
+    QByteArray data(static_cast<qsizetype>(size), '\0');
+    std::size_t bytesRead = 0;
+    if (dev.Seek(offset) != FileError::kSuccess
+        || dev.ReadSequential(reinterpret_cast<std::uint8_t *>(data.data()), size, bytesRead) != FileError::kSuccess)
+        return QByteArray();
+    return data.left(static_cast<qsizetype>(bytesRead));
+}
+
+bool writeAt(FileOperations &dev, std::uint64_t offset, const QByteArray &data)
+{
+    return dev.Seek(offset) == FileError::kSuccess
+        && dev.WriteSequential(reinterpret_cast<const std::uint8_t *>(data.constData()), static_cast<std::size_t>(data.size())) == FileError::kSuccess;
+}
+
+/* An image whose only partition starts at 4 MiB, leaving the gap below 1 MiB empty */
+QByteArray writeImage(FileOperations &dev)
+{
+    QByteArray image(static_cast<qsizetype>(ImageSize), '\0');
+    for (qsizetype i = 2 * MiB; i < image.size(); i++)
+        image[i] = static_cast<char>(i * 31 + i / 4096);
+
+    image[446 + 4] = static_cast<char>(0x0c);
+    qToLittleEndian<quint32>(4 * MiB / 512, image.data() + 446 + 8);
+    qToLittleEndian<quint32>(4 * MiB / 512, image.data() + 446 + 12);
+    image[510] = static_cast<char>(0x55);
+    image[511] = static_cast<char>(0xAA);
+
+    writeAt(dev, 0, image);
+    return QCryptographicHash::hash(image, QCryptographicHash::Sha256).toHex();
+}
+
+QByteArray customisation()
+{
+    return IdentityStamp::customisationHash("config", "cmdline", "firstrun", "", "", "systemd",
+                                            ImageOptions::EnableSsh);
+}
+
+/* Recompute the trailing digest, so only the checks on the contents can reject the record */
+QByteArray resign(QByteArray record)
+{
+    const qsizetype body = static_cast<qsizetype>(IdentityStamp::Size) - DigestSize;
+    record.replace(body, DigestSize, QCryptographicHash::hash(record.left(body), QCryptographicHash::Sha256));
+    return record;
+}
+
+} // namespace
+
+TEST_CASE("Identity stamp survives a round trip", "[identitystamp]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+    const QByteArray imageHash = writeImage(dev);
+    const QByteArray customisationHash = customisation();
+
+    IdentityStamp written;
+    REQUIRE(written.write(&dev, imageHash, customisationHash, ImageSize));
+    // One sample per MiB between the stamp and the end of the image
+    CHECK(written.sampleCount() == 7);
+
+    IdentityStamp stamp;
+    REQUIRE(stamp.read(&dev));
+    CHECK(stamp.imageSize() == ImageSize);
+    CHECK(stamp.sampleCount() == written.sampleCount());
+    CHECK(stamp.writeTime() == written.writeTime());
+    CHECK(stamp.writeTime() <= QDateTime::currentSecsSinceEpoch());
+    CHECK(stamp.confirm(&dev, imageHash, customisationHash));
+
+    CHECK_FALSE(stamp.confirm(&dev, imageHash, IdentityStamp::customisationHash("", "", "", "", "", "", {})));
+    CHECK_FALSE(stamp.confirm(&dev, QByteArray(64, '0'), customisationHash));
+}
+
+TEST_CASE("Identity stamp notices a card changed after writing", "[identitystamp]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+    const QByteArray imageHash = writeImage(dev);
+
+    IdentityStamp written;
+    REQUIRE(written.write(&dev, imageHash, customisation(), ImageSize));
+
+    IdentityStamp stamp;
+    REQUIRE(stamp.read(&dev));
+
+    SECTION("partition table") {
+        REQUIRE(writeAt(dev, 446 + 12, QByteArray(1, '\x01')));
+    }
+    SECTION("start of a chunk") {
+        REQUIRE(writeAt(dev, 4 * MiB + 10, QByteArray(1, '\x01')));
+    }
+
+    CHECK_FALSE(stamp.confirm(&dev, imageHash, customisation()));
+}
+
+TEST_CASE("Identity stamp is not written over data of the image", "[identitystamp][negative]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+    const QByteArray imageHash = writeImage(dev);
+
+    SECTION("area in use") {
+        REQUIRE(writeAt(dev, IdentityStamp::Offset + 100, QByteArray(1, '\x01')));
+    }
+    SECTION("first partition inside the area") {
+        QByteArray start(4, '\0');
+        qToLittleEndian<quint32>(2048 - 4, start.data());
+        REQUIRE(writeAt(dev, 446 + 8, start));
+    }
+
+    IdentityStamp written;
+    CHECK_FALSE(written.write(&dev, imageHash, customisation(), ImageSize));
+    IdentityStamp stamp;
+    CHECK_FALSE(stamp.read(&dev));
+}
+
+TEST_CASE("Identity stamp rejects malformed or truncated records", "[identitystamp][negative]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+    const QByteArray imageHash = writeImage(dev);
+
+    IdentityStamp written;
+    REQUIRE(written.write(&dev, imageHash, customisation(), ImageSize));
+    const QByteArray record = readAt(dev, IdentityStamp::Offset, IdentityStamp::Size);
+    REQUIRE(record.size() == static_cast<qsizetype>(IdentityStamp::Size));
+
+    // Re-signing alone does not make a record invalid
+    REQUIRE(writeAt(dev, IdentityStamp::Offset, resign(record)));
+    IdentityStamp resigned;
+    REQUIRE(resigned.read(&dev));
+
+    const std::vector<std::pair<const char *, std::function<QByteArray(QByteArray)>>> corruptions = {
+        {"flipped bit", [](QByteArray r) { r[200] = static_cast<char>(r[200] ^ 0x10); return r; }},
+        {"second half lost", [](QByteArray r) { return r.left(r.size() / 2) + QByteArray(r.size() / 2, '\0'); }},
+        {"wrong magic", [](QByteArray r) { r[0] = 'X'; return resign(r); }},
+        {"unknown version", [](QByteArray r) {
+            qToLittleEndian<quint32>(2, r.data() + VersionOffset);
+            return resign(r);
+        }},
+        {"samples missing", [](QByteArray r) {
+            qToLittleEndian<quint32>(3, r.data() + ChunkCountOffset);
+            return resign(r);
+        }},
+        {"more samples than allowed", [](QByteArray r) {
+            qToLittleEndian<quint32>(1000, r.data() + ChunkCountOffset);
+            return resign(r);
+        }},
+        {"empty samples", [](QByteArray r) {
+            qToLittleEndian<quint32>(0, r.data() + SampleSizeOffset);
+            return resign(r);
+        }},
+        {"blank", [](QByteArray r) { return QByteArray(r.size(), '\0'); }},
+    };
+
+    for (const auto &[name, corrupt] : corruptions) {
+        INFO(name);
+        REQUIRE(writeAt(dev, IdentityStamp::Offset, corrupt(record)));
+        IdentityStamp stamp;
+        CHECK_FALSE(stamp.read(&dev));
+    }
+}
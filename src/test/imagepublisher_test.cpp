@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include "imagepublisher.h"
+#include "zstdseekable.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <lzma.h>
+#include <zstd.h>
+
+using Catch::Matchers::ContainsSubstring;
+
+namespace {
+
+constexpr qint64 ImageSize = 40 * 1024 * 1024;
+
+/* 40 MB image with 1 MB of random data at 0 and at 32 MB, and a hole in between */
+QString writeSparseImage(const QTemporaryDir &dir)
+{
+    QFile f(dir.filePath("test.img"));
+    f.open(QIODevice::WriteOnly);
+    QByteArray data(1024 * 1024, Qt::Uninitialized);
+    QRandomGenerator rng(42);
+    rng.fillRange(reinterpret_cast<quint32 *>(data.data()), data.size() / 4);
+    f.write(data);
+    f.seek(32 * 1024 * 1024);
+    f.write(data);
+    f.resize(ImageSize);
+    return f.fileName();
+}
+
+QByteArray readFile(const QString &fileName)
+{
+    QFile f(fileName);
+    f.open(QIODevice::ReadOnly);
+    return f.readAll();
+}
+
+QJsonObject readJson(const QString &fileName)
+{
+    return QJsonDocument::fromJson(readFile(fileName)).object();
+}
+
+} // namespace
+
+TEST_CASE("ImagePublisher writes seekable zstd and its metadata", "[publish]") {
+    QTemporaryDir dir;
+    const QString image = writeSparseImage(dir);
+    const QByteArray raw = readFile(image);
+
+    ImagePublisher::Options options;
+    options.threads = 2;
+    options.level = 3;
+    options.baseUrl = "https://example.com/images";
+    QString outText, errText;
+    QTextStream out(&outText), err(&errText);
+    REQUIRE(ImagePublisher::publish(image, dir.filePath("out"), options, out, err) == 0);
+
+    /* Frames decode back to the image, and the seek table lists one per block */
+    const QByteArray zst = readFile(dir.filePath("out/test.img.zst"));
+    REQUIRE(ZstdSeekable::isSeekable(dir.filePath("out/test.img.zst")));
+    QByteArray decoded(ImageSize, Qt::Uninitialized);
+    CHECK(ZSTD_decompress(decoded.data(), decoded.size(), zst.constData(), zst.size()) == static_cast<size_t>(ImageSize));
+    CHECK(decoded == raw);
+    const quint32 frames = qFromLittleEndian<quint32>(zst.constData() + zst.size() - 9);
+    CHECK(frames == 3);     // 16 MB frames
+
+    /* Only the two data ranges are mapped, each with its own hash */
+    const QByteArray bmap = readFile(dir.filePath("out/test.img.bmap"));
+    const QByteArray rangeHash = QCryptographicHash::hash(raw.left(1024 * 1024), QCryptographicHash::Sha256).toHex();
+    CHECK_THAT(bmap.toStdString(), ContainsSubstring("<MappedBlocksCount> 512 </MappedBlocksCount>"));
+    CHECK_THAT(bmap.toStdString(), ContainsSubstring("<Range chksum=\"" + rangeHash.toStdString() + "\"> 0-255 </Range>"));
+    CHECK_THAT(bmap.toStdString(), ContainsSubstring("\"> 8192-8447 </Range>"));
+
+    const QJsonObject manifest = readJson(dir.filePath("out/test.img.zst.chunks.json"));
+    CHECK(manifest["size"].toInteger() == zst.size());
+    CHECK(manifest["chunks"].toArray().size() == (zst.size() + 4 * 1024 * 1024 - 1) / (4 * 1024 * 1024));
+    CHECK(manifest["chunks"].toArray().first().toString()
+          == QString::fromLatin1(QCryptographicHash::hash(zst.left(4 * 1024 * 1024), QCryptographicHash::Sha256).toHex()));
+
+    const QJsonObject entry = readJson(dir.filePath("out/test.json"));
+    CHECK(entry["url"].toString() == "https://example.com/images/test.img.zst");
+    CHECK(entry["extract_size"].toInteger() == ImageSize);
+    CHECK(entry["extract_sha256"].toString() == QString::fromLatin1(QCryptographicHash::hash(raw, QCryptographicHash::Sha256).toHex()));
+    CHECK(entry["image_download_size"].toInteger() == zst.size());
+    CHECK(entry["image_download_sha256"].toString() == QString::fromLatin1(QCryptographicHash::hash(zst, QCryptographicHash::Sha256).toHex()));
+    CHECK(QJsonDocument::fromJson(outText.toUtf8()).object() == entry);
+}
+
+TEST_CASE("ImagePublisher writes multi-block xz", "[publish]") {
+    QTemporaryDir dir;
+    const QString image = writeSparseImage(dir);
+
+    ImagePublisher::Options options;
+    options.compression = ImagePublisher::Compression::Xz;
+    options.threads = 2;
+    options.level = 0;
+    QString outText, errText;
+    QTextStream out(&outText), err(&errText);
+    REQUIRE(ImagePublisher::publish(image, dir.filePath("out"), options, out, err) == 0);
+
+    const QByteArray xz = readFile(dir.filePath("out/test.img.xz"));
+    QByteArray decoded(ImageSize, Qt::Uninitialized);
+    uint64_t memlimit = UINT64_MAX;
+    size_t inPos = 0, outPos = 0;
+    REQUIRE(lzma_stream_buffer_decode(&memlimit, 0, nullptr,
+                                      reinterpret_cast<const uint8_t *>(xz.constData()), &inPos, xz.size(),
+                                      reinterpret_cast<uint8_t *>(decoded.data()), &outPos, decoded.size()) == LZMA_OK);
+    CHECK(decoded == readFile(image));
+
+    /* One block per 16 MB, so it can be decoded in parallel */
+    lzma_index *index = nullptr;
+    memlimit = UINT64_MAX;
+    size_t indexPos = 0;
+    lzma_stream_flags footer;
+    REQUIRE(lzma_stream_footer_decode(&footer, reinterpret_cast<const uint8_t *>(xz.constData()) + xz.size() - LZMA_STREAM_HEADER_SIZE) == LZMA_OK);
+    const qsizetype indexStart = xz.size() - LZMA_STREAM_HEADER_SIZE - static_cast<qsizetype>(footer.backward_size);
+    REQUIRE(lzma_index_buffer_decode(&index, &memlimit, nullptr,
+                                     reinterpret_cast<const uint8_t *>(xz.constData()) + indexStart, &indexPos, footer.backward_size) == LZMA_OK);
+    CHECK(lzma_index_block_count(index) == 3);
+    lzma_index_end(index, nullptr);
+
+    CHECK(readJson(dir.filePath("out/test.json"))["url"].toString() == "test.img.xz");
+}
+
+TEST_CASE("ImagePublisher refuses compressed input", "[publish][negative]") {
+    QTemporaryDir dir;
+    QFile f(dir.filePath("test.img.xz"));
+    f.open(QIODevice::WriteOnly);
+    f.write("\xFD" "7zXZ\0\0", 6);
+    f.close();
+
+    QString outText, errText;
+    QTextStream out(&outText), err(&errText);
+    CHECK(ImagePublisher::publish(f.fileName(), dir.filePath("out"), ImagePublisher::Options(), out, err) == 1);
+    err.flush();
+    CHECK_THAT(errText.toStdString(), ContainsSubstring("xz compressed"));
+}
@@ -0,0 +1,362 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "linux/ktlsdownload.h"
+
+#include <QTemporaryFile>
+#include <gnutls/x509.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::vector<char> pattern(std::size_t size)
+{
+    std::vector<char> data(size);
+    for (std::size_t i = 0; i < size; i++)
+        data[i] = static_cast<char>(i * 31 + i / 4096);
+    return data;
+}
+
+/*
+ * Minimal HTTPS stand-in: self-signed certificate for "localhost", one
+ * response per connection, serving a fixed payload with Range support
+ */
+class TestServer
+{
+public:
+    explicit TestServer(const std::vector<char> &payload)
+        : _payload(payload), _chunked(false), _cutAt(0)
+    {
+        gnutls_x509_privkey_init(&_key);
+        gnutls_x509_privkey_generate(_key, GNUTLS_PK_ECDSA, GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_SECP256R1), 0);
+
+        gnutls_x509_crt_init(&_crt);
+        gnutls_x509_crt_set_version(_crt, 3);
+        unsigned char serial = 1;
+        gnutls_x509_crt_set_serial(_crt, &serial, 1);
+        gnutls_x509_crt_set_activation_time(_crt, time(nullptr) - 3600);
+        gnutls_x509_crt_set_expiration_time(_crt, time(nullptr) + 3600);
+        gnutls_x509_crt_set_dn_by_oid(_crt, GNUTLS_OID_X520_COMMON_NAME, 0, "localhost", 9);
+        gnutls_x509_crt_set_subject_alt_name(_crt, GNUTLS_SAN_DNSNAME, "localhost", 9, GNUTLS_FSAN_SET);
+        gnutls_x509_crt_set_basic_constraints(_crt, 1, -1);
+        gnutls_x509_crt_set_key(_crt, _key);
+        gnutls_x509_crt_sign2(_crt, _crt, _key, GNUTLS_DIG_SHA256, 0);
+
+        gnutls_datum_t pem;
+        gnutls_x509_crt_export2(_crt, GNUTLS_X509_FMT_PEM, &pem);
+        _caFile.open();
+        _caFile.write(reinterpret_cast<const char *>(pem.data), pem.size);
+        _caFile.flush();
+        gnutls_free(pem.data);
+
+        gnutls_certificate_allocate_credentials(&_credentials);
+        gnutls_certificate_set_x509_key(_credentials, &_crt, 1, _key);
+
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        bind(_listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        listen(_listener, 4);
+        getsockname(_listener, reinterpret_cast<sockaddr *>(&addr), &len);
+        _port = ntohs(addr.sin_port);
+    }
+
+    ~TestServer()
+    {
+        shutdown(_listener, SHUT_RDWR);
+        if (_thread.joinable())
+            _thread.join();
+        ::close(_listener);
+        gnutls_certificate_free_credentials(_credentials);
+        gnutls_x509_crt_deinit(_crt);
+        gnutls_x509_privkey_deinit(_key);
+    }
+
+    void setChunked(bool chunked) { _chunked = chunked; }
+
+    // Drop the next connection once the payload up to this offset has been sent
+    void cutNextAt(std::size_t offset) { _cutAt = offset; }
+
+    // Serve the given number of connections in the background
+    void start(int connections)
+    {
+        _thread = std::thread([this, connections]() {
+            for (int i = 0; i < connections; i++)
+            {
+                int fd = accept(_listener, nullptr, nullptr);
+                if (fd < 0)
+                    return;
+                _serve(fd);
+                ::close(fd);
+            }
+        });
+    }
+
+    QByteArray url(const char *path) const
+    {
+        return "https://localhost:" + QByteArray::number(_port) + path;
+    }
+
+    QString caFile() const { return _caFile.fileName(); }
+
+private:
+    void _serve(int fd)
+    {
+        gnutls_session_t session;
+        gnutls_init(&session, GNUTLS_SERVER);
+        gnutls_priority_set_direct(session, "NORMAL", nullptr);
+        gnutls_credentials_set(session, GNUTLS_CRD_CERTIFICATE, _credentials);
+        gnutls_transport_set_int(session, fd);
+
+        int r;
+        do {
+            r = gnutls_handshake(session);
+        } while (r < 0 && !gnutls_error_is_fatal(r));
+
+        std::string request;
+        char buf[4096];
+        while (r >= 0 && request.find("\r\n\r\n") == std::string::npos)
+        {
+            ssize_t n = gnutls_record_recv(session, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            request.append(buf, n);
+        }
+
+        if (r >= 0 && request.find("\r\n\r\n") != std::string::npos)
+        {
+            std::string response;
+            std::size_t offset = 0;
+            const std::size_t end = _cutAt ? std::min(_cutAt, _payload.size()) : _payload.size();
+            std::size_t range = request.find("Range: bytes=");
+            if (request.compare(0, 9, "GET /old ") == 0)
+                response = "HTTP/1.1 302 Found\r\nLocation: /image.bin\r\nContent-Length: 0\r\n\r\n";
+            else if (_chunked)
+                response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+            else
+            {
+                if (range != std::string::npos)
+                    offset = std::stoull(request.substr(range + 13));
+                response = std::string(range != std::string::npos ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n")
+                           + "Content-Length: " + std::to_string(_payload.size() - offset) + "\r\n"
+                           + "Last-Modified: Wed, 01 Jan 2025 00:00:00 GMT\r\n\r\n";
+                // Some body bytes in the same record as the header
+                response.append(_payload.data() + offset, std::min<std::size_t>(1000, end - offset));
+                offset += std::min<std::size_t>(1000, end - offset);
+            }
+
+            _send(session, response.data(), response.size());
+            if (!_chunked && request.compare(0, 9, "GET /old ") != 0)
+                _send(session, _payload.data() + offset, end - offset);
+            // A cut connection just closes, as when the network goes away
+            if (_cutAt)
+                _cutAt = 0;
+            else
+                gnutls_bye(session, GNUTLS_SHUT_WR);
+        }
+        gnutls_deinit(session);
+    }
+
+    static void _send(gnutls_session_t session, const char *data, std::size_t len)
+    {
+        while (len)
+        {
+            ssize_t n = gnutls_record_send(session, data, std::min<std::size_t>(len, 10000));
+            if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED)
+                continue;
+            if (n < 0)
+                return;
+            data += n;
+            len -= n;
+        }
+    }
+
+    const std::vector<char> &_payload;
+    bool _chunked;
+    std::size_t _cutAt;
+    gnutls_x509_privkey_t _key;
+    gnutls_x509_crt_t _crt;
+    gnutls_certificate_credentials_t _credentials;
+    QTemporaryFile _caFile;
+    int _listener;
+    quint16 _port;
+    std::thread _thread;
+};
+
+// Receives into fixed size buffers, like the ring buffer slots
+struct BufferSink
+{
+    explicit BufferSink(std::size_t bufferSize) : buffer(bufferSize) {}
+
+    KtlsDownload::Sink sink()
+    {
+        KtlsDownload::Sink s;
+        s.acquire = [this](size_t &capacity) {
+            capacity = buffer.size();
+            return buffer.data();
+        };
+        s.commit = [this](char *buf, size_t len) {
+            commits++;
+            received.insert(received.end(), buf, buf + len);
+            // The caller resumes from the progress reported, so it must cover every byte handed over
+            if (start + received.size() > lastNow)
+                unreported = true;
+        };
+        s.progress = [this](quint64 now, quint64 total) {
+            lastNow = now;
+            lastTotal = total;
+            return true;
+        };
+        s.header = [this](const std::string &line) {
+            headers += line;
+        };
+        return s;
+    }
+
+    std::vector<char> buffer, received;
+    std::string headers;
+    int commits = 0;
+    quint64 start = 0, lastNow = 0, lastTotal = 0;
+    bool unreported = false;
+};
+
+bool kernelTlsAvailable(KtlsDownload::Result result, const BufferSink &sink)
+{
+    if (KtlsDownload::kernelSupported())
+        return true;
+    // Without kernel support nothing may reach the sink, so curl can take over
+    CHECK(result == KtlsDownload::Result::Unsupported);
+    CHECK(sink.received.empty());
+    return false;
+}
+
+} // namespace
+
+TEST_CASE("kTLS download receives the body into sink buffers", "[ktls]") {
+    std::vector<char> payload = pattern(3 * 1024 * 1024 + 123);
+    TestServer server(payload);
+    server.start(1);
+
+    BufferSink sink(256 * 1024);
+    KtlsDownload download(server.url("/image.bin"));
+    download.setCaFile(server.caFile());
+    KtlsDownload::Result result = download.run(sink.sink());
+    if (!kernelTlsAvailable(result, sink))
+        SKIP("Kernel TLS not available");
+
+    INFO(download.errorString().toStdString());
+    REQUIRE(result == KtlsDownload::Result::Complete);
+    CHECK(sink.received == payload);
+    CHECK(sink.lastNow == payload.size());
+    CHECK(sink.lastTotal == payload.size());
+    CHECK(download.bytesReceived() == payload.size());
+    CHECK(sink.headers.find("Last-Modified: ") != std::string::npos);
+    CHECK_FALSE(download.description().isEmpty());
+}
+
+TEST_CASE("kTLS download resumes from an offset", "[ktls]") {
+    std::vector<char> payload = pattern(1024 * 1024);
+    const quint64 offset = 300000;
+    TestServer server(payload);
+    server.start(1);
+
+    BufferSink sink(64 * 1024);
+    sink.start = offset;
+    KtlsDownload download(server.url("/image.bin"), offset);
+    download.setCaFile(server.caFile());
+    KtlsDownload::Result result = download.run(sink.sink());
+    if (!kernelTlsAvailable(result, sink))
+        SKIP("Kernel TLS not available");
+
+    REQUIRE(result == KtlsDownload::Result::Complete);
+    CHECK(sink.received == std::vector<char>(payload.begin() + offset, payload.end()));
+    CHECK(sink.lastNow == payload.size());
+    CHECK(sink.lastTotal == payload.size());
+}
+
+TEST_CASE("kTLS download resumes after the connection is lost", "[ktls]") {
+    std::vector<char> payload = pattern(1024 * 1024);
+    TestServer server(payload);
+    // Lost within the body bytes that come with the header, which fill less
+    // than a buffer, so they are handed over before the next receive fails
+    server.cutNextAt(700);
+    server.start(2);
+
+    BufferSink sink(8192);
+    KtlsDownload download(server.url("/image.bin"));
+    download.setCaFile(server.caFile());
+    KtlsDownload::Result result = download.run(sink.sink());
+    if (!kernelTlsAvailable(result, sink))
+        SKIP("Kernel TLS not available");
+
+    REQUIRE(result == KtlsDownload::Result::Failed);
+    CHECK(download.bytesReceived() == 700);
+    CHECK(sink.lastNow == 700);
+    CHECK_FALSE(sink.unreported);
+
+    // Resume from what was reported, as DownloadThread does
+    sink.start = sink.lastNow;
+    sink.received.clear();
+    KtlsDownload resumed(server.url("/image.bin"), sink.start);
+    resumed.setCaFile(server.caFile());
+    REQUIRE(resumed.run(sink.sink()) == KtlsDownload::Result::Complete);
+    CHECK_FALSE(sink.unreported);
+    CHECK(sink.lastNow == payload.size());
+    CHECK(sink.received == std::vector<char>(payload.begin() + 700, payload.end()));
+}
+
+TEST_CASE("kTLS download follows redirects", "[ktls]") {
+    std::vector<char> payload = pattern(100000);
+    TestServer server(payload);
+    server.start(2);
+
+    BufferSink sink(256 * 1024);
+    KtlsDownload download(server.url("/old"));
+    download.setCaFile(server.caFile());
+    KtlsDownload::Result result = download.run(sink.sink());
+    if (!kernelTlsAvailable(result, sink))
+        SKIP("Kernel TLS not available");
+
+    REQUIRE(result == KtlsDownload::Result::Complete);
+    CHECK(sink.received == payload);
+    CHECK(sink.commits == 1);
+}
+
+TEST_CASE("kTLS download leaves chunked responses to curl", "[ktls]") {
+    std::vector<char> payload = pattern(1000);
+    TestServer server(payload);
+    server.setChunked(true);
+    server.start(1);
+
+    BufferSink sink(4096);
+    KtlsDownload download(server.url("/image.bin"));
+    download.setCaFile(server.caFile());
+    CHECK(download.run(sink.sink()) == KtlsDownload::Result::Unsupported);
+    CHECK(sink.received.empty());
+    CHECK(sink.commits == 0);
+}
+
+TEST_CASE("kTLS download rejects an untrusted server", "[ktls]") {
+    std::vector<char> payload = pattern(1000);
+    TestServer server(payload);
+    server.start(1);
+
+    BufferSink sink(4096);
+    KtlsDownload download(server.url("/image.bin"));
+    // Default system trust store does not know the test certificate
+    CHECK(download.run(sink.sink()) == KtlsDownload::Result::Unsupported);
+    CHECK(sink.received.empty());
+}
@@ -0,0 +1,185 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "perfcompare.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <random>
+
+namespace {
+
+/* Samples around mean, with noise of +-spread, the same for a given seed */
+QVector<double> samples(double mean, double spread, int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> noise(-spread, spread);
+    QVector<double> values;
+    for (int i = 0; i < count; i++)
+        values.append(mean + noise(rng));
+    return values;
+}
+
+PerfCompare::Interval interval(double point, double low, double high)
+{
+    PerfCompare::Interval i;
+    i.valid = true;
+    i.point = point;
+    i.low = low;
+    i.high = high;
+    return i;
+}
+
+/* Performance data export with one successful write cycle per entry, 20 one second slices each */
+QString writeExport(const QTemporaryDir &dir, const QString &name, const QVector<double> &cycleKBps, unsigned int seed)
+{
+    QJsonArray slices, cycles;
+    for (int c = 0; c < cycleKBps.size(); c++) {
+        const int first = static_cast<int>(slices.size());
+        for (double kbps : samples(cycleKBps[c], cycleKBps[c] * 0.05, 20, seed + c))
+            slices.append(QJsonArray({0, 0, 0, kbps}));
+
+        QJsonObject cycle;
+        cycle["cycle"] = c + 1;
+        cycle["imageName"] = "image";
+        cycle["deviceName"] = "device";
+        cycle["success"] = true;
+        cycle["durationMs"] = 20000;
+        cycle["events"] = QJsonArray({0, 0});
+        cycle["histograms"] = QJsonObject{{"write", QJsonArray({first, static_cast<int>(slices.size())})}};
+        cycles.append(cycle);
+    }
+
+    QJsonObject root;
+    root["events"] = QJsonArray();
+    root["histograms"] = QJsonObject{{"write", slices}};
+    root["cycles"] = cycles;
+
+    QFile f(dir.filePath(name));
+    if (f.open(QIODevice::WriteOnly))
+        f.write(QJsonDocument(root).toJson());
+    return f.fileName();
+}
+
+} // namespace
+
+TEST_CASE("Bootstrap interval is reproducible with a fixed seed", "[perfcompare]") {
+    const QVector<double> base = samples(100, 20, 50, 1);
+    const QVector<double> candidate = samples(100, 20, 50, 2);
+
+    const PerfCompare::Interval first = PerfCompare::meanChange(base, candidate, true, 42);
+    const PerfCompare::Interval second = PerfCompare::meanChange(base, candidate, true, 42);
+    REQUIRE(first.valid);
+    CHECK(first.point == second.point);
+    CHECK(first.low == second.low);
+    CHECK(first.high == second.high);
+    CHECK(first.low <= first.point);
+    CHECK(first.point <= first.high);
+}
+
+TEST_CASE("Bootstrap interval brackets a real change and excludes no change", "[perfcompare]") {
+    const QVector<double> base = samples(100, 10, 50, 1);
+    const QVector<double> candidate = samples(80, 10, 50, 2);
+
+    const PerfCompare::Interval relative = PerfCompare::meanChange(base, candidate, true, 1);
+    REQUIRE(relative.valid);
+    CHECK(relative.point < -0.15);
+    CHECK(relative.point > -0.25);
+    CHECK(relative.high < 0);
+
+    const PerfCompare::Interval absolute = PerfCompare::meanChange(base, candidate, false, 1);
+    REQUIRE(absolute.valid);
+    CHECK(absolute.point < -15);
+    CHECK(absolute.point > -25);
+    CHECK(absolute.high < 0);
+}
+
+TEST_CASE("Bootstrap interval of noise alone includes no change", "[perfcompare]") {
+    const QVector<double> base = samples(100, 20, 50, 1);
+
+    for (unsigned int seed : {1u, 2u, 3u}) {
+        const PerfCompare::Interval same = PerfCompare::meanChange(base, base, true, seed);
+        REQUIRE(same.valid);
+        CHECK(same.point == 0);
+        CHECK(same.low < 0);
+        CHECK(same.high > 0);
+        CHECK(PerfCompare::judge(same, true, true, 5) == PerfCompare::Verdict::NoChange);
+    }
+}
+
+TEST_CASE("Bootstrap interval needs samples and a usable base", "[perfcompare][negative]") {
+    CHECK_FALSE(PerfCompare::meanChange({}, {1, 2, 3}, true, 1).valid);
+    CHECK_FALSE(PerfCompare::meanChange({1, 2, 3}, {}, true, 1).valid);
+    // A relative change from nothing is undefined, an absolute one is not
+    CHECK_FALSE(PerfCompare::meanChange({0, 0, 0}, {1, 2, 3}, true, 1).valid);
+    CHECK(PerfCompare::meanChange({0, 0, 0}, {1, 2, 3}, false, 1).valid);
+}
+
+TEST_CASE("Changes are judged against the regression threshold", "[perfcompare]") {
+    using Verdict = PerfCompare::Verdict;
+
+    // Throughput (higher is better) down 20%, clearly outside the noise
+    const PerfCompare::Interval slower = interval(-0.20, -0.25, -0.15);
+    CHECK(PerfCompare::judge(slower, true, true, 5) == Verdict::Regression);
+    CHECK(PerfCompare::judge(slower, true, true, 19.9) == Verdict::Regression);
+    CHECK(PerfCompare::judge(slower, true, true, 20.1) == Verdict::NoChange);
+    // The same change in a duration (lower is better)
+    CHECK(PerfCompare::judge(slower, true, false, 5) == Verdict::Improved);
+
+    // Large, but the interval includes no change
+    CHECK(PerfCompare::judge(interval(-0.20, -0.45, 0.05), true, true, 5) == Verdict::NoChange);
+
+    // Stall share: percentage points, not percent
+    const PerfCompare::Interval moreStalls = interval(3, 1, 5);
+    CHECK(PerfCompare::judge(moreStalls, false, false, 2) == Verdict::Regression);
+    CHECK(PerfCompare::judge(moreStalls, false, false, 5) == Verdict::NoChange);
+
+    CHECK(PerfCompare::judge(PerfCompare::Interval(), true, true, 5) == Verdict::TooFewSamples);
+}
+
+TEST_CASE("Comparing exports reports a throughput regression", "[perfcompare]") {
+    QTemporaryDir dir;
+    const QString base = writeExport(dir, "base.json", {20480, 20480, 20480, 20480}, 1);
+    const QString same = writeExport(dir, "same.json", {20480, 20480, 20480, 20480}, 100);
+    const QString slower = writeExport(dir, "slower.json", {15360, 15360, 15360, 15360}, 200);
+
+    QString output, errors;
+    QTextStream out(&output), err(&errors);
+    CHECK(PerfCompare::compare(base, same, 5, out, err) == PerfCompare::NoRegression);
+    CHECK(PerfCompare::compare(base, slower, 5, out, err) == PerfCompare::Regression);
+    CHECK(output.contains("REGRESSION"));
+    // A threshold above the drop lets it pass
+    CHECK(PerfCompare::compare(base, slower, 30, out, err) == PerfCompare::NoRegression);
+    CHECK(errors.isEmpty());
+
+    // Deterministic: the same inputs give the same report
+    QString first, second;
+    QTextStream firstOut(&first), secondOut(&second);
+    PerfCompare::compare(base, slower, 5, firstOut, err);
+    PerfCompare::compare(base, slower, 5, secondOut, err);
+    CHECK(first == second);
+}
+
+TEST_CASE("Comparing unusable exports fails", "[perfcompare][negative]") {
+    QTemporaryDir dir;
+    const QString base = writeExport(dir, "base.json", {20480, 20480}, 1);
+    QFile broken(dir.filePath("broken.json"));
+    REQUIRE(broken.open(QIODevice::WriteOnly));
+    broken.write("{ not json");
+    broken.close();
+
+    QString output, errors;
+    QTextStream out(&output), err(&errors);
+    CHECK(PerfCompare::compare(base, dir.filePath("missing.json"), 5, out, err) == PerfCompare::Failed);
+    CHECK(PerfCompare::compare(base, broken.fileName(), 5, out, err) == PerfCompare::Failed);
+    // Valid JSON, but no cycle of the same image and device
+    CHECK(PerfCompare::compare(base, writeExport(dir, "none.json", {}, 1), 5, out, err) == PerfCompare::Failed);
+    CHECK_FALSE(errors.isEmpty());
+}
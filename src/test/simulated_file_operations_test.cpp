@@ -0,0 +1,274 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "simulated_file_operations.h"
+
+#include <filesystem>
+#include <vector>
+
+using namespace rpi_imager;
+
+namespace {
+
+// Deterministic, instantaneous profile: no latency, no penalties, no pacing
+SimulatedDeviceProfile quietProfile()
+{
+    SimulatedDeviceProfile p;
+    p.capacity = 64 * 1024 * 1024;
+    p.latency_median_us = 0;
+    p.sync_latency_us = 0;
+    p.misaligned_penalty_us = 0;
+    p.au_switch_penalty_us = 0;
+    p.time_scale = 0;
+    return p;
+}
+
+std::vector<std::uint8_t> pattern(std::size_t size, std::uint8_t seed)
+{
+    std::vector<std::uint8_t> data(size);
+    for (std::size_t i = 0; i < size; i++)
+        data[i] = static_cast<std::uint8_t>(seed + i * 31);
+    return data;
+}
+
+} // namespace
+
+TEST_CASE("Simulated device stores and reads back data", "[simulated_device]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    std::uint64_t size = 0;
+    REQUIRE(dev.GetSize(size) == FileError::kSuccess);
+    REQUIRE(size == 64 * 1024 * 1024);
+
+    // Straddles an internal block boundary
+    auto data = pattern(3 * 1024 * 1024, 7);
+    REQUIRE(dev.Seek(512 * 1024) == FileError::kSuccess);
+    REQUIRE(dev.WriteSequential(data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(dev.Tell() == 512 * 1024 + data.size());
+
+    std::vector<std::uint8_t> back(data.size());
+    std::size_t bytes_read = 0;
+    REQUIRE(dev.Seek(512 * 1024) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(bytes_read == back.size());
+    REQUIRE(back == data);
+
+    // Never written: reads as zeroes
+    std::vector<std::uint8_t> empty(4096, 0xFF);
+    REQUIRE(dev.Seek(32 * 1024 * 1024) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(empty.data(), empty.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(empty == std::vector<std::uint8_t>(4096, 0));
+
+    // Reads stop at the end of the card
+    REQUIRE(dev.Seek(size - 512) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(empty.data(), empty.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(bytes_read == 512);
+    REQUIRE(dev.Seek(size + 1) == FileError::kSeekError);
+}
+
+TEST_CASE("Simulated device charges sequential and random writes differently", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.sequential_write_mbps = 40.0;
+    p.random_write_mbps = 4.0;
+    auto card = std::make_shared<SimulatedCard>(p);
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    auto data = pattern(1000000, 1);
+    // First write has nothing to continue from, so it counts as random: 250 ms
+    REQUIRE(dev.WriteSequential(data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns == 250000000);
+
+    // Continuing sequentially: 25 ms
+    REQUIRE(dev.WriteSequential(data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns == 275000000);
+
+    // Jumping elsewhere: random again
+    REQUIRE(dev.WriteAtOffset(32 * 1024 * 1024, data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns == 525000000);
+    REQUIRE(card->Stats().bytes_written == 3000000);
+    REQUIRE(card->Stats().writes == 3);
+}
+
+TEST_CASE("Simulated device slows down once the SLC cache is exhausted", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.sequential_write_mbps = 100.0;
+    p.random_write_mbps = 100.0;
+    p.slc_cache_bytes = 1000000;
+    p.post_slc_write_mbps = 10.0;
+    auto card = std::make_shared<SimulatedCard>(p);
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    auto data = pattern(3000000, 2);
+    REQUIRE(dev.WriteSequential(data.data(), data.size()) == FileError::kSuccess);
+
+    SimulatedDeviceStats stats = card->Stats();
+    REQUIRE(stats.post_slc_bytes == 2000000);
+    // 1 MB at 100 MB/s plus 2 MB at 10 MB/s
+    REQUIRE(stats.simulated_ns == 10000000 + 200000000);
+}
+
+TEST_CASE("Simulated device penalises misaligned writes and allocation unit switches", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.sequential_write_mbps = 0;
+    p.random_write_mbps = 0;
+    p.page_size = 16 * 1024;
+    p.misaligned_penalty_us = 1000;
+    p.allocation_unit = 4 * 1024 * 1024;
+    p.au_switch_penalty_us = 5000;
+    auto card = std::make_shared<SimulatedCard>(p);
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    auto data = pattern(16 * 1024, 3);
+    REQUIRE(dev.WriteAtOffset(0, data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(dev.WriteAtOffset(16 * 1024, data.data(), 512) == FileError::kSuccess);   // Misaligned size
+    REQUIRE(dev.WriteAtOffset(8 * 1024 * 1024, data.data(), data.size()) == FileError::kSuccess);  // Other AU
+
+    SimulatedDeviceStats stats = card->Stats();
+    REQUIRE(stats.misaligned_writes == 1);
+    REQUIRE(stats.au_switches == 1);
+    REQUIRE(stats.simulated_ns == 6000000);
+}
+
+TEST_CASE("Simulated device reads back slower right after writing", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.random_write_mbps = 1000.0;
+    p.read_mbps = 100.0;
+    p.read_after_write_mbps = 10.0;
+    p.read_after_write_window_ms = 150.0;
+    auto card = std::make_shared<SimulatedCard>(p);
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    auto data = pattern(1000000, 4);
+    REQUIRE(dev.WriteSequential(data.data(), data.size()) == FileError::kSuccess);
+    std::uint64_t afterWrite = card->Stats().simulated_ns;
+
+    std::vector<std::uint8_t> back(data.size());
+    std::size_t bytes_read = 0;
+    REQUIRE(dev.Seek(0) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns - afterWrite == 100000000);   // Within the window: 10 MB/s
+
+    std::uint64_t afterFirstRead = card->Stats().simulated_ns;
+    REQUIRE(dev.Seek(0) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns - afterFirstRead == 100000000);  // Still within 150 ms of the write
+
+    std::uint64_t afterSecondRead = card->Stats().simulated_ns;
+    REQUIRE(dev.Seek(0) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(card->Stats().simulated_ns - afterSecondRead == 10000000);  // Settled: 100 MB/s
+}
+
+TEST_CASE("Simulated device injects errors", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.fail_write_offset = 1024 * 1024;
+    p.fail_read_offset = 2 * 1024 * 1024;
+    p.fail_sync = true;
+    auto card = std::make_shared<SimulatedCard>(p);
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+
+    auto data = pattern(1024 * 1024, 5);
+    REQUIRE(dev.WriteAtOffset(0, data.data(), data.size()) == FileError::kSuccess);
+
+    // The write error fires once, like a transient failure
+    REQUIRE(dev.WriteAtOffset(1024 * 1024, data.data(), data.size()) == FileError::kWriteError);
+    REQUIRE(dev.GetLastErrorCode() != 0);
+    REQUIRE(dev.WriteAtOffset(1024 * 1024, data.data(), data.size()) == FileError::kSuccess);
+    REQUIRE(dev.GetLastErrorCode() == 0);
+
+    // The read error is persistent, like a bad block
+    std::size_t bytes_read = 0;
+    REQUIRE(dev.Seek(2 * 1024 * 1024 - 512) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(data.data(), 1024, bytes_read) == FileError::kReadError);
+    REQUIRE(dev.Seek(2 * 1024 * 1024 - 512) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(data.data(), 1024, bytes_read) == FileError::kReadError);
+
+    REQUIRE(dev.ForceSync() == FileError::kSyncError);
+    REQUIRE(card->Stats().injected_errors == 4);
+}
+
+TEST_CASE("Simulated device timing is reproducible for a given seed", "[simulated_device]") {
+    SimulatedDeviceProfile p = quietProfile();
+    p.latency_median_us = 300;
+    p.latency_p99_us = 5000;
+    p.write_error_rate = 0.1;
+    p.seed = 42;
+
+    auto run = [&p]() {
+        auto card = std::make_shared<SimulatedCard>(p);
+        SimulatedFileOperations dev(card);
+        REQUIRE(dev.OpenDevice(":memory:") == FileError::kSuccess);
+        auto data = pattern(64 * 1024, 6);
+        for (int i = 0; i < 200; i++)
+            dev.WriteSequential(data.data(), data.size());
+        return card->Stats();
+    };
+
+    SimulatedDeviceStats a = run();
+    SimulatedDeviceStats b = run();
+    REQUIRE(a.simulated_ns == b.simulated_ns);
+    REQUIRE(a.injected_errors == b.injected_errors);
+    REQUIRE(a.injected_errors > 0);
+    REQUIRE(a.injected_errors < 200);
+}
+
+TEST_CASE("Simulated device can be backed by a sparse file", "[simulated_device]") {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "rpi-imager-simulated-device-test.img";
+    std::filesystem::remove(path);
+
+    auto data = pattern(128 * 1024, 8);
+    {
+        auto card = std::make_shared<SimulatedCard>(quietProfile());
+        SimulatedFileOperations dev(card);
+        REQUIRE(dev.OpenDevice(path.string()) == FileError::kSuccess);
+        REQUIRE(dev.WriteAtOffset(4096, data.data(), data.size()) == FileError::kSuccess);
+        REQUIRE(dev.ForceSync() == FileError::kSuccess);
+    }
+    REQUIRE(std::filesystem::file_size(path) == 64 * 1024 * 1024);
+
+    // A second card on the same file sees the data
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SimulatedFileOperations dev(card);
+    REQUIRE(dev.OpenDevice(path.string()) == FileError::kSuccess);
+    std::vector<std::uint8_t> back(data.size());
+    std::size_t bytes_read = 0;
+    REQUIRE(dev.Seek(4096) == FileError::kSuccess);
+    REQUIRE(dev.ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(back == data);
+    dev.Close();
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("FileOperations::Create honours the factory override", "[simulated_device]") {
+    auto card = std::make_shared<SimulatedCard>(quietProfile());
+    SetFileOperationsFactory([card]() -> std::unique_ptr<FileOperations> {
+        return std::make_unique<SimulatedFileOperations>(card);
+    });
+
+    auto a = FileOperations::Create();
+    auto b = FileOperations::Create();
+    SetFileOperationsFactory(nullptr);
+
+    REQUIRE(dynamic_cast<SimulatedFileOperations*>(a.get()) != nullptr);
+    REQUIRE(a->OpenDevice(":memory:") == FileError::kSuccess);
+    REQUIRE(b->OpenDevice(":memory:") == FileError::kSuccess);
+
+    // Both handles address the same card
+    auto data = pattern(4096, 9);
+    REQUIRE(a->WriteAtOffset(0, data.data(), data.size()) == FileError::kSuccess);
+    std::vector<std::uint8_t> back(4096);
+    std::size_t bytes_read = 0;
+    REQUIRE(b->ReadSequential(back.data(), back.size(), bytes_read) == FileError::kSuccess);
+    REQUIRE(back == data);
+}
@@ -0,0 +1,144 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "sourcecatalogue.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <cstdio>
+#include <functional>
+
+namespace {
+
+// No such block device: no filesystem UUID, so the catalogue stays in memory
+const QString Devname = "sourcecatalogue-test";
+
+/* Scans and hashes run on threads, and report back through the event loop */
+void ensureApplication()
+{
+    static int argc = 1;
+    static char name[] = "sourcecatalogue_test";
+    static char *argv[] = {name, nullptr};
+    if (!QCoreApplication::instance()) {
+        // Data location of the test, not the user's
+        QStandardPaths::setTestModeEnabled(true);
+        QCoreApplication::setOrganizationName("sourcecatalogue_test");
+        new QCoreApplication(argc, argv);
+    }
+}
+
+QByteArray writeFile(const QTemporaryDir &dir, const QString &name, const QByteArray &data)
+{
+    QFile f(dir.filePath(name));
+    if (f.open(QIODevice::WriteOnly)) {
+        f.write(data);
+    }
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+/* Lists the medium until the catalogue satisfies done, giving the scans and hashes time to finish */
+QMap<QString, SourceCatalogue::Image> waitFor(SourceCatalogue &catalogue, const QString &mountPoint,
+                                              const std::function<bool(const QMap<QString, SourceCatalogue::Image> &)> &done)
+{
+    QMap<QString, SourceCatalogue::Image> images;
+    QDeadlineTimer deadline(10000);
+    while (!deadline.hasExpired()) {
+        images.clear();
+        for (const SourceCatalogue::Image &image : catalogue.images(mountPoint, Devname)) {
+            images.insert(image.name, image);
+        }
+        if (done(images)) {
+            break;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+    return images;
+}
+
+bool allHashed(const QMap<QString, SourceCatalogue::Image> &images, int count)
+{
+    if (images.size() != count) {
+        return false;
+    }
+    for (const SourceCatalogue::Image &image : images) {
+        if (image.format == "raw" && image.extractSha256.isEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+TEST_CASE("Source catalogue lists a medium without waiting for the scan", "[sourcecatalogue]") {
+    ensureApplication();
+    QTemporaryDir dir;
+    writeFile(dir, "image.img", QByteArray(4096, 'a'));
+
+    SourceCatalogue catalogue;
+    int updates = 0;
+    QObject::connect(&catalogue, &SourceCatalogue::catalogueUpdated, [&](const QString &mountPoint) {
+        CHECK(mountPoint == dir.path());
+        updates++;
+    });
+
+    // Nothing scanned yet
+    CHECK(catalogue.images(dir.path(), Devname).isEmpty());
+
+    const auto images = waitFor(catalogue, dir.path(), [](const auto &images) { return allHashed(images, 1); });
+    REQUIRE(images.size() == 1);
+    CHECK(images["image.img"].size == 4096);
+    CHECK(images["image.img"].format == "raw");
+    CHECK(updates > 0);
+}
+
+TEST_CASE("Source catalogue rescans a medium incrementally", "[sourcecatalogue]") {
+    ensureApplication();
+    QTemporaryDir dir;
+    const QByteArray keptHash = writeFile(dir, "kept.img", QByteArray(4096, 'k'));
+    writeFile(dir, "changed.img", QByteArray(4096, 'c'));
+    writeFile(dir, "removed.img", QByteArray(4096, 'r'));
+    writeFile(dir, "notes.txt", "not an image");
+
+    SourceCatalogue catalogue;
+    auto images = waitFor(catalogue, dir.path(), [](const auto &images) { return allHashed(images, 3); });
+    REQUIRE(images.size() == 3);
+    CHECK(images["kept.img"].extractSha256 == keptHash);
+    CHECK_FALSE(images.contains("notes.txt"));
+
+    // Same size and mtime: the entry is reused as it is, without reading the file again.
+    // Replaced in one go, as the last listing may still be scanning
+    const QDateTime keptMtime = QFileInfo(dir.filePath("kept.img")).lastModified();
+    writeFile(dir, "kept.tmp", QByteArray(4096, 'x'));
+    QFile kept(dir.filePath("kept.tmp"));
+    REQUIRE(kept.open(QIODevice::ReadWrite));
+    REQUIRE(kept.setFileTime(keptMtime, QFileDevice::FileModificationTime));
+    kept.close();
+    REQUIRE(std::rename(QFile::encodeName(kept.fileName()).constData(),
+                        QFile::encodeName(dir.filePath("kept.img")).constData()) == 0);
+
+    const QByteArray changedHash = writeFile(dir, "changed.img", QByteArray(8192, 'c'));
+    REQUIRE(QFile::remove(dir.filePath("removed.img")));
+    const QByteArray addedHash = writeFile(dir, "added.img", QByteArray(2048, 'n'));
+    writeFile(dir, "added.xz", QByteArray("\xfd" "7zXZ\x00" "truncated", 15));
+
+    images = waitFor(catalogue, dir.path(), [&](const auto &images) {
+        return allHashed(images, 4) && images["changed.img"].extractSha256 == changedHash;
+    });
+    REQUIRE(images.size() == 4);
+    CHECK(images["kept.img"].extractSha256 == keptHash);
+    CHECK(images["changed.img"].size == 8192);
+    CHECK(images["changed.img"].extractSize == 8192);
+    CHECK(images["added.img"].extractSha256 == addedHash);
+    CHECK(images["added.xz"].format == "xz");
+    CHECK_FALSE(images.contains("removed.img"));
+}
@@ -0,0 +1,65 @@
+#ifndef ZSTDSEEKABLE_H
+#define ZSTDSEEKABLE_H
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2025 Raspberry Pi Ltd
+ */
+
+#include <QByteArray>
+#include <QFile>
+#include <QtEndian>
+#include <utility>
+#include <vector>
+
+/*
+ * zstd seekable format (contrib/seekable_format in the zstd tree): independent
+ * zstd frames followed by a seek table listing their sizes. The seek table is
+ * a skippable frame, so ordinary zstd decoders read the file unchanged.
+ */
+namespace ZstdSeekable {
+
+constexpr quint32 Magic = 0x8F92EAB1;
+constexpr quint32 SeekTableSkippableMagic = 0x184D2A5E;
+
+/* Compressed and decompressed size of each frame, in file order */
+using SeekTable = std::vector<std::pair<quint32, quint32>>;
+
+inline void appendLE32(QByteArray &out, quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+/* Seek table frame to append after the last frame */
+inline QByteArray seekTableFrame(const SeekTable &frames)
+{
+    QByteArray table;
+    appendLE32(table, SeekTableSkippableMagic);
+    appendLE32(table, static_cast<quint32>(frames.size() * 8 + 9));
+    for (const auto &frame : frames) {
+        appendLE32(table, frame.first);
+        appendLE32(table, frame.second);
+    }
+    appendLE32(table, static_cast<quint32>(frames.size()));
+    table.append(char(0));                          // Descriptor: no per-frame checksums in the table
+    appendLE32(table, Magic);
+    return table;
+}
+
+/* True if the file ends with a seek table */
+inline bool isSeekable(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly) || f.size() < 9) {
+        return false;
+    }
+    f.seek(f.size() - 4);
+    QByteArray magic = f.read(4);
+    return magic.size() == 4 && qFromLittleEndian<quint32>(magic.constData()) == Magic;
+}
+
+} // namespace ZstdSeekable
+
+#endif // ZSTDSEEKABLE_H